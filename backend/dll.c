@@ -42,7 +42,7 @@
 
 /* Please increase version number with every change
    (don't forget to update dll.desc) */
-#define DLL_VERSION "1.0.13"
+#define DLL_VERSION "1.0.14"
 
 #ifdef _AIX
 # include "lalloca.h"		/* MUST come first for AIX! */
@@ -154,6 +154,7 @@ posix_dlsym (void *handle, const char *func)
 #include "../include/sane/sanei_config.h"
 #define DLL_CONFIG_FILE "dll.conf"
 #define DLL_ALIASES_FILE "dll.aliases"
+#define DLL_INDEX_FILE STRINGIFY(PATH_SANE_DATA_DIR) "/sane/dll.index"
 
 #include "../include/sane/sanei_usb.h"
 
@@ -885,6 +886,243 @@ read_dlld (void)
   DBG (5, "sane_init/read_dlld: done.\n");
 }
 
+/*
+ * The index written by "sane-desc -m dll-index" tells how each backend
+ * finds its devices.  sane_get_devices uses it to leave alone backends
+ * that have nothing to find: USB backends none of whose devices is
+ * plugged in, and network backends when only local devices are wanted.
+ * Without the index, all backends are asked.
+ *
+ * The descriptions don't list every device a backend attaches: its
+ * configuration file may name more, and users may add their own.  So
+ * the "usb" lines of the configuration file of a USB backend are read
+ * as well before the backend is left alone.
+ */
+struct index_entry
+{
+  struct index_entry *next;
+  char *name;
+  u_int usb:1;			/* finds the USB devices in ids */
+  u_int net:1;			/* finds network devices */
+  u_int other:1;		/* finds devices in ways we can't check */
+  u_int config_read:1;		/* ids of the backend's config file added */
+  int num_ids, max_ids;
+  SANE_Word *ids;		/* vendor << 16 | product */
+};
+
+#define MAX_USB_DEVICES 64
+
+static struct index_entry *first_index_entry;
+
+/* the USB devices plugged in, or -1 if that is unknown */
+static SANE_Word usb_vendors[MAX_USB_DEVICES];
+static SANE_Word usb_products[MAX_USB_DEVICES];
+static int num_usb_devices = -1;
+
+static struct index_entry *
+find_index_entry (const char *name)
+{
+  struct index_entry *entry;
+
+  for (entry = first_index_entry; entry; entry = entry->next)
+    if (strcmp (entry->name, name) == 0)
+      break;
+  return entry;
+}
+
+static void
+add_index_id (struct index_entry *entry, SANE_Word id)
+{
+  SANE_Word *ids;
+
+  if (entry->num_ids == entry->max_ids)
+    {
+      ids = realloc (entry->ids, (entry->max_ids + 16) * sizeof (*ids));
+      if (!ids)
+	{
+	  /* can't tell its devices any more, so always ask it */
+	  entry->other = 1;
+	  return;
+	}
+      entry->ids = ids;
+      entry->max_ids += 16;
+    }
+  entry->ids[entry->num_ids++] = id;
+}
+
+static void
+read_index (void)
+{
+  struct index_entry *entry = NULL;
+  const char *sep = " \t\r\n";
+  char line[PATH_MAX], *word, *name;
+  unsigned long vendor, product;
+  FILE *fp;
+
+  fp = fopen (DLL_INDEX_FILE, "r");
+  if (!fp)
+    {
+      DBG (3, "sane_init/read_index: no %s, asking all backends\n",
+	   DLL_INDEX_FILE);
+      return;
+    }
+
+  while (fgets (line, sizeof (line), fp))
+    {
+      word = strtok (line, sep);
+      if (!word || word[0] == '#')
+	continue;
+
+      if (strcmp (word, "backend") == 0 && (name = strtok (NULL, sep)))
+	{
+	  entry = calloc (1, sizeof (*entry));
+	  if (!entry || !(entry->name = strdup (name)))
+	    {
+	      free (entry);
+	      break;
+	    }
+	  while ((word = strtok (NULL, sep)))
+	    {
+	      if (strcmp (word, "usb") == 0)
+		entry->usb = 1;
+	      else if (strcmp (word, "net") == 0)
+		entry->net = 1;
+	      else
+		entry->other = 1;
+	    }
+	  entry->next = first_index_entry;
+	  first_index_entry = entry;
+	}
+      else if (strcmp (word, "usb") == 0)
+	{
+	  word = strtok (NULL, sep);
+	  vendor = word ? strtoul (word, NULL, 16) : 0;
+	  word = strtok (NULL, sep);
+	  product = word ? strtoul (word, NULL, 16) : 0;
+	  name = strtok (NULL, sep);
+	  if (!name)
+	    continue;
+	  if (!entry || strcmp (entry->name, name) != 0)
+	    entry = find_index_entry (name);
+	  if (entry)
+	    add_index_id (entry, (SANE_Word) ((vendor << 16) | product));
+	}
+    }
+  fclose (fp);
+
+  DBG (3, "sane_init/read_index: read %s\n", DLL_INDEX_FILE);
+}
+
+static void
+free_index (void)
+{
+  struct index_entry *entry;
+
+  while ((entry = first_index_entry) != NULL)
+    {
+      first_index_entry = entry->next;
+      free (entry->name);
+      free (entry->ids);
+      free (entry);
+    }
+}
+
+/* Add the USB devices listed in the backend's configuration file, in
+   the "usb <vendor> <product>" form sanei_usb_attach_matching_devices
+   understands.  Any other "usb" line names a device we can't check.  */
+static void
+read_backend_config_ids (struct index_entry *entry)
+{
+  char conffile[PATH_MAX], config_line[PATH_MAX], *end;
+  const char *cp;
+  unsigned long vendor, product;
+  FILE *fp;
+
+  entry->config_read = 1;
+
+  snprintf (conffile, sizeof (conffile), "%s.conf", entry->name);
+  fp = sanei_config_open (conffile);
+  if (!fp)
+    return;
+
+  while (sanei_config_read (config_line, sizeof (config_line), fp))
+    {
+      cp = sanei_config_skip_whitespace (config_line);
+      if (strncmp (cp, "usb", 3) != 0
+	  || (cp[3] != '\0' && cp[3] != ' ' && cp[3] != '\t'))
+	continue;
+
+      cp = sanei_config_skip_whitespace (cp + 3);
+      vendor = strtoul (cp, &end, 0);
+      if (end != cp)
+	{
+	  cp = sanei_config_skip_whitespace (end);
+	  product = strtoul (cp, &end, 0);
+	}
+      if (end == cp)
+	{
+	  DBG (4, "read_backend_config_ids: `%s' lists a device that can't "
+	       "be checked\n", conffile);
+	  entry->other = 1;
+	  break;
+	}
+      add_index_id (entry, (SANE_Word) ((vendor << 16) | product));
+    }
+  fclose (fp);
+}
+
+/* Look at the USB buses once for all backends. */
+static void
+probe_usb (void)
+{
+  int i, n;
+
+  num_usb_devices = -1;
+  if (!first_index_entry)
+    return;
+
+  sanei_usb_init ();
+  n = sanei_usb_get_device_ids (usb_vendors, usb_products, MAX_USB_DEVICES);
+  sanei_usb_exit ();
+
+  if (n > MAX_USB_DEVICES)
+    return;
+  for (i = 0; i < n; i++)
+    if (!usb_vendors[i])
+      return;			/* the platform can't tell */
+
+  DBG (3, "probe_usb: %d USB devices\n", n);
+  num_usb_devices = n;
+}
+
+/* Whether BE may find devices, as far as the index can tell. */
+static int
+backend_wanted (struct backend *be, SANE_Bool local_only)
+{
+  struct index_entry *entry;
+  int i, j;
+
+  entry = find_index_entry (be->name);
+  if (entry && entry->usb && !entry->config_read)
+    read_backend_config_ids (entry);
+  if (!entry || entry->other)
+    return 1;
+  if (entry->net && !local_only)
+    return 1;
+  if (entry->usb)
+    {
+      if (num_usb_devices < 0)
+	return 1;
+      for (i = 0; i < num_usb_devices; i++)
+	for (j = 0; j < entry->num_ids; j++)
+	  if (entry->ids[j] == ((usb_vendors[i] << 16) | usb_products[i]))
+	    return 1;
+    }
+
+  DBG (4, "backend_wanted: `%s' has no devices to find\n", be->name);
+  return 0;
+}
+
 SANE_Status
 sane_init (SANE_Int * version_code, SANE_Auth_Callback authorize)
 {
@@ -919,6 +1157,8 @@ sane_init (SANE_Int * version_code, SANE_Auth_Callback authorize)
       first_backend = &preloaded_backends[i];
     }
 
+  read_index ();
+
   /* Return the version number of the sane-backends package to allow
      the frontend to print them. This is done only for net and dll,
      because these backends are usually called by the frontend. */
@@ -1040,6 +1280,8 @@ sane_exit (void)
       free (alias);
     }
 
+  free_index ();
+
   if (NULL != devlist)
     {				/* Release memory allocated by sane_get_devices(). */
       int i = 0;
@@ -1089,8 +1331,13 @@ sane_get_devices (const SANE_Device *** device_list, SANE_Bool local_only)
       free ((void *) devlist[i]);
   devlist_len = 0;
 
+  probe_usb ();
+
   for (be = first_backend; be; be = be->next)
     {
+      if (!backend_wanted (be, local_only))
+	continue;
+
       if (!be->inited)
 	if (init (be) != SANE_STATUS_GOOD)
 	  continue;
@@ -7129,6 +7129,9 @@ sane_start (SANE_Handle handle)
       s->buff_tx[0]=0;
       s->buff_tx[1]=0;
 
+      /* drop bands left over from a cancelled page */
+      band_close(s);
+
       /* reset jpeg just in case... */
       s->jpeg_stage = JPEG_STAGE_NONE;
       s->jpeg_ff_offset = -1;
@@ -7163,7 +7166,7 @@ sane_start (SANE_Handle handle)
          * option combinations can't handle it, so we make a big one */
         if(
           (s->s_mode == MODE_COLOR && s->color_interlace == COLOR_INTERLACE_3091)
-          || must_fully_buffer(s)
+          || (must_fully_buffer(s) && !can_band_buffer(s))
         ){
           s->buff_tot[SIDE_FRONT] = s->bytes_tot[SIDE_FRONT];
         }
@@ -7214,12 +7217,38 @@ sane_start (SANE_Handle handle)
 
   DBG (15, "started=%d, side=%d, source=%d\n", s->started, s->side, s->source);
 
+  /* some of those options only need the start of
+   * the image to find the size, so we block until
+   * then, and do the rest a band at a time */
+  if( can_band_buffer(s) ){
+
+    ret = band_start(s,s->side);
+
+    /* Skipping means throwing out this image.
+     * Pretend the user read the whole thing
+     * and call sane_start again.
+     * This assumes we are running in batch mode. */
+    if(ret == SANE_STATUS_NO_DOCS && s->eof_rx[s->side]){
+      band_close(s);
+      s->bytes_tx[s->side] = s->bytes_rx[s->side];
+      s->eof_tx[s->side] = 1;
+      return sane_start(handle);
+    }
+
+    if (ret != SANE_STATUS_GOOD) {
+      DBG (5, "sane_start: ERROR: cannot start band\n");
+      goto errors;
+    }
+
+    DBG (5, "sane_start: OK: band started\n");
+  }
+
   /* certain options require the entire image to
    * be collected from the scanner before we can
    * tell the user the size of the image. the sane
    * API has no way to inform the frontend of this,
    * so we block and buffer. yuck */
-  if( must_fully_buffer(s) ){
+  else if( must_fully_buffer(s) ){
 
     /* get image */
     while(!s->eof_rx[s->side] && !ret){
@@ -8055,6 +8084,29 @@ sane_read (SANE_Handle handle, SANE_Byte * buf, SANE_Int max_len, SANE_Int * len
     return SANE_STATUS_CANCELLED;
   }
 
+  /* image enhancements are done a band at a time */
+  if(s->bands[s->side]){
+
+    /* protect this block from sane_cancel */
+    s->reading = 1;
+
+    ret = read_from_band(s,buf,max_len,len,s->side);
+    if(ret){
+      DBG(5,"sane_read: band returning %d\n",ret);
+    }
+
+    /* check if user cancelled during this read, even if it ended it */
+    if(!ret || s->cancelled){
+      ret = check_for_cancel(s);
+    }
+
+    /* unprotect this block from sane_cancel */
+    s->reading = 0;
+
+    DBG (10, "sane_read: finish %d\n", ret);
+    return ret;
+  }
+
   /* sane_start required between sides */
   if(s->eof_rx[s->side] && s->bytes_tx[s->side] == s->bytes_rx[s->side]){
     DBG (15, "sane_read: returning eof\n");
@@ -9209,6 +9261,7 @@ sane_close (SANE_Handle handle)
   /*clears any held scans*/
   mode_select_buff(s);
   disconnect_fd(s);
+  band_close(s);
   DBG (10, "sane_close: finish\n");
 }
 
@@ -9939,6 +9992,32 @@ must_fully_buffer(struct fujitsu *s)
   return 0;
 }
 
+/* of the options which require buffering, deskew,
+ * crop and skip can work on a band of the image at
+ * a time. despeck, hardware crop and the scanners
+ * which fill both sides at once still need it all. */
+static int
+can_band_buffer(struct fujitsu *s)
+{
+  if(!must_fully_buffer(s) || s->hwdeskewcrop || s->swdespeck || s->ald){
+    return 0;
+  }
+
+  if(must_downsample(s)){
+    return 0;
+  }
+
+  if(s->s_mode == MODE_COLOR && s->color_interlace == COLOR_INTERLACE_3091){
+    return 0;
+  }
+
+  if(s->source == SOURCE_ADF_DUPLEX || s->source == SOURCE_CARD_DUPLEX){
+    return 0;
+  }
+
+  return 1;
+}
+
 /* certain scanners require the mode of the
  * image to be changed in software. */
 static int
@@ -10171,8 +10250,7 @@ static SANE_Status
 buffer_deskew(struct fujitsu *s, int side)
 {
   SANE_Status ret = SANE_STATUS_GOOD;
-
-  int bg_color = 0xd6;
+  SANE_Byte * outbuf;
 
   DBG (10, "buffer_deskew: start\n");
 
@@ -10196,25 +10274,26 @@ buffer_deskew(struct fujitsu *s, int side)
     s->deskew_vals[0] = s->s_params.pixels_per_line - s->deskew_vals[0];
   }
 
-  /* tweak the bg color based on scanner settings */
-  if(s->s_mode == MODE_HALFTONE || s->s_mode == MODE_LINEART){
-    if(s->bg_color == COLOR_BLACK || s->hwdeskewcrop || s->overscan)
-      bg_color = 0xff;
-    else
-      bg_color = 0;
+  /* rotate into a new buffer, and swap it in, instead of copying back */
+  outbuf = malloc(s->buff_tot[side]);
+  if(!outbuf){
+    DBG(5,"buffer_deskew: no outbuf\n");
+    goto cleanup;
   }
-  else if(s->bg_color == COLOR_BLACK || s->hwdeskewcrop || s->overscan)
-    bg_color = 0;
 
-  ret = sanei_magic_rotate(&s->s_params,s->buffers[side],
-    s->deskew_vals[0],s->deskew_vals[1],s->deskew_slope,bg_color);
+  ret = sanei_magic_rotate2(&s->s_params,s->buffers[side],outbuf,
+    s->deskew_vals[0],s->deskew_vals[1],s->deskew_slope,get_deskew_bg(s),0);
 
   if(ret){
     DBG(5,"buffer_deskew: rotate error: %d",ret);
     ret = SANE_STATUS_GOOD;
+    free(outbuf);
     goto cleanup;
   }
 
+  free(s->buffers[side]);
+  s->buffers[side] = outbuf;
+
   cleanup:
   DBG (10, "buffer_deskew: finish\n");
   return ret;
@@ -10316,3 +10395,152 @@ buffer_isblank(struct fujitsu *s, int side)
   DBG (10, "buffer_isblank: finished\n");
   return status;
 }
+
+/* Pick the color used to fill the corners exposed by deskew,
+ * based on scanner settings */
+static int
+get_deskew_bg(struct fujitsu *s)
+{
+  if(s->s_mode == MODE_HALFTONE || s->s_mode == MODE_LINEART){
+    if(s->bg_color == COLOR_BLACK || s->hwdeskewcrop || s->overscan)
+      return 0xff;
+    return 0;
+  }
+
+  if(s->bg_color == COLOR_BLACK || s->hwdeskewcrop || s->overscan)
+    return 0;
+
+  return 0xd6;
+}
+
+/* Set up deskew, crop and skip for one side, then read from the
+ * scanner until the start of the image shows its final width,
+ * and that the page is not blank. */
+static SANE_Status
+band_start(struct fujitsu *s, int side)
+{
+  SANE_Status ret = SANE_STATUS_GOOD;
+  SANE_Parameters params;
+  int ops = 0;
+
+  DBG (10, "band_start: start\n");
+
+  if(s->swdeskew)
+    ops |= SANEI_MAGIC_BAND_DESKEW;
+  if(s->swcrop)
+    ops |= SANEI_MAGIC_BAND_CROP;
+  if(s->swskip)
+    ops |= SANEI_MAGIC_BAND_BLANK;
+
+  ret = sanei_magic_band_open(&s->s_params, s->resolution_x,
+    s->resolution_y, ops, get_deskew_bg(s), s->swskip, &s->bands[side]);
+  if(ret){
+    DBG (5, "band_start: cannot open band\n");
+    goto cleanup;
+  }
+
+  while((ret = sanei_magic_band_getParams(s->bands[side], &params))
+    == SANE_STATUS_DEVICE_BUSY){
+
+    ret = band_fill(s, side);
+    if(ret)
+      goto cleanup;
+  }
+
+  if(ret){
+    DBG (5, "band_start: no image %d\n", ret);
+    goto cleanup;
+  }
+
+  /* need to update user with new size, lines is -1 when cropping */
+  s->u_params.pixels_per_line = params.pixels_per_line;
+  s->u_params.bytes_per_line = params.bytes_per_line;
+  s->u_params.lines = params.lines;
+
+  DBG (15, "band_start: ppl:%d bpl:%d lines:%d\n",
+    params.pixels_per_line, params.bytes_per_line, params.lines);
+
+  cleanup:
+  DBG (10, "band_start: finish %d\n", ret);
+  return ret;
+}
+
+/* Read a block from the scanner into the small buffer,
+ * and pass it on to the band for this side. */
+static SANE_Status
+band_fill(struct fujitsu *s, int side)
+{
+  SANE_Status ret = SANE_STATUS_GOOD;
+
+  DBG (10, "band_fill: start\n");
+
+  ret = read_from_scanner(s, side);
+  if(ret){
+    DBG (5, "band_fill: read error %d\n", ret);
+    return ret;
+  }
+
+  ret = sanei_magic_band_write(s->bands[side],
+    s->buffers[side] + s->buff_tx[side],
+    s->buff_rx[side] - s->buff_tx[side]);
+
+  /* band has its own copy, so reset buffer */
+  s->buff_rx[side] = 0;
+  s->buff_tx[side] = 0;
+
+  if(ret){
+    DBG (5, "band_fill: write error %d\n", ret);
+    return ret;
+  }
+
+  if(s->eof_rx[side]){
+    ret = sanei_magic_band_finish(s->bands[side]);
+  }
+
+  DBG (10, "band_fill: finish %d\n", ret);
+  return ret;
+}
+
+/* Copy a block of processed image from the band to the frontend,
+ * getting more from the scanner if the band has nothing ready. */
+static SANE_Status
+read_from_band(struct fujitsu *s, SANE_Byte * buf,
+  SANE_Int max_len, SANE_Int * len, int side)
+{
+  SANE_Status ret = SANE_STATUS_GOOD;
+
+  DBG (10, "read_from_band: start\n");
+
+  ret = sanei_magic_band_read(s->bands[side], buf, max_len, len);
+
+  if(!ret && !*len && !s->eof_rx[side]){
+    ret = band_fill(s, side);
+    if(!ret)
+      ret = sanei_magic_band_read(s->bands[side], buf, max_len, len);
+  }
+
+  if(ret == SANE_STATUS_EOF){
+    DBG (15, "read_from_band: returning eof\n");
+    sanei_magic_band_close(s->bands[side]);
+    s->bands[side] = NULL;
+    s->bytes_tx[side] = s->bytes_rx[side];
+    s->eof_tx[side] = 1;
+  }
+
+  DBG (10, "read_from_band: finish %d\n", ret);
+  return ret;
+}
+
+/* Free the bands for both sides */
+static void
+band_close(struct fujitsu *s)
+{
+  int i;
+
+  for(i=0; i<2; i++){
+    if(s->bands[i]){
+      sanei_magic_band_close(s->bands[i]);
+      s->bands[i] = NULL;
+    }
+  }
+}
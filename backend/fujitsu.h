@@ -573,6 +573,9 @@ struct fujitsu
 
   int crop_vals[4];
 
+  /* per-side band state, when enhancements are done while reading */
+  SANEI_Magic_Band * bands[2];
+
   /* --------------------------------------------------------------------- */
   /* values used by the compression functions, esp. jpeg with duplex       */
   int jpeg_stage;
@@ -815,6 +818,7 @@ static SANE_Status set_off_mode(struct fujitsu *s);
 
 static int must_downsample (struct fujitsu *s);
 static int must_fully_buffer (struct fujitsu *s);
+static int can_band_buffer (struct fujitsu *s);
 static int get_page_width (struct fujitsu *s);
 static int get_page_height (struct fujitsu *s);
 static int get_ipc_mode (struct fujitsu *s);
@@ -852,6 +856,12 @@ static SANE_Status buffer_deskew(struct fujitsu *s, int side);
 static SANE_Status buffer_crop(struct fujitsu *s, int side);
 static SANE_Status buffer_despeck(struct fujitsu *s, int side);
 static int buffer_isblank(struct fujitsu *s, int side);
+static int get_deskew_bg(struct fujitsu *s);
+
+static SANE_Status band_start(struct fujitsu *s, int side);
+static SANE_Status band_fill(struct fujitsu *s, int side);
+static SANE_Status read_from_band(struct fujitsu *s, SANE_Byte * buf, SANE_Int max_len, SANE_Int * len, int side);
+static void band_close(struct fujitsu *s);
 
 static void hexdump (int level, char *comment, unsigned char *p, int l);
 
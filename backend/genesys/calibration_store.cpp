@@ -0,0 +1,508 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define DEBUG_DECLARE_ONLY
+
+#include "calibration_store.h"
+#include "serialize.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+namespace genesys {
+
+namespace {
+
+const char CALIBRATION_STORE_MAGIC[16] = {
+    's', 'a', 'n', 'e', '_', 'g', 'e', 'n', 'e', 's', 'y', 's', '_', 'b', 'i', 'n'
+};
+
+// This must be increased whenever the layout of the file or the serialization of any of the
+// substructures of Genesys_Calibration_Cache changes, just like CALIBRATION_VERSION in
+// genesys.cpp.
+const std::uint32_t CALIBRATION_STORE_VERSION = 1;
+
+// The file is written in native byte order. Files from hosts with different byte order are
+// treated as invalid.
+const std::uint32_t CALIBRATION_STORE_BYTE_ORDER_MARK = 0x01020304;
+
+struct FileHeader
+{
+    char magic[16];
+    std::uint32_t version;
+    std::uint32_t byte_order_mark;
+    std::uint64_t entry_count;
+    std::uint64_t index_offset;
+};
+
+using IndexKey = std::array<std::uint32_t, 7>;
+
+IndexKey get_index_key(SensorId sensor_id, const SetupParams& params)
+{
+    return {{
+        static_cast<std::uint32_t>(sensor_id),
+        static_cast<std::uint32_t>(params.scan_method),
+        params.xres,
+        params.yres,
+        params.channels,
+        params.startx,
+        params.pixels,
+    }};
+}
+
+template<class Stream>
+void serialize_calibration_metadata(Stream& str, Genesys_Calibration_Cache& x)
+{
+    serialize(str, x.params);
+    serialize_newline(str);
+    serialize(str, x.last_calibration);
+    serialize_newline(str);
+    serialize(str, x.frontend);
+    serialize_newline(str);
+    serialize(str, x.sensor);
+    serialize_newline(str);
+    serialize(str, x.session);
+    serialize(str, x.average_size);
+}
+
+template<class T>
+void append_value(std::string& out, const T& value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void append_array(std::string& out, const std::vector<std::uint16_t>& data)
+{
+    append_value(out, static_cast<std::uint64_t>(data.size()));
+    out.append(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(data[0]));
+}
+
+template<class T>
+T read_value(const std::uint8_t* data, std::size_t size, std::size_t& offset)
+{
+    if (size < sizeof(T) || offset > size - sizeof(T)) {
+        throw SaneException("Truncated calibration entry");
+    }
+    T value;
+    std::memcpy(&value, data + offset, sizeof(T));
+    offset += sizeof(T);
+    return value;
+}
+
+std::vector<std::uint16_t> read_array(const std::uint8_t* data, std::size_t size,
+                                      std::size_t& offset)
+{
+    auto count = read_value<std::uint64_t>(data, size, offset);
+    if (count > (size - offset) / sizeof(std::uint16_t)) {
+        throw SaneException("Truncated calibration entry");
+    }
+    std::vector<std::uint16_t> ret;
+    ret.resize(count);
+    std::memcpy(ret.data(), data + offset, count * sizeof(std::uint16_t));
+    offset += count * sizeof(std::uint16_t);
+    return ret;
+}
+
+} // namespace
+
+struct CalibrationStore::IndexRecord
+{
+    std::uint32_t sensor_id;
+    std::uint32_t scan_method;
+    std::uint32_t xres;
+    std::uint32_t yres;
+    std::uint32_t channels;
+    std::uint32_t startx;
+    std::uint32_t pixels;
+    std::uint32_t reserved;
+    std::int64_t last_calibration;
+    std::uint64_t payload_offset;
+    std::uint64_t payload_size;
+
+    IndexKey key() const
+    {
+        return {{ sensor_id, scan_method, xres, yres, channels, startx, pixels }};
+    }
+};
+
+CalibrationStore::~CalibrationStore()
+{
+    close();
+}
+
+bool CalibrationStore::open(const std::string& path)
+{
+    DBG_HELPER(dbg);
+
+    // the previously opened file is kept if the new one can't be opened
+#ifdef HAVE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        DBG(DBG_info, "%s: Cannot open %s\n", __func__, path.c_str());
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+
+    std::size_t size = file_stat.st_size;
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        DBG(DBG_info, "%s: Cannot map %s\n", __func__, path.c_str());
+        return false;
+    }
+
+    const auto* data = static_cast<const std::uint8_t*>(addr);
+    std::size_t entry_count = 0;
+    std::size_t index_offset = 0;
+    if (!parse_header(data, size, entry_count, index_offset)) {
+        munmap(addr, size);
+        return false;
+    }
+
+    close();
+    data_ = data;
+    size_ = size;
+    is_mapped_ = true;
+    entry_count_ = entry_count;
+    index_offset_ = index_offset;
+    path_ = path;
+    return true;
+#else
+    std::ifstream str;
+    str.open(path, std::ios::binary);
+    if (!str.is_open()) {
+        DBG(DBG_info, "%s: Cannot open %s\n", __func__, path.c_str());
+        return false;
+    }
+    std::vector<std::uint8_t> data{std::istreambuf_iterator<char>(str),
+                                   std::istreambuf_iterator<char>()};
+    if (!open_data(std::move(data))) {
+        return false;
+    }
+    path_ = path;
+    return true;
+#endif
+}
+
+bool CalibrationStore::open_data(std::vector<std::uint8_t> data)
+{
+    std::size_t entry_count = 0;
+    std::size_t index_offset = 0;
+    if (!parse_header(data.data(), data.size(), entry_count, index_offset)) {
+        return false;
+    }
+
+    close();
+    owned_data_ = std::move(data);
+    data_ = owned_data_.data();
+    size_ = owned_data_.size();
+    entry_count_ = entry_count;
+    index_offset_ = index_offset;
+    return true;
+}
+
+void CalibrationStore::close()
+{
+#ifdef HAVE_MMAP
+    if (is_mapped_) {
+        munmap(const_cast<std::uint8_t*>(data_), size_);
+    }
+#endif
+    is_mapped_ = false;
+    owned_data_.clear();
+    data_ = nullptr;
+    size_ = 0;
+    entry_count_ = 0;
+    index_offset_ = 0;
+    path_.clear();
+}
+
+bool CalibrationStore::is_binary_calibration(const std::uint8_t* data, std::size_t size)
+{
+    return size >= sizeof(FileHeader) &&
+            std::memcmp(data, CALIBRATION_STORE_MAGIC, sizeof(CALIBRATION_STORE_MAGIC)) == 0;
+}
+
+bool CalibrationStore::parse_header(const std::uint8_t* data, std::size_t size,
+                                    std::size_t& entry_count, std::size_t& index_offset)
+{
+    if (!is_binary_calibration(data, size)) {
+        DBG(DBG_info, "%s: not a binary calibration file\n", __func__);
+        return false;
+    }
+
+    FileHeader header;
+    std::memcpy(&header, data, sizeof(header));
+
+    if (header.version != CALIBRATION_STORE_VERSION ||
+        header.byte_order_mark != CALIBRATION_STORE_BYTE_ORDER_MARK)
+    {
+        DBG(DBG_info, "%s: incorrect calibration file version\n", __func__);
+        return false;
+    }
+
+    if (header.index_offset > size ||
+        header.entry_count > (size - header.index_offset) / sizeof(IndexRecord))
+    {
+        DBG(DBG_info, "%s: truncated calibration file\n", __func__);
+        return false;
+    }
+
+    entry_count = header.entry_count;
+    index_offset = header.index_offset;
+    return true;
+}
+
+CalibrationStore::IndexRecord CalibrationStore::read_index_record(std::size_t index) const
+{
+    if (index >= entry_count_) {
+        throw SaneException("Calibration entry index out of range");
+    }
+    IndexRecord record;
+    std::memcpy(&record, data_ + index_offset_ + index * sizeof(IndexRecord), sizeof(record));
+    return record;
+}
+
+std::vector<std::size_t> CalibrationStore::find_entries(SensorId sensor_id,
+                                                        const SetupParams& params) const
+{
+    auto key = get_index_key(sensor_id, params);
+
+    // the index is sorted by key, so a binary search finds the first matching record
+    std::size_t first = 0;
+    std::size_t count = entry_count_;
+    while (count > 0) {
+        std::size_t step = count / 2;
+        if (read_index_record(first + step).key() < key) {
+            first += step + 1;
+            count -= step + 1;
+        } else {
+            count = step;
+        }
+    }
+
+    std::vector<std::size_t> ret;
+    for (std::size_t i = first; i < entry_count_ && read_index_record(i).key() == key; ++i) {
+        ret.push_back(i);
+    }
+    return ret;
+}
+
+Genesys_Calibration_Cache CalibrationStore::get_entry_header(std::size_t index) const
+{
+    auto record = read_index_record(index);
+
+    Genesys_Calibration_Cache ret;
+    ret.sensor.sensor_id = static_cast<SensorId>(record.sensor_id);
+    ret.params.scan_method = static_cast<ScanMethod>(record.scan_method);
+    ret.params.xres = record.xres;
+    ret.params.yres = record.yres;
+    ret.params.channels = record.channels;
+    ret.params.startx = record.startx;
+    ret.params.pixels = record.pixels;
+    ret.last_calibration = static_cast<std::time_t>(record.last_calibration);
+    return ret;
+}
+
+Genesys_Calibration_Cache CalibrationStore::load_entry(std::size_t index) const
+{
+    DBG_HELPER_ARGS(dbg, "index: %zu", index);
+    auto record = read_index_record(index);
+
+    if (record.payload_offset > size_ || record.payload_size > size_ - record.payload_offset) {
+        throw SaneException("Truncated calibration file");
+    }
+
+    const std::uint8_t* data = data_ + record.payload_offset;
+    std::size_t size = record.payload_size;
+    std::size_t offset = 0;
+
+    auto metadata_size = read_value<std::uint64_t>(data, size, offset);
+    if (metadata_size > size - offset) {
+        throw SaneException("Truncated calibration entry");
+    }
+
+    Genesys_Calibration_Cache ret;
+    std::istringstream str{std::string(reinterpret_cast<const char*>(data + offset),
+                                       metadata_size)};
+    serialize_calibration_metadata(static_cast<std::istream&>(str), ret);
+    offset += metadata_size;
+
+    ret.white_average_data = read_array(data, size, offset);
+    ret.dark_average_data = read_array(data, size, offset);
+    return ret;
+}
+
+void CalibrationStore::write(std::ostream& str,
+                             const std::vector<Genesys_Calibration_Cache>& entries) const
+{
+    struct PendingEntry
+    {
+        IndexRecord record;
+        std::string payload;
+    };
+
+    std::vector<PendingEntry> pending;
+    std::vector<IndexKey> new_keys;
+
+    for (const auto& entry : entries) {
+        auto key = get_index_key(entry.sensor.sensor_id, entry.params);
+        new_keys.push_back(key);
+
+        PendingEntry pending_entry;
+        auto& record = pending_entry.record;
+        std::memset(&record, 0, sizeof(record));
+        record.sensor_id = key[0];
+        record.scan_method = key[1];
+        record.xres = key[2];
+        record.yres = key[3];
+        record.channels = key[4];
+        record.startx = key[5];
+        record.pixels = key[6];
+        record.last_calibration = entry.last_calibration;
+
+        std::ostringstream metadata_str;
+        auto entry_copy = entry;
+        serialize_calibration_metadata(static_cast<std::ostream&>(metadata_str), entry_copy);
+        auto metadata = metadata_str.str();
+
+        auto& payload = pending_entry.payload;
+        append_value(payload, static_cast<std::uint64_t>(metadata.size()));
+        payload.append(metadata);
+        append_array(payload, entry.white_average_data);
+        append_array(payload, entry.dark_average_data);
+
+        pending.push_back(std::move(pending_entry));
+    }
+
+    // keep the entries that have not been loaded and superseded by new entries
+    for (std::size_t i = 0; i < entry_count_; ++i) {
+        auto record = read_index_record(i);
+        if (std::find(new_keys.begin(), new_keys.end(), record.key()) != new_keys.end()) {
+            continue;
+        }
+        if (record.payload_offset > size_ || record.payload_size > size_ - record.payload_offset) {
+            continue;
+        }
+
+        PendingEntry pending_entry;
+        pending_entry.record = record;
+        pending_entry.payload.assign(reinterpret_cast<const char*>(data_ + record.payload_offset),
+                                     record.payload_size);
+        pending.push_back(std::move(pending_entry));
+    }
+
+    std::stable_sort(pending.begin(), pending.end(),
+                     [](const PendingEntry& a, const PendingEntry& b)
+    {
+        return a.record.key() < b.record.key();
+    });
+
+    FileHeader header;
+    std::memcpy(header.magic, CALIBRATION_STORE_MAGIC, sizeof(header.magic));
+    header.version = CALIBRATION_STORE_VERSION;
+    header.byte_order_mark = CALIBRATION_STORE_BYTE_ORDER_MARK;
+    header.entry_count = pending.size();
+    header.index_offset = sizeof(FileHeader);
+
+    std::uint64_t payload_offset = header.index_offset + pending.size() * sizeof(IndexRecord);
+    for (auto& pending_entry : pending) {
+        pending_entry.record.payload_offset = payload_offset;
+        pending_entry.record.payload_size = pending_entry.payload.size();
+        payload_offset += pending_entry.payload.size();
+    }
+
+    str.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const auto& pending_entry : pending) {
+        str.write(reinterpret_cast<const char*>(&pending_entry.record),
+                  sizeof(pending_entry.record));
+    }
+    for (const auto& pending_entry : pending) {
+        str.write(pending_entry.payload.data(), pending_entry.payload.size());
+    }
+}
+
+void write_calibration_store(const std::string& path,
+                             const std::vector<Genesys_Calibration_Cache>& entries,
+                             const CalibrationStore& store)
+{
+    DBG_HELPER(dbg);
+
+    // the entries of the store are only kept if it was opened from the same file
+    CalibrationStore empty_store;
+    const CalibrationStore& source_store = store.path() == path ? store : empty_store;
+
+    // The temporary file gets a unique name in the same directory, so that processes saving
+    // calibration at the same time don't write into the same file, and the rename is atomic.
+    std::vector<char> temp_name(path.begin(), path.end());
+    const char temp_suffix[] = ".XXXXXX";
+    temp_name.insert(temp_name.end(), temp_suffix, temp_suffix + sizeof(temp_suffix));
+    int fd = mkstemp(temp_name.data());
+    if (fd < 0) {
+        throw SaneException("Cannot create temporary calibration file");
+    }
+    // mkstemp creates the file readable only by the owner
+    fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    close(fd);
+
+    std::string temp_path = temp_name.data();
+    {
+        std::ofstream str;
+        str.open(temp_path, std::ios::binary);
+        if (!str.is_open()) {
+            std::remove(temp_path.c_str());
+            throw SaneException("Cannot open calibration for writing");
+        }
+        source_store.write(str, entries);
+        if (!str) {
+            str.close();
+            std::remove(temp_path.c_str());
+            throw SaneException("Cannot write calibration");
+        }
+    }
+
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        // rename does not replace existing files on some systems
+        std::remove(path.c_str());
+        if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+            std::remove(temp_path.c_str());
+            throw SaneException("Cannot replace calibration file");
+        }
+    }
+}
+
+} // namespace genesys
@@ -0,0 +1,103 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BACKEND_GENESYS_CALIBRATION_STORE_H
+#define BACKEND_GENESYS_CALIBRATION_STORE_H
+
+#include "calibration.h"
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace genesys {
+
+// Provides access to a binary calibration file. The file consists of a header, an index of
+// fixed-size records sorted by the parameters that determine whether a calibration entry can be
+// used for a scan and a payload for each entry. The file is memory-mapped and only the index
+// records are accessed until an entry is loaded, thus neither opening the file nor looking up an
+// entry depends on the number of entries in the file.
+class CalibrationStore
+{
+public:
+    CalibrationStore() = default;
+    ~CalibrationStore();
+
+    CalibrationStore(const CalibrationStore&) = delete;
+    CalibrationStore& operator=(const CalibrationStore&) = delete;
+
+    // Opens a binary calibration file. Returns false if the file can't be opened or it's not a
+    // binary calibration file of the current version. In that case the previously opened file,
+    // if any, remains open.
+    bool open(const std::string& path);
+
+    // Same as open(), except that the file contents are supplied directly
+    bool open_data(std::vector<std::uint8_t> data);
+
+    void close();
+
+    bool is_open() const { return data_ != nullptr; }
+    const std::string& path() const { return path_; }
+
+    std::size_t size() const { return entry_count_; }
+
+    // Returns the indices of the entries that were created for the given sensor and have the
+    // same values of the parameters checked by sanei_genesys_is_compatible_calibration().
+    std::vector<std::size_t> find_entries(SensorId sensor_id, const SetupParams& params) const;
+
+    // Returns an entry in which only the parameters stored in the index are filled. This is
+    // enough to call sanei_genesys_is_compatible_calibration() on it.
+    Genesys_Calibration_Cache get_entry_header(std::size_t index) const;
+
+    // Parses and returns the full entry
+    Genesys_Calibration_Cache load_entry(std::size_t index) const;
+
+    // Writes a binary calibration file containing the given entries and all entries of this
+    // store that have not been superseded by an entry with the same index parameters.
+    void write(std::ostream& str, const std::vector<Genesys_Calibration_Cache>& entries) const;
+
+    // Returns true if the data starts with the header of a binary calibration file
+    static bool is_binary_calibration(const std::uint8_t* data, std::size_t size);
+
+private:
+    struct IndexRecord;
+
+    static bool parse_header(const std::uint8_t* data, std::size_t size,
+                             std::size_t& entry_count, std::size_t& index_offset);
+    IndexRecord read_index_record(std::size_t index) const;
+
+    std::string path_;
+
+    const std::uint8_t* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool is_mapped_ = false;
+    std::vector<std::uint8_t> owned_data_;
+
+    std::size_t entry_count_ = 0;
+    std::size_t index_offset_ = 0;
+};
+
+// Writes the calibration entries to the given path. The file is first written to a temporary
+// file and then renamed, thus the store may be mapped from the same path.
+void write_calibration_store(const std::string& path,
+                             const std::vector<Genesys_Calibration_Cache>& entries,
+                             const CalibrationStore& store);
+
+} // namespace genesys
+
+#endif // BACKEND_GENESYS_CALIBRATION_STORE_H
@@ -82,6 +82,7 @@ void Genesys_Device::clear()
     calib_file.clear();
 
     calibration_cache.clear();
+    calibration_store.close();
 
     white_average_data.clear();
     dark_average_data.clear();
@@ -92,6 +93,13 @@ ImagePipelineNodeBufferedCallableSource& Genesys_Device::get_pipeline_source()
     return static_cast<ImagePipelineNodeBufferedCallableSource&>(pipeline.front());
 }
 
+void Genesys_Device::stop_pipeline_prefetch()
+{
+    if (!pipeline.empty()) {
+        get_pipeline_source().stop_prefetch();
+    }
+}
+
 bool Genesys_Device::is_head_pos_known(ScanHeadId scan_head) const
 {
     switch (scan_head) {
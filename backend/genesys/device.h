@@ -22,6 +22,7 @@
 #define BACKEND_GENESYS_DEVICE_H
 
 #include "calibration.h"
+#include "calibration_store.h"
 #include "command_set.h"
 #include "enums.h"
 #include "image_pipeline.h"
@@ -304,6 +305,10 @@ struct Genesys_Device
 
     Calibration calibration_cache;
 
+    // the binary calibration file from which the entries that are not in calibration_cache are
+    // loaded when needed
+    CalibrationStore calibration_store;
+
     // number of scan lines used during scan
     int line_count = 0;
 
@@ -318,6 +323,9 @@ struct Genesys_Device
 
     ImagePipelineNodeBufferedCallableSource& get_pipeline_source();
 
+    // stops reading scan data ahead of the pipeline. Must be called before the scan is ended.
+    void stop_pipeline_prefetch();
+
     std::unique_ptr<ScannerInterface> interface;
 
     bool is_head_pos_known(ScanHeadId scan_head) const;
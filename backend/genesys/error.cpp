@@ -190,32 +190,50 @@ void DebugMessageHelper::vlog(unsigned level, const char* format, ...)
     DBG(level, "%s: %s\n", func_, msg.c_str());
 }
 
-enum class LogImageDataStatus
+enum class DebugSettingStatus
 {
     NOT_SET,
     ENABLED,
     DISABLED
 };
 
-static LogImageDataStatus s_log_image_data_setting = LogImageDataStatus::NOT_SET;
+static DebugSettingStatus s_log_image_data_setting = DebugSettingStatus::NOT_SET;
+static DebugSettingStatus s_no_pipeline_fusion_setting = DebugSettingStatus::NOT_SET;
+static DebugSettingStatus s_pipeline_stats_setting = DebugSettingStatus::NOT_SET;
 
-LogImageDataStatus dbg_read_log_image_data_setting()
+static DebugSettingStatus dbg_read_bool_setting(const char* name)
 {
-    auto* setting = std::getenv("SANE_DEBUG_GENESYS_IMAGE");
+    auto* setting = std::getenv(name);
     if (!setting)
-        return LogImageDataStatus::DISABLED;
+        return DebugSettingStatus::DISABLED;
     auto setting_int = std::strtol(setting, nullptr, 10);
     if (setting_int == 0)
-        return LogImageDataStatus::DISABLED;
-    return LogImageDataStatus::ENABLED;
+        return DebugSettingStatus::DISABLED;
+    return DebugSettingStatus::ENABLED;
 }
 
 bool dbg_log_image_data()
 {
-    if (s_log_image_data_setting == LogImageDataStatus::NOT_SET) {
-        s_log_image_data_setting = dbg_read_log_image_data_setting();
+    if (s_log_image_data_setting == DebugSettingStatus::NOT_SET) {
+        s_log_image_data_setting = dbg_read_bool_setting("SANE_DEBUG_GENESYS_IMAGE");
     }
-    return s_log_image_data_setting == LogImageDataStatus::ENABLED;
+    return s_log_image_data_setting == DebugSettingStatus::ENABLED;
+}
+
+bool dbg_no_pipeline_fusion()
+{
+    if (s_no_pipeline_fusion_setting == DebugSettingStatus::NOT_SET) {
+        s_no_pipeline_fusion_setting = dbg_read_bool_setting("SANE_DEBUG_GENESYS_NO_FUSION");
+    }
+    return s_no_pipeline_fusion_setting == DebugSettingStatus::ENABLED;
+}
+
+bool dbg_pipeline_stats()
+{
+    if (s_pipeline_stats_setting == DebugSettingStatus::NOT_SET) {
+        s_pipeline_stats_setting = dbg_read_bool_setting("SANE_DEBUG_GENESYS_PIPELINE_STATS");
+    }
+    return s_pipeline_stats_setting == DebugSettingStatus::ENABLED;
 }
 
 } // namespace genesys
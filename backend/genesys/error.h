@@ -127,6 +127,14 @@ private:
 
 bool dbg_log_image_data();
 
+// Returns true if the image pipeline should process each node separately instead of fusing
+// consecutive row transform nodes
+bool dbg_no_pipeline_fusion();
+
+// Returns true if the statistics of the image pipeline stages should be collected and printed when
+// the scan is cancelled
+bool dbg_pipeline_stats();
+
 template<class F>
 SANE_Status wrap_exceptions_to_status_code(const char* func, F&& function)
 {
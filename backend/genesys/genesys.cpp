@@ -3483,6 +3483,33 @@ static void genesys_send_shading_coefficient(Genesys_Device* dev, const Genesys_
 }
 
 
+/**
+ * Searches the calibration cache for an entry matching the given scan session. If there's no
+ * such entry in memory, it is looked up in the calibration file and loaded.
+ */
+static Genesys_Calibration_Cache* find_compatible_calibration(Genesys_Device* dev,
+                                                              const Genesys_Sensor& sensor,
+                                                              const ScanSession& session)
+{
+    DBG_HELPER(dbg);
+
+    for (auto& cache : dev->calibration_cache) {
+        if (sanei_genesys_is_compatible_calibration(dev, session, &cache, false)) {
+            return &cache;
+        }
+    }
+
+    auto& store = dev->calibration_store;
+    for (auto index : store.find_entries(sensor.sensor_id, session.params)) {
+        auto header = store.get_entry_header(index);
+        if (sanei_genesys_is_compatible_calibration(dev, session, &header, false)) {
+            dev->calibration_cache.push_back(store.load_entry(index));
+            return &dev->calibration_cache.back();
+        }
+    }
+    return nullptr;
+}
+
 /**
  * search calibration cache list for an entry matching required scan.
  * If one is found, set device calibration with it
@@ -3496,37 +3523,34 @@ genesys_restore_calibration(Genesys_Device * dev, Genesys_Sensor& sensor)
     DBG_HELPER(dbg);
 
     // if no cache or no function to evaluate cache entry there can be no match/
-    if (dev->calibration_cache.empty()) {
+    if (dev->calibration_cache.empty() && dev->calibration_store.size() == 0) {
         return false;
     }
 
     auto session = dev->cmd_set->calculate_scan_session(dev, sensor, dev->settings);
 
-  /* we walk the link list of calibration cache in search for a
-   * matching one */
-  for (auto& cache : dev->calibration_cache)
-    {
-        if (sanei_genesys_is_compatible_calibration(dev, session, &cache, false)) {
-            dev->frontend = cache.frontend;
-          /* we don't restore the gamma fields */
-          sensor.exposure = cache.sensor.exposure;
+    auto* cache = find_compatible_calibration(dev, sensor, session);
+    if (cache == nullptr) {
+        DBG(DBG_proc, "%s: completed(nothing found)\n", __func__);
+        return false;
+    }
 
-            dev->calib_session = cache.session;
-          dev->average_size = cache.average_size;
+    dev->frontend = cache->frontend;
+    // we don't restore the gamma fields
+    sensor.exposure = cache->sensor.exposure;
 
-          dev->dark_average_data = cache.dark_average_data;
-          dev->white_average_data = cache.white_average_data;
+    dev->calib_session = cache->session;
+    dev->average_size = cache->average_size;
 
-            if (!dev->cmd_set->has_send_shading_data()) {
-            genesys_send_shading_coefficient(dev, sensor);
-          }
+    dev->dark_average_data = cache->dark_average_data;
+    dev->white_average_data = cache->white_average_data;
 
-          DBG(DBG_proc, "%s: restored\n", __func__);
-          return true;
-	}
+    if (!dev->cmd_set->has_send_shading_data()) {
+        genesys_send_shading_coefficient(dev, sensor);
     }
-  DBG(DBG_proc, "%s: completed(nothing found)\n", __func__);
-  return false;
+
+    DBG(DBG_proc, "%s: restored\n", __func__);
+    return true;
 }
 
 
@@ -4143,6 +4167,7 @@ static void genesys_read_ordered_data(Genesys_Device* dev, SANE_Byte* destinatio
   /* end scan if all needed data have been read */
    if(dev->total_bytes_read >= dev->total_bytes_to_read)
     {
+        dev->stop_pipeline_prefetch();
         dev->cmd_set->end_scan(dev, &dev->reg, true);
         if (dev->model->is_sheetfed) {
             dev->cmd_set->eject_document (dev);
@@ -5213,14 +5238,25 @@ bool read_calibration(std::istream& str, Genesys_Device::Calibration& calibratio
 }
 
 /**
- * reads previously cached calibration data
- * from file defined in dev->calib_file
+ * reads previously cached calibration data from the given file. Binary calibration files are
+ * only indexed and the entries are loaded when needed. Calibration files in the older text format
+ * are read fully.
  */
 static bool sanei_genesys_read_calibration(Genesys_Device::Calibration& calibration,
-                                           const std::string& path)
+                                           CalibrationStore& store, const std::string& path)
 {
     DBG_HELPER(dbg);
 
+    if (store.is_open() && store.path() == path) {
+        // the file has already been indexed and calibration may contain newer entries
+        return true;
+    }
+
+    if (store.open(path)) {
+        calibration.clear();
+        return true;
+    }
+
     std::ifstream str;
     str.open(path);
     if (!str.is_open()) {
@@ -5228,7 +5264,11 @@ static bool sanei_genesys_read_calibration(Genesys_Device::Calibration& calibrat
         return false;
     }
 
-    return read_calibration(str, calibration, path);
+    if (!read_calibration(str, calibration, path)) {
+        return false;
+    }
+    store.close();
+    return true;
 }
 
 void write_calibration(std::ostream& str, Genesys_Device::Calibration& calibration)
@@ -5241,18 +5281,6 @@ void write_calibration(std::ostream& str, Genesys_Device::Calibration& calibrati
     serialize(str, calibration);
 }
 
-static void write_calibration(Genesys_Device::Calibration& calibration, const std::string& path)
-{
-    DBG_HELPER(dbg);
-
-    std::ofstream str;
-    str.open(path);
-    if (!str.is_open()) {
-        throw SaneException("Cannot open calibration for writing");
-    }
-    write_calibration(str, calibration);
-}
-
 /* -------------------------- SANE API functions ------------------------- */
 
 void sane_init_impl(SANE_Int * version_code, SANE_Auth_Callback authorize)
@@ -5543,8 +5571,11 @@ sane_close_impl(SANE_Handle handle)
 
     // here is the place to store calibration cache
     if (dev->force_calibration == 0 && !is_testing_mode()) {
-        catch_all_exceptions(__func__, [&](){ write_calibration(dev->calibration_cache,
-                                                                dev->calib_file); });
+        catch_all_exceptions(__func__, [&]()
+        {
+            write_calibration_store(dev->calib_file, dev->calibration_cache,
+                                    dev->calibration_store);
+        });
     }
 
     dev->already_initialized = false;
@@ -5818,12 +5849,13 @@ static void set_calibration_value(Genesys_Scanner* s, const char* val)
     auto dev = s->dev;
 
     std::string new_calib_path = val;
-    Genesys_Device::Calibration new_calibration;
+    Genesys_Device::Calibration new_calibration = dev->calibration_cache;
 
     bool is_calib_success = false;
     catch_all_exceptions(__func__, [&]()
     {
-        is_calib_success = sanei_genesys_read_calibration(new_calibration, new_calib_path);
+        is_calib_success = sanei_genesys_read_calibration(new_calibration, dev->calibration_store,
+                                                          new_calib_path);
     });
 
     if (!is_calib_success) {
@@ -6074,6 +6106,7 @@ static void set_option_value(Genesys_Scanner* s, int option, void *val, SANE_Int
         }
         case OPT_CLEAR_CALIBRATION: {
             dev->calibration_cache.clear();
+            dev->calibration_store.close();
 
             // remove file
             unlink(dev->calib_file.c_str());
@@ -6084,6 +6117,7 @@ static void set_option_value(Genesys_Scanner* s, int option, void *val, SANE_Int
         case OPT_FORCE_CALIBRATION: {
             dev->force_calibration = 1;
             dev->calibration_cache.clear();
+            dev->calibration_store.close();
             dev->calib_file.clear();
 
             // signals that sensors will have to be read again
@@ -6230,7 +6264,8 @@ void sane_start_impl(SANE_Handle handle)
 
         catch_all_exceptions(__func__, [&]()
         {
-            sanei_genesys_read_calibration(dev->calibration_cache, dev->calib_file);
+            sanei_genesys_read_calibration(dev->calibration_cache, dev->calibration_store,
+                                           dev->calib_file);
         });
     }
 
@@ -6332,6 +6367,13 @@ void sane_cancel_impl(SANE_Handle handle)
     s->scanning = false;
     dev->read_active = false;
 
+    dev->stop_pipeline_prefetch();
+
+    if (dbg_pipeline_stats() && !dev->pipeline.empty()) {
+        DBG(DBG_error0, "%s: image pipeline statistics:\n%s", __func__,
+            format_pipeline_stage_stats(dev->pipeline.get_stage_stats()).c_str());
+    }
+
     // no need to end scan if we are parking the head
     if (!dev->parking) {
         dev->cmd_set->end_scan(dev, &dev->reg, true);
@@ -90,8 +90,8 @@ void convert_pixel_row_impl2(const std::uint8_t* in_data, std::uint8_t* out_data
                              std::size_t count)
 {
     for (std::size_t i = 0; i < count; ++i) {
-        Pixel pixel = get_pixel_from_row(in_data, i, SrcFormat);
-        set_pixel_to_row(out_data, i, pixel, DstFormat);
+        Pixel pixel = get_pixel_from_row<SrcFormat>(in_data, i);
+        set_pixel_to_row<DstFormat>(out_data, i, pixel);
     }
 }
 
@@ -60,6 +60,10 @@ bool ImageBuffer::get_data(std::size_t size, std::uint8_t* out_data)
         buffer_offset_ = 0;
 
         std::size_t size_to_read = size_;
+        if (multi_chunk_reads_ && remaining_size_ == BUFFER_SIZE_UNSET) {
+            std::size_t chunks = (out_data_end - out_data) / size_;
+            size_to_read = std::max<std::size_t>(chunks, 1) * size_;
+        }
         if (remaining_size_ != BUFFER_SIZE_UNSET) {
             size_to_read = std::min<std::uint64_t>(size_to_read, remaining_size_);
             remaining_size_ -= size_to_read;
@@ -70,10 +74,18 @@ bool ImageBuffer::get_data(std::size_t size, std::uint8_t* out_data)
             aligned_size_to_read = align_multiple_ceil(size_to_read, last_read_multiple_);
         }
 
-        got_data &= producer_(aligned_size_to_read, buffer_.data());
-        curr_size_ = size_to_read;
+        if (static_cast<std::size_t>(out_data_end - out_data) >= aligned_size_to_read) {
+            // the whole chunk fits into the output, so read it there directly instead of copying
+            // it through the internal buffer
+            got_data &= producer_(aligned_size_to_read, out_data);
+            curr_size_ = 0;
+            out_data += size_to_read;
+        } else {
+            got_data &= producer_(aligned_size_to_read, buffer_.data());
+            curr_size_ = size_to_read;
 
-        copy_buffer();
+            copy_buffer();
+        }
 
         if (remaining_size_ == 0 && out_data < out_data_end) {
             got_data = false;
@@ -84,4 +96,205 @@ bool ImageBuffer::get_data(std::size_t size, std::uint8_t* out_data)
     return got_data;
 }
 
+PrefetchImageBuffer::PrefetchImageBuffer(std::size_t size, std::size_t prefetch_count,
+                                         ProducerCallback producer) :
+    producer_{producer},
+    size_{size},
+    prefetch_count_{std::max<std::size_t>(prefetch_count, 1)}
+{}
+
+PrefetchImageBuffer::~PrefetchImageBuffer()
+{
+    stop();
+}
+
+std::size_t PrefetchImageBuffer::buffered_size() const
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    std::size_t size = available();
+    for (const auto& chunk : filled_chunks_) {
+        size += chunk.size;
+    }
+    return size;
+}
+
+std::uint64_t PrefetchImageBuffer::remaining_size() const
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    return remaining_size_;
+}
+
+void PrefetchImageBuffer::set_remaining_size(std::uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    remaining_size_ = bytes;
+}
+
+void PrefetchImageBuffer::set_last_read_multiple(std::uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    last_read_multiple_ = bytes;
+}
+
+void PrefetchImageBuffer::start()
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (started_) {
+        return;
+    }
+    started_ = true;
+
+    if (stop_requested_) {
+        producer_finished_ = true;
+        return;
+    }
+
+    // the last read may be rounded up, thus the buffers need to be large enough to hold it
+    std::size_t buffer_size = size_;
+    if (last_read_multiple_ != BUFFER_SIZE_UNSET) {
+        buffer_size = align_multiple_ceil(buffer_size, last_read_multiple_);
+    }
+
+    // one buffer is held by the consumer, the rest may be filled by the producer
+    free_buffers_.resize(prefetch_count_ + 1);
+    for (auto& buffer : free_buffers_) {
+        buffer.resize(buffer_size);
+    }
+    thread_ = std::thread([this]() { producer_thread(); });
+}
+
+void PrefetchImageBuffer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stop_requested_ = true;
+    }
+    cond_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void PrefetchImageBuffer::producer_thread()
+{
+    while (true) {
+        std::vector<std::uint8_t> buffer;
+        std::size_t size_to_read = 0;
+        std::size_t aligned_size_to_read = 0;
+        {
+            std::unique_lock<std::mutex> lock{mutex_};
+            cond_.wait(lock, [this]()
+            {
+                return stop_requested_ || (!free_buffers_.empty() &&
+                                           filled_chunks_.size() < prefetch_count_);
+            });
+
+            if (stop_requested_ || remaining_size_ == 0) {
+                break;
+            }
+
+            size_to_read = size_;
+            if (remaining_size_ != BUFFER_SIZE_UNSET) {
+                size_to_read = std::min<std::uint64_t>(size_to_read, remaining_size_);
+                remaining_size_ -= size_to_read;
+            }
+
+            aligned_size_to_read = size_to_read;
+            if (remaining_size_ == 0 && last_read_multiple_ != BUFFER_SIZE_UNSET) {
+                aligned_size_to_read = align_multiple_ceil(size_to_read, last_read_multiple_);
+            }
+
+            buffer = std::move(free_buffers_.back());
+            free_buffers_.pop_back();
+        }
+
+        bool got_data = false;
+        try {
+            got_data = producer_(aligned_size_to_read, buffer.data());
+        } catch (...) {
+            std::lock_guard<std::mutex> lock{mutex_};
+            producer_exception_ = std::current_exception();
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            Chunk chunk;
+            chunk.data = std::move(buffer);
+            chunk.size = size_to_read;
+            chunk.got_data = got_data;
+            filled_chunks_.push_back(std::move(chunk));
+        }
+        cond_.notify_all();
+
+        if (!got_data) {
+            break;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        producer_finished_ = true;
+    }
+    cond_.notify_all();
+}
+
+bool PrefetchImageBuffer::get_data(std::size_t size, std::uint8_t* out_data)
+{
+    start();
+
+    const std::uint8_t* out_data_end = out_data + size;
+
+    auto copy_buffer = [&]()
+    {
+        std::size_t bytes_copy = std::min<std::size_t>(out_data_end - out_data, available());
+        std::memcpy(out_data, curr_chunk_.data.data() + curr_offset_, bytes_copy);
+        out_data += bytes_copy;
+        curr_offset_ += bytes_copy;
+    };
+
+    // first, read remaining data from the current chunk
+    if (available() > 0) {
+        copy_buffer();
+    }
+
+    if (out_data == out_data_end) {
+        return true;
+    }
+
+    // now the current chunk is empty and there's more data to be read
+    bool got_data = true;
+    do {
+        {
+            std::unique_lock<std::mutex> lock{mutex_};
+            if (!curr_chunk_.data.empty()) {
+                free_buffers_.push_back(std::move(curr_chunk_.data));
+                curr_chunk_ = Chunk{};
+                curr_offset_ = 0;
+                cond_.notify_all();
+            }
+
+            cond_.wait(lock, [this]() { return !filled_chunks_.empty() || producer_finished_; });
+
+            if (filled_chunks_.empty()) {
+                if (producer_exception_) {
+                    std::rethrow_exception(producer_exception_);
+                }
+                return false;
+            }
+
+            curr_chunk_ = std::move(filled_chunks_.front());
+            filled_chunks_.pop_front();
+            curr_offset_ = 0;
+        }
+        cond_.notify_all();
+
+        got_data &= curr_chunk_.got_data;
+        copy_buffer();
+
+    } while (out_data < out_data_end && got_data);
+
+    return got_data;
+}
+
 } // namespace genesys
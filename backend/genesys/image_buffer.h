@@ -24,7 +24,12 @@
 #include "enums.h"
 #include "row_buffer.h"
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <functional>
+#include <mutex>
+#include <thread>
 
 namespace genesys {
 
@@ -48,6 +53,12 @@ public:
     // May be used to force the last read to be rounded up of a certain number of bytes
     void set_last_read_multiple(std::uint64_t bytes) { last_read_multiple_ = bytes; }
 
+    // Allows a single producer call to fill all whole chunks that fit into out_data, so that the
+    // producer may process them at once. Has no effect while the remaining size is set.
+    void set_multi_chunk_reads(bool enabled) { multi_chunk_reads_ = enabled; }
+
+    // Whole chunks that fit into out_data are read from the producer directly into it. Only the
+    // data of a chunk that is split across requests passes through the internal buffer.
     bool get_data(std::size_t size, std::uint8_t* out_data);
 
 private:
@@ -57,11 +68,79 @@ private:
 
     std::uint64_t remaining_size_ = BUFFER_SIZE_UNSET;
     std::uint64_t last_read_multiple_ = BUFFER_SIZE_UNSET;
+    bool multi_chunk_reads_ = false;
 
     std::size_t buffer_offset_ = 0;
     std::vector<std::uint8_t> buffer_;
 };
 
+// This class has the same interface as ImageBuffer, except that the producer is called on a
+// separate thread. Up to prefetch_count chunks are read ahead of the consumer, so that e.g. the
+// USB transfers continue while the consumer processes the previously read data. The producer is
+// not called until the first call to get_data().
+class PrefetchImageBuffer
+{
+public:
+    using ProducerCallback = ImageBuffer::ProducerCallback;
+    static constexpr std::uint64_t BUFFER_SIZE_UNSET = ImageBuffer::BUFFER_SIZE_UNSET;
+
+    PrefetchImageBuffer(std::size_t size, std::size_t prefetch_count, ProducerCallback producer);
+    ~PrefetchImageBuffer();
+
+    PrefetchImageBuffer(const PrefetchImageBuffer&) = delete;
+    PrefetchImageBuffer& operator=(const PrefetchImageBuffer&) = delete;
+
+    std::size_t available() const { return curr_chunk_.size - curr_offset_; }
+
+    // Returns the amount of data that has been read from the producer, but not yet consumed
+    std::size_t buffered_size() const;
+
+    // The remaining size excludes the data that has already been requested from the producer
+    std::uint64_t remaining_size() const;
+    void set_remaining_size(std::uint64_t bytes);
+
+    void set_last_read_multiple(std::uint64_t bytes);
+
+    bool get_data(std::size_t size, std::uint8_t* out_data);
+
+    // Stops the producer thread. If the producer is currently being called, waits for it to
+    // complete. No data is requested from the producer afterwards.
+    void stop();
+
+private:
+    struct Chunk
+    {
+        std::vector<std::uint8_t> data;
+        std::size_t size = 0;
+        bool got_data = true;
+    };
+
+    void start();
+    void producer_thread();
+
+    ProducerCallback producer_;
+    std::size_t size_ = 0;
+    std::size_t prefetch_count_ = 0;
+
+    std::thread thread_;
+
+    // the following members are protected by mutex_
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    bool started_ = false;
+    bool stop_requested_ = false;
+    bool producer_finished_ = false;
+    std::exception_ptr producer_exception_;
+    std::uint64_t remaining_size_ = BUFFER_SIZE_UNSET;
+    std::uint64_t last_read_multiple_ = BUFFER_SIZE_UNSET;
+    std::deque<Chunk> filled_chunks_;
+    std::vector<std::vector<std::uint8_t>> free_buffers_;
+
+    // the following members are accessed only by the consumer
+    Chunk curr_chunk_;
+    std::size_t curr_offset_ = 0;
+};
+
 } // namespace genesys
 
 #endif // BACKEND_GENESYS_IMAGE_BUFFER_H
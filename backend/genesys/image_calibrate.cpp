@@ -0,0 +1,373 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define DEBUG_DECLARE_ONLY
+
+#include "image_calibrate.h"
+#include "error.h"
+#include "utilities.h"
+
+#include <cmath>
+
+// The SIMD kernels must produce exactly the same results as the scalar code, thus they are only
+// enabled when the scalar floating-point math is done in the same registers with the same
+// precision, i.e. not on x87.
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__SSE2_MATH__))
+    #define GENESYS_CALIBRATE_X86 1
+    #include <immintrin.h>
+#endif
+
+// armv7 NEON lacks division and correct rounding, so only aarch64 is supported
+#if defined(__aarch64__) && defined(__ARM_NEON) && \
+        defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    #define GENESYS_CALIBRATE_NEON 1
+    #include <arm_neon.h>
+#endif
+
+namespace genesys {
+
+namespace {
+
+template<std::size_t MaxValue>
+inline std::int32_t calibrate_sample(std::int32_t value, float offset, float multiplier)
+{
+    float value_f = static_cast<float>(value) / MaxValue;
+    value_f = (value_f - offset) * multiplier;
+    value_f = std::round(value_f * MaxValue);
+    return clamp<std::int32_t>(static_cast<std::int32_t>(value_f), 0, MaxValue);
+}
+
+void calibrate_row_8bit_scalar(std::uint8_t* data, std::size_t count, const float* offset,
+                               const float* multiplier)
+{
+    for (std::size_t i = 0; i < count; ++i) {
+        data[i] = calibrate_sample<255>(data[i], offset[i], multiplier[i]);
+    }
+}
+
+void calibrate_row_16bit_scalar(std::uint8_t* data, std::size_t count, const float* offset,
+                                const float* multiplier)
+{
+    for (std::size_t i = 0; i < count; ++i) {
+        std::int32_t value = data[i * 2] | (data[i * 2 + 1] << 8);
+        value = calibrate_sample<65535>(value, offset[i], multiplier[i]);
+        data[i * 2] = value;
+        data[i * 2 + 1] = value >> 8;
+    }
+}
+
+#if GENESYS_CALIBRATE_X86
+
+// Computes static_cast<std::int32_t>(std::round(x)) for 4 values. std::round rounds halfway
+// cases away from zero, which none of the SSE rounding modes do, so we truncate and then adjust
+// by the exactly computed fractional part. Out of range values and NaNs give 0x80000000 just like
+// the scalar conversion on x86.
+inline __m128i round_to_int_sse2(__m128 x)
+{
+    __m128i t = _mm_cvttps_epi32(x);
+    __m128 frac = _mm_sub_ps(x, _mm_cvtepi32_ps(t));
+
+    __m128 up = _mm_and_ps(_mm_cmpge_ps(frac, _mm_set1_ps(0.5f)),
+                           _mm_cmplt_ps(frac, _mm_set1_ps(1.0f)));
+    __m128 down = _mm_and_ps(_mm_cmple_ps(frac, _mm_set1_ps(-0.5f)),
+                             _mm_cmpgt_ps(frac, _mm_set1_ps(-1.0f)));
+    // masks are -1 where set
+    t = _mm_sub_epi32(t, _mm_castps_si128(up));
+    t = _mm_add_epi32(t, _mm_castps_si128(down));
+    return t;
+}
+
+inline __m128i clamp_sse2(__m128i value, __m128i max_value)
+{
+    value = _mm_and_si128(value, _mm_cmpgt_epi32(value, _mm_setzero_si128()));
+    __m128i over = _mm_cmpgt_epi32(value, max_value);
+    return _mm_or_si128(_mm_andnot_si128(over, value), _mm_and_si128(over, max_value));
+}
+
+inline __m128i calibrate_4_sse2(__m128i value, const float* offset, const float* multiplier,
+                                __m128 max_value_f, __m128i max_value)
+{
+    __m128 value_f = _mm_div_ps(_mm_cvtepi32_ps(value), max_value_f);
+    value_f = _mm_mul_ps(_mm_sub_ps(value_f, _mm_loadu_ps(offset)), _mm_loadu_ps(multiplier));
+    value_f = _mm_mul_ps(value_f, max_value_f);
+    return clamp_sse2(round_to_int_sse2(value_f), max_value);
+}
+
+void calibrate_row_8bit_sse2(std::uint8_t* data, std::size_t count, const float* offset,
+                             const float* multiplier)
+{
+    const __m128 max_value_f = _mm_set1_ps(255.0f);
+    const __m128i max_value = _mm_set1_epi32(255);
+    const __m128i zero = _mm_setzero_si128();
+
+    std::size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i lo16 = _mm_unpacklo_epi8(in, zero);
+        __m128i hi16 = _mm_unpackhi_epi8(in, zero);
+
+        __m128i v0 = calibrate_4_sse2(_mm_unpacklo_epi16(lo16, zero), offset + i,
+                                      multiplier + i, max_value_f, max_value);
+        __m128i v1 = calibrate_4_sse2(_mm_unpackhi_epi16(lo16, zero), offset + i + 4,
+                                      multiplier + i + 4, max_value_f, max_value);
+        __m128i v2 = calibrate_4_sse2(_mm_unpacklo_epi16(hi16, zero), offset + i + 8,
+                                      multiplier + i + 8, max_value_f, max_value);
+        __m128i v3 = calibrate_4_sse2(_mm_unpackhi_epi16(hi16, zero), offset + i + 12,
+                                      multiplier + i + 12, max_value_f, max_value);
+
+        __m128i out = _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), out);
+    }
+    calibrate_row_8bit_scalar(data + i, count - i, offset + i, multiplier + i);
+}
+
+void calibrate_row_16bit_sse2(std::uint8_t* data, std::size_t count, const float* offset,
+                              const float* multiplier)
+{
+    const __m128 max_value_f = _mm_set1_ps(65535.0f);
+    const __m128i max_value = _mm_set1_epi32(65535);
+    const __m128i zero = _mm_setzero_si128();
+    // SSE2 has only signed saturation when packing 32-bit values, so the values are biased to the
+    // signed range before packing and back afterwards.
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 2));
+
+        __m128i v0 = calibrate_4_sse2(_mm_unpacklo_epi16(in, zero), offset + i,
+                                      multiplier + i, max_value_f, max_value);
+        __m128i v1 = calibrate_4_sse2(_mm_unpackhi_epi16(in, zero), offset + i + 4,
+                                      multiplier + i + 4, max_value_f, max_value);
+
+        __m128i out = _mm_packs_epi32(_mm_sub_epi32(v0, bias32), _mm_sub_epi32(v1, bias32));
+        out = _mm_xor_si128(out, bias16);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i * 2), out);
+    }
+    calibrate_row_16bit_scalar(data + i * 2, count - i, offset + i, multiplier + i);
+}
+
+__attribute__((target("avx2")))
+inline __m256i calibrate_8_avx2(__m256i value, const float* offset, const float* multiplier,
+                                __m256 max_value_f, __m256i max_value)
+{
+    __m256 x = _mm256_div_ps(_mm256_cvtepi32_ps(value), max_value_f);
+    x = _mm256_mul_ps(_mm256_sub_ps(x, _mm256_loadu_ps(offset)), _mm256_loadu_ps(multiplier));
+    x = _mm256_mul_ps(x, max_value_f);
+
+    // see round_to_int_sse2()
+    __m256i t = _mm256_cvttps_epi32(x);
+    __m256 frac = _mm256_sub_ps(x, _mm256_cvtepi32_ps(t));
+    __m256 up = _mm256_and_ps(_mm256_cmp_ps(frac, _mm256_set1_ps(0.5f), _CMP_GE_OQ),
+                              _mm256_cmp_ps(frac, _mm256_set1_ps(1.0f), _CMP_LT_OQ));
+    __m256 down = _mm256_and_ps(_mm256_cmp_ps(frac, _mm256_set1_ps(-0.5f), _CMP_LE_OQ),
+                                _mm256_cmp_ps(frac, _mm256_set1_ps(-1.0f), _CMP_GT_OQ));
+    t = _mm256_sub_epi32(t, _mm256_castps_si256(up));
+    t = _mm256_add_epi32(t, _mm256_castps_si256(down));
+
+    t = _mm256_max_epi32(t, _mm256_setzero_si256());
+    return _mm256_min_epi32(t, max_value);
+}
+
+__attribute__((target("avx2")))
+void calibrate_row_8bit_avx2(std::uint8_t* data, std::size_t count, const float* offset,
+                             const float* multiplier)
+{
+    const __m256 max_value_f = _mm256_set1_ps(255.0f);
+    const __m256i max_value = _mm256_set1_epi32(255);
+
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i in = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(data + i));
+        __m256i v = calibrate_8_avx2(_mm256_cvtepu8_epi32(in), offset + i, multiplier + i,
+                                     max_value_f, max_value);
+
+        __m128i out = _mm_packus_epi32(_mm256_castsi256_si128(v),
+                                       _mm256_extracti128_si256(v, 1));
+        out = _mm_packus_epi16(out, out);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(data + i), out);
+    }
+    calibrate_row_8bit_scalar(data + i, count - i, offset + i, multiplier + i);
+}
+
+__attribute__((target("avx2")))
+void calibrate_row_16bit_avx2(std::uint8_t* data, std::size_t count, const float* offset,
+                              const float* multiplier)
+{
+    const __m256 max_value_f = _mm256_set1_ps(65535.0f);
+    const __m256i max_value = _mm256_set1_epi32(65535);
+
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 2));
+        __m256i v = calibrate_8_avx2(_mm256_cvtepu16_epi32(in), offset + i, multiplier + i,
+                                     max_value_f, max_value);
+
+        __m128i out = _mm_packus_epi32(_mm256_castsi256_si128(v),
+                                       _mm256_extracti128_si256(v, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i * 2), out);
+    }
+    calibrate_row_16bit_scalar(data + i * 2, count - i, offset + i, multiplier + i);
+}
+
+#endif // GENESYS_CALIBRATE_X86
+
+#if GENESYS_CALIBRATE_NEON
+
+// vcvtaq_s32_f32 rounds halfway cases away from zero and saturates just like the scalar
+// conversion on aarch64.
+inline uint32x4_t calibrate_4_neon(uint32x4_t value, const float* offset, const float* multiplier,
+                                   float32x4_t max_value_f, int32x4_t max_value)
+{
+    float32x4_t x = vdivq_f32(vcvtq_f32_u32(value), max_value_f);
+    x = vmulq_f32(vsubq_f32(x, vld1q_f32(offset)), vld1q_f32(multiplier));
+    x = vmulq_f32(x, max_value_f);
+
+    int32x4_t t = vcvtaq_s32_f32(x);
+    t = vminq_s32(vmaxq_s32(t, vdupq_n_s32(0)), max_value);
+    return vreinterpretq_u32_s32(t);
+}
+
+void calibrate_row_8bit_neon(std::uint8_t* data, std::size_t count, const float* offset,
+                             const float* multiplier)
+{
+    const float32x4_t max_value_f = vdupq_n_f32(255.0f);
+    const int32x4_t max_value = vdupq_n_s32(255);
+
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint16x8_t in = vmovl_u8(vld1_u8(data + i));
+        uint32x4_t v0 = calibrate_4_neon(vmovl_u16(vget_low_u16(in)), offset + i,
+                                         multiplier + i, max_value_f, max_value);
+        uint32x4_t v1 = calibrate_4_neon(vmovl_u16(vget_high_u16(in)), offset + i + 4,
+                                         multiplier + i + 4, max_value_f, max_value);
+        uint16x8_t out = vcombine_u16(vmovn_u32(v0), vmovn_u32(v1));
+        vst1_u8(data + i, vmovn_u16(out));
+    }
+    calibrate_row_8bit_scalar(data + i, count - i, offset + i, multiplier + i);
+}
+
+void calibrate_row_16bit_neon(std::uint8_t* data, std::size_t count, const float* offset,
+                              const float* multiplier)
+{
+    const float32x4_t max_value_f = vdupq_n_f32(65535.0f);
+    const int32x4_t max_value = vdupq_n_s32(65535);
+
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint16x8_t in = vreinterpretq_u16_u8(vld1q_u8(data + i * 2));
+        uint32x4_t v0 = calibrate_4_neon(vmovl_u16(vget_low_u16(in)), offset + i,
+                                         multiplier + i, max_value_f, max_value);
+        uint32x4_t v1 = calibrate_4_neon(vmovl_u16(vget_high_u16(in)), offset + i + 4,
+                                         multiplier + i + 4, max_value_f, max_value);
+        uint16x8_t out = vcombine_u16(vmovn_u32(v0), vmovn_u32(v1));
+        vst1q_u8(data + i * 2, vreinterpretq_u8_u16(out));
+    }
+    calibrate_row_16bit_scalar(data + i * 2, count - i, offset + i, multiplier + i);
+}
+
+#endif // GENESYS_CALIBRATE_NEON
+
+SimdLevel detect_best_simd_level()
+{
+#if GENESYS_CALIBRATE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+    return SimdLevel::SSE2;
+#elif GENESYS_CALIBRATE_NEON
+    return SimdLevel::NEON;
+#else
+    return SimdLevel::NONE;
+#endif
+}
+
+} // namespace
+
+SimdLevel get_best_simd_level()
+{
+    static SimdLevel level = detect_best_simd_level();
+    return level;
+}
+
+std::vector<SimdLevel> get_supported_simd_levels()
+{
+    std::vector<SimdLevel> levels = { SimdLevel::NONE };
+    auto best = get_best_simd_level();
+    if (best == SimdLevel::AVX2) {
+        levels.push_back(SimdLevel::SSE2);
+    }
+    if (best != SimdLevel::NONE) {
+        levels.push_back(best);
+    }
+    return levels;
+}
+
+void calibrate_row_8bit(std::uint8_t* data, std::size_t count, const float* offset,
+                        const float* multiplier, SimdLevel level)
+{
+    switch (level) {
+        case SimdLevel::NONE:
+            calibrate_row_8bit_scalar(data, count, offset, multiplier);
+            return;
+#if GENESYS_CALIBRATE_X86
+        case SimdLevel::SSE2:
+            calibrate_row_8bit_sse2(data, count, offset, multiplier);
+            return;
+        case SimdLevel::AVX2:
+            calibrate_row_8bit_avx2(data, count, offset, multiplier);
+            return;
+#endif
+#if GENESYS_CALIBRATE_NEON
+        case SimdLevel::NEON:
+            calibrate_row_8bit_neon(data, count, offset, multiplier);
+            return;
+#endif
+        default:
+            throw SaneException("Unsupported simd level %d", static_cast<unsigned>(level));
+    }
+}
+
+void calibrate_row_16bit(std::uint8_t* data, std::size_t count, const float* offset,
+                         const float* multiplier, SimdLevel level)
+{
+    switch (level) {
+        case SimdLevel::NONE:
+            calibrate_row_16bit_scalar(data, count, offset, multiplier);
+            return;
+#if GENESYS_CALIBRATE_X86
+        case SimdLevel::SSE2:
+            calibrate_row_16bit_sse2(data, count, offset, multiplier);
+            return;
+        case SimdLevel::AVX2:
+            calibrate_row_16bit_avx2(data, count, offset, multiplier);
+            return;
+#endif
+#if GENESYS_CALIBRATE_NEON
+        case SimdLevel::NEON:
+            calibrate_row_16bit_neon(data, count, offset, multiplier);
+            return;
+#endif
+        default:
+            throw SaneException("Unsupported simd level %d", static_cast<unsigned>(level));
+    }
+}
+
+} // namespace genesys
@@ -0,0 +1,55 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BACKEND_GENESYS_IMAGE_CALIBRATE_H
+#define BACKEND_GENESYS_IMAGE_CALIBRATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace genesys {
+
+// The instruction sets that the shading calibration kernels can use
+enum class SimdLevel
+{
+    NONE,
+    SSE2,
+    AVX2,
+    NEON,
+};
+
+// Returns the best instruction set supported by the current CPU. The result is computed once.
+SimdLevel get_best_simd_level();
+
+// Returns all instruction sets that are supported both by the build and the current CPU. NONE is
+// always included.
+std::vector<SimdLevel> get_supported_simd_levels();
+
+// Applies shading calibration to count consecutive samples. Each sample i is transformed as
+// round(((value / max) - offset[i]) * multiplier[i] * max) and then clamped to [0, max], where max
+// is the maximum value of the sample. The results are bit-identical for all simd levels.
+// 16-bit samples are stored in little endian byte order, as in the image pipeline.
+void calibrate_row_8bit(std::uint8_t* data, std::size_t count, const float* offset,
+                        const float* multiplier, SimdLevel level);
+void calibrate_row_16bit(std::uint8_t* data, std::size_t count, const float* offset,
+                         const float* multiplier, SimdLevel level);
+
+} // namespace genesys
+
+#endif // BACKEND_GENESYS_IMAGE_CALIBRATE_H
@@ -23,13 +23,254 @@
 #include "image_pipeline.h"
 #include "image.h"
 #include "low.h"
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
+#include <iomanip>
 #include <numeric>
+#include <sstream>
+#include <typeinfo>
+
+#if defined(__GNUC__)
+#include <cxxabi.h>
+#endif
 
 namespace genesys {
 
 ImagePipelineNode::~ImagePipelineNode() {}
 
+bool ImagePipelineNode::get_next_rows_data(std::size_t count, std::uint8_t* out_data)
+{
+    bool got_data = true;
+    for (std::size_t i = 0; i < count; ++i) {
+        got_data &= get_next_row_data(out_data);
+        out_data += get_row_bytes();
+    }
+    return got_data;
+}
+
+namespace {
+
+// Returns the instantiation of Kernel<Format>::apply that corresponds to the given runtime pixel
+// format. The pipeline nodes resolve their kernels once at construction time, so that the row
+// loops are compiled for a single pixel format and don't dispatch on it for each pixel.
+template<template<PixelFormat> class Kernel>
+auto select_pixel_format_kernel(PixelFormat format) -> decltype(&Kernel<PixelFormat::I8>::apply)
+{
+    switch (format) {
+        case PixelFormat::I1: return &Kernel<PixelFormat::I1>::apply;
+        case PixelFormat::RGB111: return &Kernel<PixelFormat::RGB111>::apply;
+        case PixelFormat::I8: return &Kernel<PixelFormat::I8>::apply;
+        case PixelFormat::RGB888: return &Kernel<PixelFormat::RGB888>::apply;
+        case PixelFormat::BGR888: return &Kernel<PixelFormat::BGR888>::apply;
+        case PixelFormat::I16: return &Kernel<PixelFormat::I16>::apply;
+        case PixelFormat::RGB161616: return &Kernel<PixelFormat::RGB161616>::apply;
+        case PixelFormat::BGR161616: return &Kernel<PixelFormat::BGR161616>::apply;
+        default:
+            throw SaneException("Unknown pixel format %d", static_cast<unsigned>(format));
+    }
+}
+
+// Returns the single-channel format with the same depth as the given format. The raw layout of
+// the RGB and BGR variants is identical, so this is all that's needed to merge or split channels.
+constexpr PixelFormat get_mono_pixel_format(PixelFormat format)
+{
+    return (format == PixelFormat::RGB111) ? PixelFormat::I1 :
+           (format == PixelFormat::RGB888 || format == PixelFormat::BGR888) ? PixelFormat::I8 :
+           (format == PixelFormat::RGB161616 || format == PixelFormat::BGR161616) ?
+                PixelFormat::I16 : format;
+}
+
+constexpr PixelFormat get_color_pixel_format(PixelFormat format)
+{
+    return (format == PixelFormat::I1) ? PixelFormat::RGB111 :
+           (format == PixelFormat::I8) ? PixelFormat::RGB888 :
+           (format == PixelFormat::I16) ? PixelFormat::RGB161616 : format;
+}
+
+template<PixelFormat Format>
+struct DesegmentKernel
+{
+    static void apply(const std::uint8_t* in_data, std::uint8_t* out_data,
+                      std::size_t groups_count, const std::vector<unsigned>& segment_order,
+                      std::size_t segment_pixels, std::size_t pixels_per_chunk)
+    {
+        auto segment_count = segment_order.size();
+
+        for (std::size_t igroup = 0; igroup < groups_count; ++igroup) {
+            for (std::size_t isegment = 0; isegment < segment_count; ++isegment) {
+                auto input_offset = igroup * pixels_per_chunk;
+                input_offset += segment_pixels * segment_order[isegment];
+                auto output_offset = (igroup * segment_count + isegment) * pixels_per_chunk;
+
+                for (std::size_t ipixel = 0; ipixel < pixels_per_chunk; ++ipixel) {
+                    auto pixel = get_raw_pixel_from_row<Format>(in_data, input_offset + ipixel);
+                    set_raw_pixel_to_row<Format>(out_data, output_offset + ipixel, pixel);
+                }
+            }
+        }
+    }
+};
+
+// Format is the format of the mono input lines
+template<PixelFormat Format>
+struct MergeMonoLinesToColorKernel
+{
+    static void apply(const std::uint8_t* row0, const std::uint8_t* row1,
+                      const std::uint8_t* row2, std::uint8_t* out_data, std::size_t width)
+    {
+        constexpr PixelFormat OutFormat = get_color_pixel_format(Format);
+
+        for (std::size_t x = 0; x < width; ++x) {
+            std::uint16_t ch0 = get_raw_channel_from_row<Format>(row0, x, 0);
+            std::uint16_t ch1 = get_raw_channel_from_row<Format>(row1, x, 0);
+            std::uint16_t ch2 = get_raw_channel_from_row<Format>(row2, x, 0);
+            set_raw_channel_to_row<OutFormat>(out_data, x, 0, ch0);
+            set_raw_channel_to_row<OutFormat>(out_data, x, 1, ch1);
+            set_raw_channel_to_row<OutFormat>(out_data, x, 2, ch2);
+        }
+    }
+};
+
+// Format is the format of the color input line
+template<PixelFormat Format>
+struct MergeColorToGrayKernel
+{
+    static void apply(const std::uint8_t* in_data, std::uint8_t* out_data, std::size_t width,
+                      float ch0_mult, float ch1_mult, float ch2_mult)
+    {
+        constexpr PixelFormat OutFormat = get_mono_pixel_format(Format);
+
+        for (std::size_t x = 0; x < width; ++x) {
+            std::uint16_t ch0 = get_raw_channel_from_row<Format>(in_data, x, 0);
+            std::uint16_t ch1 = get_raw_channel_from_row<Format>(in_data, x, 1);
+            std::uint16_t ch2 = get_raw_channel_from_row<Format>(in_data, x, 2);
+            float mono = ch0 * ch0_mult + ch1 * ch1_mult + ch2 * ch2_mult;
+            set_raw_channel_to_row<OutFormat>(out_data, x, 0, static_cast<std::uint16_t>(mono));
+        }
+    }
+};
+
+template<PixelFormat Format>
+struct ComponentShiftLinesKernel
+{
+    static void apply(const std::uint8_t* row0, const std::uint8_t* row1,
+                      const std::uint8_t* row2, std::uint8_t* out_data, std::size_t width)
+    {
+        for (std::size_t x = 0; x < width; ++x) {
+            std::uint16_t ch0 = get_raw_channel_from_row<Format>(row0, x, 0);
+            std::uint16_t ch1 = get_raw_channel_from_row<Format>(row1, x, 1);
+            std::uint16_t ch2 = get_raw_channel_from_row<Format>(row2, x, 2);
+            set_raw_channel_to_row<Format>(out_data, x, 0, ch0);
+            set_raw_channel_to_row<Format>(out_data, x, 1, ch1);
+            set_raw_channel_to_row<Format>(out_data, x, 2, ch2);
+        }
+    }
+};
+
+template<PixelFormat Format>
+struct PixelShiftLinesKernel
+{
+    static void apply(const std::vector<std::uint8_t*>& rows, std::uint8_t* out_data,
+                      std::size_t width)
+    {
+        auto shift_count = rows.size();
+
+        for (std::size_t x = 0; x < width;) {
+            for (std::size_t irow = 0; irow < shift_count && x < width; irow++, x++) {
+                RawPixel pixel = get_raw_pixel_from_row<Format>(rows[irow], x);
+                set_raw_pixel_to_row<Format>(out_data, x, pixel);
+            }
+        }
+    }
+};
+
+template<PixelFormat Format>
+struct PixelShiftColumnsKernel
+{
+    static void apply(const std::uint8_t* in_data, std::uint8_t* out_data, std::size_t width,
+                      const std::vector<std::size_t>& shifts)
+    {
+        auto shift_count = shifts.size();
+
+        for (std::size_t x = 0; x < width; x += shift_count) {
+            for (std::size_t ishift = 0; ishift < shift_count && x + ishift < width; ishift++) {
+                RawPixel pixel = get_raw_pixel_from_row<Format>(in_data, x + shifts[ishift]);
+                set_raw_pixel_to_row<Format>(out_data, x + ishift, pixel);
+            }
+        }
+    }
+};
+
+template<PixelFormat Format>
+struct ScaleRowsKernel
+{
+    static void apply(const std::uint8_t* src_data, std::uint8_t* out_data,
+                      std::size_t src_width, std::size_t dst_width, unsigned channels)
+    {
+        if (src_width > dst_width) {
+            // average
+            std::uint32_t counter = src_width / 2;
+            unsigned src_x = 0;
+            for (unsigned dst_x = 0; dst_x < dst_width; dst_x++) {
+                unsigned avg[3] = {0, 0, 0};
+                unsigned count = 0;
+                while (counter < src_width && src_x < src_width) {
+                    counter += dst_width;
+
+                    for (unsigned c = 0; c < channels; c++) {
+                        avg[c] += get_raw_channel_from_row<Format>(src_data, src_x, c);
+                    }
+
+                    src_x++;
+                    count++;
+                }
+                counter -= src_width;
+
+                for (unsigned c = 0; c < channels; c++) {
+                    set_raw_channel_to_row<Format>(out_data, dst_x, c, avg[c] / count);
+                }
+            }
+        } else {
+            // interpolate and copy pixels
+            std::uint32_t counter = dst_width / 2;
+            unsigned dst_x = 0;
+
+            for (unsigned src_x = 0; src_x < src_width; src_x++) {
+                unsigned avg[3] = {0, 0, 0};
+                for (unsigned c = 0; c < channels; c++) {
+                    avg[c] += get_raw_channel_from_row<Format>(src_data, src_x, c);
+                }
+                while ((counter < dst_width || src_x + 1 == src_width) && dst_x < dst_width) {
+                    counter += src_width;
+
+                    for (unsigned c = 0; c < channels; c++) {
+                        set_raw_channel_to_row<Format>(out_data, dst_x, c, avg[c]);
+                    }
+                    dst_x++;
+                }
+                counter -= dst_width;
+            }
+        }
+    }
+};
+
+} // namespace
+
+bool ImagePipelineRowTransformNode::get_next_row_data(std::uint8_t* out_data)
+{
+    if (supports_in_place_transform()) {
+        bool got_data = source_.get_next_row_data(out_data);
+        transform_row(out_data, out_data);
+        return got_data;
+    }
+
+    buffer_.resize(source_.get_row_bytes());
+    bool got_data = source_.get_next_row_data(buffer_.data());
+    transform_row(buffer_.data(), out_data);
+    return got_data;
+}
+
 bool ImagePipelineNodeCallableSource::get_next_row_data(std::uint8_t* out_data)
 {
     bool got_data = producer_(get_row_bytes(), out_data);
@@ -40,13 +281,18 @@ bool ImagePipelineNodeCallableSource::get_next_row_data(std::uint8_t* out_data)
 
 ImagePipelineNodeBufferedCallableSource::ImagePipelineNodeBufferedCallableSource(
         std::size_t width, std::size_t height, PixelFormat format, std::size_t input_batch_size,
-        ProducerCallback producer) :
+        ProducerCallback producer, std::size_t prefetch_count) :
     width_{width},
     height_{height},
-    format_{format},
-    buffer_{input_batch_size, producer}
+    format_{format}
 {
-    buffer_.set_remaining_size(height_ * get_row_bytes());
+    if (prefetch_count > 0) {
+        prefetch_buffer_.reset(new PrefetchImageBuffer{input_batch_size, prefetch_count,
+                                                       producer});
+    } else {
+        buffer_ = ImageBuffer{input_batch_size, producer};
+    }
+    set_remaining_bytes(height_ * get_row_bytes());
 }
 
 bool ImagePipelineNodeBufferedCallableSource::get_next_row_data(std::uint8_t* out_data)
@@ -60,7 +306,11 @@ bool ImagePipelineNodeBufferedCallableSource::get_next_row_data(std::uint8_t* ou
 
     bool got_data = true;
 
-    got_data &= buffer_.get_data(get_row_bytes(), out_data);
+    if (prefetch_buffer_) {
+        got_data &= prefetch_buffer_->get_data(get_row_bytes(), out_data);
+    } else {
+        got_data &= buffer_.get_data(get_row_bytes(), out_data);
+    }
     curr_row_++;
     if (!got_data) {
         eof_ = true;
@@ -68,6 +318,47 @@ bool ImagePipelineNodeBufferedCallableSource::get_next_row_data(std::uint8_t* ou
     return got_data;
 }
 
+std::size_t ImagePipelineNodeBufferedCallableSource::get_buffered_bytes() const
+{
+    if (prefetch_buffer_) {
+        return prefetch_buffer_->buffered_size();
+    }
+    return buffer_.available();
+}
+
+std::size_t ImagePipelineNodeBufferedCallableSource::remaining_bytes() const
+{
+    if (prefetch_buffer_) {
+        return prefetch_buffer_->remaining_size();
+    }
+    return buffer_.remaining_size();
+}
+
+void ImagePipelineNodeBufferedCallableSource::set_remaining_bytes(std::size_t bytes)
+{
+    if (prefetch_buffer_) {
+        prefetch_buffer_->set_remaining_size(bytes);
+    } else {
+        buffer_.set_remaining_size(bytes);
+    }
+}
+
+void ImagePipelineNodeBufferedCallableSource::set_last_read_multiple(std::size_t bytes)
+{
+    if (prefetch_buffer_) {
+        prefetch_buffer_->set_last_read_multiple(bytes);
+    } else {
+        buffer_.set_last_read_multiple(bytes);
+    }
+}
+
+void ImagePipelineNodeBufferedCallableSource::stop_prefetch()
+{
+    if (prefetch_buffer_) {
+        prefetch_buffer_->stop();
+    }
+}
+
 ImagePipelineNodeArraySource::ImagePipelineNodeArraySource(std::size_t width, std::size_t height,
                                                            PixelFormat format,
                                                            std::vector<std::uint8_t> data) :
@@ -113,19 +404,18 @@ bool ImagePipelineNodeImageSource::get_next_row_data(std::uint8_t* out_data)
     return true;
 }
 
-bool ImagePipelineNodeFormatConvert::get_next_row_data(std::uint8_t* out_data)
+void ImagePipelineNodeFormatConvert::transform_row(const std::uint8_t* in_data,
+                                                   std::uint8_t* out_data) const
 {
     auto src_format = source_.get_format();
     if (src_format == dst_format_) {
-        return source_.get_next_row_data(out_data);
+        if (in_data != out_data) {
+            std::memcpy(out_data, in_data, get_row_bytes());
+        }
+        return;
     }
 
-    buffer_.clear();
-    buffer_.resize(source_.get_row_bytes());
-    bool got_data = source_.get_next_row_data(buffer_.data());
-
-    convert_pixel_row_format(buffer_.data(), src_format, out_data, dst_format_, get_width());
-    return got_data;
+    convert_pixel_row_format(in_data, src_format, out_data, dst_format_, get_width());
 }
 
 ImagePipelineNodeDesegment::ImagePipelineNodeDesegment(ImagePipelineNode& source,
@@ -150,6 +440,7 @@ ImagePipelineNodeDesegment::ImagePipelineNodeDesegment(ImagePipelineNode& source
         throw SaneException("Height is not a multiple of the number of lines to interelave %zu/%zu",
                             source_.get_height(), interleaved_lines_);
     }
+    row_func_ = select_pixel_format_kernel<DesegmentKernel>(get_format());
 }
 
 ImagePipelineNodeDesegment::ImagePipelineNodeDesegment(ImagePipelineNode& source,
@@ -171,6 +462,7 @@ ImagePipelineNodeDesegment::ImagePipelineNodeDesegment(ImagePipelineNode& source
 
     segment_order_.resize(segment_count);
     std::iota(segment_order_.begin(), segment_order_.end(), 0);
+    row_func_ = select_pixel_format_kernel<DesegmentKernel>(get_format());
 }
 
 bool ImagePipelineNodeDesegment::get_next_row_data(std::uint8_t* out_data)
@@ -186,25 +478,12 @@ bool ImagePipelineNodeDesegment::get_next_row_data(std::uint8_t* out_data)
         throw SaneException("Buffer is not linear");
     }
 
-    auto format = get_format();
-    auto segment_count = segment_order_.size();
-
     const std::uint8_t* in_data = buffer_.get_row_ptr(0);
 
     std::size_t groups_count = output_width_ / (segment_order_.size() * pixels_per_chunk_);
 
-    for (std::size_t igroup = 0; igroup < groups_count; ++igroup) {
-        for (std::size_t isegment = 0; isegment < segment_count; ++isegment) {
-            auto input_offset = igroup * pixels_per_chunk_;
-            input_offset += segment_pixels_ * segment_order_[isegment];
-            auto output_offset = (igroup * segment_count + isegment) * pixels_per_chunk_;
-
-            for (std::size_t ipixel = 0; ipixel < pixels_per_chunk_; ++ipixel) {
-                auto pixel = get_raw_pixel_from_row(in_data, input_offset + ipixel, format);
-                set_raw_pixel_to_row(out_data, output_offset + ipixel, pixel, format);
-            }
-        }
-    }
+    row_func_(in_data, out_data, groups_count, segment_order_, segment_pixels_,
+              pixels_per_chunk_);
     return got_data;
 }
 
@@ -216,7 +495,7 @@ ImagePipelineNodeDeinterleaveLines::ImagePipelineNodeDeinterleaveLines(
 {}
 
 ImagePipelineNodeSwap16BitEndian::ImagePipelineNodeSwap16BitEndian(ImagePipelineNode& source) :
-    source_(source),
+    ImagePipelineRowTransformNode(source),
     needs_swapping_{false}
 {
     if (get_pixel_format_depth(source_.get_format()) == 16) {
@@ -226,61 +505,63 @@ ImagePipelineNodeSwap16BitEndian::ImagePipelineNodeSwap16BitEndian(ImagePipeline
     }
 }
 
-bool ImagePipelineNodeSwap16BitEndian::get_next_row_data(std::uint8_t* out_data)
+void ImagePipelineNodeSwap16BitEndian::transform_row(const std::uint8_t* in_data,
+                                                     std::uint8_t* out_data) const
 {
-    bool got_data = source_.get_next_row_data(out_data);
-    if (needs_swapping_) {
-        std::size_t pixels = get_row_bytes() / 2;
-        for (std::size_t i = 0; i < pixels; ++i) {
-            std::swap(*out_data, *(out_data + 1));
-            out_data += 2;
+    if (!needs_swapping_) {
+        if (in_data != out_data) {
+            std::memcpy(out_data, in_data, get_row_bytes());
         }
+        return;
+    }
+
+    std::size_t pixels = get_row_bytes() / 2;
+    for (std::size_t i = 0; i < pixels; ++i) {
+        std::uint8_t first = in_data[0];
+        std::uint8_t second = in_data[1];
+        out_data[0] = second;
+        out_data[1] = first;
+        in_data += 2;
+        out_data += 2;
     }
-    return got_data;
 }
 
 ImagePipelineNodeInvert::ImagePipelineNodeInvert(ImagePipelineNode& source) :
-    source_(source)
+    ImagePipelineRowTransformNode(source)
 {
 }
 
-bool ImagePipelineNodeInvert::get_next_row_data(std::uint8_t* out_data)
+void ImagePipelineNodeInvert::transform_row(const std::uint8_t* in_data,
+                                            std::uint8_t* out_data) const
 {
-    bool got_data = source_.get_next_row_data(out_data);
     auto num_values = get_width() * get_pixel_channels(source_.get_format());
     auto depth = get_pixel_format_depth(source_.get_format());
 
     switch (depth) {
         case 16: {
-            auto* data = reinterpret_cast<std::uint16_t*>(out_data);
+            const auto* src = reinterpret_cast<const std::uint16_t*>(in_data);
+            auto* dst = reinterpret_cast<std::uint16_t*>(out_data);
             for (std::size_t i = 0; i < num_values; ++i) {
-                *data = 0xffff - *data;
-                data++;
+                *dst++ = 0xffff - *src++;
             }
             break;
         }
         case 8: {
-            auto* data = out_data;
             for (std::size_t i = 0; i < num_values; ++i) {
-                *data = 0xff - *data;
-                data++;
+                *out_data++ = 0xff - *in_data++;
             }
             break;
         }
         case 1: {
-            auto* data = out_data;
             auto num_bytes = (num_values + 7) / 8;
             for (std::size_t i = 0; i < num_bytes; ++i) {
-                *data = ~*data;
-                data++;
+                *out_data++ = ~*in_data++;
             }
             break;
         }
         default:
             throw SaneException("Unsupported pixel depth");
     }
-
-    return got_data;
 }
 
 ImagePipelineNodeMergeMonoLinesToColor::ImagePipelineNodeMergeMonoLinesToColor(
@@ -291,6 +572,7 @@ ImagePipelineNodeMergeMonoLinesToColor::ImagePipelineNodeMergeMonoLinesToColor(
     DBG_HELPER_ARGS(dbg, "color_order %d", static_cast<unsigned>(color_order));
 
     output_format_ = get_output_format(source_.get_format(), color_order);
+    row_func_ = select_pixel_format_kernel<MergeMonoLinesToColorKernel>(source_.get_format());
 }
 
 bool ImagePipelineNodeMergeMonoLinesToColor::get_next_row_data(std::uint8_t* out_data)
@@ -307,16 +589,7 @@ bool ImagePipelineNodeMergeMonoLinesToColor::get_next_row_data(std::uint8_t* out
     const auto* row1 = buffer_.get_row_ptr(1);
     const auto* row2 = buffer_.get_row_ptr(2);
 
-    auto format = source_.get_format();
-
-    for (std::size_t x = 0, width = get_width(); x < width; ++x) {
-        std::uint16_t ch0 = get_raw_channel_from_row(row0, x, 0, format);
-        std::uint16_t ch1 = get_raw_channel_from_row(row1, x, 0, format);
-        std::uint16_t ch2 = get_raw_channel_from_row(row2, x, 0, format);
-        set_raw_channel_to_row(out_data, x, 0, ch0, output_format_);
-        set_raw_channel_to_row(out_data, x, 1, ch1, output_format_);
-        set_raw_channel_to_row(out_data, x, 2, ch2, output_format_);
-    }
+    row_func_(row0, row1, row2, out_data, get_width());
     return got_data;
 }
 
@@ -398,7 +671,7 @@ PixelFormat ImagePipelineNodeSplitMonoLines::get_output_format(PixelFormat input
 
 
 ImagePipelineNodeMergeColorToGray::ImagePipelineNodeMergeColorToGray(ImagePipelineNode& source) :
-    source_(source)
+    ImagePipelineRowTransformNode(source)
 {
 
     output_format_ = get_output_format(source_.get_format());
@@ -428,25 +701,13 @@ ImagePipelineNodeMergeColorToGray::ImagePipelineNodeMergeColorToGray(ImagePipeli
         default:
             throw SaneException("Unknown color order");
     }
-    temp_buffer_.resize(source_.get_row_bytes());
+    row_func_ = select_pixel_format_kernel<MergeColorToGrayKernel>(source_.get_format());
 }
 
-bool ImagePipelineNodeMergeColorToGray::get_next_row_data(std::uint8_t* out_data)
+void ImagePipelineNodeMergeColorToGray::transform_row(const std::uint8_t* in_data,
+                                                      std::uint8_t* out_data) const
 {
-    auto* src_data = temp_buffer_.data();
-
-    bool got_data = source_.get_next_row_data(src_data);
-
-    auto src_format = source_.get_format();
-
-    for (std::size_t x = 0, width = get_width(); x < width; ++x) {
-        std::uint16_t ch0 = get_raw_channel_from_row(src_data, x, 0, src_format);
-        std::uint16_t ch1 = get_raw_channel_from_row(src_data, x, 1, src_format);
-        std::uint16_t ch2 = get_raw_channel_from_row(src_data, x, 2, src_format);
-        float mono = ch0 * ch0_mult_ + ch1 * ch1_mult_ + ch2 * ch2_mult_;
-        set_raw_channel_to_row(out_data, x, 0, static_cast<std::uint16_t>(mono), output_format_);
-    }
-    return got_data;
+    row_func_(in_data, out_data, get_width(), ch0_mult_, ch1_mult_, ch2_mult_);
 }
 
 PixelFormat ImagePipelineNodeMergeColorToGray::get_output_format(PixelFormat input_format)
@@ -495,6 +756,7 @@ ImagePipelineNodeComponentShiftLines::ImagePipelineNodeComponentShiftLines(
     } else {
         height_ -= extra_height_;
     }
+    row_func_ = select_pixel_format_kernel<ComponentShiftLinesKernel>(get_format());
 }
 
 bool ImagePipelineNodeComponentShiftLines::get_next_row_data(std::uint8_t* out_data)
@@ -509,19 +771,11 @@ bool ImagePipelineNodeComponentShiftLines::get_next_row_data(std::uint8_t* out_d
         got_data &= source_.get_next_row_data(buffer_.get_back_row_ptr());
     }
 
-    auto format = get_format();
     const auto* row0 = buffer_.get_row_ptr(channel_shifts_[0]);
     const auto* row1 = buffer_.get_row_ptr(channel_shifts_[1]);
     const auto* row2 = buffer_.get_row_ptr(channel_shifts_[2]);
 
-    for (std::size_t x = 0, width = get_width(); x < width; ++x) {
-        std::uint16_t ch0 = get_raw_channel_from_row(row0, x, 0, format);
-        std::uint16_t ch1 = get_raw_channel_from_row(row1, x, 1, format);
-        std::uint16_t ch2 = get_raw_channel_from_row(row2, x, 2, format);
-        set_raw_channel_to_row(out_data, x, 0, ch0, format);
-        set_raw_channel_to_row(out_data, x, 1, ch1, format);
-        set_raw_channel_to_row(out_data, x, 2, ch2, format);
-    }
+    row_func_(row0, row1, row2, out_data, get_width());
     return got_data;
 }
 
@@ -538,6 +792,7 @@ ImagePipelineNodePixelShiftLines::ImagePipelineNodePixelShiftLines(
     } else {
         height_ -= extra_height_;
     }
+    row_func_ = select_pixel_format_kernel<PixelShiftLinesKernel>(get_format());
 }
 
 bool ImagePipelineNodePixelShiftLines::get_next_row_data(std::uint8_t* out_data)
@@ -552,7 +807,6 @@ bool ImagePipelineNodePixelShiftLines::get_next_row_data(std::uint8_t* out_data)
         got_data &= source_.get_next_row_data(buffer_.get_back_row_ptr());
     }
 
-    auto format = get_format();
     auto shift_count = pixel_shifts_.size();
 
     std::vector<std::uint8_t*> rows;
@@ -562,18 +816,13 @@ bool ImagePipelineNodePixelShiftLines::get_next_row_data(std::uint8_t* out_data)
         rows[irow] = buffer_.get_row_ptr(pixel_shifts_[irow]);
     }
 
-    for (std::size_t x = 0, width = get_width(); x < width;) {
-        for (std::size_t irow = 0; irow < shift_count && x < width; irow++, x++) {
-            RawPixel pixel = get_raw_pixel_from_row(rows[irow], x, format);
-            set_raw_pixel_to_row(out_data, x, pixel, format);
-        }
-    }
+    row_func_(rows, out_data, get_width());
     return got_data;
 }
 
 ImagePipelineNodePixelShiftColumns::ImagePipelineNodePixelShiftColumns(
         ImagePipelineNode& source, const std::vector<std::size_t>& shifts) :
-    source_(source),
+    ImagePipelineRowTransformNode(source),
     pixel_shifts_{shifts}
 {
     width_ = source_.get_width();
@@ -583,27 +832,16 @@ ImagePipelineNodePixelShiftColumns::ImagePipelineNodePixelShiftColumns(
     } else {
         width_ -= extra_width_;
     }
-    temp_buffer_.resize(source_.get_row_bytes());
+    row_func_ = select_pixel_format_kernel<PixelShiftColumnsKernel>(get_format());
 }
 
-bool ImagePipelineNodePixelShiftColumns::get_next_row_data(std::uint8_t* out_data)
+void ImagePipelineNodePixelShiftColumns::transform_row(const std::uint8_t* in_data,
+                                                       std::uint8_t* out_data) const
 {
     if (width_ == 0) {
         throw SaneException("Attempt to read zero-width line");
     }
-    bool got_data = source_.get_next_row_data(temp_buffer_.data());
-
-    auto format = get_format();
-    auto shift_count = pixel_shifts_.size();
-
-    for (std::size_t x = 0, width = get_width(); x < width; x += shift_count) {
-        for (std::size_t ishift = 0; ishift < shift_count && x + ishift < width; ishift++) {
-            RawPixel pixel = get_raw_pixel_from_row(temp_buffer_.data(), x + pixel_shifts_[ishift],
-                                                    format);
-            set_raw_pixel_to_row(out_data, x + ishift, pixel, format);
-        }
-    }
-    return got_data;
+    row_func_(in_data, out_data, get_width(), pixel_shifts_);
 }
 
 
@@ -644,68 +882,16 @@ ImagePipelineNodeExtract::~ImagePipelineNodeExtract() {}
 
 ImagePipelineNodeScaleRows::ImagePipelineNodeScaleRows(ImagePipelineNode& source,
                                                        std::size_t width) :
-    source_(source),
+    ImagePipelineRowTransformNode(source),
     width_{width}
 {
-    cached_line_.resize(source_.get_row_bytes());
+    row_func_ = select_pixel_format_kernel<ScaleRowsKernel>(get_format());
 }
 
-bool ImagePipelineNodeScaleRows::get_next_row_data(std::uint8_t* out_data)
+void ImagePipelineNodeScaleRows::transform_row(const std::uint8_t* in_data,
+                                               std::uint8_t* out_data) const
 {
-    auto src_width = source_.get_width();
-    auto dst_width = width_;
-
-    bool got_data = source_.get_next_row_data(cached_line_.data());
-
-    const auto* src_data = cached_line_.data();
-    auto format = get_format();
-    auto channels = get_pixel_channels(format);
-
-    if (src_width > dst_width) {
-        // average
-        std::uint32_t counter = src_width / 2;
-        unsigned src_x = 0;
-        for (unsigned dst_x = 0; dst_x < dst_width; dst_x++) {
-            unsigned avg[3] = {0, 0, 0};
-            unsigned count = 0;
-            while (counter < src_width && src_x < src_width) {
-                counter += dst_width;
-
-                for (unsigned c = 0; c < channels; c++) {
-                    avg[c] += get_raw_channel_from_row(src_data, src_x, c, format);
-                }
-
-                src_x++;
-                count++;
-            }
-            counter -= src_width;
-
-            for (unsigned c = 0; c < channels; c++) {
-                set_raw_channel_to_row(out_data, dst_x, c, avg[c] / count, format);
-            }
-        }
-    } else {
-        // interpolate and copy pixels
-        std::uint32_t counter = dst_width / 2;
-        unsigned dst_x = 0;
-
-        for (unsigned src_x = 0; src_x < src_width; src_x++) {
-            unsigned avg[3] = {0, 0, 0};
-            for (unsigned c = 0; c < channels; c++) {
-                avg[c] += get_raw_channel_from_row(src_data, src_x, c, format);
-            }
-            while ((counter < dst_width || src_x + 1 == src_width) && dst_x < dst_width) {
-                counter += src_width;
-
-                for (unsigned c = 0; c < channels; c++) {
-                    set_raw_channel_to_row(out_data, dst_x, c, avg[c], format);
-                }
-                dst_x++;
-            }
-            counter -= dst_width;
-        }
-    }
-    return got_data;
+    row_func_(in_data, out_data, source_.get_width(), width_, get_pixel_channels(get_format()));
 }
 
 bool ImagePipelineNodeExtract::get_next_row_data(std::uint8_t* out_data)
@@ -760,7 +946,7 @@ ImagePipelineNodeCalibrate::ImagePipelineNodeCalibrate(ImagePipelineNode& source
                                                        const std::vector<std::uint16_t>& bottom,
                                                        const std::vector<std::uint16_t>& top,
                                                        std::size_t x_start) :
-    source_(source)
+    ImagePipelineRowTransformNode(source)
 {
     std::size_t size = 0;
     if (bottom.size() >= x_start && top.size() >= x_start) {
@@ -774,40 +960,32 @@ ImagePipelineNodeCalibrate::ImagePipelineNodeCalibrate(ImagePipelineNode& source
         offset_.push_back(bottom[i + x_start] / 65535.0f);
         multiplier_.push_back(65535.0f / (top[i + x_start] - bottom[i + x_start]));
     }
+    simd_level_ = get_best_simd_level();
 }
 
-bool ImagePipelineNodeCalibrate::get_next_row_data(std::uint8_t* out_data)
+void ImagePipelineNodeCalibrate::transform_row(const std::uint8_t* in_data,
+                                               std::uint8_t* out_data) const
 {
-    bool ret = source_.get_next_row_data(out_data);
+    if (in_data != out_data) {
+        std::memcpy(out_data, in_data, get_row_bytes());
+    }
 
     auto format = get_format();
     auto depth = get_pixel_format_depth(format);
-    std::size_t max_value = 1;
+
+    // calibration data is specified for each sample regardless of the channel it belongs to
+    std::size_t count = std::min(get_width() * get_pixel_channels(format), offset_.size());
+
     switch (depth) {
-        case 8: max_value = 255; break;
-        case 16: max_value = 65535; break;
+        case 8:
+            calibrate_row_8bit(out_data, count, offset_.data(), multiplier_.data(), simd_level_);
+            break;
+        case 16:
+            calibrate_row_16bit(out_data, count, offset_.data(), multiplier_.data(), simd_level_);
+            break;
         default:
             throw SaneException("Unsupported depth for calibration %d", depth);
     }
-    unsigned channels = get_pixel_channels(format);
-
-    std::size_t max_calib_i = offset_.size();
-    std::size_t curr_calib_i = 0;
-
-    for (std::size_t x = 0, width = get_width(); x < width && curr_calib_i < max_calib_i; ++x) {
-        for (unsigned ch = 0; ch < channels && curr_calib_i < max_calib_i; ++ch) {
-            std::int32_t value = get_raw_channel_from_row(out_data, x, ch, format);
-
-            float value_f = static_cast<float>(value) / max_value;
-            value_f = (value_f - offset_[curr_calib_i]) * multiplier_[curr_calib_i];
-            value_f = std::round(value_f * max_value);
-            value = clamp<std::int32_t>(static_cast<std::int32_t>(value_f), 0, max_value);
-            set_raw_channel_to_row(out_data, x, ch, value, format);
-
-            curr_calib_i++;
-        }
-    }
-    return ret;
 }
 
 ImagePipelineNodeDebug::ImagePipelineNodeDebug(ImagePipelineNode& source,
@@ -839,6 +1017,293 @@ bool ImagePipelineNodeDebug::get_next_row_data(std::uint8_t* out_data)
     return got_data;
 }
 
+ImagePipelineNodeFusedRows::ImagePipelineNodeFusedRows(ImagePipelineNode& source,
+                                                       ThreadPool* pool) :
+    source_(source),
+    input_(find_input(source)),
+    pool_(pool)
+{
+    // The batches are sized so that each task processes roughly this amount of data, which keeps
+    // the synchronization overhead low even for narrow rows.
+    const std::size_t TASK_BYTES = 256 * 1024;
+
+    ImagePipelineNode* node = &source_;
+    while (node != &input_) {
+        auto* transform = static_cast<const ImagePipelineRowTransformNode*>(node);
+        transforms_.push_back(transform);
+        max_row_bytes_ = std::max(max_row_bytes_, transform->get_row_bytes());
+        node = &transform->get_source();
+    }
+    std::reverse(transforms_.begin(), transforms_.end());
+
+    last_copy_index_ = transforms_.size();
+    for (std::size_t i = 0; i < transforms_.size(); ++i) {
+        if (!transforms_[i]->supports_in_place_transform()) {
+            last_copy_index_ = i;
+        }
+    }
+
+    input_row_bytes_ = input_.get_row_bytes();
+    output_row_bytes_ = source_.get_row_bytes();
+    max_row_bytes_ = std::max(std::max(max_row_bytes_, input_row_bytes_), std::size_t{1});
+
+    unsigned thread_count = pool_ ? pool_->thread_count() : 1;
+    if (pool_ && thread_count > 1) {
+        rows_per_task_ = std::max<std::size_t>(TASK_BYTES / max_row_bytes_, 1);
+        max_batch_rows_ = rows_per_task_ * thread_count;
+        output_data_.resize(output_row_bytes_ * max_batch_rows_);
+        got_data_.resize(max_batch_rows_);
+    } else {
+        pool_ = nullptr;
+        rows_per_task_ = 1;
+        max_batch_rows_ = 1;
+    }
+
+    input_data_.resize(input_row_bytes_ * max_batch_rows_);
+    // each task alternates between two intermediate rows
+    temp_data_.resize(max_row_bytes_ * 2 * thread_count);
+}
+
+ImagePipelineNode& ImagePipelineNodeFusedRows::find_input(ImagePipelineNode& source)
+{
+    auto* transform = dynamic_cast<ImagePipelineRowTransformNode*>(&source);
+    if (transform == nullptr) {
+        throw SaneException("The source of fused rows node must be a row transform node");
+    }
+    while (true) {
+        auto& next = transform->get_source();
+        auto* next_transform = dynamic_cast<ImagePipelineRowTransformNode*>(&next);
+        if (next_transform == nullptr) {
+            return next;
+        }
+        transform = next_transform;
+    }
+}
+
+bool ImagePipelineNodeFusedRows::get_next_row_data(std::uint8_t* out_data)
+{
+    if (pool_ == nullptr) {
+        auto* read_data = get_read_buffer(out_data, input_data_.data());
+        bool got_data = input_.get_next_row_data(read_data);
+        transform_row(read_data, out_data, temp_data_.data());
+        return got_data;
+    }
+
+    if (next_row_ == batch_rows_) {
+        process_next_batch();
+    }
+
+    std::memcpy(out_data, output_data_.data() + next_row_ * output_row_bytes_, output_row_bytes_);
+    return got_data_[next_row_++];
+}
+
+std::uint8_t* ImagePipelineNodeFusedRows::get_read_buffer(std::uint8_t* out_data,
+                                                          std::uint8_t* in_data) const
+{
+    // if all transforms are applied in place, the output buffer is used for all of them
+    if (last_copy_index_ == transforms_.size()) {
+        return out_data;
+    }
+    return in_data;
+}
+
+void ImagePipelineNodeFusedRows::transform_row(std::uint8_t* in_data, std::uint8_t* out_data,
+                                               std::uint8_t* temp_data) const
+{
+    std::uint8_t* temp_rows[2] = { temp_data, temp_data + max_row_bytes_ };
+    unsigned next_temp_row = 0;
+
+    std::uint8_t* curr_data = in_data;
+    for (std::size_t i = 0; i < transforms_.size(); ++i) {
+        const auto* transform = transforms_[i];
+        if (i != last_copy_index_ && transform->supports_in_place_transform()) {
+            transform->transform_row(curr_data, curr_data);
+            continue;
+        }
+
+        std::uint8_t* dst_data = out_data;
+        if (i != last_copy_index_) {
+            dst_data = temp_rows[next_temp_row];
+            next_temp_row ^= 1;
+        }
+        transform->transform_row(curr_data, dst_data);
+        curr_data = dst_data;
+    }
+}
+
+bool ImagePipelineNodeFusedRows::get_next_rows_data(std::size_t count, std::uint8_t* out_data)
+{
+    bool got_data = true;
+
+    // the rows left from a batch that get_next_row_data() has started come first
+    while (count > 0 && (pool_ == nullptr || next_row_ < batch_rows_)) {
+        got_data &= get_next_row_data(out_data);
+        out_data += output_row_bytes_;
+        count--;
+    }
+
+    while (count > 0) {
+        std::size_t rows = get_batch_size(std::min(count, max_batch_rows_));
+        process_rows(rows, out_data);
+        for (std::size_t i = 0; i < rows; ++i) {
+            got_data &= got_data_[i];
+        }
+        out_data += rows * output_row_bytes_;
+        count -= rows;
+    }
+    return got_data;
+}
+
+std::size_t ImagePipelineNodeFusedRows::get_batch_size(std::size_t max_rows) const
+{
+    // The input is read sequentially. Rows past the height of the image are read one by one in
+    // order to not read more data than the caller has requested.
+    std::size_t height = input_.get_height();
+    if (rows_read_ >= height) {
+        return 1;
+    }
+    return std::min(max_rows, height - rows_read_);
+}
+
+void ImagePipelineNodeFusedRows::process_rows(std::size_t count, std::uint8_t* out_data)
+{
+    for (std::size_t i = 0; i < count; ++i) {
+        auto* read_data = get_read_buffer(out_data + i * output_row_bytes_,
+                                          input_data_.data() + i * input_row_bytes_);
+        got_data_[i] = input_.get_next_row_data(read_data);
+    }
+    rows_read_ += count;
+
+    std::size_t task_count = (count + rows_per_task_ - 1) / rows_per_task_;
+    pool_->parallel_for(task_count, [&](std::size_t task)
+    {
+        std::size_t first_row = task * rows_per_task_;
+        std::size_t end_row = std::min(first_row + rows_per_task_, count);
+        auto* temp_data = temp_data_.data() + task * max_row_bytes_ * 2;
+
+        for (std::size_t row = first_row; row < end_row; ++row) {
+            auto* row_out_data = out_data + row * output_row_bytes_;
+            auto* in_data = input_data_.data() + row * input_row_bytes_;
+            auto* read_data = get_read_buffer(row_out_data, in_data);
+            transform_row(read_data, row_out_data, temp_data);
+        }
+    });
+}
+
+void ImagePipelineNodeFusedRows::process_next_batch()
+{
+    batch_rows_ = get_batch_size(max_batch_rows_);
+    process_rows(batch_rows_, output_data_.data());
+    next_row_ = 0;
+}
+
+static std::string get_node_type_name(const ImagePipelineNode& node)
+{
+    std::string name = typeid(node).name();
+#if defined(__GNUC__)
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status);
+    if (demangled) {
+        name = demangled;
+        std::free(demangled);
+    }
+#endif
+    const std::string prefix = "genesys::ImagePipelineNode";
+    if (name.compare(0, prefix.size(), prefix) == 0) {
+        name = name.substr(prefix.size());
+    }
+    return name;
+}
+
+static std::string get_node_name(const ImagePipelineNode& node)
+{
+    std::string name = get_node_type_name(node);
+
+    if (const auto* fused = dynamic_cast<const ImagePipelineNodeFusedRows*>(&node)) {
+        name += "(";
+        for (std::size_t i = 0; i < fused->get_transform_count(); ++i) {
+            if (i != 0) {
+                name += ",";
+            }
+            name += get_node_type_name(fused->get_transform(i));
+        }
+        name += ")";
+    }
+    return name;
+}
+
+ImagePipelineNodeProfile::ImagePipelineNodeProfile(ImagePipelineNode& source) :
+    source_(source)
+{
+    stats_.name = get_node_name(source_);
+}
+
+void ImagePipelineNodeProfile::add_stats(std::uint64_t ns, std::size_t rows)
+{
+    stats_.total_ns += ns;
+    stats_.rows += rows;
+    stats_.bytes += get_row_bytes() * rows;
+    stats_.max_buffered_bytes = std::max(stats_.max_buffered_bytes, source_.get_buffered_bytes());
+}
+
+bool ImagePipelineNodeProfile::get_next_row_data(std::uint8_t* out_data)
+{
+    auto begin = std::chrono::high_resolution_clock::now();
+    bool got_data = source_.get_next_row_data(out_data);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    add_stats(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count(), 1);
+    return got_data;
+}
+
+bool ImagePipelineNodeProfile::get_next_rows_data(std::size_t count, std::uint8_t* out_data)
+{
+    auto begin = std::chrono::high_resolution_clock::now();
+    bool got_data = source_.get_next_rows_data(count, out_data);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    add_stats(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count(), count);
+    return got_data;
+}
+
+std::string format_pipeline_stage_stats(const std::vector<ImagePipelineStageStats>& stats)
+{
+    std::uint64_t total_self_ns = 0;
+    std::size_t name_width = 5;
+    for (const auto& stage : stats) {
+        total_self_ns += stage.self_ns;
+        name_width = std::max(name_width, stage.name.size());
+    }
+
+    std::stringstream out;
+    out << std::left << std::setw(name_width) << "stage" << std::right
+        << std::setw(10) << "rows"
+        << std::setw(14) << "bytes"
+        << std::setw(12) << "self ms"
+        << std::setw(8) << "self %"
+        << std::setw(12) << "total ms"
+        << std::setw(10) << "MiB/s"
+        << std::setw(14) << "max buffered" << '\n';
+
+    out << std::fixed << std::setprecision(1);
+    for (const auto& stage : stats) {
+        double self_ms = stage.self_ns / 1e6;
+        double self_percent = total_self_ns > 0 ? 100.0 * stage.self_ns / total_self_ns : 0;
+        double throughput = stage.self_ns > 0
+                ? (stage.bytes / (1024.0 * 1024.0)) / (stage.self_ns / 1e9) : 0;
+
+        out << std::left << std::setw(name_width) << stage.name << std::right
+            << std::setw(10) << stage.rows
+            << std::setw(14) << stage.bytes
+            << std::setw(12) << self_ms
+            << std::setw(8) << self_percent
+            << std::setw(12) << stage.total_ns / 1e6
+            << std::setw(10) << throughput
+            << std::setw(14) << stage.max_buffered_bytes << '\n';
+    }
+    return out.str();
+}
+
 std::size_t ImagePipelineStack::get_input_width() const
 {
     ensure_node_exists();
@@ -894,6 +1359,78 @@ void ImagePipelineStack::ensure_node_exists() const
     }
 }
 
+void ImagePipelineStack::set_fusion_enabled(bool enabled)
+{
+    if (!nodes_.empty()) {
+        throw SaneException("Fusion must be configured before any nodes are pushed");
+    }
+    fusion_enabled_ = enabled;
+}
+
+void ImagePipelineStack::set_thread_count(unsigned thread_count)
+{
+    if (!nodes_.empty()) {
+        throw SaneException("Thread count must be set before any nodes are pushed");
+    }
+    thread_pool_.reset();
+    if (thread_count > 1) {
+        thread_pool_.reset(new ThreadPool(thread_count));
+    }
+}
+
+void ImagePipelineStack::set_profiling_enabled(bool enabled)
+{
+    if (!nodes_.empty()) {
+        throw SaneException("Profiling must be configured before any nodes are pushed");
+    }
+    profiling_enabled_ = enabled;
+}
+
+void ImagePipelineStack::finish_stage()
+{
+    if (!has_open_stage_) {
+        return;
+    }
+    has_open_stage_ = false;
+    push_fused_rows_node();
+    if (profiling_enabled_) {
+        nodes_.emplace_back(std::unique_ptr<ImagePipelineNode>(
+                new ImagePipelineNodeProfile(*nodes_.back())));
+    }
+}
+
+std::vector<ImagePipelineStageStats> ImagePipelineStack::get_stage_stats() const
+{
+    std::vector<ImagePipelineStageStats> ret;
+    std::uint64_t prev_total_ns = 0;
+    for (const auto& node : nodes_) {
+        const auto* profile = dynamic_cast<const ImagePipelineNodeProfile*>(node.get());
+        if (profile == nullptr) {
+            continue;
+        }
+        auto stats = profile->get_stats();
+        // the time of the previous stage is a part of the time of this stage, except for the
+        // rows that a stage has read ahead and not returned yet
+        stats.self_ns = stats.total_ns > prev_total_ns ? stats.total_ns - prev_total_ns : 0;
+        prev_total_ns = stats.total_ns;
+        ret.push_back(stats);
+    }
+    return ret;
+}
+
+void ImagePipelineStack::push_fused_rows_node()
+{
+    has_pending_row_transforms_ = false;
+    if (!groups_row_transforms() || nodes_.empty()) {
+        return;
+    }
+    if (dynamic_cast<ImagePipelineRowTransformNode*>(nodes_.back().get()) == nullptr) {
+        return;
+    }
+    nodes_.emplace_back(std::unique_ptr<ImagePipelineNode>(
+            new ImagePipelineNodeFusedRows(*nodes_.back(), thread_pool_.get())));
+}
+
 void ImagePipelineStack::clear()
 {
     // we need to destroy the nodes back to front, so that the destructors still have valid
@@ -902,6 +1439,8 @@ void ImagePipelineStack::clear()
         it->reset();
     }
     nodes_.clear();
+    has_pending_row_transforms_ = false;
+    has_open_stage_ = false;
 }
 
 std::vector<std::uint8_t> ImagePipelineStack::get_all_data()
@@ -22,12 +22,18 @@
 #define BACKEND_GENESYS_IMAGE_PIPELINE_H
 
 #include "image.h"
+#include "image_calibrate.h"
 #include "image_pixel.h"
 #include "image_buffer.h"
+#include "thread_pool.h"
 
 #include <algorithm>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 namespace genesys {
 
@@ -50,6 +56,43 @@ public:
     // returns true if the row was filled successfully, false otherwise (e.g. if not enough data
     // was available.
     virtual bool get_next_row_data(std::uint8_t* out_data) = 0;
+
+    // Fills count consecutive rows, as count calls to get_next_row_data() would. Nodes that
+    // process rows in batches override this to produce the rows directly in out_data.
+    virtual bool get_next_rows_data(std::size_t count, std::uint8_t* out_data);
+
+    // Returns the amount of data that has been produced or read from the source, but not yet
+    // returned from get_next_row_data(). Used only for statistics.
+    virtual std::size_t get_buffered_bytes() const { return 0; }
+};
+
+// A pipeline node that computes each output row only from the corresponding row of the source
+// node and does not keep any state across rows. transform_row() may be called concurrently from
+// multiple threads, which allows ImagePipelineNodeFusedRows to process many rows at once.
+class ImagePipelineRowTransformNode : public ImagePipelineNode
+{
+public:
+    explicit ImagePipelineRowTransformNode(ImagePipelineNode& source) : source_(source) {}
+
+    std::size_t get_height() const override { return source_.get_height(); }
+
+    bool eof() const override { return source_.eof(); }
+
+    bool get_next_row_data(std::uint8_t* out_data) override;
+
+    ImagePipelineNode& get_source() const { return source_; }
+
+    // Computes a row of output data from a row of source data. in_data and out_data must not
+    // overlap unless supports_in_place_transform() returns true.
+    virtual void transform_row(const std::uint8_t* in_data, std::uint8_t* out_data) const = 0;
+
+    virtual bool supports_in_place_transform() const { return false; }
+
+protected:
+    ImagePipelineNode& source_;
+
+private:
+    std::vector<std::uint8_t> buffer_;
 };
 
 // A pipeline node that produces data from a callable
@@ -82,7 +125,9 @@ private:
     bool eof_ = false;
 };
 
-// A pipeline node that produces data from a callable requesting fixed-size chunks.
+// A pipeline node that produces data from a callable requesting fixed-size chunks. If
+// prefetch_count is not zero, the callable is invoked on a separate thread and up to
+// prefetch_count chunks are read ahead of the consumer.
 class ImagePipelineNodeBufferedCallableSource : public ImagePipelineNode
 {
 public:
@@ -90,7 +135,8 @@ public:
 
     ImagePipelineNodeBufferedCallableSource(std::size_t width, std::size_t height,
                                             PixelFormat format, std::size_t input_batch_size,
-                                            ProducerCallback producer);
+                                            ProducerCallback producer,
+                                            std::size_t prefetch_count = 0);
 
     std::size_t get_width() const override { return width_; }
     std::size_t get_height() const override { return height_; }
@@ -100,9 +146,15 @@ public:
 
     bool get_next_row_data(std::uint8_t* out_data) override;
 
-    std::size_t remaining_bytes() const { return buffer_.remaining_size(); }
-    void set_remaining_bytes(std::size_t bytes) { buffer_.set_remaining_size(bytes); }
-    void set_last_read_multiple(std::size_t bytes) { buffer_.set_last_read_multiple(bytes); }
+    std::size_t get_buffered_bytes() const override;
+
+    std::size_t remaining_bytes() const;
+    void set_remaining_bytes(std::size_t bytes);
+    void set_last_read_multiple(std::size_t bytes);
+
+    // Stops prefetching data. Must be called before the producer becomes unable to provide data,
+    // e.g. before the scan is cancelled. Does nothing if prefetching is not used.
+    void stop_prefetch();
 
 private:
     ProducerCallback producer_;
@@ -114,6 +166,7 @@ private:
     std::size_t curr_row_ = 0;
 
     ImageBuffer buffer_;
+    std::unique_ptr<PrefetchImageBuffer> prefetch_buffer_;
 };
 
 // A pipeline node that produces data from the given array.
@@ -163,28 +216,28 @@ private:
 };
 
 // A pipeline node that converts between pixel formats
-class ImagePipelineNodeFormatConvert : public ImagePipelineNode
+class ImagePipelineNodeFormatConvert : public ImagePipelineRowTransformNode
 {
 public:
     ImagePipelineNodeFormatConvert(ImagePipelineNode& source, PixelFormat dst_format) :
-        source_(source),
+        ImagePipelineRowTransformNode(source),
         dst_format_{dst_format}
     {}
 
     ~ImagePipelineNodeFormatConvert() override = default;
 
     std::size_t get_width() const override { return source_.get_width(); }
-    std::size_t get_height() const override { return source_.get_height(); }
     PixelFormat get_format() const override { return dst_format_; }
 
-    bool eof() const override { return source_.eof(); }
+    void transform_row(const std::uint8_t* in_data, std::uint8_t* out_data) const override;
 
-    bool get_next_row_data(std::uint8_t* out_data) override;
+    bool supports_in_place_transform() const override
+    {
+        return source_.get_format() == dst_format_;
+    }
 
 private:
-    ImagePipelineNode& source_;
     PixelFormat dst_format_;
-    std::vector<std::uint8_t> buffer_;
 };
 
 // A pipeline node that handles data that comes out of segmented sensors. Note that the width of
@@ -217,6 +270,11 @@ public:
 
     bool get_next_row_data(std::uint8_t* out_data) override;
 
+    std::size_t get_buffered_bytes() const override
+    {
+        return buffer_.height() * buffer_.row_bytes();
+    }
+
 private:
     ImagePipelineNode& source_;
     std::size_t output_width_;
@@ -226,6 +284,12 @@ private:
     std::size_t pixels_per_chunk_ = 0;
 
     RowBuffer buffer_;
+
+    using RowFunction = void (*)(const std::uint8_t* in_data, std::uint8_t* out_data,
+                                 std::size_t groups_count,
+                                 const std::vector<unsigned>& segment_order,
+                                 std::size_t segment_pixels, std::size_t pixels_per_chunk);
+    RowFunction row_func_ = nullptr;
 };
 
 // A pipeline node that deinterleaves data on multiple lines
@@ -238,39 +302,33 @@ public:
 };
 
 // A pipeline that swaps bytes in 16-bit components and does nothing otherwise.
-class ImagePipelineNodeSwap16BitEndian : public ImagePipelineNode
+class ImagePipelineNodeSwap16BitEndian : public ImagePipelineRowTransformNode
 {
 public:
     ImagePipelineNodeSwap16BitEndian(ImagePipelineNode& source);
 
     std::size_t get_width() const override { return source_.get_width(); }
-    std::size_t get_height() const override { return source_.get_height(); }
     PixelFormat get_format() const override { return source_.get_format(); }
 
-    bool eof() const override { return source_.eof(); }
+    void transform_row(const std::uint8_t* in_data, std::uint8_t* out_data) const override;
 
-    bool get_next_row_data(std::uint8_t* out_data) override;
+    bool supports_in_place_transform() const override { return true; }
 
 private:
-    ImagePipelineNode& source_;
     bool needs_swapping_ = false;
 };
 
-class ImagePipelineNodeInvert : public ImagePipelineNode
+class ImagePipelineNodeInvert : public ImagePipelineRowTransformNode
 {
 public:
     ImagePipelineNodeInvert(ImagePipelineNode& source);
 
     std::size_t get_width() const override { return source_.get_width(); }
-    std::size_t get_height() const override { return source_.get_height(); }
     PixelFormat get_format() const override { return source_.get_format(); }
 
-    bool eof() const override { return source_.eof(); }
+    void transform_row(const std::uint8_t* in_data, std::uint8_t* out_data) const override;
 
-    bool get_next_row_data(std::uint8_t* out_data) override;
-
-private:
-    ImagePipelineNode& source_;
+    bool supports_in_place_transform() const override { return true; }
 };
 
 // A pipeline node that merges 3 mono lines into a color channel
@@ -288,6 +346,11 @@ public:
 
     bool get_next_row_data(std::uint8_t* out_data) override;
 
+    std::size_t get_buffered_bytes() const override
+    {
+        return buffer_.height() * buffer_.row_bytes();
+    }
+
 private:
     static PixelFormat get_output_format(PixelFormat input_format, ColorOrder order);
 
@@ -295,6 +358,11 @@ private:
     PixelFormat output_format_ = PixelFormat::UNKNOWN;
 
     RowBuffer buffer_;
+
+    using RowFunction = void (*)(const std::uint8_t* row0, const std::uint8_t* row1,
+                                 const std::uint8_t* row2, std::uint8_t* out_data,
+                                 std::size_t width);
+    RowFunction row_func_ = nullptr;
 };
 
 // A pipeline node that splits a color channel into 3 mono lines
@@ -323,29 +391,28 @@ private:
 
 
 // A pipeline node that merges 3 mono lines into a gray channel
-class ImagePipelineNodeMergeColorToGray : public ImagePipelineNode
+class ImagePipelineNodeMergeColorToGray : public ImagePipelineRowTransformNode
 {
 public:
     ImagePipelineNodeMergeColorToGray(ImagePipelineNode& source);
 
     std::size_t get_width() const override { return source_.get_width(); }
-    std::size_t get_height() const override { return source_.get_height(); }
     PixelFormat get_format() const override { return output_format_; }
 
-    bool eof() const override { return source_.eof(); }
-
-    bool get_next_row_data(std::uint8_t* out_data) override;
+    void transform_row(const std::uint8_t* in_data, std::uint8_t* out_data) const override;
 
 private:
     static PixelFormat get_output_format(PixelFormat input_format);
 
-    ImagePipelineNode& source_;
     PixelFormat output_format_ = PixelFormat::UNKNOWN;
     float ch0_mult_ = 0;
     float ch1_mult_ = 0;
     float ch2_mult_ = 0;
 
-    std::vector<std::uint8_t> temp_buffer_;
+    using RowFunction = void (*)(const std::uint8_t* in_data, std::uint8_t* out_data,
+                                 std::size_t width, float ch0_mult, float ch1_mult,
+                                 float ch2_mult);
+    RowFunction row_func_ = nullptr;
 };
 
 // A pipeline node that shifts colors across lines by the given offsets
@@ -363,6 +430,11 @@ public:
 
     bool get_next_row_data(std::uint8_t* out_data) override;
 
+    std::size_t get_buffered_bytes() const override
+    {
+        return buffer_.height() * buffer_.row_bytes();
+    }
+
 private:
     ImagePipelineNode& source_;
     std::size_t extra_height_ = 0;
@@ -371,6 +443,11 @@ private:
     std::array<unsigned, 3> channel_shifts_;
 
     RowBuffer buffer_;
+
+    using RowFunction = void (*)(const std::uint8_t* row0, const std::uint8_t* row1,
+                                 const std::uint8_t* row2, std::uint8_t* out_data,
+                                 std::size_t width);
+    RowFunction row_func_ = nullptr;
 };
 
 // A pipeline node that shifts pixels across lines by the given offsets (performs vertical
@@ -389,6 +466,11 @@ public:
 
     bool get_next_row_data(std::uint8_t* out_data) override;
 
+    std::size_t get_buffered_bytes() const override
+    {
+        return buffer_.height() * buffer_.row_bytes();
+    }
+
 private:
     ImagePipelineNode& source_;
     std::size_t extra_height_ = 0;
@@ -397,33 +479,35 @@ private:
     std::vector<std::size_t> pixel_shifts_;
 
     RowBuffer buffer_;
+
+    using RowFunction = void (*)(const std::vector<std::uint8_t*>& rows, std::uint8_t* out_data,
+                                 std::size_t width);
+    RowFunction row_func_ = nullptr;
 };
 
 // A pipeline node that shifts pixels across columns by the given offsets. Each row is divided
 // into pixel groups of shifts.size() pixels. For each output group starting at position xgroup,
 // the i-th pixel will be set to the input pixel at position xgroup + shifts[i].
-class ImagePipelineNodePixelShiftColumns : public ImagePipelineNode
+class ImagePipelineNodePixelShiftColumns : public ImagePipelineRowTransformNode
 {
 public:
     ImagePipelineNodePixelShiftColumns(ImagePipelineNode& source,
                                        const std::vector<std::size_t>& shifts);
 
     std::size_t get_width() const override { return width_; }
-    std::size_t get_height() const override { return source_.get_height(); }
     PixelFormat get_format() const override { return source_.get_format(); }
 
-    bool eof() const override { return source_.eof(); }
-
-    bool get_next_row_data(std::uint8_t* out_data) override;
+    void transform_row(const std::uint8_t* in_data, std::uint8_t* out_data) const override;
 
 private:
-    ImagePipelineNode& source_;
     std::size_t width_ = 0;
     std::size_t extra_width_ = 0;
 
     std::vector<std::size_t> pixel_shifts_;
 
-    std::vector<std::uint8_t> temp_buffer_;
+    using RowFunction = void (*)(const std::uint8_t* in_data, std::uint8_t* out_data,
+                                 std::size_t width, const std::vector<std::size_t>& shifts);
+    RowFunction row_func_ = nullptr;
 };
 
 // exposed for tests
@@ -461,28 +545,26 @@ private:
 };
 
 // A pipeline node that scales rows to the specified width by using a point filter
-class ImagePipelineNodeScaleRows : public ImagePipelineNode
+class ImagePipelineNodeScaleRows : public ImagePipelineRowTransformNode
 {
 public:
     ImagePipelineNodeScaleRows(ImagePipelineNode& source, std::size_t width);
 
     std::size_t get_width() const override { return width_; }
-    std::size_t get_height() const override { return source_.get_height(); }
     PixelFormat get_format() const override { return source_.get_format(); }
 
-    bool eof() const override { return source_.eof(); }
-
-    bool get_next_row_data(std::uint8_t* out_data) override;
+    void transform_row(const std::uint8_t* in_data, std::uint8_t* out_data) const override;
 
 private:
-    ImagePipelineNode& source_;
     std::size_t width_ = 0;
 
-    std::vector<std::uint8_t> cached_line_;
+    using RowFunction = void (*)(const std::uint8_t* src_data, std::uint8_t* out_data,
+                                 std::size_t src_width, std::size_t dst_width, unsigned channels);
+    RowFunction row_func_ = nullptr;
 };
 
 // A pipeline node that mimics the calibration behavior on Genesys chips
-class ImagePipelineNodeCalibrate : public ImagePipelineNode
+class ImagePipelineNodeCalibrate : public ImagePipelineRowTransformNode
 {
 public:
 
@@ -490,18 +572,17 @@ public:
                                const std::vector<std::uint16_t>& top, std::size_t x_start);
 
     std::size_t get_width() const override { return source_.get_width(); }
-    std::size_t get_height() const override { return source_.get_height(); }
     PixelFormat get_format() const override { return source_.get_format(); }
 
-    bool eof() const override { return source_.eof(); }
+    void transform_row(const std::uint8_t* in_data, std::uint8_t* out_data) const override;
 
-    bool get_next_row_data(std::uint8_t* out_data) override;
+    bool supports_in_place_transform() const override { return true; }
 
 private:
-    ImagePipelineNode& source_;
-
     std::vector<float> offset_;
     std::vector<float> multiplier_;
+
+    SimdLevel simd_level_ = SimdLevel::NONE;
 };
 
 class ImagePipelineNodeDebug : public ImagePipelineNode
@@ -524,6 +605,134 @@ private:
     RowBuffer buffer_;
 };
 
+// A pipeline node that applies a sequence of consecutive row transform nodes in one pass. The
+// source must be the last node of the sequence. The data is read directly from the source of the
+// first node in the sequence; the get_next_row_data() functions of the row transform nodes are
+// not used. Each row passes through the whole sequence while it's still in cache, and transforms
+// that support it are applied in place, so that a row is copied to a new buffer only when the
+// pixel layout changes.
+//
+// If a thread pool is given, batches of rows are processed on multiple threads. Otherwise rows
+// are processed one at a time and no data is read ahead from the source.
+class ImagePipelineNodeFusedRows : public ImagePipelineNode
+{
+public:
+    ImagePipelineNodeFusedRows(ImagePipelineNode& source, ThreadPool* pool);
+
+    std::size_t get_width() const override { return source_.get_width(); }
+    std::size_t get_height() const override { return source_.get_height(); }
+    PixelFormat get_format() const override { return source_.get_format(); }
+
+    bool eof() const override { return next_row_ == batch_rows_ && input_.eof(); }
+
+    bool get_next_row_data(std::uint8_t* out_data) override;
+
+    // Whole batches are transformed directly in out_data, without passing through the internal
+    // output buffer
+    bool get_next_rows_data(std::size_t count, std::uint8_t* out_data) override;
+
+    std::size_t get_buffered_bytes() const override
+    {
+        return (batch_rows_ - next_row_) * output_row_bytes_;
+    }
+
+    std::size_t get_transform_count() const { return transforms_.size(); }
+    const ImagePipelineRowTransformNode& get_transform(std::size_t i) const
+    {
+        return *transforms_[i];
+    }
+
+private:
+    static ImagePipelineNode& find_input(ImagePipelineNode& source);
+
+    // Returns the buffer that the input row needs to be read into for the given output row and
+    // input row buffer
+    std::uint8_t* get_read_buffer(std::uint8_t* out_data, std::uint8_t* in_data) const;
+
+    void transform_row(std::uint8_t* in_data, std::uint8_t* out_data,
+                       std::uint8_t* temp_data) const;
+
+    // Returns the number of rows that can be read at once, up to max_rows
+    std::size_t get_batch_size(std::size_t max_rows) const;
+
+    // Reads the given number of rows and transforms them into consecutive rows of out_data
+    void process_rows(std::size_t count, std::uint8_t* out_data);
+
+    void process_next_batch();
+
+    ImagePipelineNode& source_;
+    ImagePipelineNode& input_;
+    ThreadPool* pool_ = nullptr;
+
+    // ordered from the first node to apply to the last
+    std::vector<const ImagePipelineRowTransformNode*> transforms_;
+
+    // the index of the last transform that can't be applied in place, or transforms_.size() if
+    // all transforms are applied in place
+    std::size_t last_copy_index_ = 0;
+
+    std::size_t input_row_bytes_ = 0;
+    std::size_t output_row_bytes_ = 0;
+    std::size_t max_row_bytes_ = 0;
+    std::size_t rows_per_task_ = 0;
+    std::size_t max_batch_rows_ = 0;
+
+    std::size_t rows_read_ = 0;
+    std::size_t batch_rows_ = 0;
+    std::size_t next_row_ = 0;
+
+    std::vector<std::uint8_t> input_data_;
+    std::vector<std::uint8_t> output_data_;
+    std::vector<std::uint8_t> temp_data_;
+    std::vector<bool> got_data_;
+};
+
+// Statistics of a single stage of ImagePipelineStack. A stage is either a single node or a group
+// of fused row transform nodes.
+struct ImagePipelineStageStats
+{
+    std::string name;
+    std::size_t rows = 0;
+    std::size_t bytes = 0;
+    // the time spent in get_next_row(s)_data() including the time spent in the previous stages
+    std::uint64_t total_ns = 0;
+    // the time spent in get_next_row(s)_data() excluding the time spent in the previous stages
+    std::uint64_t self_ns = 0;
+    // the maximum amount of data that has been buffered within the stage at once
+    std::size_t max_buffered_bytes = 0;
+};
+
+// A pipeline node that passes the data of the source through unchanged and measures the time
+// spent in the source and the amount of data it produces.
+class ImagePipelineNodeProfile : public ImagePipelineNode
+{
+public:
+    ImagePipelineNodeProfile(ImagePipelineNode& source);
+
+    std::size_t get_width() const override { return source_.get_width(); }
+    std::size_t get_height() const override { return source_.get_height(); }
+    PixelFormat get_format() const override { return source_.get_format(); }
+
+    bool eof() const override { return source_.eof(); }
+
+    bool get_next_row_data(std::uint8_t* out_data) override;
+
+    // Forwarded to the source, so that profiling doesn't disable its batched path
+    bool get_next_rows_data(std::size_t count, std::uint8_t* out_data) override;
+
+    // self_ns is not filled, because the time spent in the previous stages is not known here
+    const ImagePipelineStageStats& get_stats() const { return stats_; }
+
+private:
+    void add_stats(std::uint64_t ns, std::size_t rows);
+
+    ImagePipelineNode& source_;
+    ImagePipelineStageStats stats_;
+};
+
+// Formats the statistics of the pipeline stages as a human-readable table
+std::string format_pipeline_stage_stats(const std::vector<ImagePipelineStageStats>& stats);
+
 class ImagePipelineStack
 {
 public:
@@ -532,12 +741,22 @@ public:
     {
         clear();
         nodes_ = std::move(other.nodes_);
+        thread_pool_ = std::move(other.thread_pool_);
+        fusion_enabled_ = other.fusion_enabled_;
+        profiling_enabled_ = other.profiling_enabled_;
+        has_pending_row_transforms_ = other.has_pending_row_transforms_;
+        has_open_stage_ = other.has_open_stage_;
     }
 
     ImagePipelineStack& operator=(ImagePipelineStack&& other)
     {
         clear();
         nodes_ = std::move(other.nodes_);
+        thread_pool_ = std::move(other.thread_pool_);
+        fusion_enabled_ = other.fusion_enabled_;
+        profiling_enabled_ = other.profiling_enabled_;
+        has_pending_row_transforms_ = other.has_pending_row_transforms_;
+        has_open_stage_ = other.has_open_stage_;
         return *this;
     }
 
@@ -555,10 +774,26 @@ public:
 
     ImagePipelineNode& front() { return *(nodes_.front().get()); }
 
+    bool empty() const { return nodes_.empty(); }
+
     bool eof() const { return nodes_.back()->eof(); }
 
     void clear();
 
+    // Enables fusion of consecutive row transform nodes into a single ImagePipelineNodeFusedRows
+    // node. Must be called before any nodes are pushed. Fusion is disabled by default.
+    void set_fusion_enabled(bool enabled);
+
+    // Sets the number of threads that consecutive row transform nodes are processed on. Must be
+    // called before any nodes are pushed. A thread count of 1 disables parallel processing. A
+    // higher thread count groups the row transform nodes into ImagePipelineNodeFusedRows even if
+    // fusion is disabled.
+    void set_thread_count(unsigned thread_count);
+
+    // Enables collection of per-stage statistics, see get_stage_stats(). Must be called before any
+    // nodes are pushed. Profiling is disabled by default.
+    void set_profiling_enabled(bool enabled);
+
     template<class Node, class... Args>
     Node& push_first_node(Args&&... args)
     {
@@ -566,6 +801,7 @@ public:
             throw SaneException("Trying to append first node when there are existing nodes");
         }
         nodes_.emplace_back(std::unique_ptr<Node>(new Node(std::forward<Args>(args)...)));
+        has_open_stage_ = true;
         return static_cast<Node&>(*nodes_.back());
     }
 
@@ -573,16 +809,37 @@ public:
     Node& push_node(Args&&... args)
     {
         ensure_node_exists();
+        bool is_row_transform = std::is_base_of<ImagePipelineRowTransformNode, Node>::value;
+        if (!is_row_transform || !has_pending_row_transforms_) {
+            finish_stage();
+        }
         nodes_.emplace_back(std::unique_ptr<Node>(new Node(*nodes_.back(),
                                                            std::forward<Args>(args)...)));
+        has_pending_row_transforms_ = is_row_transform && groups_row_transforms();
+        has_open_stage_ = true;
         return static_cast<Node&>(*nodes_.back());
     }
 
     bool get_next_row_data(std::uint8_t* out_data)
     {
+        if (has_open_stage_) {
+            finish_stage();
+        }
         return nodes_.back()->get_next_row_data(out_data);
     }
 
+    bool get_next_rows_data(std::size_t count, std::uint8_t* out_data)
+    {
+        if (has_open_stage_) {
+            finish_stage();
+        }
+        return nodes_.back()->get_next_rows_data(count, out_data);
+    }
+
+    // Returns the statistics of each stage of the pipeline in the order the data flows through
+    // them. Returns an empty list if profiling is not enabled.
+    std::vector<ImagePipelineStageStats> get_stage_stats() const;
+
     std::vector<std::uint8_t> get_all_data();
 
     Image get_image();
@@ -590,7 +847,21 @@ public:
 private:
     void ensure_node_exists() const;
 
+    bool groups_row_transforms() const { return fusion_enabled_ || thread_pool_ != nullptr; }
+
+    // Fuses the row transform nodes at the end of the stack, if any
+    void push_fused_rows_node();
+
+    // Completes the stage at the end of the stack: fuses the pending row transform nodes and, if
+    // profiling is enabled, pushes a node that measures the stage.
+    void finish_stage();
+
     std::vector<std::unique_ptr<ImagePipelineNode>> nodes_;
+    std::unique_ptr<ThreadPool> thread_pool_;
+    bool fusion_enabled_ = false;
+    bool profiling_enabled_ = false;
+    bool has_pending_row_transforms_ = false;
+    bool has_open_stage_ = false;
 };
 
 } // namespace genesys
@@ -22,6 +22,7 @@
 #define BACKEND_GENESYS_IMAGE_PIXEL_H
 
 #include "enums.h"
+#include "error.h"
 #include <algorithm>
 #include <cstdint>
 #include <cstddef>
@@ -101,21 +102,293 @@ std::uint16_t get_raw_channel_from_row(const std::uint8_t* data, std::size_t x,
 void set_raw_channel_to_row(std::uint8_t* data, std::size_t x, unsigned channel, std::uint16_t pixel,
                             PixelFormat format);
 
+// helpers for accessing individual bits of 1-bit pixel formats
+inline unsigned read_bit(const std::uint8_t* data, std::size_t x)
+{
+    return (data[x / 8] >> (7 - (x % 8))) & 0x1;
+}
+
+inline void write_bit(std::uint8_t* data, std::size_t x, unsigned value)
+{
+    value = (value & 0x1) << (7 - (x % 8));
+    std::uint8_t mask = 0x1 << (7 - (x % 8));
+
+    data[x / 8] = (data[x / 8] & ~mask) | (value & mask);
+}
+
+// Same as the above, except that the pixel format is resolved at compile time. These are
+// defined in the header so that the per-pixel format dispatch can be optimized out of the row
+// loops that use them.
 template<PixelFormat Format>
-Pixel get_pixel_from_row(const std::uint8_t* data, std::size_t x);
+Pixel get_pixel_from_row(const std::uint8_t* data, std::size_t x)
+{
+    switch (Format) {
+        case PixelFormat::I1: {
+            std::uint16_t val = read_bit(data, x) ? 0xffff : 0x0000;
+            return Pixel(val, val, val);
+        }
+        case PixelFormat::RGB111: {
+            x *= 3;
+            std::uint16_t r = read_bit(data, x) ? 0xffff : 0x0000;
+            std::uint16_t g = read_bit(data, x + 1) ? 0xffff : 0x0000;
+            std::uint16_t b = read_bit(data, x + 2) ? 0xffff : 0x0000;
+            return Pixel(r, g, b);
+        }
+        case PixelFormat::I8: {
+            std::uint16_t val = std::uint16_t(data[x]) | (data[x] << 8);
+            return Pixel(val, val, val);
+        }
+        case PixelFormat::I16: {
+            x *= 2;
+            std::uint16_t val = std::uint16_t(data[x]) | (data[x + 1] << 8);
+            return Pixel(val, val, val);
+        }
+        case PixelFormat::RGB888: {
+            x *= 3;
+            std::uint16_t r = std::uint16_t(data[x]) | (data[x] << 8);
+            std::uint16_t g = std::uint16_t(data[x + 1]) | (data[x + 1] << 8);
+            std::uint16_t b = std::uint16_t(data[x + 2]) | (data[x + 2] << 8);
+            return Pixel(r, g, b);
+        }
+        case PixelFormat::BGR888: {
+            x *= 3;
+            std::uint16_t b = std::uint16_t(data[x]) | (data[x] << 8);
+            std::uint16_t g = std::uint16_t(data[x + 1]) | (data[x + 1] << 8);
+            std::uint16_t r = std::uint16_t(data[x + 2]) | (data[x + 2] << 8);
+            return Pixel(r, g, b);
+        }
+        case PixelFormat::RGB161616: {
+            x *= 6;
+            std::uint16_t r = std::uint16_t(data[x]) | (data[x + 1] << 8);
+            std::uint16_t g = std::uint16_t(data[x + 2]) | (data[x + 3] << 8);
+            std::uint16_t b = std::uint16_t(data[x + 4]) | (data[x + 5] << 8);
+            return Pixel(r, g, b);
+        }
+        case PixelFormat::BGR161616: {
+            x *= 6;
+            std::uint16_t b = std::uint16_t(data[x]) | (data[x + 1] << 8);
+            std::uint16_t g = std::uint16_t(data[x + 2]) | (data[x + 3] << 8);
+            std::uint16_t r = std::uint16_t(data[x + 4]) | (data[x + 5] << 8);
+            return Pixel(r, g, b);
+        }
+        default:
+            throw SaneException("Unknown pixel format %d", static_cast<unsigned>(Format));
+    }
+}
+
 template<PixelFormat Format>
-void set_pixel_to_row(std::uint8_t* data, std::size_t x, RawPixel pixel);
+void set_pixel_to_row(std::uint8_t* data, std::size_t x, Pixel pixel)
+{
+    switch (Format) {
+        case PixelFormat::I1:
+            write_bit(data, x, pixel.r & 0x8000 ? 1 : 0);
+            return;
+        case PixelFormat::RGB111: {
+            x *= 3;
+            write_bit(data, x, pixel.r & 0x8000 ? 1 : 0);
+            write_bit(data, x + 1,pixel.g & 0x8000 ? 1 : 0);
+            write_bit(data, x + 2, pixel.b & 0x8000 ? 1 : 0);
+            return;
+        }
+        case PixelFormat::I8: {
+            float val = (pixel.r >> 8) * 0.3f;
+            val += (pixel.g >> 8) * 0.59f;
+            val += (pixel.b >> 8) * 0.11f;
+            data[x] = static_cast<std::uint16_t>(val);
+            return;
+        }
+        case PixelFormat::I16: {
+            x *= 2;
+            float val = pixel.r * 0.3f;
+            val += pixel.g * 0.59f;
+            val += pixel.b * 0.11f;
+            auto val16 = static_cast<std::uint16_t>(val);
+            data[x] = val16 & 0xff;
+            data[x + 1] = (val16 >> 8) & 0xff;
+            return;
+        }
+        case PixelFormat::RGB888: {
+            x *= 3;
+            data[x] = pixel.r >> 8;
+            data[x + 1] = pixel.g >> 8;
+            data[x + 2] = pixel.b >> 8;
+            return;
+        }
+        case PixelFormat::BGR888: {
+            x *= 3;
+            data[x] = pixel.b >> 8;
+            data[x + 1] = pixel.g >> 8;
+            data[x + 2] = pixel.r >> 8;
+            return;
+        }
+        case PixelFormat::RGB161616: {
+            x *= 6;
+            data[x] = pixel.r & 0xff;
+            data[x + 1] = (pixel.r >> 8) & 0xff;
+            data[x + 2] = pixel.g & 0xff;
+            data[x + 3] = (pixel.g >> 8) & 0xff;
+            data[x + 4] = pixel.b & 0xff;
+            data[x + 5] = (pixel.b >> 8) & 0xff;
+            return;
+        }
+        case PixelFormat::BGR161616:
+            x *= 6;
+            data[x] = pixel.b & 0xff;
+            data[x + 1] = (pixel.b >> 8) & 0xff;
+            data[x + 2] = pixel.g & 0xff;
+            data[x + 3] = (pixel.g >> 8) & 0xff;
+            data[x + 4] = pixel.r & 0xff;
+            data[x + 5] = (pixel.r >> 8) & 0xff;
+            return;
+        default:
+            throw SaneException("Unknown pixel format %d", static_cast<unsigned>(Format));
+    }
+}
 
 template<PixelFormat Format>
-Pixel get_raw_pixel_from_row(const std::uint8_t* data, std::size_t x);
+RawPixel get_raw_pixel_from_row(const std::uint8_t* data, std::size_t x)
+{
+    switch (Format) {
+        case PixelFormat::I1:
+            return RawPixel(read_bit(data, x));
+        case PixelFormat::RGB111: {
+            x *= 3;
+            return RawPixel(read_bit(data, x) << 2 |
+                            (read_bit(data, x + 1) << 1) |
+                            (read_bit(data, x + 2)));
+        }
+        case PixelFormat::I8:
+            return RawPixel(data[x]);
+        case PixelFormat::I16: {
+            x *= 2;
+            return RawPixel(data[x], data[x + 1]);
+        }
+        case PixelFormat::RGB888:
+        case PixelFormat::BGR888: {
+            x *= 3;
+            return RawPixel(data[x], data[x + 1], data[x + 2]);
+        }
+        case PixelFormat::RGB161616:
+        case PixelFormat::BGR161616: {
+            x *= 6;
+            return RawPixel(data[x], data[x + 1], data[x + 2],
+                            data[x + 3], data[x + 4], data[x + 5]);
+        }
+        default:
+            throw SaneException("Unknown pixel format %d", static_cast<unsigned>(Format));
+    }
+}
+
 template<PixelFormat Format>
-void set_raw_pixel_to_row(std::uint8_t* data, std::size_t x, RawPixel pixel);
+void set_raw_pixel_to_row(std::uint8_t* data, std::size_t x, RawPixel pixel)
+{
+    switch (Format) {
+        case PixelFormat::I1:
+            write_bit(data, x, pixel.data[0] & 0x1);
+            return;
+        case PixelFormat::RGB111: {
+            x *= 3;
+            write_bit(data, x, (pixel.data[0] >> 2) & 0x1);
+            write_bit(data, x + 1, (pixel.data[0] >> 1) & 0x1);
+            write_bit(data, x + 2, (pixel.data[0]) & 0x1);
+            return;
+        }
+        case PixelFormat::I8:
+            data[x] = pixel.data[0];
+            return;
+        case PixelFormat::I16: {
+            x *= 2;
+            data[x] = pixel.data[0];
+            data[x + 1] = pixel.data[1];
+            return;
+        }
+        case PixelFormat::RGB888:
+        case PixelFormat::BGR888: {
+            x *= 3;
+            data[x] = pixel.data[0];
+            data[x + 1] = pixel.data[1];
+            data[x + 2] = pixel.data[2];
+            return;
+        }
+        case PixelFormat::RGB161616:
+        case PixelFormat::BGR161616: {
+            x *= 6;
+            data[x] = pixel.data[0];
+            data[x + 1] = pixel.data[1];
+            data[x + 2] = pixel.data[2];
+            data[x + 3] = pixel.data[3];
+            data[x + 4] = pixel.data[4];
+            data[x + 5] = pixel.data[5];
+            return;
+        }
+        default:
+            throw SaneException("Unknown pixel format %d", static_cast<unsigned>(Format));
+    }
+}
 
 template<PixelFormat Format>
-std::uint16_t get_raw_channel_from_row(const std::uint8_t* data, std::size_t x, unsigned channel);
+std::uint16_t get_raw_channel_from_row(const std::uint8_t* data, std::size_t x, unsigned channel)
+{
+    switch (Format) {
+        case PixelFormat::I1:
+            return read_bit(data, x);
+        case PixelFormat::RGB111:
+            return read_bit(data, x * 3 + channel);
+        case PixelFormat::I8:
+            return data[x];
+        case PixelFormat::I16: {
+            x *= 2;
+            return data[x] | (data[x + 1] << 8);
+        }
+        case PixelFormat::RGB888:
+        case PixelFormat::BGR888:
+            return data[x * 3 + channel];
+        case PixelFormat::RGB161616:
+        case PixelFormat::BGR161616:
+            return data[x * 6 + channel * 2] | (data[x * 6 + channel * 2 + 1]) << 8;
+        default:
+            throw SaneException("Unknown pixel format %d", static_cast<unsigned>(Format));
+    }
+}
+
 template<PixelFormat Format>
 void set_raw_channel_to_row(std::uint8_t* data, std::size_t x, unsigned channel,
-                            std::uint16_t pixel);
+                            std::uint16_t pixel)
+{
+    switch (Format) {
+        case PixelFormat::I1:
+            write_bit(data, x, pixel & 0x1);
+            return;
+        case PixelFormat::RGB111: {
+            write_bit(data, x * 3 + channel, pixel & 0x1);
+            return;
+        }
+        case PixelFormat::I8:
+            data[x] = pixel;
+            return;
+        case PixelFormat::I16: {
+            x *= 2;
+            data[x] = pixel;
+            data[x + 1] = pixel >> 8;
+            return;
+        }
+        case PixelFormat::RGB888:
+        case PixelFormat::BGR888: {
+            x *= 3;
+            data[x + channel] = pixel;
+            return;
+        }
+        case PixelFormat::RGB161616:
+        case PixelFormat::BGR161616: {
+            x *= 6;
+            data[x + channel * 2] = pixel;
+            data[x + channel * 2 + 1] = pixel >> 8;
+            return;
+        }
+        default:
+            throw SaneException("Unknown pixel format %d", static_cast<unsigned>(Format));
+    }
+}
 
 } // namespace genesys
 
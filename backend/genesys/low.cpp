@@ -1132,7 +1132,6 @@ ImagePipelineStack build_image_pipeline(const Genesys_Device& dev, const ScanSes
     auto format = create_pixel_format(session.params.depth,
                                       dev.model->is_cis ? 1 : session.params.channels,
                                       dev.model->line_mode_color_order);
-    auto depth = get_pixel_format_depth(format);
     auto width = get_pixels_from_row_bytes(format, session.output_line_bytes_raw);
 
     auto read_data_from_usb = [&dev](std::size_t size, std::uint8_t* data)
@@ -1147,8 +1146,6 @@ ImagePipelineStack build_image_pipeline(const Genesys_Device& dev, const ScanSes
         return true;
     };
 
-    auto debug_prefix = "gl_pipeline_" + std::to_string(pipeline_index);
-
     ImagePipelineStack pipeline;
 
     auto lines = session.optical_line_count;
@@ -1158,10 +1155,40 @@ ImagePipelineStack build_image_pipeline(const Genesys_Device& dev, const ScanSes
     // certain circumstances.
     buffer_size = align_multiple_ceil(buffer_size, 2);
 
+    pipeline.set_fusion_enabled(!dbg_no_pipeline_fusion());
+    pipeline.set_profiling_enabled(dbg_pipeline_stats());
+
+    // The scan data is read ahead on a separate thread so that the USB transfers continue while
+    // the pipeline processes the previous chunk. Additionally, the fused row transform nodes
+    // process batches of rows on multiple threads. Both read data before it's requested, which
+    // is not done on sheetfed scanners because the amount of data to read is reduced during the
+    // scan once the end of document is detected. Replay testing relies on the exact sequence of
+    // transfers, so it's not done there either.
+    std::size_t prefetch_count = 0;
+    if (!dev.model->is_sheetfed && !dev.interface->is_mock() &&
+        !sanei_usb_is_replay_mode_enabled())
+    {
+        prefetch_count = 2;
+        if (!dbg_no_pipeline_fusion()) {
+            pipeline.set_thread_count(get_image_processing_thread_count());
+        }
+    }
+
     auto& src_node = pipeline.push_first_node<ImagePipelineNodeBufferedCallableSource>(
-                          width, lines, format, buffer_size, read_data_from_usb);
+                          width, lines, format, buffer_size, read_data_from_usb, prefetch_count);
     src_node.set_last_read_multiple(2);
 
+    push_image_pipeline_nodes(pipeline, dev, session, pipeline_index, log_image_data);
+    return pipeline;
+}
+
+void push_image_pipeline_nodes(ImagePipelineStack& pipeline, const Genesys_Device& dev,
+                               const ScanSession& session, unsigned pipeline_index,
+                               bool log_image_data)
+{
+    auto depth = get_pixel_format_depth(pipeline.get_output_format());
+    auto debug_prefix = "gl_pipeline_" + std::to_string(pipeline_index);
+
     if (log_image_data) {
         pipeline.push_node<ImagePipelineNodeDebug>(debug_prefix + "_0_from_usb.tiff");
     }
@@ -1276,8 +1303,6 @@ ImagePipelineStack build_image_pipeline(const Genesys_Device& dev, const ScanSes
     if (pipeline.get_output_width() != session.params.get_requested_pixels()) {
         pipeline.push_node<ImagePipelineNodeScaleRows>(session.params.get_requested_pixels());
     }
-
-    return pipeline;
 }
 
 void setup_image_pipeline(Genesys_Device& dev, const ScanSession& session)
@@ -1288,13 +1313,17 @@ void setup_image_pipeline(Genesys_Device& dev, const ScanSession& session)
 
     dev.pipeline = build_image_pipeline(dev, session, s_pipeline_index, dbg_log_image_data());
 
+    // The rows that fit into the frontend's buffer are requested at once, so that batches of rows
+    // are transformed directly in it
     auto read_from_pipeline = [&dev](std::size_t size, std::uint8_t* out_data)
     {
-        (void) size; // will be always equal to dev.pipeline.get_output_row_bytes()
-        return dev.pipeline.get_next_row_data(out_data);
+        // will be always a multiple of dev.pipeline.get_output_row_bytes()
+        return dev.pipeline.get_next_rows_data(size / dev.pipeline.get_output_row_bytes(),
+                                               out_data);
     };
     dev.pipeline_buffer = ImageBuffer{dev.pipeline.get_output_row_bytes(),
                                        read_from_pipeline};
+    dev.pipeline_buffer.set_multi_chunk_reads(true);
 }
 
 std::uint8_t compute_frontend_gain_wolfson(float value, float target_value)
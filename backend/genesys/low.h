@@ -410,6 +410,12 @@ void compute_session(const Genesys_Device* dev, ScanSession& s, const Genesys_Se
 ImagePipelineStack build_image_pipeline(const Genesys_Device& dev, const ScanSession& session,
                                         unsigned pipeline_index, bool log_image_data);
 
+// Pushes the nodes that convert the raw scan data of the session into the final image. The first
+// node of the pipeline must produce the data in the format that is read from the scanner.
+void push_image_pipeline_nodes(ImagePipelineStack& pipeline, const Genesys_Device& dev,
+                               const ScanSession& session, unsigned pipeline_index,
+                               bool log_image_data);
+
 // sets up a image pipeline for device `dev`
 void setup_image_pipeline(Genesys_Device& dev, const ScanSession& session);
 
@@ -27,7 +27,16 @@ namespace genesys {
 
 ScannerInterfaceUsb::~ScannerInterfaceUsb() = default;
 
-ScannerInterfaceUsb::ScannerInterfaceUsb(Genesys_Device* dev) : dev_{dev} {}
+ScannerInterfaceUsb::ScannerInterfaceUsb(Genesys_Device* dev) :
+    dev_{dev},
+    usb_dev_{new UsbDevice}
+{}
+
+ScannerInterfaceUsb::ScannerInterfaceUsb(Genesys_Device* dev,
+                                         std::unique_ptr<IUsbDevice> usb_dev) :
+    dev_{dev},
+    usb_dev_{std::move(usb_dev)}
+{}
 
 bool ScannerInterfaceUsb::is_mock() const
 {
@@ -36,6 +45,7 @@ bool ScannerInterfaceUsb::is_mock() const
 
 std::uint8_t ScannerInterfaceUsb::read_register(std::uint16_t address)
 {
+    std::lock_guard<std::recursive_mutex> lock{usb_mutex_};
     DBG_HELPER(dbg);
 
     std::uint8_t value = 0;
@@ -53,7 +63,7 @@ std::uint8_t ScannerInterfaceUsb::read_register(std::uint16_t address)
             usb_value |= 0x100;
         }
 
-        usb_dev_.control_msg(REQUEST_TYPE_IN, REQUEST_BUFFER, usb_value, address16, 2, value2x8);
+        usb_dev_->control_msg(REQUEST_TYPE_IN, REQUEST_BUFFER, usb_value, address16, 2, value2x8);
 
         // check usb link status
         if (value2x8[1] != 0x55) {
@@ -72,9 +82,9 @@ std::uint8_t ScannerInterfaceUsb::read_register(std::uint16_t address)
 
         std::uint8_t address8 = address & 0xff;
 
-        usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_SET_REGISTER, INDEX,
+        usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_SET_REGISTER, INDEX,
                              1, &address8);
-        usb_dev_.control_msg(REQUEST_TYPE_IN, REQUEST_REGISTER, VALUE_READ_REGISTER, INDEX,
+        usb_dev_->control_msg(REQUEST_TYPE_IN, REQUEST_REGISTER, VALUE_READ_REGISTER, INDEX,
                              1, &value);
     }
     return value;
@@ -82,6 +92,7 @@ std::uint8_t ScannerInterfaceUsb::read_register(std::uint16_t address)
 
 void ScannerInterfaceUsb::write_register(std::uint16_t address, std::uint8_t value)
 {
+    std::lock_guard<std::recursive_mutex> lock{usb_mutex_};
     DBG_HELPER_ARGS(dbg, "address: 0x%04x, value: 0x%02x", static_cast<unsigned>(address),
                     static_cast<unsigned>(value));
 
@@ -100,7 +111,7 @@ void ScannerInterfaceUsb::write_register(std::uint16_t address, std::uint8_t val
             usb_value |= 0x100;
         }
 
-        usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, usb_value, INDEX,
+        usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, usb_value, INDEX,
                                   2, buffer);
 
     } else {
@@ -110,10 +121,10 @@ void ScannerInterfaceUsb::write_register(std::uint16_t address, std::uint8_t val
 
         std::uint8_t address8 = address & 0xff;
 
-        usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_SET_REGISTER, INDEX,
+        usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_SET_REGISTER, INDEX,
                              1, &address8);
 
-        usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_WRITE_REGISTER, INDEX,
+        usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_WRITE_REGISTER, INDEX,
                              1, &value);
 
     }
@@ -122,6 +133,7 @@ void ScannerInterfaceUsb::write_register(std::uint16_t address, std::uint8_t val
 
 void ScannerInterfaceUsb::write_registers(const Genesys_Register_Set& regs)
 {
+    std::lock_guard<std::recursive_mutex> lock{usb_mutex_};
     DBG_HELPER(dbg);
     if (dev_->model->asic_type == AsicType::GL646 ||
         dev_->model->asic_type == AsicType::GL841)
@@ -148,25 +160,27 @@ void ScannerInterfaceUsb::write_registers(const Genesys_Register_Set& regs)
             outdata[6] = ((buffer.size() >> 16) & 0xff);
             outdata[7] = ((buffer.size() >> 24) & 0xff);
 
-            usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, VALUE_BUFFER, INDEX,
+            usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, VALUE_BUFFER, INDEX,
                                  sizeof(outdata), outdata);
 
             size_t write_size = buffer.size();
 
-            usb_dev_.bulk_write(buffer.data(), &write_size);
+            usb_dev_->bulk_write(buffer.data(), &write_size);
         } else {
             for (std::size_t i = 0; i < regs.size();) {
                 std::size_t c = regs.size() - i;
                 if (c > 32)  /*32 is max on GL841. checked that.*/
                     c = 32;
 
-                usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, VALUE_SET_REGISTER,
+                usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, VALUE_SET_REGISTER,
                                      INDEX, c * 2, buffer.data() + i * 2);
 
                 i += c;
             }
         }
     } else {
+        // The other ASICs have not been checked against USB captures, thus the registers are
+        // written one by one.
         for (const auto& r : regs) {
             write_register(r.address, r.value);
         }
@@ -177,11 +191,12 @@ void ScannerInterfaceUsb::write_registers(const Genesys_Register_Set& regs)
 
 void ScannerInterfaceUsb::write_0x8c(std::uint8_t index, std::uint8_t value)
 {
+    std::lock_guard<std::recursive_mutex> lock{usb_mutex_};
     DBG_HELPER_ARGS(dbg, "0x%02x,0x%02x", index, value);
-    usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_BUF_ENDACCESS, index, 1, &value);
+    usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_BUF_ENDACCESS, index, 1, &value);
 }
 
-static void bulk_read_data_send_header(UsbDevice& usb_dev, AsicType asic_type, size_t size)
+static void bulk_read_data_send_header(IUsbDevice& usb_dev, AsicType asic_type, size_t size)
 {
     DBG_HELPER(dbg);
 
@@ -223,6 +238,7 @@ static void bulk_read_data_send_header(UsbDevice& usb_dev, AsicType asic_type, s
 
 void ScannerInterfaceUsb::bulk_read_data(std::uint8_t addr, std::uint8_t* data, std::size_t size)
 {
+    std::lock_guard<std::recursive_mutex> lock{usb_mutex_};
     // currently supported: GL646, GL841, GL843, GL845, GL846, GL847, GL124
     DBG_HELPER(dbg);
 
@@ -247,7 +263,7 @@ void ScannerInterfaceUsb::bulk_read_data(std::uint8_t addr, std::uint8_t* data,
         return;
 
     if (is_addr_used) {
-        usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_SET_REGISTER, 0x00,
+        usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_SET_REGISTER, 0x00,
                              1, &addr);
     }
 
@@ -256,7 +272,7 @@ void ScannerInterfaceUsb::bulk_read_data(std::uint8_t addr, std::uint8_t* data,
     std::size_t max_in_size = sanei_genesys_get_bulk_max_size(dev_->model->asic_type);
 
     if (!has_header_before_each_chunk) {
-        bulk_read_data_send_header(usb_dev_, dev_->model->asic_type, size);
+        bulk_read_data_send_header(*usb_dev_, dev_->model->asic_type, size);
     }
 
     // loop until computed data size is read
@@ -264,12 +280,12 @@ void ScannerInterfaceUsb::bulk_read_data(std::uint8_t addr, std::uint8_t* data,
         std::size_t block_size = std::min(target_size, max_in_size);
 
         if (has_header_before_each_chunk) {
-            bulk_read_data_send_header(usb_dev_, dev_->model->asic_type, block_size);
+            bulk_read_data_send_header(*usb_dev_, dev_->model->asic_type, block_size);
         }
 
         DBG(DBG_io2, "%s: trying to read %zu bytes of data\n", __func__, block_size);
 
-        usb_dev_.bulk_read(data, &block_size);
+        usb_dev_->bulk_read(data, &block_size);
 
         DBG(DBG_io2, "%s: read %zu bytes, %zu remaining\n", __func__, block_size, target_size - block_size);
 
@@ -280,13 +296,14 @@ void ScannerInterfaceUsb::bulk_read_data(std::uint8_t addr, std::uint8_t* data,
 
 void ScannerInterfaceUsb::bulk_write_data(std::uint8_t addr, std::uint8_t* data, std::size_t len)
 {
+    std::lock_guard<std::recursive_mutex> lock{usb_mutex_};
     DBG_HELPER_ARGS(dbg, "writing %zu bytes", len);
 
     // supported: GL646, GL841, GL843
     std::size_t size;
     std::uint8_t outdata[8];
 
-    usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_SET_REGISTER, INDEX,
+    usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_SET_REGISTER, INDEX,
                              1, &addr);
 
     std::size_t max_out_size = sanei_genesys_get_bulk_max_size(dev_->model->asic_type);
@@ -316,10 +333,10 @@ void ScannerInterfaceUsb::bulk_write_data(std::uint8_t addr, std::uint8_t* data,
         outdata[6] = ((size >> 16) & 0xff);
         outdata[7] = ((size >> 24) & 0xff);
 
-        usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, VALUE_BUFFER, 0x00,
+        usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, VALUE_BUFFER, 0x00,
                              sizeof(outdata), outdata);
 
-        usb_dev_.bulk_write(data, &size);
+        usb_dev_->bulk_write(data, &size);
 
         DBG(DBG_io2, "%s: wrote %zu bytes, %zu remaining\n", __func__, size, len - size);
 
@@ -331,6 +348,7 @@ void ScannerInterfaceUsb::bulk_write_data(std::uint8_t addr, std::uint8_t* data,
 void ScannerInterfaceUsb::write_buffer(std::uint8_t type, std::uint32_t addr, std::uint8_t* data,
                                        std::size_t size)
 {
+    std::lock_guard<std::recursive_mutex> lock{usb_mutex_};
     DBG_HELPER_ARGS(dbg, "type: 0x%02x, addr: 0x%08x, size: 0x%08zx", type, addr, size);
     if (dev_->model->asic_type != AsicType::GL646 &&
         dev_->model->asic_type != AsicType::GL841 &&
@@ -354,6 +372,7 @@ void ScannerInterfaceUsb::write_buffer(std::uint8_t type, std::uint32_t addr, st
 void ScannerInterfaceUsb::write_gamma(std::uint8_t type, std::uint32_t addr, std::uint8_t* data,
                                       std::size_t size)
 {
+    std::lock_guard<std::recursive_mutex> lock{usb_mutex_};
     DBG_HELPER_ARGS(dbg, "type: 0x%02x, addr: 0x%08x, size: 0x%08zx", type, addr, size);
     if (dev_->model->asic_type != AsicType::GL841 &&
         dev_->model->asic_type != AsicType::GL842 &&
@@ -378,6 +397,7 @@ void ScannerInterfaceUsb::write_gamma(std::uint8_t type, std::uint32_t addr, std
 
 void ScannerInterfaceUsb::write_ahb(std::uint32_t addr, std::uint32_t size, std::uint8_t* data)
 {
+    std::lock_guard<std::recursive_mutex> lock{usb_mutex_};
     DBG_HELPER_ARGS(dbg, "address: 0x%08x, size: %d", static_cast<unsigned>(addr),
                     static_cast<unsigned>(size));
 
@@ -399,7 +419,7 @@ void ScannerInterfaceUsb::write_ahb(std::uint32_t addr, std::uint32_t size, std:
     outdata[7] = ((size >> 24) & 0xff);
 
     // write addr and size for AHB
-    usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, VALUE_BUFFER, 0x01, 8, outdata);
+    usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, VALUE_BUFFER, 0x01, 8, outdata);
 
     std::size_t max_out_size = sanei_genesys_get_bulk_max_size(dev_->model->asic_type);
 
@@ -408,7 +428,7 @@ void ScannerInterfaceUsb::write_ahb(std::uint32_t addr, std::uint32_t size, std:
     do {
         std::size_t block_size = std::min(size - written, max_out_size);
 
-        usb_dev_.bulk_write(data + written, &block_size);
+        usb_dev_->bulk_write(data + written, &block_size);
 
         written += block_size;
     } while (written < size);
@@ -416,6 +436,7 @@ void ScannerInterfaceUsb::write_ahb(std::uint32_t addr, std::uint32_t size, std:
 
 std::uint16_t ScannerInterfaceUsb::read_fe_register(std::uint8_t address)
 {
+    std::lock_guard<std::recursive_mutex> lock{usb_mutex_};
     DBG_HELPER(dbg);
     Genesys_Register_Set reg;
 
@@ -434,6 +455,7 @@ std::uint16_t ScannerInterfaceUsb::read_fe_register(std::uint8_t address)
 
 void ScannerInterfaceUsb::write_fe_register(std::uint8_t address, std::uint16_t value)
 {
+    std::lock_guard<std::recursive_mutex> lock{usb_mutex_};
     DBG_HELPER_ARGS(dbg, "0x%02x, 0x%04x", address, value);
     Genesys_Register_Set reg(Genesys_Register_Set::SEQUENTIAL);
 
@@ -451,7 +473,7 @@ void ScannerInterfaceUsb::write_fe_register(std::uint8_t address, std::uint16_t
 
 IUsbDevice& ScannerInterfaceUsb::get_usb_device()
 {
-    return usb_dev_;
+    return *usb_dev_;
 }
 
 void ScannerInterfaceUsb::sleep_us(unsigned microseconds)
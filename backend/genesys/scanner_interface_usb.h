@@ -24,6 +24,9 @@
 #include "scanner_interface.h"
 #include "usb_device.h"
 
+#include <memory>
+#include <mutex>
+
 namespace genesys {
 
 class ScannerInterfaceUsb : public ScannerInterface
@@ -31,6 +34,9 @@ class ScannerInterfaceUsb : public ScannerInterface
 public:
     ScannerInterfaceUsb(Genesys_Device* dev);
 
+    // Used in tests to check the data sent to the device
+    ScannerInterfaceUsb(Genesys_Device* dev, std::unique_ptr<IUsbDevice> usb_dev);
+
     ~ScannerInterfaceUsb() override;
 
     bool is_mock() const override;
@@ -67,7 +73,11 @@ public:
 
 private:
     Genesys_Device* dev_;
-    UsbDevice usb_dev_;
+    std::unique_ptr<IUsbDevice> usb_dev_;
+
+    // Scan data may be read on a separate thread while the main thread accesses the registers,
+    // thus each multi-transfer operation must complete without interruption.
+    std::recursive_mutex usb_mutex_;
 };
 
 } // namespace genesys
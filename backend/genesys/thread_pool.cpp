@@ -0,0 +1,167 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define DEBUG_DECLARE_ONLY
+
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace genesys {
+
+ThreadPool::ThreadPool(unsigned thread_count) :
+    thread_count_{std::max(thread_count, 1u)}
+{}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stop_ = true;
+    }
+    start_cond_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallel_for(std::size_t count, const TaskFunction& fn)
+{
+    if (count == 0) {
+        return;
+    }
+
+    if (thread_count_ == 1 || count == 1) {
+        for (std::size_t i = 0; i < count; ++i) {
+            fn(i);
+        }
+        return;
+    }
+
+    start_workers();
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        task_fn_ = &fn;
+        task_count_ = count;
+        remaining_tasks_ = count;
+        exception_ = nullptr;
+        next_task_ = 0;
+        generation_++;
+    }
+    start_cond_.notify_all();
+
+    run_tasks(fn, count);
+
+    std::exception_ptr exception;
+    {
+        std::unique_lock<std::mutex> lock{mutex_};
+        done_cond_.wait(lock, [this]() { return remaining_tasks_ == 0 && active_workers_ == 0; });
+
+        // workers that wake up after this point must not see the finished job
+        task_fn_ = nullptr;
+        task_count_ = 0;
+        exception = exception_;
+        exception_ = nullptr;
+    }
+
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
+
+void ThreadPool::start_workers()
+{
+    if (!workers_.empty()) {
+        return;
+    }
+    workers_.reserve(thread_count_ - 1);
+    for (unsigned i = 1; i < thread_count_; ++i) {
+        workers_.emplace_back([this]() { worker_thread(); });
+    }
+}
+
+void ThreadPool::worker_thread()
+{
+    std::uint64_t seen_generation = 0;
+    while (true) {
+        const TaskFunction* fn = nullptr;
+        std::size_t count = 0;
+        {
+            std::unique_lock<std::mutex> lock{mutex_};
+            start_cond_.wait(lock, [&]()
+            {
+                return stop_ || (task_fn_ != nullptr && generation_ != seen_generation);
+            });
+            if (stop_) {
+                return;
+            }
+            seen_generation = generation_;
+            fn = task_fn_;
+            count = task_count_;
+            active_workers_++;
+        }
+
+        run_tasks(*fn, count);
+
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            active_workers_--;
+        }
+        done_cond_.notify_all();
+    }
+}
+
+void ThreadPool::run_tasks(const TaskFunction& fn, std::size_t count)
+{
+    while (true) {
+        std::size_t index = next_task_.fetch_add(1);
+        if (index >= count) {
+            return;
+        }
+
+        try {
+            fn(index);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock{mutex_};
+            if (!exception_) {
+                exception_ = std::current_exception();
+            }
+        }
+
+        bool done = false;
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            remaining_tasks_--;
+            done = remaining_tasks_ == 0;
+        }
+        if (done) {
+            done_cond_.notify_all();
+        }
+    }
+}
+
+unsigned get_image_processing_thread_count()
+{
+    // The benefit of additional threads diminishes quickly because reading from the source
+    // node is sequential.
+    const unsigned MAX_THREADS = 8;
+    return std::min(std::max(std::thread::hardware_concurrency(), 1u), MAX_THREADS);
+}
+
+} // namespace genesys
@@ -0,0 +1,87 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BACKEND_GENESYS_THREAD_POOL_H
+#define BACKEND_GENESYS_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace genesys {
+
+// A simple pool of worker threads that executes batches of independent tasks. The thread that
+// calls parallel_for() participates in the execution, thus a pool with thread_count of 1 does not
+// create any additional threads. The worker threads are started by the first parallel_for() call
+// that has more than one task, so that pipelines that are built only to compute the scan
+// parameters and are never read from don't start any threads.
+class ThreadPool
+{
+public:
+    using TaskFunction = std::function<void(std::size_t index)>;
+
+    explicit ThreadPool(unsigned thread_count);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Returns the number of threads that execute tasks, including the calling thread
+    unsigned thread_count() const { return thread_count_; }
+
+    // Calls fn(i) for each i in [0, count) and waits until all calls complete. The calls may
+    // happen concurrently in any order. If any call throws, the first exception is rethrown once
+    // all calls complete.
+    void parallel_for(std::size_t count, const TaskFunction& fn);
+
+private:
+    void start_workers();
+    void worker_thread();
+    void run_tasks(const TaskFunction& fn, std::size_t count);
+
+    unsigned thread_count_ = 1;
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable start_cond_;
+    std::condition_variable done_cond_;
+
+    // the following members are protected by mutex_
+    bool stop_ = false;
+    std::uint64_t generation_ = 0;
+    const TaskFunction* task_fn_ = nullptr;
+    std::size_t task_count_ = 0;
+    std::size_t remaining_tasks_ = 0;
+    unsigned active_workers_ = 0;
+    std::exception_ptr exception_;
+
+    std::atomic<std::size_t> next_task_{0};
+};
+
+// Returns the number of threads that should be used for image processing
+unsigned get_image_processing_thread_count();
+
+} // namespace genesys
+
+#endif // BACKEND_GENESYS_THREAD_POOL_H
@@ -97,6 +97,9 @@ static AvahiServiceBrowser *avahi_browser = NULL;
 #include "../include/sane/sanei_config.h"
 #define NET_CONFIG_FILE "net.conf"
 
+/* Largest compressed data record we accept from saned.  */
+#define NET_MAX_COMPRESSED_RECORD (16 * 1024 * 1024)
+
 /* Please increase version number with every change
    (don't forget to update net.desc) */
 
@@ -104,13 +107,13 @@ static AvahiServiceBrowser *avahi_browser = NULL;
 #if defined (HAVE_GETADDRINFO) && defined (HAVE_GETNAMEINFO)
 # define NET_USES_AF_INDEP
 # ifdef ENABLE_IPV6
-#  define NET_VERSION "1.0.14 (AF-indep+IPv6)"
+#  define NET_VERSION "1.0.15 (AF-indep+IPv6)"
 # else
-#  define NET_VERSION "1.0.14 (AF-indep)"
+#  define NET_VERSION "1.0.15 (AF-indep)"
 # endif /* ENABLE_IPV6 */
 #else
 # undef ENABLE_IPV6
-# define NET_VERSION "1.0.14"
+# define NET_VERSION "1.0.15"
 #endif /* HAVE_GETADDRINFO && HAVE_GETNAMEINFO */
 
 static SANE_Auth_Callback auth_callback;
@@ -121,6 +124,7 @@ static int client_big_endian; /* 1 == big endian; 0 == little endian */
 static int server_big_endian; /* 1 == big endian; 0 == little endian */
 static int depth; /* bits per pixel */
 static int connect_timeout = -1; /* timeout for connection to saned */
+static int data_compression = 1; /* ask saned for compressed image data */
 
 #ifndef NET_USES_AF_INDEP
 static int saned_port;
@@ -508,7 +512,8 @@ connect_dev (Net_Device * dev)
   dev->wire.io.read = read;
   dev->wire.io.write = write;
 
-  /* exchange version codes with the server: */
+  /* exchange version codes with the server; saned answers with the
+     newest version both sides understand: */
   req.version_code = SANE_VERSION_CODE (V_MAJOR, V_MINOR,
 					SANEI_NET_PROTOCOL_VERSION);
   req.username = get_current_username();
@@ -548,8 +553,8 @@ connect_dev (Net_Device * dev)
       status = SANE_STATUS_IO_ERROR;
       goto fail;
     }
-  if (SANE_VERSION_BUILD (version_code) != SANEI_NET_PROTOCOL_VERSION
-      && SANE_VERSION_BUILD (version_code) != 2)
+  if (SANE_VERSION_BUILD (version_code) > SANEI_NET_PROTOCOL_VERSION
+      || SANE_VERSION_BUILD (version_code) < 2)
     {
       DBG (1, "connect_dev: network protocol version mismatch: "
 	   "got %d, expected %d\n",
@@ -569,9 +574,161 @@ fail:
 }
 
 
+static void do_authorization (Net_Device * dev, SANE_String resource);
+
+/* Install the descriptors sent in REPLY.  The cache takes them over and
+   hands the descriptors they replace back to the reply to be freed.  */
+static SANE_Status
+apply_option_changes (Net_Scanner * s, SANE_Control_Options_Reply * reply)
+{
+  SANE_Option_Descriptor *old;
+  SANE_Word i, option;
+
+  if (s->opt.num_options == 0 && reply->num_options > 0)
+    {
+      s->opt.desc = calloc (reply->num_options, sizeof (s->opt.desc[0]));
+      if (!s->opt.desc)
+	{
+	  DBG (1, "apply_option_changes: not enough memory\n");
+	  return SANE_STATUS_NO_MEM;
+	}
+      s->opt.num_options = reply->num_options;
+      s->hw->wire.allocated_memory += reply->num_options * sizeof (s->opt.desc[0]);
+    }
+  else if (reply->num_options != s->opt.num_options)
+    {
+      DBG (1, "apply_option_changes: number of options changed from %d "
+	   "to %d\n", s->opt.num_options, reply->num_options);
+      return SANE_STATUS_IO_ERROR;
+    }
+
+  for (i = 0; i < reply->num_changes; ++i)
+    {
+      option = reply->changes[i].option;
+      if (option < 0 || option >= s->opt.num_options
+	  || !reply->changes[i].desc)
+	{
+	  DBG (1, "apply_option_changes: bad descriptor for option %d\n",
+	       option);
+	  return SANE_STATUS_IO_ERROR;
+	}
+      old = s->opt.desc[option];
+      s->opt.desc[option] = reply->changes[i].desc;
+      reply->changes[i].desc = old;
+
+      if (s->local_opt.num_options == s->opt.num_options)
+	memcpy (s->local_opt.desc[option], s->opt.desc[option],
+		sizeof (SANE_Option_Descriptor));
+    }
+
+  for (i = 0; i < s->opt.num_options; ++i)
+    if (!s->opt.desc[i])
+      {
+	DBG (1, "apply_option_changes: descriptor %d is missing\n", i);
+	return SANE_STATUS_IO_ERROR;
+      }
+
+  DBG (3, "apply_option_changes: %d of %d descriptors changed "
+       "(generation %d)\n", reply->num_changes, reply->num_options,
+       reply->generation);
+  s->opt_generation = reply->generation;
+  return SANE_STATUS_GOOD;
+}
+
+/* Run NUM_ACTIONS option actions in a single SANE_NET_CONTROL_OPTIONS
+   call and bring the cached descriptors up to date.  Values sent back by
+   saned are copied into the actions; *INFO gets the info bits of all of
+   them.  If the cache could not be updated, the options are invalidated
+   and SANE_INFO_RELOAD_OPTIONS is reported.  */
+static SANE_Status
+control_options (Net_Scanner * s, SANE_Word num_actions,
+		 SANE_Option_Action * actions, SANE_Word * info)
+{
+  SANE_Control_Options_Req req;
+  SANE_Control_Options_Reply reply;
+  SANE_Status status;
+  SANE_Word i, local_info = 0;
+  int need_auth;
+
+  req.handle = s->handle;
+  req.generation = s->options_valid ? s->opt_generation : 0;
+  req.num_actions = num_actions;
+  req.actions = actions;
+
+  DBG (3, "control_options: %d actions, generation %d\n", num_actions,
+       req.generation);
+  memset (&reply, 0, sizeof (reply));
+  sanei_w_call (&s->hw->wire, SANE_NET_CONTROL_OPTIONS,
+		(WireCodecFunc) sanei_w_control_options_req, &req,
+		(WireCodecFunc) sanei_w_control_options_reply, &reply);
+
+  do
+    {
+      if (s->hw->wire.status)
+	{
+	  DBG (1, "control_options: failed (%s)\n",
+	       strerror (s->hw->wire.status));
+	  sanei_w_free (&s->hw->wire,
+			(WireCodecFunc) sanei_w_control_options_reply, &reply);
+	  s->options_valid = 0;
+	  return SANE_STATUS_IO_ERROR;
+	}
+
+      status = reply.status;
+      need_auth = (reply.resource_to_authorize != 0);
+      if (need_auth)
+	{
+	  DBG (3, "control_options: auth required\n");
+	  do_authorization (s->hw, reply.resource_to_authorize);
+	  sanei_w_free (&s->hw->wire,
+			(WireCodecFunc) sanei_w_control_options_reply, &reply);
+
+	  sanei_w_set_dir (&s->hw->wire, WIRE_DECODE);
+
+	  sanei_w_control_options_reply (&s->hw->wire, &reply);
+	  continue;
+	}
+
+      for (i = 0; i < reply.num_results && i < num_actions; ++i)
+	{
+	  SANE_Option_Result *r = &reply.results[i];
+
+	  if (r->status != SANE_STATUS_GOOD)
+	    continue;
+	  local_info |= r->info;
+	  if (actions[i].value_size == 0)
+	    continue;
+	  if (r->value_size == actions[i].value_size)
+	    memcpy (actions[i].value, r->value, r->value_size);
+	  else
+	    DBG (1, "control_options: size of option %d changed from %d "
+		 "to %d\n", actions[i].option, actions[i].value_size,
+		 r->value_size);
+	}
+
+      if (apply_option_changes (s, &reply) != SANE_STATUS_GOOD)
+	{
+	  s->options_valid = 0;
+	  s->opt_generation = 0;
+	  local_info |= SANE_INFO_RELOAD_OPTIONS;
+	}
+
+      sanei_w_free (&s->hw->wire,
+		    (WireCodecFunc) sanei_w_control_options_reply, &reply);
+    }
+  while (need_auth);
+
+  if (info)
+    *info = local_info;
+  DBG (3, "control_options: done (%s, info %x)\n", sane_strstatus (status),
+       local_info);
+  return status;
+}
+
 static SANE_Status
 fetch_options (Net_Scanner * s)
 {
+  SANE_Status status;
   int option_number;
   DBG (3, "fetch_options: %p\n", (void *) s);
 
@@ -589,15 +746,37 @@ fetch_options (Net_Scanner * s)
 	  return SANE_STATUS_IO_ERROR;
 	}
     }
-  DBG (3, "fetch_options: get_option_descriptors\n");
-  sanei_w_call (&s->hw->wire, SANE_NET_GET_OPTION_DESCRIPTORS,
-		(WireCodecFunc) sanei_w_word, &s->handle,
-		(WireCodecFunc) sanei_w_option_descriptor_array, &s->opt);
-  if (s->hw->wire.status)
+  s->opt.num_options = 0;
+  s->opt.desc = NULL;
+  s->opt_generation = 0;
+  s->options_valid = 0;
+
+  if (s->hw->wire.version >= SANEI_NET_OPTION_BATCH_VERSION)
     {
-      DBG (1, "fetch_options: failed to get option descriptors (%s)\n",
-	   strerror (s->hw->wire.status));
-      return SANE_STATUS_IO_ERROR;
+      /* an empty batch with generation 0 returns every descriptor */
+      DBG (3, "fetch_options: control_options\n");
+      status = control_options (s, 0, NULL, NULL);
+      if (status == SANE_STATUS_GOOD && s->opt_generation == 0)
+	status = SANE_STATUS_IO_ERROR;
+      if (status != SANE_STATUS_GOOD)
+	{
+	  DBG (1, "fetch_options: failed to get option descriptors (%s)\n",
+	       sane_strstatus (status));
+	  return status;
+	}
+    }
+  else
+    {
+      DBG (3, "fetch_options: get_option_descriptors\n");
+      sanei_w_call (&s->hw->wire, SANE_NET_GET_OPTION_DESCRIPTORS,
+		    (WireCodecFunc) sanei_w_word, &s->handle,
+		    (WireCodecFunc) sanei_w_option_descriptor_array, &s->opt);
+      if (s->hw->wire.status)
+	{
+	  DBG (1, "fetch_options: failed to get option descriptors (%s)\n",
+	       strerror (s->hw->wire.status));
+	  return SANE_STATUS_IO_ERROR;
+	}
     }
 
   if (s->local_opt.num_options == 0)
@@ -1069,6 +1248,24 @@ sane_init (SANE_Int * version_code, SANE_Auth_Callback authorize)
 		  DBG (2, "sane_init: connect timeout set to %d seconds\n", connect_timeout);
 		}
 
+	      continue;
+	    }
+	  if (strstr(device_name, "data_compression") != NULL)
+	    {
+	      optval = strchr(device_name, '=');
+
+	      if (!optval)
+		continue;
+
+	      optval = sanei_config_skip_whitespace (++optval);
+	      if ((optval != NULL) && (*optval != '\0'))
+		{
+		  data_compression = (strncmp (optval, "no", 2) != 0);
+
+		  DBG (2, "sane_init: data compression %s\n",
+		       data_compression ? "enabled" : "disabled");
+		}
+
 	      continue;
 	    }
 #if WITH_AVAHI
@@ -1711,6 +1908,8 @@ sane_close (SANE_Handle handle)
       DBG (2, "sane_close: closing data pipe\n");
       close (s->data);
     }
+  free (s->cbuf);
+  free (s->dbuf);
   free (s);
   DBG (2, "sane_close: done\n");
 }
@@ -1797,6 +1996,33 @@ sane_control_option (SANE_Handle handle, SANE_Int option,
   if (action == SANE_ACTION_SET_AUTO)
     value_size = 0;
 
+  if (s->hw->wire.version >= SANEI_NET_OPTION_BATCH_VERSION)
+    {
+      SANE_Option_Action a;
+
+      /* saned sends the descriptors that changed along with the result,
+         so SANE_INFO_RELOAD_OPTIONS does not need another round trip */
+      a.option = option;
+      a.action = action;
+      a.value_type = s->opt.desc[option]->type;
+      a.value_size = value_size;
+      a.value = value;
+
+      status = control_options (s, 1, &a, &local_info);
+      if (info)
+	*info = local_info;
+
+      if (status == SANE_STATUS_GOOD && info == NULL && !s->options_valid)
+	{
+	  DBG (2, "sane_control_option: reloading options as frontend does not care\n");
+	  status = fetch_options (s);
+	}
+
+      DBG (2, "sane_control_option: done (%s, info %x)\n",
+	   sane_strstatus (status), local_info);
+      return status;
+    }
+
   req.handle = s->handle;
   req.option = option;
   req.action = action;
@@ -1905,6 +2131,7 @@ SANE_Status
 sane_start (SANE_Handle handle)
 {
   Net_Scanner *s = handle;
+  SANE_Start_Req req;
   SANE_Start_Reply reply;
   struct sockaddr_in sin;
   struct sockaddr *sa;
@@ -1963,8 +2190,10 @@ sane_start (SANE_Handle handle)
     }
 
   DBG (3, "sane_start: remote start\n");
+  req.handle = s->handle;
+  req.flags = data_compression ? 0 : SANEI_NET_START_NO_COMPRESSION;
   sanei_w_call (&s->hw->wire, SANE_NET_START,
-		(WireCodecFunc) sanei_w_word, &s->handle,
+		(WireCodecFunc) sanei_w_start_req, &req,
 		(WireCodecFunc) sanei_w_start_reply, &reply);
   do
     {
@@ -2034,6 +2263,8 @@ sane_start (SANE_Handle handle)
   s->data = fd;
   s->reclen_buf_offset = 0;
   s->bytes_remaining = 0;
+  s->compressed = 0;
+  s->dbuf_len = s->dbuf_offset = 0;
   DBG (3, "sane_start: done (%s)\n", sane_strstatus (status));
   return status;
 }
@@ -2044,6 +2275,7 @@ SANE_Status
 sane_start (SANE_Handle handle)
 {
   Net_Scanner *s = handle;
+  SANE_Start_Req req;
   SANE_Start_Reply reply;
   struct sockaddr_in sin;
   SANE_Status status;
@@ -2080,8 +2312,10 @@ sane_start (SANE_Handle handle)
     }
 
   DBG (3, "sane_start: remote start\n");
+  req.handle = s->handle;
+  req.flags = data_compression ? 0 : SANEI_NET_START_NO_COMPRESSION;
   sanei_w_call (&s->hw->wire, SANE_NET_START,
-		(WireCodecFunc) sanei_w_word, &s->handle,
+		(WireCodecFunc) sanei_w_start_req, &req,
 		(WireCodecFunc) sanei_w_start_reply, &reply);
   do
     {
@@ -2141,17 +2375,79 @@ sane_start (SANE_Handle handle)
   s->data = fd;
   s->reclen_buf_offset = 0;
   s->bytes_remaining = 0;
+  s->compressed = 0;
+  s->dbuf_len = s->dbuf_offset = 0;
   DBG (3, "sane_start: done (%s)\n", sane_strstatus (status));
   return status;
 }
 #endif /* NET_USES_AF_INDEP */
 
 
+/* Receive the rest of a compressed data record and decompress it.  If the
+   record is incomplete (non-blocking mode), s->compressed stays set.  */
+static SANE_Status
+read_compressed_record (Net_Scanner * s)
+{
+  ssize_t nread;
+  size_t size;
+  SANE_Byte *buf;
+
+  while (s->bytes_remaining > 0)
+    {
+      nread = read (s->data, s->cbuf + s->cbuf_len, s->bytes_remaining);
+      if (nread < 0)
+	{
+	  if (errno == EAGAIN)
+	    return SANE_STATUS_GOOD;
+	  DBG (1, "read_compressed_record: read failed (%s)\n",
+	       strerror (errno));
+	  return SANE_STATUS_IO_ERROR;
+	}
+      if (nread == 0)
+	{
+	  DBG (1, "read_compressed_record: data connection closed\n");
+	  return SANE_STATUS_IO_ERROR;
+	}
+      s->cbuf_len += nread;
+      s->bytes_remaining -= nread;
+    }
+
+  if (sanei_net_decompressed_size (s->cbuf, s->cbuf_len, &size)
+      != SANE_STATUS_GOOD)
+    {
+      DBG (1, "read_compressed_record: invalid record header\n");
+      return SANE_STATUS_IO_ERROR;
+    }
+  if (size > s->dbuf_size)
+    {
+      buf = realloc (s->dbuf, size);
+      if (!buf)
+	return SANE_STATUS_NO_MEM;
+      s->dbuf = buf;
+      s->dbuf_size = size;
+    }
+  if (sanei_net_decompress (s->cbuf, s->cbuf_len, s->dbuf, size)
+      != SANE_STATUS_GOOD)
+    {
+      DBG (1, "read_compressed_record: corrupt record\n");
+      return SANE_STATUS_IO_ERROR;
+    }
+  DBG (4, "read_compressed_record: %lu bytes decompressed to %lu\n",
+       (u_long) s->cbuf_len, (u_long) size);
+
+  s->compressed = 0;
+  s->dbuf_len = size;
+  s->dbuf_offset = 0;
+  return SANE_STATUS_GOOD;
+}
+
 SANE_Status
 sane_read (SANE_Handle handle, SANE_Byte * data, SANE_Int max_length,
 	   SANE_Int * length)
 {
   Net_Scanner *s = handle;
+  SANE_Status status;
+  SANE_Byte *buf;
   ssize_t nread;
   SANE_Int cnt;
   SANE_Int start_cnt;
@@ -2195,7 +2491,7 @@ sane_read (SANE_Handle handle, SANE_Byte * data, SANE_Int max_length,
       return SANE_STATUS_CANCELLED;
     }
 
-  if (s->bytes_remaining == 0)
+  if (s->bytes_remaining == 0 && s->dbuf_offset == s->dbuf_len)
     {
       /* boy, is this painful or what? */
 
@@ -2253,27 +2549,78 @@ sane_read (SANE_Handle handle, SANE_Byte * data, SANE_Int max_length,
 	  do_cancel (s);
 	  return (SANE_Status) ch;
 	}
+      if (s->bytes_remaining & SANEI_NET_RECORD_COMPRESSED)
+	{
+	  s->bytes_remaining &= SANEI_NET_RECORD_LENGTH_MASK;
+	  if (s->hw->wire.version < SANEI_NET_COMPRESSION_VERSION
+	      || s->bytes_remaining == 0
+	      || s->bytes_remaining > NET_MAX_COMPRESSED_RECORD)
+	    {
+	      DBG (1, "sane_read: unexpected compressed record of %lu bytes\n",
+		   (u_long) s->bytes_remaining);
+	      do_cancel (s);
+	      return SANE_STATUS_IO_ERROR;
+	    }
+	  if (s->bytes_remaining > s->cbuf_size)
+	    {
+	      buf = realloc (s->cbuf, s->bytes_remaining);
+	      if (!buf)
+		{
+		  do_cancel (s);
+		  return SANE_STATUS_NO_MEM;
+		}
+	      s->cbuf = buf;
+	      s->cbuf_size = s->bytes_remaining;
+	    }
+	  s->cbuf_len = 0;
+	  s->compressed = 1;
+	}
     }
 
-  if (max_length > (SANE_Int) s->bytes_remaining)
-    max_length = s->bytes_remaining;
-
-  nread = read (s->data, data, max_length);
-
-  if (nread < 0)
+  if (s->compressed)
     {
-      DBG (2, "sane_read: error code %s\n", strerror (errno));
-      if (errno == EAGAIN)
-	return SANE_STATUS_GOOD;
-      else
+      status = read_compressed_record (s);
+      if (status != SANE_STATUS_GOOD)
 	{
 	  DBG (1, "sane_read: cancelling scan\n");
 	  do_cancel (s);
-	  return SANE_STATUS_IO_ERROR;
+	  return status;
 	}
+      if (s->compressed)
+	return SANE_STATUS_GOOD;	/* rest of the record not there yet */
     }
 
-  s->bytes_remaining -= nread;
+  if (s->dbuf_offset < s->dbuf_len)
+    {
+      /* serve what's left of a decompressed record */
+      if ((size_t) max_length > s->dbuf_len - s->dbuf_offset)
+	max_length = s->dbuf_len - s->dbuf_offset;
+      memcpy (data, s->dbuf + s->dbuf_offset, max_length);
+      s->dbuf_offset += max_length;
+      nread = max_length;
+    }
+  else
+    {
+      if (max_length > (SANE_Int) s->bytes_remaining)
+	max_length = s->bytes_remaining;
+
+      nread = read (s->data, data, max_length);
+
+      if (nread < 0)
+	{
+	  DBG (2, "sane_read: error code %s\n", strerror (errno));
+	  if (errno == EAGAIN)
+	    return SANE_STATUS_GOOD;
+	  else
+	    {
+	      DBG (1, "sane_read: cancelling scan\n");
+	      do_cancel (s);
+	      return SANE_STATUS_IO_ERROR;
+	    }
+	}
+
+      s->bytes_remaining -= nread;
+    }
 
   *length = nread;
   /* Check whether we are scanning with a depth of 16 bits/pixel and whether
@@ -70,6 +70,7 @@ typedef struct Net_Scanner
 
     int options_valid;			/* are the options current? */
     SANE_Option_Descriptor_Array opt, local_opt;
+    SANE_Word opt_generation;		/* saned's name for this set of opt */
 
     SANE_Word handle;		/* remote handle (it's a word, not a ptr!) */
 
@@ -78,6 +79,13 @@ typedef struct Net_Scanner
     u_char reclen_buf[4];
     size_t bytes_remaining;	/* how many bytes left in this record? */
 
+    /* compressed records are received whole and then decompressed: */
+    int compressed;		/* is the current record compressed? */
+    SANE_Byte *cbuf;		/* compressed record being received */
+    size_t cbuf_size, cbuf_len;
+    SANE_Byte *dbuf;		/* decompressed data not returned yet */
+    size_t dbuf_size, dbuf_len, dbuf_offset;
+
     /* device (host) info: */
     Net_Device *hw;
   }
@@ -46,6 +46,11 @@
 # undef ENABLE_IPV6
 #endif /* HAVE_GETADDRINFO && HAVE_GETNAMEINFO */
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(USE_PTHREAD) \
+    && defined(SANED_USES_AF_INDEP)
+# define SANED_USES_THREADS
+#endif
+
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -88,6 +93,17 @@
 
 #include "lgetopt.h"
 
+#ifdef SANED_USES_THREADS
+# include <stddef.h>
+# include <pthread.h>
+# include <sys/epoll.h>
+#endif
+
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+# define SANED_USES_ZEROCOPY
+# include <linux/errqueue.h>
+#endif
+
 #if defined(HAVE_POLL_H) && defined(HAVE_POLL)
 # include <poll.h>
 #else
@@ -241,6 +257,8 @@ int numchildren;
 enum saned_fd_type {
   SANED_FD_LISTENER,
   SANED_FD_PROCESS,
+  SANED_FD_CLIENT,		/* control connection, --threaded only */
+  SANED_FD_WAKEUP,		/* wakes up the --threaded event loop */
 };
 struct saned_fd
 {
@@ -265,22 +283,64 @@ typedef struct
   u_int inuse:1;		/* is this handle in use? */
   u_int scanning:1;		/* are we scanning? */
   u_int docancel:1;		/* cancel the current scan */
+  u_int nocompress:1;		/* send the scan uncompressed */
   SANE_Handle handle;		/* backends handle */
+  /* option descriptors as last sent by SANE_NET_CONTROL_OPTIONS: */
+  SANE_Word generation;
+  SANE_Int num_options;
+  SANE_Option_Descriptor *options;
+#ifdef SANED_USES_THREADS
+  struct saned_backend *backend;	/* serializes the calls to the backend */
+#endif
 }
 Handle;
 
-static SANE_Net_Procedure_Number current_request;
+/* State of one control connection.  */
+typedef struct saned_client
+{
+  Wire wire;
+  Handle *handle;
+  int num_handles;
+  int last_handle_checked;
+  SANE_Net_Procedure_Number current_request;
+  int can_authorize;
+  char *username;
+  char *remote_ip;
+#ifdef SANED_USES_AF_INDEP
+  union {
+    struct sockaddr_storage ss;
+    struct sockaddr sa;
+    struct sockaddr_in sin;
+#ifdef ENABLE_IPV6
+    struct sockaddr_in6 sin6;
+#endif
+  } remote_address;
+  int remote_address_len;
+#else
+  struct in_addr remote_address;
+#endif /* SANED_USES_AF_INDEP */
+#ifdef SANED_USES_THREADS
+  struct saned_fd event;	/* registration with the event loop */
+  int initialized;		/* has SANE_NET_INIT been processed? */
+  char *device;			/* first device opened by this client */
+  struct saned_worker *worker;	/* thread running the client's requests */
+  struct saned_client *queue_next;
+  struct saned_client *next;	/* list of all clients */
+  time_t idle_since;		/* when the client went idle, 0 while busy */
+#endif /* SANED_USES_THREADS */
+}
+Client;
+
 static const char *prog_name;
-static int can_authorize;
-static Wire wire;
-static int num_handles;
+static Client client;		/* the client of a forked or inetd saned */
 static int debug;
 static int run_mode;
 static int run_foreground;
 static int run_once;
 static int allow_network;
 static int data_connect_timeout = 4000;
-static Handle *handle;
+static int data_compression = 1;
+static int data_zerocopy = 1;
 static char *bind_addr;
 static short bind_port = -1;
 static size_t buffer_size = (1 * 1024 * 1024);
@@ -295,26 +355,11 @@ byte_order;
    it does is save a remote user some work by reducing the amount of
    text s/he has to type when authentication is requested.  */
 static const char *default_username = "saned-user";
-static char *remote_ip;
 
 /* data port range */
 static in_port_t data_port_lo;
 static in_port_t data_port_hi;
 
-#ifdef SANED_USES_AF_INDEP
-static union {
-  struct sockaddr_storage ss;
-  struct sockaddr sa;
-  struct sockaddr_in sin;
-#ifdef ENABLE_IPV6
-  struct sockaddr_in6 sin6;
-#endif
-} remote_address;
-static int remote_address_len;
-#else
-static struct in_addr remote_address;
-#endif /* SANED_USES_AF_INDEP */
-
 #ifndef _PATH_HEQUIV
 # define _PATH_HEQUIV   "/etc/hosts.equiv"
 #endif
@@ -326,11 +371,14 @@ static const char *config_file_names[] = {
 static SANE_Bool log_to_syslog = SANE_TRUE;
 
 /* forward declarations: */
-static int process_request (Wire * w);
+static int process_request (Client * c);
 
 #define SANED_RUN_INETD  0
 #define SANED_RUN_ALONE  1
 
+/* seconds without activity after which a connection is dropped */
+#define SANED_IDLE_TIMEOUT 3600
+
 #define DBG_ERR  1
 #define DBG_WARN 2
 #define DBG_MSG  3
@@ -363,12 +411,178 @@ saned_debug_call (int level, const char *fmt, ...)
 #endif
 }
 
+#ifdef SANED_USES_THREADS
+/* With --threaded, a single process serves all clients.  The main thread
+   waits for connections and requests with epoll.  A request is run by
+   the worker thread of the device the client opened, or by the general
+   worker before it opened one.  This serializes the requests for each
+   device while different devices scan concurrently, and keeps the
+   backends loaded from one connection to the next.  */
+typedef struct saned_worker
+{
+  char *device;			/* NULL for the general worker */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  Client *head, *tail;		/* clients with a pending request */
+  struct saned_worker *next;
+}
+Worker;
+
+/* Backends are not required to be thread-safe.  The calls that change
+   the device lists (sane_get_devices, sane_open and sane_close) may
+   touch any backend and state shared by all of them, such as the
+   sanei_usb device list, so they exclude all other backend calls.  The
+   other calls run on a handle and only exclude the calls to devices of
+   the same backend.  */
+typedef struct saned_backend
+{
+  char *name;
+  pthread_mutex_t lock;
+  struct saned_backend *next;
+}
+Backend;
+
+static int run_threaded;
+static pthread_key_t current_client_key;
+static int epoll_fd = -1;
+static int wakeup_pipe[2] = { -1, -1 };
+static Worker *workers;
+static Worker *general_worker;
+static int workers_quit;
+static Client *clients;
+static int num_clients;
+/* protects the worker and client lists */
+static pthread_mutex_t workers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t backend_lock = PTHREAD_RWLOCK_INITIALIZER;
+/* only changed while backend_lock is held for writing */
+static Backend *backends;
+#endif /* SANED_USES_THREADS */
+
+static void
+lock_backends (void)
+{
+#ifdef SANED_USES_THREADS
+  if (run_threaded)
+    pthread_rwlock_wrlock (&backend_lock);
+#endif
+}
+
+static void
+unlock_backends (void)
+{
+#ifdef SANED_USES_THREADS
+  if (run_threaded)
+    pthread_rwlock_unlock (&backend_lock);
+#endif
+}
+
+/* Must be held around every backend call on the handle.  */
+static void
+lock_handle (Handle * hd)
+{
+#ifdef SANED_USES_THREADS
+  if (run_threaded)
+    {
+      pthread_rwlock_rdlock (&backend_lock);
+      pthread_mutex_lock (&hd->backend->lock);
+    }
+#else
+  (void) hd;
+#endif
+}
+
+static void
+unlock_handle (Handle * hd)
+{
+#ifdef SANED_USES_THREADS
+  if (run_threaded)
+    {
+      pthread_mutex_unlock (&hd->backend->lock);
+      pthread_rwlock_unlock (&backend_lock);
+    }
+#else
+  (void) hd;
+#endif
+}
+
+#ifdef SANED_USES_THREADS
+/* Find the lock of backend NAME and create it on first use.  Must be
+   called with the backends locked.  */
+static Backend *
+find_backend (const char *name)
+{
+  Backend *be;
+
+  for (be = backends; be; be = be->next)
+    if (strcmp (be->name, name) == 0)
+      return be;
+
+  be = calloc (1, sizeof (*be));
+  if (!be)
+    return NULL;
+  be->name = strdup (name);
+  if (!be->name)
+    {
+      free (be);
+      return NULL;
+    }
+  pthread_mutex_init (&be->lock, NULL);
+  be->next = backends;
+  backends = be;
+  return be;
+}
+
+static void
+free_backends (void)
+{
+  Backend *be;
+
+  while (backends)
+    {
+      be = backends;
+      backends = be->next;
+      pthread_mutex_destroy (&be->lock);
+      free (be->name);
+      free (be);
+    }
+}
+#endif /* SANED_USES_THREADS */
+
+/* The client whose request the calling thread is processing.  The
+   backends' authorization callback has no other way to find it.  */
+static void
+set_current_client (Client * c)
+{
+#ifdef SANED_USES_THREADS
+  if (run_threaded)
+    pthread_setspecific (current_client_key, c);
+#else
+  (void) c;
+#endif
+}
+
+static Client *
+get_current_client (void)
+{
+#ifdef SANED_USES_THREADS
+  if (run_threaded)
+    return pthread_getspecific (current_client_key);
+#endif
+  return &client;
+}
 
 static void
 reset_watchdog (void)
 {
+#ifdef SANED_USES_THREADS
+  /* the alarm would take all other clients down as well; idle clients
+     are dropped by close_idle_clients () instead */
+  if (run_threaded)
+    return;
+#endif
   if (!debug)
-    alarm (3600);
+    alarm (SANED_IDLE_TIMEOUT);
 }
 
 static void
@@ -376,6 +590,7 @@ auth_callback (SANE_String_Const res,
 	       SANE_Char *username,
 	       SANE_Char *password)
 {
+  Client *c = get_current_client ();
   SANE_Net_Procedure_Number procnum;
   SANE_Authorization_Req req;
   SANE_Word word, ack = 0;
@@ -383,7 +598,7 @@ auth_callback (SANE_String_Const res,
   memset (username, 0, SANE_MAX_USERNAME_LEN);
   memset (password, 0, SANE_MAX_PASSWORD_LEN);
 
-  if (!can_authorize)
+  if (!c->can_authorize)
     {
       DBG (DBG_WARN,
 	   "auth_callback: called during non-authorizable RPC (resource=%s)\n",
@@ -391,13 +606,13 @@ auth_callback (SANE_String_Const res,
       return;
     }
 
-  if (wire.status)
+  if (c->wire.status)
     {
-      DBG(DBG_ERR, "auth_callback: bad status %d\n", wire.status);
+      DBG(DBG_ERR, "auth_callback: bad status %d\n", c->wire.status);
       return;
     }
 
-  switch (current_request)
+  switch (c->current_request)
     {
     case SANE_NET_OPEN:
       {
@@ -405,7 +620,7 @@ auth_callback (SANE_String_Const res,
 
 	memset (&reply, 0, sizeof (reply));
 	reply.resource_to_authorize = (char *) res;
-	sanei_w_reply (&wire, (WireCodecFunc) sanei_w_open_reply, &reply);
+	sanei_w_reply (&c->wire, (WireCodecFunc) sanei_w_open_reply, &reply);
       }
       break;
 
@@ -415,42 +630,53 @@ auth_callback (SANE_String_Const res,
 
 	memset (&reply, 0, sizeof (reply));
 	reply.resource_to_authorize = (char *) res;
-	sanei_w_reply (&wire,
+	sanei_w_reply (&c->wire,
 		       (WireCodecFunc) sanei_w_control_option_reply, &reply);
       }
       break;
 
+    case SANE_NET_CONTROL_OPTIONS:
+      {
+	SANE_Control_Options_Reply reply;
+
+	memset (&reply, 0, sizeof (reply));
+	reply.resource_to_authorize = (char *) res;
+	sanei_w_reply (&c->wire,
+		       (WireCodecFunc) sanei_w_control_options_reply, &reply);
+      }
+      break;
+
     case SANE_NET_START:
       {
 	SANE_Start_Reply reply;
 
 	memset (&reply, 0, sizeof (reply));
 	reply.resource_to_authorize = (char *) res;
-	sanei_w_reply (&wire, (WireCodecFunc) sanei_w_start_reply, &reply);
+	sanei_w_reply (&c->wire, (WireCodecFunc) sanei_w_start_reply, &reply);
       }
       break;
 
     default:
       DBG (DBG_WARN,
 	   "auth_callback: called for unexpected request %d (resource=%s)\n",
-	   current_request, res);
+	   c->current_request, res);
       break;
     }
 
-  if (wire.status)
+  if (c->wire.status)
     {
-      DBG(DBG_ERR, "auth_callback: bad status %d\n", wire.status);
+      DBG(DBG_ERR, "auth_callback: bad status %d\n", c->wire.status);
       return;
     }
 
   reset_watchdog ();
 
-  sanei_w_set_dir (&wire, WIRE_DECODE);
-  sanei_w_word (&wire, &word);
+  sanei_w_set_dir (&c->wire, WIRE_DECODE);
+  sanei_w_word (&c->wire, &word);
 
-  if (wire.status)
+  if (c->wire.status)
     {
-      DBG(DBG_ERR, "auth_callback: bad status %d\n", wire.status);
+      DBG(DBG_ERR, "auth_callback: bad status %d\n", c->wire.status);
       return;
     }
 
@@ -464,10 +690,10 @@ auth_callback (SANE_String_Const res,
       return;
     }
 
-  sanei_w_authorization_req (&wire, &req);
-  if (wire.status)
+  sanei_w_authorization_req (&c->wire, &req);
+  if (c->wire.status)
     {
-      DBG(DBG_ERR, "auth_callback: bad status %d\n", wire.status);
+      DBG(DBG_ERR, "auth_callback: bad status %d\n", c->wire.status);
       return;
     }
 
@@ -481,8 +707,8 @@ auth_callback (SANE_String_Const res,
 	   "auth_callback: got auth for resource %s (expected resource=%s)\n",
 	   res, req.resource);
     }
-  sanei_w_free (&wire, (WireCodecFunc) sanei_w_authorization_req, &req);
-  sanei_w_reply (&wire, (WireCodecFunc) sanei_w_word, &ack);
+  sanei_w_free (&c->wire, (WireCodecFunc) sanei_w_authorization_req, &req);
+  sanei_w_reply (&c->wire, (WireCodecFunc) sanei_w_word, &ack);
 }
 
 static void
@@ -501,14 +727,14 @@ quit (int signum)
     }
   running = 1;
 
-  for (i = 0; i < num_handles; ++i)
-    if (handle[i].inuse)
-      sane_close (handle[i].handle);
+  for (i = 0; i < client.num_handles; ++i)
+    if (client.handle[i].inuse)
+      sane_close (client.handle[i].handle);
 
   sane_exit ();
-  sanei_w_exit (&wire);
-  if (handle)
-    free (handle);
+  sanei_w_exit (&client.wire);
+  if (client.handle)
+    free (client.handle);
   DBG (DBG_WARN, "quit: exiting\n");
   if (log_to_syslog)
     closelog ();
@@ -516,62 +742,334 @@ quit (int signum)
 }
 
 static SANE_Word
-get_free_handle (void)
+get_free_handle (Client * c)
 {
 # define ALLOC_INCREMENT        16
-  static int h, last_handle_checked = -1;
+  int h;
 
-  if (num_handles > 0)
+  if (c->num_handles > 0)
     {
-      h = last_handle_checked + 1;
+      h = c->last_handle_checked + 1;
       do
 	{
-	  if (h >= num_handles)
+	  if (h >= c->num_handles)
 	    h = 0;
-	  if (!handle[h].inuse)
+	  if (!c->handle[h].inuse)
 	    {
-	      last_handle_checked = h;
-	      memset (handle + h, 0, sizeof (handle[0]));
-	      handle[h].inuse = 1;
+	      c->last_handle_checked = h;
+	      memset (c->handle + h, 0, sizeof (c->handle[0]));
+	      c->handle[h].inuse = 1;
 	      return h;
 	    }
 	  ++h;
 	}
-      while (h != last_handle_checked);
+      while (h != c->last_handle_checked);
     }
 
   /* we're out of handles---alloc some more: */
-  last_handle_checked = num_handles - 1;
-  num_handles += ALLOC_INCREMENT;
-  if (handle)
-    handle = realloc (handle, num_handles * sizeof (handle[0]));
+  c->last_handle_checked = c->num_handles - 1;
+  c->num_handles += ALLOC_INCREMENT;
+  if (c->handle)
+    c->handle = realloc (c->handle, c->num_handles * sizeof (c->handle[0]));
   else
-    handle = malloc (num_handles * sizeof (handle[0]));
-  if (!handle)
+    c->handle = malloc (c->num_handles * sizeof (c->handle[0]));
+  if (!c->handle)
     return -1;
-  memset (handle + last_handle_checked + 1, 0,
-	  ALLOC_INCREMENT * sizeof (handle[0]));
-  return get_free_handle ();
+  memset (c->handle + c->last_handle_checked + 1, 0,
+	  ALLOC_INCREMENT * sizeof (c->handle[0]));
+  return get_free_handle (c);
 # undef ALLOC_INCREMENT
 }
 
 static void
-close_handle (int h)
+free_descriptor_copy (SANE_Option_Descriptor * d)
+{
+  int i;
+
+  free ((void *) d->name);
+  free ((void *) d->title);
+  free ((void *) d->desc);
+  switch (d->constraint_type)
+    {
+    case SANE_CONSTRAINT_RANGE:
+      free ((void *) d->constraint.range);
+      break;
+    case SANE_CONSTRAINT_WORD_LIST:
+      free ((void *) d->constraint.word_list);
+      break;
+    case SANE_CONSTRAINT_STRING_LIST:
+      if (d->constraint.string_list)
+	for (i = 0; d->constraint.string_list[i]; ++i)
+	  free ((void *) d->constraint.string_list[i]);
+      free ((void *) d->constraint.string_list);
+      break;
+    default:
+      break;
+    }
+  memset (d, 0, sizeof (*d));
+}
+
+static SANE_Status
+copy_descriptor (SANE_Option_Descriptor * dst,
+		 const SANE_Option_Descriptor * src)
 {
-  if (h >= 0 && handle[h].inuse)
+  SANE_String_Const *list;
+  int i, n;
+
+  free_descriptor_copy (dst);
+  *dst = *src;
+  dst->name = src->name ? strdup (src->name) : NULL;
+  dst->title = src->title ? strdup (src->title) : NULL;
+  dst->desc = src->desc ? strdup (src->desc) : NULL;
+  dst->constraint_type = SANE_CONSTRAINT_NONE;
+
+  switch (src->constraint_type)
     {
-      sane_close (handle[h].handle);
-      handle[h].inuse = 0;
+    case SANE_CONSTRAINT_RANGE:
+      if (src->constraint.range)
+	{
+	  SANE_Range *range = malloc (sizeof (*range));
+	  if (!range)
+	    goto no_mem;
+	  *range = *src->constraint.range;
+	  dst->constraint.range = range;
+	}
+      break;
+
+    case SANE_CONSTRAINT_WORD_LIST:
+      if (src->constraint.word_list)
+	{
+	  n = src->constraint.word_list[0] + 1;
+	  dst->constraint.word_list = malloc (n * sizeof (SANE_Word));
+	  if (!dst->constraint.word_list)
+	    goto no_mem;
+	  memcpy ((void *) dst->constraint.word_list,
+		  src->constraint.word_list, n * sizeof (SANE_Word));
+	}
+      break;
+
+    case SANE_CONSTRAINT_STRING_LIST:
+      if (src->constraint.string_list)
+	{
+	  for (n = 0; src->constraint.string_list[n]; ++n);
+	  list = calloc (n + 1, sizeof (list[0]));
+	  if (!list)
+	    goto no_mem;
+	  dst->constraint.string_list = list;
+	  dst->constraint_type = SANE_CONSTRAINT_STRING_LIST;
+	  for (i = 0; i < n; ++i)
+	    if (!(list[i] = strdup (src->constraint.string_list[i])))
+	      goto no_mem;
+	}
+      break;
+
+    default:
+      break;
     }
+  dst->constraint_type = src->constraint_type;
+
+  if ((src->name && !dst->name) || (src->title && !dst->title)
+      || (src->desc && !dst->desc))
+    goto no_mem;
+  return SANE_STATUS_GOOD;
+
+no_mem:
+  free_descriptor_copy (dst);
+  return SANE_STATUS_NO_MEM;
+}
+
+static int
+string_equal (SANE_String_Const a, SANE_String_Const b)
+{
+  if (!a || !b)
+    return a == b;
+  return strcmp (a, b) == 0;
+}
+
+static int
+descriptor_equal (const SANE_Option_Descriptor * a,
+		  const SANE_Option_Descriptor * b)
+{
+  int i;
+
+  if (!string_equal (a->name, b->name) || !string_equal (a->title, b->title)
+      || !string_equal (a->desc, b->desc) || a->type != b->type
+      || a->unit != b->unit || a->size != b->size || a->cap != b->cap
+      || a->constraint_type != b->constraint_type)
+    return 0;
+
+  switch (a->constraint_type)
+    {
+    case SANE_CONSTRAINT_RANGE:
+      if (!a->constraint.range || !b->constraint.range)
+	return a->constraint.range == b->constraint.range;
+      return memcmp (a->constraint.range, b->constraint.range,
+		     sizeof (SANE_Range)) == 0;
+
+    case SANE_CONSTRAINT_WORD_LIST:
+      if (!a->constraint.word_list || !b->constraint.word_list)
+	return a->constraint.word_list == b->constraint.word_list;
+      return a->constraint.word_list[0] == b->constraint.word_list[0]
+	&& memcmp (a->constraint.word_list, b->constraint.word_list,
+		   (a->constraint.word_list[0] + 1) * sizeof (SANE_Word)) == 0;
+
+    case SANE_CONSTRAINT_STRING_LIST:
+      if (!a->constraint.string_list || !b->constraint.string_list)
+	return a->constraint.string_list == b->constraint.string_list;
+      for (i = 0; a->constraint.string_list[i]; ++i)
+	if (!string_equal (a->constraint.string_list[i],
+			   b->constraint.string_list[i]))
+	  return 0;
+      return b->constraint.string_list[i] == NULL;
+
+    default:
+      return 1;
+    }
+}
+
+static void
+free_option_snapshot (Handle * hd)
+{
+  int i;
+
+  for (i = 0; i < hd->num_options; ++i)
+    free_descriptor_copy (&hd->options[i]);
+  free (hd->options);
+  hd->options = NULL;
+  hd->num_options = 0;
+  hd->generation = 0;
+}
+
+static void
+close_handle (Client * c, int h)
+{
+  if (h >= 0 && c->handle[h].inuse)
+    {
+      lock_backends ();
+      sane_close (c->handle[h].handle);
+      unlock_backends ();
+      free_option_snapshot (&c->handle[h]);
+      c->handle[h].inuse = 0;
+    }
+}
+
+/* Run one action of a SANE_NET_CONTROL_OPTIONS request.  The backend
+   gets a private buffer of at least the option's size so that a client
+   sending a short value cannot make it read or write past the end.  */
+static SANE_Status
+run_option_action (SANE_Handle be_handle, SANE_Option_Action * a,
+		   SANE_Option_Result * r)
+{
+  const SANE_Option_Descriptor *opt;
+  SANE_Word size = 0;
+  void *buf;
+
+  r->info = 0;
+  r->value_type = a->value_type;
+  r->value_size = a->value_size;
+  r->value = a->value;
+
+  opt = sane_get_option_descriptor (be_handle, a->option);
+  if (!opt)
+    return r->status = SANE_STATUS_INVAL;
+
+  if (a->action == SANE_ACTION_SET_AUTO)
+    return r->status = sane_control_option (be_handle, a->option, a->action,
+					    NULL, &r->info);
+
+  if (opt->type != SANE_TYPE_BUTTON && opt->type != SANE_TYPE_GROUP)
+    size = opt->size;
+  if (size < a->value_size)
+    size = a->value_size;
+
+  buf = calloc (size + 1, 1);
+  if (!buf)
+    return r->status = SANE_STATUS_NO_MEM;
+  if (a->value_size > 0)
+    memcpy (buf, a->value, a->value_size);
+
+  r->status = sane_control_option (be_handle, a->option, a->action, buf,
+				   &r->info);
+
+  if (a->value_size > 0)
+    memcpy (a->value, buf, a->value_size);
+  free (buf);
+  return r->status;
+}
+
+/* Fill in the descriptors that changed since the client's GENERATION
+   and remember them for the next request.  */
+static SANE_Status
+diff_option_descriptors (Handle * hd, SANE_Word generation,
+			 SANE_Control_Options_Reply * reply)
+{
+  const SANE_Option_Descriptor *opt;
+  SANE_Status status = SANE_STATUS_GOOD;
+  SANE_Int num_options = 0;
+  int full, i;
+
+  if (sane_control_option (hd->handle, 0, SANE_ACTION_GET_VALUE,
+			   &num_options, 0) != SANE_STATUS_GOOD
+      || num_options < 0)
+    num_options = 0;
+
+  full = (generation == 0 || generation != hd->generation
+	  || num_options != hd->num_options);
+
+  if (num_options != hd->num_options)
+    {
+      free_option_snapshot (hd);
+      if (num_options > 0)
+	{
+	  hd->options = calloc (num_options, sizeof (hd->options[0]));
+	  if (!hd->options)
+	    return SANE_STATUS_NO_MEM;
+	  hd->num_options = num_options;
+	}
+    }
+
+  reply->num_options = num_options;
+  reply->num_changes = 0;
+  reply->changes = NULL;
+  if (num_options > 0)
+    {
+      reply->changes = malloc (num_options * sizeof (reply->changes[0]));
+      if (!reply->changes)
+	return SANE_STATUS_NO_MEM;
+    }
+
+  for (i = 0; i < num_options; ++i)
+    {
+      opt = sane_get_option_descriptor (hd->handle, i);
+      if (!opt || (!full && descriptor_equal (&hd->options[i], opt)))
+	continue;
+
+      if (copy_descriptor (&hd->options[i], opt) != SANE_STATUS_GOOD)
+	status = SANE_STATUS_NO_MEM;
+      reply->changes[reply->num_changes].option = i;
+      reply->changes[reply->num_changes].desc = (SANE_Option_Descriptor *) opt;
+      reply->num_changes++;
+    }
+
+  if (full || reply->num_changes > 0)
+    {
+      if (++hd->generation == 0)
+	hd->generation = 1;
+    }
+  /* without a complete snapshot, the client must ask for everything */
+  if (status != SANE_STATUS_GOOD)
+    hd->generation = 0;
+  reply->generation = hd->generation;
+
+  return SANE_STATUS_GOOD;
 }
 
 static SANE_Word
-decode_handle (Wire * w, const char *op)
+check_handle (Client * c, const char *op, SANE_Word h)
 {
-  SANE_Word h;
+  Wire *w = &c->wire;
 
-  sanei_w_word (w, &h);
-  if (w->status || (unsigned) h >= (unsigned) num_handles || !handle[h].inuse)
+  if (w->status || (unsigned) h >= (unsigned) c->num_handles || !c->handle[h].inuse)
     {
       DBG (DBG_ERR,
 	   "decode_handle: %s: error while decoding handle argument "
@@ -581,6 +1079,15 @@ decode_handle (Wire * w, const char *op)
   return h;
 }
 
+static SANE_Word
+decode_handle (Client * c, const char *op)
+{
+  SANE_Word h;
+
+  sanei_w_word (&c->wire, &h);
+  return check_handle (c, op, h);
+}
+
 
 
 /* Convert a number of bits to an 8-bit bitmask */
@@ -772,8 +1279,9 @@ check_v4_in_range (struct in_addr *inaddr, struct in_addr *base, char *netmask)
 /* Access control */
 #ifdef SANED_USES_AF_INDEP
 static SANE_Status
-check_host (int fd)
+check_host (Client * c)
 {
+  int fd = c->wire.io.fd;
   struct sockaddr_in *sin = NULL;
 #ifdef ENABLE_IPV6
   struct sockaddr_in6 *sin6;
@@ -799,32 +1307,32 @@ check_host (int fd)
   FILE *fp;
 
   /* Get address of remote host */
-  remote_address_len = sizeof (remote_address.ss);
-  if (getpeername (fd, &remote_address.sa, (socklen_t *) &remote_address_len) < 0)
+  c->remote_address_len = sizeof (c->remote_address.ss);
+  if (getpeername (fd, &c->remote_address.sa, (socklen_t *) &c->remote_address_len) < 0)
     {
       DBG (DBG_ERR, "check_host: getpeername failed: %s\n", strerror (errno));
-      remote_ip = strdup ("[error]");
+      c->remote_ip = strdup ("[error]");
       return SANE_STATUS_INVAL;
     }
 
-  err = getnameinfo (&remote_address.sa, remote_address_len,
+  err = getnameinfo (&c->remote_address.sa, c->remote_address_len,
 		     hostname, sizeof (hostname), NULL, 0, NI_NUMERICHOST);
   if (err)
     {
       DBG (DBG_DBG, "check_host: getnameinfo failed: %s\n", gai_strerror(err));
-      remote_ip = strdup ("[error]");
+      c->remote_ip = strdup ("[error]");
       return SANE_STATUS_INVAL;
     }
   else
-    remote_ip = strdup (hostname);
+    c->remote_ip = strdup (hostname);
 
 #ifdef ENABLE_IPV6
-  sin6 = &remote_address.sin6;
+  sin6 = &c->remote_address.sin6;
 
   if (IN6_IS_ADDR_V4MAPPED ((struct in6_addr *)sin6->sin6_addr.s6_addr))
     {
       DBG (DBG_DBG, "check_host: detected an IPv4-mapped address\n");
-      remote_ipv4 = remote_ip + 7;
+      remote_ipv4 = c->remote_ip + 7;
       IPv4map = SANE_TRUE;
 
       memset (&hints, 0, sizeof (struct addrinfo));
@@ -845,7 +1353,7 @@ check_host (int fd)
     }
 #endif /* ENABLE_IPV6 */
 
-  DBG (DBG_WARN, "check_host: access by remote host: %s\n", remote_ip);
+  DBG (DBG_WARN, "check_host: access by remote host: %s\n", c->remote_ip);
 
   /* Always allow access from local host. Do it here to avoid DNS lookups
      and reading saned.conf. */
@@ -864,9 +1372,9 @@ check_host (int fd)
     }
 #endif /* ENABLE_IPV6 */
 
-  sin = &remote_address.sin;
+  sin = &c->remote_address.sin;
 
-  switch (SS_FAMILY(remote_address.ss))
+  switch (SS_FAMILY(c->remote_address.ss))
     {
       case AF_INET:
 	if (IN_LOOPBACK (ntohl (sin->sin_addr.s_addr)))
@@ -937,10 +1445,10 @@ check_host (int fd)
 		strncpy (text_addr, "[error]", 8);
 
 #ifdef ENABLE_IPV6
-	  if ((strcasecmp (text_addr, remote_ip) == 0) ||
+	  if ((strcasecmp (text_addr, c->remote_ip) == 0) ||
 	      ((IPv4map == SANE_TRUE) && (strcmp (text_addr, remote_ipv4) == 0)))
 #else
-	  if (strcmp (text_addr, remote_ip) == 0)
+	  if (strcmp (text_addr, c->remote_ip) == 0)
 #endif /* ENABLE_IPV6 */
 	    {
 	      DBG (DBG_MSG, "check_host: remote host has same addr as local: access granted\n");
@@ -1025,32 +1533,32 @@ check_host (int fd)
 	      DBG (DBG_DBG,
 		   "check_host: access granted from any host (`+')\n");
 	    }
-	  /* compare remote_ip (remote IP address) to the config_line */
-	  else if (strcasecmp (config_line, remote_ip) == 0)
+	  /* compare c->remote_ip (remote IP address) to the config_line */
+	  else if (strcasecmp (config_line, c->remote_ip) == 0)
 	    {
 	      access_ok = 1;
 	      DBG (DBG_DBG,
-		   "check_host: access granted from IP address %s\n", remote_ip);
+		   "check_host: access granted from IP address %s\n", c->remote_ip);
 	    }
 #ifdef ENABLE_IPV6
 	  else if ((IPv4map == SANE_TRUE) && (strcmp (config_line, remote_ipv4) == 0))
 	    {
 	      access_ok = 1;
 	      DBG (DBG_DBG,
-		   "check_host: access granted from IP address %s (IPv4-mapped)\n", remote_ip);
+		   "check_host: access granted from IP address %s (IPv4-mapped)\n", c->remote_ip);
 	    }
 	  /* handle IP ranges, take care of the IPv4map stuff */
 	  else if (netmask != NULL)
 	    {
 	      if (strchr (config_line, ':') != NULL) /* is a v6 address */
 		{
-		  if (SS_FAMILY(remote_address.ss) == AF_INET6)
+		  if (SS_FAMILY(c->remote_address.ss) == AF_INET6)
 		    {
 		      if (check_v6_in_range (sin6, config_line, netmask))
 			{
 			  access_ok = 1;
 			  DBG (DBG_DBG, "check_host: access granted from IP address %s (in subnet [%s]/%s)\n",
-			       remote_ip, config_line, netmask);
+			       c->remote_ip, config_line, netmask);
 			}
 		    }
 		}
@@ -1070,20 +1578,20 @@ check_host (int fd)
 			sin = (struct sockaddr_in *)res->ai_addr;
 		    }
 
-		  if ((SS_FAMILY(remote_address.ss) == AF_INET) ||
+		  if ((SS_FAMILY(c->remote_address.ss) == AF_INET) ||
 		      (IPv4map == SANE_TRUE))
 		    {
 
 		      if (check_v4_in_range (sin, config_line, netmask))
 			{
 			  DBG (DBG_DBG, "check_host: access granted from IP address %s (in subnet %s/%s)\n",
-			       ((IPv4map == SANE_TRUE) ? remote_ipv4 : remote_ip), config_line, netmask);
+			       ((IPv4map == SANE_TRUE) ? remote_ipv4 : c->remote_ip), config_line, netmask);
 			  access_ok = 1;
 			}
 		      else
 			{
 			  /* restore the old sin pointer */
-			  sin = &remote_address.sin;
+			  sin = &c->remote_address.sin;
 			}
 
 		      if (res != NULL)
@@ -1102,7 +1610,7 @@ check_host (int fd)
 		{
 		  access_ok = 1;
 		  DBG (DBG_DBG, "check_host: access granted from IP address %s (in subnet %s/%s)\n",
-		       remote_ip, config_line, netmask);
+		       c->remote_ip, config_line, netmask);
 		}
 	    }
 #endif /* ENABLE_IPV6 */
@@ -1140,10 +1648,10 @@ check_host (int fd)
 			   text_addr);
 
 #ifdef ENABLE_IPV6
-		      if ((strcasecmp (text_addr, remote_ip) == 0) ||
+		      if ((strcasecmp (text_addr, c->remote_ip) == 0) ||
 			  ((IPv4map == SANE_TRUE) && (strcmp (text_addr, remote_ipv4) == 0)))
 #else
-		      if (strcmp (text_addr, remote_ip) == 0)
+		      if (strcmp (text_addr, c->remote_ip) == 0)
 #endif /* ENABLE_IPV6 */
 			access_ok = 1;
 
@@ -1167,8 +1675,9 @@ check_host (int fd)
 #else /* !SANED_USES_AF_INDEP */
 
 static SANE_Status
-check_host (int fd)
+check_host (Client * c)
 {
+  int fd = c->wire.io.fd;
   struct sockaddr_in sin;
   int j, access_ok = 0;
   struct hostent *he;
@@ -1188,15 +1697,15 @@ check_host (int fd)
   if (getpeername (fd, (struct sockaddr *) &sin, (socklen_t *) &len) < 0)
     {
       DBG (DBG_ERR, "check_host: getpeername failed: %s\n", strerror (errno));
-      remote_ip = strdup ("[error]");
+      c->remote_ip = strdup ("[error]");
       return SANE_STATUS_INVAL;
     }
   r_hostname = inet_ntoa (sin.sin_addr);
-  remote_ip = strdup (r_hostname);
+  c->remote_ip = strdup (r_hostname);
   DBG (DBG_WARN, "check_host: access by remote host: %s\n",
-       remote_ip);
+       c->remote_ip);
   /* Save remote address for check of control and data connections */
-  memcpy (&remote_address, &sin.sin_addr, sizeof (remote_address));
+  memcpy (&c->remote_address, &sin.sin_addr, sizeof (c->remote_address));
 
   /* Always allow access from local host. Do it here to avoid DNS lookups
      and reading saned.conf. */
@@ -1240,7 +1749,7 @@ check_host (int fd)
 	    strcpy (text_addr, "[error]");
 	  DBG (DBG_DBG, "check_host: local host address (from DNS): %s\n",
 	       text_addr);
-	  if (memcmp (he->h_addr_list[0], &remote_address.s_addr, 4) == 0)
+	  if (memcmp (he->h_addr_list[0], &c->remote_address.s_addr, 4) == 0)
 	    {
 	      DBG (DBG_MSG,
 		   "check_host: remote host has same addr as local: "
@@ -1311,16 +1820,16 @@ check_host (int fd)
 	    {
 	      if (inet_pton (AF_INET, config_line, &config_line_address) > 0)
 		{
-		  if (memcmp (&remote_address.s_addr,
+		  if (memcmp (&c->remote_address.s_addr,
 			      &config_line_address.s_addr, 4) == 0)
 		    access_ok = 1;
 		  else if (netmask != NULL)
 		    {
-		      if (check_v4_in_range (&remote_address, &config_line_address, netmask))
+		      if (check_v4_in_range (&c->remote_address, &config_line_address, netmask))
 			{
 			  access_ok = 1;
 			  DBG (DBG_DBG, "check_host: access granted from IP address %s (in subnet %s/%s)\n",
-			       remote_ip, config_line, netmask);
+			       c->remote_ip, config_line, netmask);
 			}
 		    }
 		}
@@ -1345,7 +1854,7 @@ check_host (int fd)
 		  DBG (DBG_MSG,
 		       "check_host: DNS lookup returns IP address: %s\n",
 		       text_addr);
-		  if (memcmp (&remote_address.s_addr,
+		  if (memcmp (&c->remote_address.s_addr,
 			      he->h_addr_list[0], 4) == 0)
 		    access_ok = 1;
 		}
@@ -1360,9 +1869,28 @@ check_host (int fd)
 
 #endif /* SANED_USES_AF_INDEP */
 
+/* Initialize the backends once per process.  With --threaded they stay
+   loaded for all clients.  */
+static SANE_Status
+init_backends (SANE_Int * version_code)
+{
+  static SANE_Status status;
+  static SANE_Int be_version_code;
+  static int initialized;
+
+  if (!initialized)
+    {
+      status = sane_init (&be_version_code, auth_callback);
+      initialized = (status == SANE_STATUS_GOOD);
+    }
+  *version_code = be_version_code;
+  return status;
+}
+
 static int
-init (Wire * w)
+init (Client * c)
 {
+  Wire *w = &c->wire;
   SANE_Word word, be_version_code;
   SANE_Init_Reply reply;
   SANE_Status status;
@@ -1370,10 +1898,10 @@ init (Wire * w)
 
   reset_watchdog ();
 
-  status = check_host (w->io.fd);
+  status = check_host (c);
   if (status != SANE_STATUS_GOOD)
     {
-      DBG (DBG_WARN, "init: access by host %s denied\n", remote_ip);
+      DBG (DBG_WARN, "init: access by host %s denied\n", c->remote_ip);
       return -1;
     }
   else
@@ -1401,9 +1929,17 @@ init (Wire * w)
       return -1;
     }
 
-  w->version = SANEI_NET_PROTOCOL_VERSION;
+  /* Answer with the newest version both sides understand.  Clients
+     that predate compressed data records get the version they have
+     always been answered with.  */
+  if (SANE_VERSION_BUILD (req.version_code) >= SANEI_NET_PROTOCOL_VERSION)
+    w->version = SANEI_NET_PROTOCOL_VERSION;
+  else if (SANE_VERSION_BUILD (req.version_code) >= SANEI_NET_COMPRESSION_VERSION)
+    w->version = SANE_VERSION_BUILD (req.version_code);
+  else
+    w->version = 3;
   if (req.username)
-    default_username = strdup (req.username);
+    c->username = strdup (req.username);
 
   sanei_w_free (w, (WireCodecFunc) sanei_w_init_req, &req);
   if (w->status)
@@ -1412,15 +1948,14 @@ init (Wire * w)
       return -1;
     }
 
-  reply.version_code = SANE_VERSION_CODE (V_MAJOR, V_MINOR,
-					  SANEI_NET_PROTOCOL_VERSION);
+  reply.version_code = SANE_VERSION_CODE (V_MAJOR, V_MINOR, w->version);
 
   DBG (DBG_WARN, "init: access granted to %s@%s\n",
-       default_username, remote_ip);
+       c->username ? c->username : default_username, c->remote_ip);
 
   if (status == SANE_STATUS_GOOD)
     {
-      status = sane_init (&be_version_code, auth_callback);
+      status = init_backends (&be_version_code);
       if (status != SANE_STATUS_GOOD)
 	DBG (DBG_ERR, "init: failed to initialize backend (%s)\n",
 	     sane_strstatus (status));
@@ -1446,7 +1981,7 @@ init (Wire * w)
 
 #ifdef SANED_USES_AF_INDEP
 static int
-start_scan (Wire * w, int h, SANE_Start_Reply * reply)
+start_scan (Client * c, int h, SANE_Start_Reply * reply)
 {
   union {
     struct sockaddr_storage ss;
@@ -1465,10 +2000,10 @@ start_scan (Wire * w, int h, SANE_Start_Reply * reply)
   in_port_t data_port;
   int ret = -1;
 
-  be_handle = handle[h].handle;
+  be_handle = c->handle[h].handle;
 
   len = sizeof (data_addr.ss);
-  if (getsockname (w->io.fd, &data_addr.sa, (socklen_t *) &len) < 0)
+  if (getsockname (c->wire.io.fd, &data_addr.sa, (socklen_t *) &len) < 0)
     {
       DBG (DBG_ERR, "start_scan: failed to obtain socket address (%s)\n",
 	   strerror (errno));
@@ -1568,8 +2103,8 @@ start_scan (Wire * w, int h, SANE_Start_Reply * reply)
   reply->status = sane_start (be_handle);
   if (reply->status == SANE_STATUS_GOOD)
     {
-      handle[h].scanning = 1;
-      handle[h].docancel = 0;
+      c->handle[h].scanning = 1;
+      c->handle[h].docancel = 0;
     }
 
   return fd;
@@ -1578,7 +2113,7 @@ start_scan (Wire * w, int h, SANE_Start_Reply * reply)
 #else /* !SANED_USES_AF_INDEP */
 
 static int
-start_scan (Wire * w, int h, SANE_Start_Reply * reply)
+start_scan (Client * c, int h, SANE_Start_Reply * reply)
 {
   struct sockaddr_in sin;
   SANE_Handle be_handle;
@@ -1586,10 +2121,10 @@ start_scan (Wire * w, int h, SANE_Start_Reply * reply)
   in_port_t data_port;
   int ret;
 
-  be_handle = handle[h].handle;
+  be_handle = c->handle[h].handle;
 
   len = sizeof (sin);
-  if (getsockname (w->io.fd, (struct sockaddr *) &sin, (socklen_t *) &len) < 0)
+  if (getsockname (c->wire.io.fd, (struct sockaddr *) &sin, (socklen_t *) &len) < 0)
     {
       DBG (DBG_ERR, "start_scan: failed to obtain socket address (%s)\n",
 	   strerror (errno));
@@ -1649,14 +2184,238 @@ start_scan (Wire * w, int h, SANE_Start_Reply * reply)
   reply->status = sane_start (be_handle);
   if (reply->status == SANE_STATUS_GOOD)
     {
-      handle[h].scanning = 1;
-      handle[h].docancel = 0;
+      c->handle[h].scanning = 1;
+      c->handle[h].docancel = 0;
     }
 
   return fd;
 }
 #endif /* SANED_USES_AF_INDEP */
 
+/*
+ * Zero-copy transmission of image data.
+ *
+ * Records that are large enough are sent with MSG_ZEROCOPY, so that the
+ * kernel transmits them straight out of the read buffer instead of
+ * copying them into the socket first.  The kernel keeps using those
+ * parts of the buffer until the client has acknowledged the data and it
+ * has told us so on the socket's error queue; until then they must not
+ * be overwritten by the next record.
+ */
+#ifdef SANED_USES_ZEROCOPY
+
+/* smaller sends are cheaper to copy than to pin and track */
+#define ZEROCOPY_MIN_SEND	(16 * 1024)
+#define ZEROCOPY_MAX_PENDING	64
+
+typedef struct
+{
+  int enabled;			/* send large records with MSG_ZEROCOPY */
+  uint32_t next_id;		/* the kernel's number for the next send */
+  uint32_t done_id;		/* oldest send the kernel may still use */
+  struct
+  {
+    size_t start;		/* where it starts in the read buffer */
+    int done;
+  } sent[ZEROCOPY_MAX_PENDING];
+} Zerocopy;
+
+static void
+zerocopy_init (Zerocopy * zc, int fd)
+{
+  int on = 1;
+
+  memset (zc, 0, sizeof (*zc));
+  if (!data_zerocopy)
+    return;
+
+  if (setsockopt (fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof (on)) < 0)
+    {
+      DBG (DBG_INFO, "zerocopy_init: not supported (%s)\n", strerror (errno));
+      return;
+    }
+  zc->enabled = 1;
+}
+
+static int
+zerocopy_pending (Zerocopy * zc)
+{
+  return (int) (zc->next_id - zc->done_id);
+}
+
+static ssize_t
+zerocopy_write (Zerocopy * zc, int fd, SANE_Byte * buf, size_t offset,
+		size_t nbytes)
+{
+  ssize_t nwritten;
+
+  if (zc->enabled && nbytes >= ZEROCOPY_MIN_SEND
+      && zerocopy_pending (zc) < ZEROCOPY_MAX_PENDING)
+    {
+      nwritten = send (fd, buf + offset, nbytes, MSG_ZEROCOPY);
+      if (nwritten > 0)
+	{
+	  zc->sent[zc->next_id % ZEROCOPY_MAX_PENDING].start = offset;
+	  zc->sent[zc->next_id % ZEROCOPY_MAX_PENDING].done = 0;
+	  zc->next_id++;
+	  return nwritten;
+	}
+      /* ENOBUFS: out of memory for pinning pages, copy this one */
+      if (nwritten == 0 || errno != ENOBUFS)
+	return nwritten;
+    }
+
+  return write (fd, buf + offset, nbytes);
+}
+
+/* Read the completion notifications queued on FD and return how many
+   there were.  */
+static int
+zerocopy_reap (Zerocopy * zc, int fd)
+{
+  char control[CMSG_SPACE (sizeof (struct sock_extended_err)) + 64];
+  struct sock_extended_err *serr;
+  struct cmsghdr *cm;
+  struct msghdr msg;
+  uint32_t id, n;
+  int count = 0;
+
+  for (;;)
+    {
+      memset (&msg, 0, sizeof (msg));
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof (control);
+      if (recvmsg (fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+	break;
+
+      for (cm = CMSG_FIRSTHDR (&msg); cm; cm = CMSG_NXTHDR (&msg, cm))
+	{
+	  serr = (struct sock_extended_err *) CMSG_DATA (cm);
+	  if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+	    continue;
+
+	  /* sends ee_info to ee_data, inclusive, have completed */
+	  for (n = 0; n <= serr->ee_data - serr->ee_info; ++n)
+	    {
+	      id = serr->ee_info + n;
+	      if (id - zc->done_id < (uint32_t) zerocopy_pending (zc))
+		zc->sent[id % ZEROCOPY_MAX_PENDING].done = 1;
+	    }
+	  if ((serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && zc->enabled)
+	    {
+	      /* e.g. over loopback, where pinning only adds overhead */
+	      DBG (DBG_MSG, "zerocopy_reap: kernel copied the data anyway, "
+		   "not using zero-copy for this scan\n");
+	      zc->enabled = 0;
+	    }
+	  count++;
+	}
+    }
+
+  while (zc->done_id != zc->next_id
+	 && zc->sent[zc->done_id % ZEROCOPY_MAX_PENDING].done)
+    zc->done_id++;
+
+  return count;
+}
+
+/* The buffer is empty; return how many bytes a new record may occupy
+   without touching data the kernel still uses, and move *START to where
+   it should begin.  */
+static size_t
+zerocopy_room (Zerocopy * zc, size_t buf_size, int *start)
+{
+  size_t pin;
+
+  if (!zerocopy_pending (zc))
+    {
+      *start = 0;
+      return buf_size;
+    }
+
+  pin = zc->sent[zc->done_id % ZEROCOPY_MAX_PENDING].start;
+  if (pin < (size_t) *start)
+    {
+      /* in use from pin up to *start: take the larger free end */
+      if (buf_size - *start >= pin)
+	return buf_size - *start;
+      *start = 0;
+      return pin;
+    }
+  return pin - *start;
+}
+
+/* Wait until the kernel is done with the read buffer, unless the client
+   has gone away.  */
+static void
+zerocopy_finish (Zerocopy * zc, int fd, int wait)
+{
+  struct pollfd pfd;
+  int err = 0;
+  socklen_t len = sizeof (err);
+
+  while (wait && zerocopy_pending (zc))
+    {
+      pfd.fd = fd;
+      pfd.events = 0;
+      if (poll (&pfd, 1, 1000) < 0 && errno != EINTR)
+	break;
+      if (zerocopy_reap (zc, fd) == 0 && (pfd.revents & POLLERR)
+	  && (getsockopt (fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err))
+	break;
+    }
+  if (zerocopy_pending (zc))
+    DBG (DBG_MSG, "zerocopy_finish: %d sends not acknowledged by client\n",
+	 zerocopy_pending (zc));
+}
+
+#else /* !SANED_USES_ZEROCOPY */
+
+typedef struct
+{
+  int enabled;
+} Zerocopy;
+
+static void
+zerocopy_init (Zerocopy * zc, int __sane_unused__ fd)
+{
+  zc->enabled = 0;
+}
+
+static int
+zerocopy_pending (Zerocopy __sane_unused__ * zc)
+{
+  return 0;
+}
+
+static ssize_t
+zerocopy_write (Zerocopy __sane_unused__ * zc, int fd, SANE_Byte * buf,
+		size_t offset, size_t nbytes)
+{
+  return write (fd, buf + offset, nbytes);
+}
+
+static int
+zerocopy_reap (Zerocopy __sane_unused__ * zc, int __sane_unused__ fd)
+{
+  return 0;
+}
+
+static size_t
+zerocopy_room (Zerocopy __sane_unused__ * zc, size_t buf_size, int *start)
+{
+  *start = 0;
+  return buf_size;
+}
+
+static void
+zerocopy_finish (Zerocopy __sane_unused__ * zc, int __sane_unused__ fd,
+		 int __sane_unused__ wait)
+{
+}
+
+#endif /* SANED_USES_ZEROCOPY */
+
 static int
 store_reclen (SANE_Byte * buf, size_t buf_size, int i, size_t reclen)
 {
@@ -1676,21 +2435,49 @@ store_reclen (SANE_Byte * buf, size_t buf_size, int i, size_t reclen)
 }
 
 static void
-do_scan (Wire * w, int h, int data_fd)
+do_scan (Client * c, int h, int data_fd)
 {
+  Wire *w = &c->wire;
   int num_fds, be_fd = -1, reader, bytes_in_buf, status_dirty = 0;
+  int timeout = -1;
   size_t writer;
-  SANE_Handle be_handle = handle[h].handle;
-  struct timeval tv, *timeout = 0;
-  fd_set rd_set, rd_mask, wr_set, wr_mask;
+  SANE_Handle be_handle = c->handle[h].handle;
+  struct pollfd fds[3];		/* control wire, data socket, backend */
   SANE_Byte *buf = NULL;
+  SANE_Byte *cbuf = NULL;
+  SANE_Parameters params;
   SANE_Status status;
   ssize_t nwritten;
   SANE_Int length;
-  size_t nbytes;
+  size_t nbytes, reclen, room, min_room;
+  unsigned int stride = 1;
+  Zerocopy zc;
 
   DBG (3, "do_scan: start\n");
 
+  /*
+   * Compress data records if the client understands them.  Bytes are
+   * predicted from the same sample of the previous pixel.
+   */
+  if (data_compression && w->version >= SANEI_NET_COMPRESSION_VERSION
+      && !c->handle[h].nocompress)
+    {
+      cbuf = malloc (buffer_size);
+      if (!cbuf)
+        DBG (DBG_WARN, "do_scan: no memory for compression, sending raw data\n");
+      else
+        {
+          lock_handle (&c->handle[h]);
+          status = sane_get_parameters (be_handle, &params);
+          unlock_handle (&c->handle[h]);
+          if (status == SANE_STATUS_GOOD && params.format == SANE_FRAME_RGB)
+            stride = 3;
+          if (status == SANE_STATUS_GOOD && params.depth == 16)
+            stride *= 2;
+        }
+      DBG (DBG_MSG, "do_scan: compressing data records (stride %u)\n", stride);
+    }
+
   /*
    * Allocate the read buffer.
    *
@@ -1704,62 +2491,93 @@ do_scan (Wire * w, int h, int data_fd)
     }
   else
     {
-      FD_ZERO(&rd_mask);
-      FD_SET(w->io.fd, &rd_mask);
-      num_fds = w->io.fd + 1;
-
-      FD_ZERO(&wr_mask);
-      FD_SET(data_fd, &wr_mask);
-      if (data_fd >= num_fds)
-        num_fds = data_fd + 1;
-
+      /* poll () rather than select (): with --threaded, descriptors
+         beyond FD_SETSIZE are to be expected.  */
+      fds[0].fd = w->io.fd;
+      fds[0].events = POLLIN;
+      fds[1].fd = data_fd;
+      num_fds = 2;
+
+      zerocopy_init (&zc, data_fd);
+      /* don't start a record in less than a quarter of the buffer */
+      min_room = buffer_size / 4 > 5 ? buffer_size / 4 : 5;
+
+      lock_handle (&c->handle[h]);
       sane_set_io_mode (be_handle, SANE_TRUE);
-      if (sane_get_select_fd (be_handle, &be_fd) == SANE_STATUS_GOOD)
+      status = sane_get_select_fd (be_handle, &be_fd);
+      unlock_handle (&c->handle[h]);
+      if (status == SANE_STATUS_GOOD)
         {
-          FD_SET(be_fd, &rd_mask);
-          if (be_fd >= num_fds)
-            num_fds = be_fd + 1;
+          fds[2].fd = be_fd;
+          fds[2].events = POLLIN;
+          num_fds = 3;
         }
       else
-        {
-          memset (&tv, 0, sizeof(tv));
-          timeout = &tv;
-        }
+        timeout = 0;
 
       status = SANE_STATUS_GOOD;
       reader = writer = bytes_in_buf = 0;
       do
         {
-          rd_set = rd_mask;
-          wr_set = wr_mask;
-          if (select (num_fds, &rd_set, &wr_set, 0, timeout) < 0)
+          int wait_room = 0;
+
+          /* With the buffer empty, the next record (or the final status)
+             goes in front.  If the kernel still sends from there, wait
+             for it rather than for the backend.  */
+          room = buffer_size;
+          if (bytes_in_buf == 0)
             {
-              if (be_fd >= 0 && errno == EBADF)
-                {
-                  /* This normally happens when a backend closes a select
-                   filedescriptor when reaching the end of file.  So
-                   pass back this status to the client: */
-                  FD_CLR(be_fd, &rd_mask);
-                  be_fd = -1;
-                  /* only set status_dirty if EOF hasn't been already detected */
-                  if (status == SANE_STATUS_GOOD)
-                    status_dirty = 1;
-                  status = SANE_STATUS_EOF;
-                  DBG (DBG_INFO, "do_scan: select_fd was closed --> EOF\n");
-                  continue;
-                }
-              else
+              room = zerocopy_room (&zc, buffer_size, &reader);
+              writer = reader;
+              wait_room = ((status == SANE_STATUS_GOOD || status_dirty)
+                           && room < min_room);
+            }
+
+          /* only wait for the client while there is something to send */
+          fds[1].events = bytes_in_buf ? POLLOUT : 0;
+          fds[2].revents = 0;
+          if (poll (fds, wait_room ? 2 : num_fds, wait_room ? -1 : timeout) < 0)
+            {
+              if (errno == EINTR)
+                continue;
+              status = SANE_STATUS_IO_ERROR;
+              DBG (DBG_ERR, "do_scan: poll failed (%s)\n", strerror (errno));
+              break;
+            }
+
+          if (zerocopy_pending (&zc) && (fds[1].revents & POLLERR))
+            {
+              /* an error without notifications is a real one, which
+                 the next write reports if there is anything to send */
+              if (zerocopy_reap (&zc, data_fd) > 0)
+                continue;
+              if (bytes_in_buf == 0)
                 {
-                  status = SANE_STATUS_IO_ERROR;
-                  DBG (DBG_ERR, "do_scan: select failed (%s)\n",
-                       strerror (errno));
+                  DBG (DBG_ERR, "do_scan: data connection failed\n");
+                  status = SANE_STATUS_CANCELLED;
+                  c->handle[h].docancel = 1;
                   break;
                 }
             }
 
+          if (be_fd >= 0 && (fds[2].revents & POLLNVAL))
+            {
+              /* This normally happens when a backend closes a select
+                 filedescriptor when reaching the end of file.  So
+                 pass back this status to the client: */
+              num_fds = 2;
+              be_fd = -1;
+              /* only set status_dirty if EOF hasn't been already detected */
+              if (status == SANE_STATUS_GOOD)
+                status_dirty = 1;
+              status = SANE_STATUS_EOF;
+              DBG (DBG_INFO, "do_scan: select_fd was closed --> EOF\n");
+              continue;
+            }
+
           if (bytes_in_buf)
             {
-              if (FD_ISSET(data_fd, &wr_set))
+              if (fds[1].revents & (POLLOUT | POLLERR | POLLHUP))
                 {
                   if (bytes_in_buf > 0)
                     {
@@ -1770,7 +2588,8 @@ do_scan (Wire * w, int h, int data_fd)
                       DBG (DBG_INFO,
                            "do_scan: trying to write %d bytes to client\n",
                            nbytes);
-                      nwritten = write (data_fd, buf + writer, nbytes);
+                      nwritten = zerocopy_write (&zc, data_fd, buf, writer,
+                                                 nbytes);
                       DBG (DBG_INFO, "do_scan: wrote %ld bytes to client\n",
                            nwritten);
                       if (nwritten < 0)
@@ -1778,7 +2597,7 @@ do_scan (Wire * w, int h, int data_fd)
                           DBG (DBG_ERR, "do_scan: write failed (%s)\n",
                                strerror (errno));
                           status = SANE_STATUS_CANCELLED;
-                          handle[h].docancel = 1;
+                          c->handle[h].docancel = 1;
                           break;
                         }
                       bytes_in_buf -= (size_t) nwritten;
@@ -1788,35 +2607,43 @@ do_scan (Wire * w, int h, int data_fd)
                     }
                 }
             }
-          else if (status == SANE_STATUS_GOOD
-              && (timeout || FD_ISSET(be_fd, &rd_set)))
+          else if (status == SANE_STATUS_GOOD && !wait_room
+              && (timeout == 0
+                  || (fds[2].revents & (POLLIN | POLLERR | POLLHUP))))
             {
               int i;
 
               /* get more input data */
+              assert(bytes_in_buf == 0);
 
               /* reserve 4 bytes to store the length of the data record: */
               i = reader;
               reader += 4;
-              if (reader >= (int) buffer_size)
-                reader -= buffer_size;
-
-              assert(bytes_in_buf == 0);
-              nbytes = buffer_size - 4;
-              if (reader + nbytes > buffer_size)
-                nbytes = buffer_size - reader;
+              nbytes = room - 4;
 
               DBG (DBG_INFO, "do_scan: trying to read %d bytes from scanner\n",
                    nbytes);
+              lock_handle (&c->handle[h]);
               status = sane_read (be_handle, buf + reader, nbytes, &length);
+              unlock_handle (&c->handle[h]);
               DBG (DBG_INFO, "do_scan: read %d bytes from scanner\n", length);
 
               reset_watchdog ();
 
-              reader += length;
-              if (reader >= (int) buffer_size)
-                reader = 0;
-              bytes_in_buf += length + 4;
+              reclen = length;
+              if (cbuf && status == SANE_STATUS_GOOD && length > 0)
+                {
+                  nbytes = sanei_net_compress (buf + reader, length, stride,
+                                               cbuf);
+                  if (nbytes > 0)
+                    {
+                      DBG (DBG_INFO, "do_scan: compressed %d bytes to %zu\n",
+                           length, nbytes);
+                      memcpy (buf + reader, cbuf, nbytes);
+                      length = nbytes;
+                      reclen = nbytes | SANEI_NET_RECORD_COMPRESSED;
+                    }
+                }
 
               if (status != SANE_STATUS_GOOD)
                 {
@@ -1826,10 +2653,16 @@ do_scan (Wire * w, int h, int data_fd)
                        sane_strstatus (status));
                 }
               else
-                store_reclen (buf, buffer_size, i, length);
+                {
+                  store_reclen (buf, buffer_size, i, reclen);
+                  reader += length;
+                  if (reader >= (int) buffer_size)
+                    reader = 0;
+                  bytes_in_buf += length + 4;
+                }
             }
 
-          if (status_dirty && buffer_size - bytes_in_buf >= 5)
+          if (status_dirty && bytes_in_buf == 0 && !wait_room)
             {
               status_dirty = 0;
               reader = store_reclen (buf, buffer_size, reader, 0xffffffff);
@@ -1839,38 +2672,47 @@ do_scan (Wire * w, int h, int data_fd)
                    sane_strstatus (status));
             }
 
-          if (FD_ISSET(w->io.fd, &rd_set))
+          if (fds[0].revents & (POLLIN | POLLERR | POLLHUP))
             {
               DBG (DBG_MSG, "do_scan: processing RPC request on fd %d\n",
                    w->io.fd);
-              if (process_request (w) < 0)
-                handle[h].docancel = 1;
+              if (process_request (c) < 0)
+                c->handle[h].docancel = 1;
 
-              if (handle[h].docancel)
+              if (c->handle[h].docancel)
                 break;
             }
         }
       while (status == SANE_STATUS_GOOD || bytes_in_buf > 0 || status_dirty);
       DBG (DBG_MSG, "do_scan: done, status=%s\n", sane_strstatus (status));
 
+      zerocopy_finish (&zc, data_fd, !c->handle[h].docancel);
       free (buf);
       buf = NULL;
     }
+  free (cbuf);
 
-  if (handle[h].docancel)
-    sane_cancel (handle[h].handle);
+  if (c->handle[h].docancel)
+    {
+      lock_handle (&c->handle[h]);
+      sane_cancel (c->handle[h].handle);
+      unlock_handle (&c->handle[h]);
+    }
 
-  handle[h].docancel = 0;
-  handle[h].scanning = 0;
+  c->handle[h].docancel = 0;
+  c->handle[h].scanning = 0;
 }
 
 static int
-process_request (Wire * w)
+process_request (Client * c)
 {
+  Wire *w = &c->wire;
   SANE_Handle be_handle;
   SANE_Word h, word;
   int i;
 
+  set_current_client (c);
+
   DBG (DBG_DBG, "process_request: waiting for request\n");
   sanei_w_set_dir (w, WIRE_DECODE);
   sanei_w_word (w, &word);	/* decode procedure number */
@@ -1882,20 +2724,22 @@ process_request (Wire * w)
       return -1;
     }
 
-  current_request = word;
+  c->current_request = word;
 
-  DBG (DBG_MSG, "process_request: got request %d\n", current_request);
+  DBG (DBG_MSG, "process_request: got request %d\n", c->current_request);
 
-  switch (current_request)
+  switch (c->current_request)
     {
     case SANE_NET_GET_DEVICES:
       {
 	SANE_Get_Devices_Reply reply;
 
+	lock_backends ();
 	reply.status =
 	  sane_get_devices ((const SANE_Device ***) &reply.device_list,
 			    !allow_network);
 	sanei_w_reply (w, (WireCodecFunc) sanei_w_get_devices_reply, &reply);
+	unlock_backends ();
       }
       break;
 
@@ -1904,6 +2748,9 @@ process_request (Wire * w)
 	SANE_Open_Reply reply;
 	SANE_Handle be_handle;
 	SANE_String name, resource;
+#ifdef SANED_USES_THREADS
+	Backend *backend = NULL;
+#endif
 
 	sanei_w_string (w, &name);
 	if (w->status)
@@ -1922,7 +2769,7 @@ process_request (Wire * w)
 	    return 1;
 	  }
 
-	can_authorize = 1;
+	c->can_authorize = 1;
 
 	resource = strdup (name);
 
@@ -1933,8 +2780,14 @@ process_request (Wire * w)
 	  DBG(DBG_DBG, "process_request: (open) strlen(resource) == 0\n");
 	  free (resource);
 
-	  if ((i = sane_get_devices (&device_list, SANE_TRUE)) !=
-	      SANE_STATUS_GOOD)
+	  lock_backends ();
+	  resource = NULL;
+	  i = sane_get_devices (&device_list, SANE_TRUE);
+	  if (i == SANE_STATUS_GOOD && device_list && device_list[0])
+	    resource = strdup (device_list[0]->name);
+	  unlock_backends ();
+
+	  if (i != SANE_STATUS_GOOD)
 	    {
 	      DBG(DBG_ERR, "process_request: (open) sane_get_devices failed\n");
 	      memset (&reply, 0, sizeof (reply));
@@ -1943,7 +2796,7 @@ process_request (Wire * w)
 	      break;
 	    }
 
-	  if ((device_list == NULL) || (device_list[0] == NULL))
+	  if (resource == NULL)
 	    {
 	      DBG(DBG_ERR, "process_request: (open) device_list[0] == 0\n");
 	      memset (&reply, 0, sizeof (reply));
@@ -1951,8 +2804,6 @@ process_request (Wire * w)
 	      sanei_w_reply (w, (WireCodecFunc) sanei_w_open_reply, &reply);
 	      break;
 	    }
-
-	  resource = strdup (device_list[0]->name);
 	}
 
 	if (strchr (resource, ':'))
@@ -1971,26 +2822,44 @@ process_request (Wire * w)
 	  {
 	    DBG (DBG_MSG, "process_request: access to resource `%s' granted\n",
 		 resource);
-	    free (resource);
 	    memset (&reply, 0, sizeof (reply));	/* avoid leaking bits */
+	    lock_backends ();
 	    reply.status = sane_open (name, &be_handle);
+#ifdef SANED_USES_THREADS
+	    if (reply.status == SANE_STATUS_GOOD && run_threaded)
+	      {
+		backend = find_backend (resource);
+		if (!backend)
+		  {
+		    sane_close (be_handle);
+		    reply.status = SANE_STATUS_NO_MEM;
+		  }
+	      }
+#endif
+	    unlock_backends ();
+	    free (resource);
 	    DBG (DBG_MSG, "process_request: sane_open returned: %s\n",
 		 sane_strstatus (reply.status));
 	  }
 
 	if (reply.status == SANE_STATUS_GOOD)
 	  {
-	    h = get_free_handle ();
+	    h = get_free_handle (c);
 	    if (h < 0)
 	      reply.status = SANE_STATUS_NO_MEM;
 	    else
 	      {
-		handle[h].handle = be_handle;
+		c->handle[h].handle = be_handle;
 		reply.handle = h;
+#ifdef SANED_USES_THREADS
+		c->handle[h].backend = backend;
+		if (!c->device)
+		  c->device = strdup (name);
+#endif
 	      }
 	  }
 
-	can_authorize = 0;
+	c->can_authorize = 0;
 
 	sanei_w_reply (w, (WireCodecFunc) sanei_w_open_reply, &reply);
 	sanei_w_free (w, (WireCodecFunc) sanei_w_string, &name);
@@ -2001,8 +2870,8 @@ process_request (Wire * w)
       {
 	SANE_Word ack = 0;
 
-	h = decode_handle (w, "close");
-	close_handle (h);
+	h = decode_handle (c, "close");
+	close_handle (c, h);
 	sanei_w_reply (w, (WireCodecFunc) sanei_w_word, &ack);
       }
       break;
@@ -2011,10 +2880,11 @@ process_request (Wire * w)
       {
 	SANE_Option_Descriptor_Array opt;
 
-	h = decode_handle (w, "get_option_descriptors");
+	h = decode_handle (c, "get_option_descriptors");
 	if (h < 0)
 	  return 1;
-	be_handle = handle[h].handle;
+	be_handle = c->handle[h].handle;
+	lock_handle (&c->handle[h]);
 	sane_control_option (be_handle, 0, SANE_ACTION_GET_VALUE,
 			     &opt.num_options, 0);
 
@@ -2025,6 +2895,7 @@ process_request (Wire * w)
 
 	sanei_w_reply (w,(WireCodecFunc) sanei_w_option_descriptor_array,
 		       &opt);
+	unlock_handle (&c->handle[h]);
 
 	free (opt.desc);
       }
@@ -2036,8 +2907,8 @@ process_request (Wire * w)
 	SANE_Control_Option_Reply reply;
 
 	sanei_w_control_option_req (w, &req);
-	if (w->status || (unsigned) req.handle >= (unsigned) num_handles
-	    || !handle[req.handle].inuse)
+	if (w->status || (unsigned) req.handle >= (unsigned) c->num_handles
+	    || !c->handle[req.handle].inuse)
 	  {
 	    DBG (DBG_ERR,
 		 "process_request: (control_option) "
@@ -2078,18 +2949,20 @@ process_request (Wire * w)
             w->allocated_memory += req.value_size;
           }
 
-	can_authorize = 1;
+	c->can_authorize = 1;
 
 	memset (&reply, 0, sizeof (reply));	/* avoid leaking bits */
-	be_handle = handle[req.handle].handle;
+	be_handle = c->handle[req.handle].handle;
+	lock_handle (&c->handle[req.handle]);
 	reply.status = sane_control_option (be_handle, req.option,
 					    req.action, req.value,
 					    &reply.info);
+	unlock_handle (&c->handle[req.handle]);
 	reply.value_type = req.value_type;
 	reply.value_size = req.value_size;
 	reply.value = req.value;
 
-	can_authorize = 0;
+	c->can_authorize = 0;
 
 	sanei_w_reply (w, (WireCodecFunc) sanei_w_control_option_reply,
 		       &reply);
@@ -2097,16 +2970,78 @@ process_request (Wire * w)
       }
       break;
 
+    case SANE_NET_CONTROL_OPTIONS:
+      {
+	SANE_Control_Options_Req req;
+	SANE_Control_Options_Reply reply;
+	SANE_Status status;
+	Handle *hd;
+
+	sanei_w_control_options_req (w, &req);
+	if (w->status || (unsigned) req.handle >= (unsigned) c->num_handles
+	    || !c->handle[req.handle].inuse)
+	  {
+	    DBG (DBG_ERR,
+		 "process_request: (control_options) "
+		 "error while decoding args h=%d (%s)\n"
+		 , req.handle, strerror (w->status));
+	    return 1;
+	  }
+	hd = &c->handle[req.handle];
+
+	memset (&reply, 0, sizeof (reply));
+	reply.status = SANE_STATUS_GOOD;
+	if (req.num_actions > 0)
+	  {
+	    reply.results = calloc (req.num_actions, sizeof (reply.results[0]));
+	    if (!reply.results)
+	      reply.status = SANE_STATUS_NO_MEM;
+	  }
+
+	c->can_authorize = 1;
+	lock_handle (hd);
+
+	/* stop at the first failure; later actions may depend on it */
+	for (i = 0; i < req.num_actions && reply.status == SANE_STATUS_GOOD;
+	     ++i)
+	  {
+	    reply.status = run_option_action (hd->handle, &req.actions[i],
+					      &reply.results[i]);
+	    reply.num_results = i + 1;
+	  }
+
+	c->can_authorize = 0;
+
+	status = diff_option_descriptors (hd, req.generation, &reply);
+	unlock_handle (hd);
+	if (reply.status == SANE_STATUS_GOOD)
+	  reply.status = status;
+
+	DBG (DBG_MSG, "process_request: (control_options) %d of %d actions "
+	     "done (%s), %d of %d descriptors sent\n", reply.num_results,
+	     req.num_actions, sane_strstatus (reply.status),
+	     reply.num_changes, reply.num_options);
+
+	sanei_w_reply (w, (WireCodecFunc) sanei_w_control_options_reply,
+		       &reply);
+	free (reply.results);
+	free (reply.changes);
+	sanei_w_free (w, (WireCodecFunc) sanei_w_control_options_req, &req);
+      }
+      break;
+
     case SANE_NET_GET_PARAMETERS:
       {
 	SANE_Get_Parameters_Reply reply;
 
-	h = decode_handle (w, "get_parameters");
+	h = decode_handle (c, "get_parameters");
 	if (h < 0)
 	  return 1;
-	be_handle = handle[h].handle;
+	be_handle = c->handle[h].handle;
 
+	lock_handle (&c->handle[h]);
 	reply.status = sane_get_parameters (be_handle, &reply.params);
+	unlock_handle (&c->handle[h]);
 
 	sanei_w_reply (w, (WireCodecFunc) sanei_w_get_parameters_reply,
 		       &reply);
@@ -2115,22 +3050,30 @@ process_request (Wire * w)
 
     case SANE_NET_START:
       {
+	SANE_Start_Req req;
 	SANE_Start_Reply reply;
 	int fd = -1, data_fd = -1;
 
-	h = decode_handle (w, "start");
+	sanei_w_start_req (w, &req);
+	h = check_handle (c, "start", req.handle);
 	if (h < 0)
 	  return 1;
+	c->handle[h].nocompress =
+	  (req.flags & SANEI_NET_START_NO_COMPRESSION) != 0;
 
 	memset (&reply, 0, sizeof (reply));	/* avoid leaking bits */
 	reply.byte_order = SANE_NET_LITTLE_ENDIAN;
 	if (byte_order.w != 1)
 	  reply.byte_order = SANE_NET_BIG_ENDIAN;
 
-	if (handle[h].scanning)
+	if (c->handle[h].scanning)
 	  reply.status = SANE_STATUS_DEVICE_BUSY;
 	else
-	  fd = start_scan (w, h, &reply);
+	  {
+	    lock_handle (&c->handle[h]);
+	    fd = start_scan (c, h, &reply);
+	    unlock_handle (&c->handle[h]);
+	  }
 
 	sanei_w_reply (w, (WireCodecFunc) sanei_w_start_reply, &reply);
 
@@ -2194,7 +3137,7 @@ process_request (Wire * w)
 	    DBG (DBG_MSG, "process_request: access to data port from %s\n",
 		 text_addr);
 
-	    if (strcmp (text_addr, remote_ip) != 0)
+	    if (strcmp (text_addr, c->remote_ip) != 0)
 	      {
 		DBG (DBG_ERR, "process_request: however, only %s is authorized\n",
 		     text_addr);
@@ -2252,15 +3195,15 @@ process_request (Wire * w)
 		return 1;
 	      }
 
-	    if (memcmp (&remote_address, &sin.sin_addr,
-			sizeof (remote_address)) != 0)
+	    if (memcmp (&c->remote_address, &sin.sin_addr,
+			sizeof (c->remote_address)) != 0)
 	      {
 		DBG (DBG_ERR,
 		     "process_request: access to data port from %s\n",
 		     inet_ntoa (sin.sin_addr));
 		DBG (DBG_ERR,
 		     "process_request: however, only %s is authorized\n",
-		     inet_ntoa (remote_address));
+		     inet_ntoa (c->remote_address));
 		DBG (DBG_ERR,
 		     "process_request: configuration problem or attack?\n");
 		close (data_fd);
@@ -2274,16 +3217,18 @@ process_request (Wire * w)
 
 	    if (data_fd < 0)
 	      {
-		sane_cancel (handle[h].handle);
-		handle[h].scanning = 0;
-		handle[h].docancel = 0;
+		lock_handle (&c->handle[h]);
+		sane_cancel (c->handle[h].handle);
+		unlock_handle (&c->handle[h]);
+		c->handle[h].scanning = 0;
+		c->handle[h].docancel = 0;
 		DBG (DBG_ERR, "process_request: accept failed! (%s)\n",
 		     strerror (errno));
 		return 1;
 	      }
 	    fcntl (data_fd, F_SETFL, O_NONBLOCK);      /* set non-blocking */
 	    shutdown (data_fd, SHUT_RD);
-	    do_scan (w, h, data_fd);
+	    do_scan (c, h, data_fd);
 	    close (data_fd);
 	  }
       }
@@ -2293,11 +3238,13 @@ process_request (Wire * w)
       {
 	SANE_Word ack = 0;
 
-	h = decode_handle (w, "cancel");
+	h = decode_handle (c, "cancel");
 	if (h >= 0)
 	  {
-	    sane_cancel (handle[h].handle);
-	    handle[h].docancel = 1;
+	    lock_handle (&c->handle[h]);
+	    sane_cancel (c->handle[h].handle);
+	    unlock_handle (&c->handle[h]);
+	    c->handle[h].docancel = 1;
 	  }
 	sanei_w_reply (w, (WireCodecFunc) sanei_w_word, &ack);
       }
@@ -2312,7 +3259,7 @@ process_request (Wire * w)
     default:
       DBG (DBG_ERR,
 	   "process_request: received unexpected procedure number %d\n",
-	   current_request);
+	   c->current_request);
       return -1;
     }
 
@@ -2420,21 +3367,23 @@ wait_child (pid_t pid, int *status, int options)
 
 
 static void
-handle_connection (int fd)
+client_init (Client * c, int fd)
+{
+  memset (c, 0, sizeof (*c));
+  sanei_w_init (&c->wire, sanei_codec_bin_init);
+  c->wire.io.fd = fd;
+  c->wire.io.read = read;
+  c->wire.io.write = write;
+  c->last_handle_checked = -1;
+}
+
+static void
+set_nodelay (int fd)
 {
 #ifdef TCP_NODELAY
   int on = 1;
   int level = -1;
-#endif
-
-  DBG (DBG_DBG, "handle_connection: processing client connection\n");
-
-  wire.io.fd = fd;
-
-  signal (SIGALRM, quit);
-  signal (SIGPIPE, quit);
 
-#ifdef TCP_NODELAY
 # ifdef SOL_TCP
   level = SOL_TCP;
 # else /* !SOL_TCP */
@@ -2444,25 +3393,40 @@ handle_connection (int fd)
     p = getprotobyname ("tcp");
     if (p == 0)
       {
-	DBG (DBG_WARN, "handle_connection: cannot look up `tcp' protocol number\n");
+	DBG (DBG_WARN, "set_nodelay: cannot look up `tcp' protocol number\n");
       }
     else
       level = p->p_proto;
   }
 # endif	/* SOL_TCP */
   if (level == -1
-      || setsockopt (wire.io.fd, level, TCP_NODELAY, &on, sizeof (on)))
-    DBG (DBG_WARN, "handle_connection: failed to put socket in TCP_NODELAY mode (%s)\n",
+      || setsockopt (fd, level, TCP_NODELAY, &on, sizeof (on)))
+    DBG (DBG_WARN, "set_nodelay: failed to put socket in TCP_NODELAY mode (%s)\n",
 	 strerror (errno));
+#else
+  (void) fd;
 #endif /* !TCP_NODELAY */
+}
+
+static void
+handle_connection (int fd)
+{
+  DBG (DBG_DBG, "handle_connection: processing client connection\n");
+
+  client_init (&client, fd);
+
+  signal (SIGALRM, quit);
+  signal (SIGPIPE, quit);
+
+  set_nodelay (fd);
 
-  if (init (&wire) < 0)
+  if (init (&client) < 0)
     return;
 
   while (1)
     {
       reset_watchdog ();
-      if (process_request (&wire) < 0)
+      if (process_request (&client) < 0)
 	break;
     }
 }
@@ -2547,6 +3511,446 @@ sig_int_term_handler (int signum)
 }
 
 
+#ifdef SANED_USES_THREADS
+static void do_bindings (void);
+static void *worker_main (void *arg);
+
+static Worker *
+start_worker (const char *device)
+{
+  Worker *wk;
+
+  wk = calloc (1, sizeof (*wk));
+  if (!wk)
+    return NULL;
+
+  if (device)
+    wk->device = strdup (device);
+  pthread_mutex_init (&wk->lock, NULL);
+  pthread_cond_init (&wk->cond, NULL);
+
+  if (pthread_create (&wk->thread, NULL, worker_main, wk) != 0)
+    {
+      DBG (DBG_ERR, "start_worker: cannot create thread for %s\n",
+	   device ? device : "general requests");
+      pthread_cond_destroy (&wk->cond);
+      pthread_mutex_destroy (&wk->lock);
+      free (wk->device);
+      free (wk);
+      return NULL;
+    }
+
+  DBG (DBG_MSG, "start_worker: started worker for %s\n",
+       device ? device : "general requests");
+  wk->next = workers;
+  workers = wk;
+  return wk;
+}
+
+/* Find the worker serving DEVICE and start it on first use.  */
+static Worker *
+get_worker (const char *device)
+{
+  Worker *wk;
+
+  pthread_mutex_lock (&workers_lock);
+  for (wk = workers; wk; wk = wk->next)
+    if (wk->device && strcmp (wk->device, device) == 0)
+      break;
+  if (!wk)
+    wk = start_worker (device);
+  pthread_mutex_unlock (&workers_lock);
+
+  return wk;
+}
+
+static void
+queue_client (Worker * wk, Client * c)
+{
+  pthread_mutex_lock (&wk->lock);
+  c->queue_next = NULL;
+  if (wk->tail)
+    wk->tail->queue_next = c;
+  else
+    wk->head = c;
+  wk->tail = c;
+  pthread_cond_signal (&wk->cond);
+  pthread_mutex_unlock (&wk->lock);
+}
+
+static void
+close_client (Client * c)
+{
+  struct epoll_event ev;
+  Client **cp;
+  int i;
+
+  DBG (DBG_MSG, "close_client: closing connection from %s\n",
+       c->remote_ip ? c->remote_ip : "[unknown]");
+
+  memset (&ev, 0, sizeof (ev));
+  epoll_ctl (epoll_fd, EPOLL_CTL_DEL, c->event.fd, &ev);
+
+  pthread_mutex_lock (&workers_lock);
+  for (cp = &clients; *cp; cp = &(*cp)->next)
+    if (*cp == c)
+      {
+	*cp = c->next;
+	break;
+      }
+  pthread_mutex_unlock (&workers_lock);
+
+  for (i = 0; i < c->num_handles; ++i)
+    close_handle (c, i);
+
+  sanei_w_exit (&c->wire);
+  close (c->event.fd);
+  free (c->handle);
+  free (c->username);
+  free (c->remote_ip);
+  free (c->device);
+  free (c);
+
+  pthread_mutex_lock (&workers_lock);
+  if (--num_clients == 0 && run_once)
+    {
+      /* the only client we were going to serve is gone */
+      if (write (wakeup_pipe[1], "", 1) < 0)
+	DBG (DBG_ERR, "close_client: cannot wake up event loop: %s\n",
+	     strerror (errno));
+    }
+  pthread_mutex_unlock (&workers_lock);
+}
+
+static void *
+worker_main (void *arg)
+{
+  Worker *wk = arg;
+  struct epoll_event ev;
+  Client *c;
+  int ret;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&wk->lock);
+      while (!wk->head && !workers_quit)
+	pthread_cond_wait (&wk->cond, &wk->lock);
+      c = wk->head;
+      if (c)
+	{
+	  wk->head = c->queue_next;
+	  if (!wk->head)
+	    wk->tail = NULL;
+	}
+      pthread_mutex_unlock (&wk->lock);
+
+      if (!c)
+	break;
+
+      if (!c->initialized)
+	{
+	  c->initialized = 1;
+	  ret = init (c);
+	}
+      else
+	ret = process_request (c);
+      set_current_client (NULL);
+
+      if (ret < 0)
+	{
+	  close_client (c);
+	  continue;
+	}
+
+      /* from now on, the device's own worker runs this client's requests */
+      if (c->device && c->worker == general_worker)
+	{
+	  c->worker = get_worker (c->device);
+	  if (!c->worker)
+	    {
+	      close_client (c);
+	      continue;
+	    }
+	}
+
+      /* the client may be closed as idle as soon as it is re-armed */
+      memset (&ev, 0, sizeof (ev));
+      ev.events = EPOLLIN | EPOLLONESHOT;
+      ev.data.ptr = &c->event;
+      pthread_mutex_lock (&workers_lock);
+      ret = epoll_ctl (epoll_fd, EPOLL_CTL_MOD, c->event.fd, &ev);
+      if (ret == 0)
+	c->idle_since = time (NULL);
+      pthread_mutex_unlock (&workers_lock);
+      if (ret < 0)
+	{
+	  DBG (DBG_ERR, "worker_main: cannot wait for next request: %s\n",
+	       strerror (errno));
+	  close_client (c);
+	}
+    }
+
+  return NULL;
+}
+
+static void
+stop_workers (void)
+{
+  Worker *wk;
+
+  pthread_mutex_lock (&workers_lock);
+  workers_quit = 1;
+  for (wk = workers; wk; wk = wk->next)
+    {
+      pthread_mutex_lock (&wk->lock);
+      pthread_cond_signal (&wk->cond);
+      pthread_mutex_unlock (&wk->lock);
+    }
+  pthread_mutex_unlock (&workers_lock);
+
+  while (workers)
+    {
+      wk = workers;
+      workers = wk->next;
+      pthread_join (wk->thread, NULL);
+      pthread_cond_destroy (&wk->cond);
+      pthread_mutex_destroy (&wk->lock);
+      free (wk->device);
+      free (wk);
+    }
+  general_worker = NULL;
+}
+
+/* Drop the connections that have been waiting for a request for too
+   long, as the watchdog does for a forked saned.  Only called by the
+   event loop, so a client found idle can't get a request meanwhile.  */
+static void
+close_idle_clients (void)
+{
+  Client *c, *idle = NULL;
+  time_t now = time (NULL);
+
+  pthread_mutex_lock (&workers_lock);
+  for (c = clients; c; c = c->next)
+    if (c->idle_since && now - c->idle_since >= SANED_IDLE_TIMEOUT)
+      {
+	c->idle_since = 0;
+	c->queue_next = idle;
+	idle = c;
+      }
+  pthread_mutex_unlock (&workers_lock);
+
+  while (idle)
+    {
+      c = idle;
+      idle = c->queue_next;
+      DBG (DBG_MSG, "close_idle_clients: %s has been idle for too long\n",
+	   c->remote_ip ? c->remote_ip : "[unknown]");
+      close_client (c);
+    }
+}
+
+/* Register the saned_fds of the types in TYPE_MASK with the event loop.  */
+static void
+watch_fds (unsigned type_mask)
+{
+  struct epoll_event ev;
+  struct saned_fd *sfd;
+
+  for (sfd = saned_fds; sfd; sfd = sfd->next)
+    {
+      if (!(type_mask & (1 << sfd->type)))
+	continue;
+      memset (&ev, 0, sizeof (ev));
+      ev.events = EPOLLIN;
+      ev.data.ptr = sfd;
+      if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, sfd->fd, &ev) < 0)
+	DBG (DBG_ERR, "watch_fds: cannot watch fd %d: %s\n", sfd->fd,
+	     strerror (errno));
+    }
+}
+
+static void
+unwatch_fds (unsigned type_mask)
+{
+  struct epoll_event ev;
+  struct saned_fd *sfd;
+
+  memset (&ev, 0, sizeof (ev));
+  for (sfd = saned_fds; sfd; sfd = sfd->next)
+    if (type_mask & (1 << sfd->type))
+      epoll_ctl (epoll_fd, EPOLL_CTL_DEL, sfd->fd, &ev);
+}
+
+static void
+accept_client (int listen_fd)
+{
+  struct epoll_event ev;
+  Client *c;
+  int fd;
+
+  fd = accept (listen_fd, 0, 0);
+  if (fd < 0)
+    {
+      if (errno != EAGAIN)
+	DBG (DBG_ERR, "accept_client: accept failed: %s\n", strerror (errno));
+      return;
+    }
+
+  c = malloc (sizeof (*c));
+  if (!c)
+    {
+      DBG (DBG_ERR, "accept_client: not enough memory for client\n");
+      close (fd);
+      return;
+    }
+  client_init (c, fd);
+  c->event.type = SANED_FD_CLIENT;
+  c->event.fd = fd;
+  c->worker = general_worker;
+  set_nodelay (fd);
+
+  pthread_mutex_lock (&workers_lock);
+  num_clients++;
+  c->next = clients;
+  clients = c;
+  c->idle_since = time (NULL);
+  pthread_mutex_unlock (&workers_lock);
+
+  /* one shot: the worker re-arms the descriptor once it has replied */
+  memset (&ev, 0, sizeof (ev));
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.ptr = &c->event;
+  if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+      DBG (DBG_ERR, "accept_client: cannot watch client: %s\n",
+	   strerror (errno));
+      close_client (c);
+    }
+}
+
+static void
+serve_threaded (void)
+{
+  struct epoll_event events[32];
+  struct saned_fd wakeup, *sfd;
+  struct saned_child *child;
+  SANE_Int version_code;
+  int running = SANE_TRUE;
+  int do_rebind, do_reap;
+  char byte;
+  int i, n;
+
+  DBG (DBG_MSG, "serve_threaded: serving all clients from this process\n");
+
+  signal (SIGPIPE, SIG_IGN);
+
+  epoll_fd = epoll_create (32);
+  if (epoll_fd < 0 || pipe (wakeup_pipe) < 0
+      || pthread_key_create (&current_client_key, NULL) != 0)
+    {
+      DBG (DBG_ERR, "serve_threaded: cannot set up event loop: %s\n",
+	   strerror (errno));
+      bail_out (1);
+    }
+
+  wakeup.type = SANED_FD_WAKEUP;
+  wakeup.fd = wakeup_pipe[0];
+  memset (events, 0, sizeof (events[0]));
+  events[0].events = EPOLLIN;
+  events[0].data.ptr = &wakeup;
+  epoll_ctl (epoll_fd, EPOLL_CTL_ADD, wakeup.fd, &events[0]);
+  watch_fds ((1 << SANED_FD_LISTENER) | (1 << SANED_FD_PROCESS));
+
+  general_worker = get_worker (NULL);
+  if (!general_worker)
+    bail_out (1);
+
+  /* load the backends now rather than when the first client connects */
+  if (init_backends (&version_code) != SANE_STATUS_GOOD)
+    DBG (DBG_ERR, "serve_threaded: failed to initialize backends\n");
+
+  while (running)
+    {
+      do_rebind = SANE_FALSE;
+      do_reap = SANE_FALSE;
+      for (child = children; child; child = child->next)
+	if (child->pidfd == -1)
+	  do_reap = SANE_TRUE;
+
+      /* wake up once a minute to look for idle clients */
+      n = epoll_wait (epoll_fd, events, NELEMS (events),
+		      do_reap ? 500 : debug ? -1 : 60 * 1000);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  DBG (DBG_ERR, "serve_threaded: epoll_wait failed: %s\n",
+	       strerror (errno));
+	  break;
+	}
+
+      for (i = 0; i < n; i++)
+	{
+	  sfd = events[i].data.ptr;
+
+	  switch (sfd->type)
+	    {
+	    case SANED_FD_LISTENER:
+	      if (events[i].events & (EPOLLERR | EPOLLHUP))
+		do_rebind = SANE_TRUE;
+	      else if (events[i].events & EPOLLIN)
+		{
+		  accept_client (sfd->fd);
+		  if (run_once == SANE_TRUE)
+		    unwatch_fds (1 << SANED_FD_LISTENER);
+		}
+	      break;
+	    case SANED_FD_PROCESS:
+	      do_reap = SANE_TRUE;
+	      break;
+	    case SANED_FD_CLIENT:
+	      {
+		Client *c = (Client *) ((char *) sfd - offsetof (Client, event));
+		pthread_mutex_lock (&workers_lock);
+		c->idle_since = 0;
+		pthread_mutex_unlock (&workers_lock);
+		queue_client (c->worker, c);
+	      }
+	      break;
+	    case SANED_FD_WAKEUP:
+	      if (read (sfd->fd, &byte, 1) == 1)
+		running = SANE_FALSE;
+	      break;
+	    }
+	}
+
+      if (do_rebind && running)
+	{
+	  DBG (DBG_WARN, "serve_threaded: invalid fd in set, attempting to re-bind\n");
+	  close_fds (1 << SANED_FD_LISTENER, -1);
+	  do_bindings ();
+	  watch_fds (1 << SANED_FD_LISTENER);
+	}
+
+      if (do_reap)
+	while (wait_child (-1, NULL, WNOHANG) > 0);
+
+      if (!debug)
+	close_idle_clients ();
+    }
+
+  stop_workers ();
+  sane_exit ();
+  free_backends ();
+  close (epoll_fd);
+  close (wakeup_pipe[0]);
+  close (wakeup_pipe[1]);
+  epoll_fd = -1;
+}
+#endif /* SANED_USES_THREADS */
+
+
 #if WITH_AVAHI
 static void
 saned_avahi (void);
@@ -2907,6 +4311,42 @@ read_config (void)
                 DBG (DBG_INFO, "read_config: data connect timeout: %d\n", data_connect_timeout);
               }
             }
+            else if(strstr(config_line, "data_zerocopy") != NULL)
+            {
+              optval = sanei_config_skip_whitespace (++optval);
+              if ((optval != NULL) && (*optval != '\0'))
+              {
+                if (strncmp (optval, "no", 2) == 0)
+                  data_zerocopy = 0;
+                else if (strncmp (optval, "yes", 3) == 0)
+                  data_zerocopy = 1;
+                else
+                {
+                  DBG (DBG_ERR, "read_config: invalid value for data_zerocopy\n");
+                  continue;
+                }
+                DBG (DBG_INFO, "read_config: zero-copy data transfer: %s\n",
+                     data_zerocopy ? "yes" : "no");
+              }
+            }
+            else if(strstr(config_line, "data_compression") != NULL)
+            {
+              optval = sanei_config_skip_whitespace (++optval);
+              if ((optval != NULL) && (*optval != '\0'))
+              {
+                if (strncmp (optval, "no", 2) == 0)
+                  data_compression = 0;
+                else if (strncmp (optval, "yes", 3) == 0)
+                  data_compression = 1;
+                else
+                {
+                  DBG (DBG_ERR, "read_config: invalid value for data_compression\n");
+                  continue;
+                }
+                DBG (DBG_INFO, "read_config: data compression: %s\n",
+                     data_compression ? "yes" : "no");
+              }
+            }
         }
       fclose (fp);
       DBG (DBG_INFO, "read_config: done reading config\n");
@@ -3314,6 +4754,14 @@ run_standalone (char *user)
 
   DBG (DBG_MSG, "run_standalone: waiting for control connection\n");
 
+#ifdef SANED_USES_THREADS
+  if (run_threaded)
+    {
+      serve_threaded ();
+      running = SANE_FALSE;
+    }
+#endif
+
   while (running)
     {
       struct saned_child *child;
@@ -3394,6 +4842,9 @@ run_standalone (char *user)
 	      do_reap = SANE_TRUE;
 	      poll_set_valid = SANE_FALSE; /* We will expect to drop a pidfd */
 	    }
+	    break;
+	  default:
+	    break;
 	  }
         }
 
@@ -3510,6 +4961,7 @@ static void usage(char *me, int err)
        "  -n, --allow-network	        allow saned to use network scanners\n"
        "  -D, --daemonize	        run in background\n"
        "  -o, --once		        exit after first client disconnects\n"
+       "  -t, --threaded	        serve all clients from one process\n"
        "  -d, --debug=level	        set debug level `level' (default is 2)\n"
        "  -e, --stderr		        output to stderr\n"
        "  -b, --bind=addr	        bind address `addr' (default all interfaces)\n"
@@ -3532,6 +4984,7 @@ static struct option long_options[] =
   {"allow-network",     no_argument,            0, 'n'},
   {"daemonize",         no_argument,            0, 'D'},
   {"once",              no_argument,            0, 'o'},
+  {"threaded",          no_argument,            0, 't'},
   {"debug",             required_argument,      0, 'd'},
   {"stderr",            no_argument,            0, 'e'},
   {"bind",              required_argument,      0, 'b'},
@@ -3563,7 +5016,7 @@ main (int argc, char *argv[])
   run_once = SANE_FALSE;
   allow_network = SANE_FALSE;
 
-  while((c = getopt_long(argc, argv,"ha::lu:nDod:eb:p:B:", long_options, &long_index )) != -1)
+  while((c = getopt_long(argc, argv,"ha::lu:nDotd:eb:p:B:", long_options, &long_index )) != -1)
     {
       switch(c) {
       case 'a':
@@ -3587,6 +5040,14 @@ main (int argc, char *argv[])
       case 'o':
 	run_once = SANE_TRUE;
 	break;
+      case 't':
+#ifdef SANED_USES_THREADS
+	run_threaded = SANE_TRUE;
+#else
+	DBG (DBG_ERR, "saned: threaded mode is not supported by this build\n");
+	exit (1);
+#endif
+	break;
       case 'd':
 	debug = atoi(optarg);
 	break;
@@ -3633,10 +5094,6 @@ main (int argc, char *argv[])
   byte_order.w = 0;
   byte_order.ch = 1;
 
-  sanei_w_init (&wire, sanei_codec_bin_init);
-  wire.io.read = read;
-  wire.io.write = write;
-
 #ifdef SANED_USES_AF_INDEP
   strcat(options, "AF-indep");
 # ifdef ENABLE_IPV6
@@ -3645,6 +5102,10 @@ main (int argc, char *argv[])
 #else
   strcat(options, "IPv4 only");
 #endif
+#ifdef SANED_USES_THREADS
+  if (run_threaded && run_mode == SANED_RUN_ALONE)
+    strcat(options, "+threaded");
+#endif
 #ifdef HAVE_SYSTEMD
   if (sd_listen_fds(0) > 0)
     {
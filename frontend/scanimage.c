@@ -43,6 +43,12 @@
 #include <libgen.h>     // for basename()
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+
+#if defined(HAVE_PTHREAD_H) && defined(USE_PTHREAD)
+#include <pthread.h>
+#define SCANIMAGE_THREADS
+#endif
 
 #ifdef HAVE_LIBPNG
 #include <png.h>
@@ -90,6 +96,9 @@ Image;
 #define OPTION_BATCH_INCREMENT	1006
 #define OPTION_BATCH_PROMPT    1007
 #define OPTION_BATCH_PRINT     1008
+#define OPTION_PIPELINE        1009
+#define OPTION_BATCH_ENCODERS  1010
+#define OPTION_BATCH_MEMORY    1011
 
 #define BATCH_COUNT_UNLIMITED -1
 
@@ -112,10 +121,13 @@ static struct option basic_options[] = {
   {"batch-increment", required_argument, NULL, OPTION_BATCH_INCREMENT},
   {"batch-print", no_argument, NULL, OPTION_BATCH_PRINT},
   {"batch-prompt", no_argument, NULL, OPTION_BATCH_PROMPT},
+  {"batch-encoders", required_argument, NULL, OPTION_BATCH_ENCODERS},
+  {"batch-memory", required_argument, NULL, OPTION_BATCH_MEMORY},
   {"format", required_argument, NULL, OPTION_FORMAT},
   {"accept-md5-only", no_argument, NULL, OPTION_MD5},
   {"icc-profile", required_argument, NULL, 'i'},
   {"dont-scan", no_argument, NULL, 'n'},
+  {"pipeline", optional_argument, NULL, OPTION_PIPELINE},
   {0, 0, NULL, 0}
 };
 
@@ -128,6 +140,8 @@ static struct option basic_options[] = {
 
 #define BASE_OPTSTRING	"d:hi:Lf:o:B:nvVTAbp"
 #define STRIP_HEIGHT	256	/* # lines we increment image height */
+#define PIPELINE_SLOTS	4	/* # buffers read ahead by default */
+#define BATCH_MEMORY	512	/* MB of raw pages waiting for encoders */
 
 static struct option *all_options = NULL;
 static int option_number_len = 0;
@@ -143,6 +157,7 @@ static int help = 0;
 static int dont_scan = 0;
 static const char *prog_name = NULL;
 static int resolution_optind = -1, resolution_value = 0;
+static int pipeline_slots = 0;	/* read ahead in a thread if > 0 */
 
 /* window (area) related options */
 static SANE_Option_Descriptor window_option[4] = {0}; /*updated descs for x,y,l,t*/
@@ -1358,8 +1373,347 @@ advance (Image * image)
   return image->data;
 }
 
+static double
+now_seconds (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+#ifdef SCANIMAGE_THREADS
+/* With --pipeline, a reader thread calls sane_read into a ring of
+   buffers while scan_it encodes the ones filled before, so a slow
+   encoder doesn't hold up the device.  */
+typedef struct
+{
+  SANE_Byte *data;
+  SANE_Int len;
+  SANE_Status status;
+}
+Slot;
+
+typedef struct
+{
+  Slot *slots;
+  int num_slots;
+  int head;			/* next slot the reader fills */
+  int tail;			/* next slot the encoder takes */
+  int filled;
+  int held;			/* encoder still uses the tail slot */
+  int stop;			/* reader must not start another read */
+  int running;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t reader;
+  double reader_wait;		/* seconds the ring was full */
+  double encoder_wait;		/* seconds the ring was empty */
+}
+Pipeline;
+
+static void *
+pipeline_reader (void *arg)
+{
+  Pipeline *pipeline = arg;
+  SANE_Status status;
+  Slot *slot;
+  double start;
+
+  do
+    {
+      pthread_mutex_lock (&pipeline->lock);
+      start = now_seconds ();
+      while (pipeline->filled == pipeline->num_slots && !pipeline->stop)
+	pthread_cond_wait (&pipeline->cond, &pipeline->lock);
+      pipeline->reader_wait += now_seconds () - start;
+      if (pipeline->stop)
+	{
+	  pthread_mutex_unlock (&pipeline->lock);
+	  break;
+	}
+      slot = &pipeline->slots[pipeline->head];
+      pthread_mutex_unlock (&pipeline->lock);
+
+      status = sane_read (device, slot->data, buffer_size, &slot->len);
+      slot->status = status;
+
+      pthread_mutex_lock (&pipeline->lock);
+      pipeline->head = (pipeline->head + 1) % pipeline->num_slots;
+      pipeline->filled++;
+      pthread_cond_signal (&pipeline->cond);
+      pthread_mutex_unlock (&pipeline->lock);
+    }
+  while (status == SANE_STATUS_GOOD);
+
+  return NULL;
+}
+
+/* allocate the ring, once per scan */
+static SANE_Status
+pipeline_init (Pipeline *pipeline, int num_slots)
+{
+  int i;
+
+  memset (pipeline, 0, sizeof (*pipeline));
+  pthread_mutex_init (&pipeline->lock, NULL);
+  pthread_cond_init (&pipeline->cond, NULL);
+
+  pipeline->slots = calloc (num_slots, sizeof (Slot));
+  if (!pipeline->slots)
+    return SANE_STATUS_NO_MEM;
+  pipeline->num_slots = num_slots;
+
+  for (i = 0; i < num_slots; i++)
+    {
+      pipeline->slots[i].data = malloc (buffer_size);
+      if (!pipeline->slots[i].data)
+	return SANE_STATUS_NO_MEM;
+    }
+  return SANE_STATUS_GOOD;
+}
+
+/* start reading a frame */
 static SANE_Status
-scan_it (FILE *ofp, void* pw)
+pipeline_start (Pipeline *pipeline)
+{
+  pipeline->head = pipeline->tail = pipeline->filled = 0;
+  pipeline->held = pipeline->stop = 0;
+
+  if (pthread_create (&pipeline->reader, NULL, pipeline_reader, pipeline))
+    {
+      fprintf (stderr, "%s: can't start reader thread\n", prog_name);
+      return SANE_STATUS_NO_MEM;
+    }
+  pipeline->running = 1;
+  return SANE_STATUS_GOOD;
+}
+
+/* hand out the next filled buffer, after giving back the previous one */
+static SANE_Status
+pipeline_read (Pipeline *pipeline, SANE_Byte **data, SANE_Int *len)
+{
+  Slot *slot;
+  double start;
+
+  pthread_mutex_lock (&pipeline->lock);
+  if (pipeline->held)
+    {
+      pipeline->tail = (pipeline->tail + 1) % pipeline->num_slots;
+      pipeline->filled--;
+      pipeline->held = 0;
+      pthread_cond_signal (&pipeline->cond);
+    }
+  start = now_seconds ();
+  while (pipeline->filled == 0)
+    pthread_cond_wait (&pipeline->cond, &pipeline->lock);
+  pipeline->encoder_wait += now_seconds () - start;
+  slot = &pipeline->slots[pipeline->tail];
+  pipeline->held = 1;
+  pthread_mutex_unlock (&pipeline->lock);
+
+  *data = slot->data;
+  *len = slot->len;
+  return slot->status;
+}
+
+/* wait for the reader of a frame to finish.  If the encoder gave up
+   early, the reader stops after its current read.  */
+static void
+pipeline_stop (Pipeline *pipeline)
+{
+  if (!pipeline->running)
+    return;
+
+  pthread_mutex_lock (&pipeline->lock);
+  pipeline->stop = 1;
+  pthread_cond_signal (&pipeline->cond);
+  pthread_mutex_unlock (&pipeline->lock);
+
+  pthread_join (pipeline->reader, NULL);
+  pipeline->running = 0;
+}
+
+static void
+pipeline_free (Pipeline *pipeline)
+{
+  int i;
+
+  pipeline_stop (pipeline);
+  if (pipeline->slots)
+    {
+      for (i = 0; i < pipeline->num_slots; i++)
+	free (pipeline->slots[i].data);
+      free (pipeline->slots);
+      pipeline->slots = NULL;
+    }
+
+  pthread_mutex_destroy (&pipeline->lock);
+  pthread_cond_destroy (&pipeline->cond);
+}
+#endif
+
+/* A page read into memory by record_page, so that scan_it can encode
+   it later, away from the device.  Separate red, green and blue
+   frames make up to three.  */
+#define PAGE_FRAMES	3
+
+typedef struct
+{
+  SANE_Parameters parm;
+  SANE_Byte *data;
+  size_t len;
+  size_t size;			/* allocated */
+}
+Frame;
+
+typedef struct Page
+{
+  int n;			/* page number of the file name */
+  int seq;			/* order in which pages are written */
+  char path[PATH_MAX];
+  char part_path[PATH_MAX];
+  Frame frames[PAGE_FRAMES];
+  int num_frames;
+  int frame;			/* frame scan_it is at */
+  size_t pos;			/* offset scan_it is at */
+  size_t size;			/* bytes held by the frames */
+  FILE *ofp;			/* encoded page, until it is written */
+  SANE_Status status;
+  struct Page *next;
+}
+Page;
+
+static void
+free_page (Page *page)
+{
+  int i;
+
+  for (i = 0; i < page->num_frames; i++)
+    free (page->frames[i].data);
+  if (page->ofp)
+    fclose (page->ofp);
+  free (page);
+}
+
+/* read all frames of a started page into memory */
+static SANE_Status
+record_page (Page *page)
+{
+  SANE_Status status;
+  SANE_Int len;
+  Frame *frame;
+
+  do
+    {
+      if (page->num_frames)
+	{
+#ifdef SANE_STATUS_WARMING_UP
+	  do
+	    {
+	      status = sane_start (device);
+	    }
+	  while(status == SANE_STATUS_WARMING_UP);
+#else
+	  status = sane_start (device);
+#endif
+	  if (status != SANE_STATUS_GOOD)
+	    {
+	      fprintf (stderr, "%s: sane_start: %s\n",
+		       prog_name, sane_strstatus (status));
+	      return status;
+	    }
+	}
+
+      if (page->num_frames == PAGE_FRAMES)
+	{
+	  fprintf (stderr, "%s: too many frames in page %d\n",
+		   prog_name, page->n);
+	  return SANE_STATUS_INVAL;
+	}
+      frame = &page->frames[page->num_frames++];
+
+      status = sane_get_parameters (device, &frame->parm);
+      if (status != SANE_STATUS_GOOD)
+	{
+	  fprintf (stderr, "%s: sane_get_parameters: %s\n",
+		   prog_name, sane_strstatus (status));
+	  return status;
+	}
+
+      /* start with the announced size, if there is one */
+      frame->size = buffer_size;
+      if (frame->parm.lines > 0)
+	frame->size = (size_t) frame->parm.bytes_per_line
+	  * frame->parm.lines + 1;
+
+      while (1)
+	{
+	  size_t left;
+
+	  if (frame->len == frame->size || !frame->data)
+	    {
+	      SANE_Byte *data;
+
+	      if (frame->data)
+		frame->size *= 2;
+	      data = realloc (frame->data, frame->size);
+	      if (!data)
+		{
+		  fprintf (stderr, "%s: can't allocate page buffer (%lu)\n",
+			   prog_name, (unsigned long) frame->size);
+		  return SANE_STATUS_NO_MEM;
+		}
+	      frame->data = data;
+	    }
+
+	  left = frame->size - frame->len;
+	  if (left > buffer_size)
+	    left = buffer_size;
+
+	  status = sane_read (device, frame->data + frame->len, left, &len);
+	  if (status == SANE_STATUS_EOF)
+	    break;
+	  if (status != SANE_STATUS_GOOD)
+	    {
+	      fprintf (stderr, "%s: sane_read: %s\n",
+		       prog_name, sane_strstatus (status));
+	      return status;
+	    }
+	  frame->len += len;
+	}
+      page->size += frame->size;
+    }
+  while (!frame->parm.last_frame);
+
+  return SANE_STATUS_GOOD;
+}
+
+/* hand out the data of the current frame of a recorded page,
+   like sane_read */
+static SANE_Status
+page_read (Page *page, SANE_Byte **data, SANE_Int *len)
+{
+  Frame *frame = &page->frames[page->frame];
+  size_t left = frame->len - page->pos;
+
+  if (!left)
+    {
+      page->pos = 0;
+      *len = 0;
+      return SANE_STATUS_EOF;
+    }
+
+  if (left > buffer_size)
+    left = buffer_size;
+  *data = frame->data + page->pos;
+  *len = left;
+  page->pos += left;
+  return SANE_STATUS_GOOD;
+}
+
+static SANE_Status
+scan_it (FILE *ofp, void* pw, int out_format, Page *page)
 {
   int i, len, first_frame = 1, offset = 0, must_buffer = 0;
   uint64_t hundred_percent = 0;
@@ -1384,12 +1738,29 @@ scan_it (FILE *ofp, void* pw)
   struct jpeg_compress_struct cinfo;
   struct jpeg_error_mgr jerr;
 #endif
+  SANE_Byte *data;
+#ifdef SCANIMAGE_THREADS
+  Pipeline pipeline;
+#endif
 
   (void)pw;
 
+#ifdef SCANIMAGE_THREADS
+  if (pipeline_slots > 0 && !page
+      && pipeline_init (&pipeline, pipeline_slots))
+    {
+      fprintf (stderr, "%s: can't allocate %d read buffers\n",
+	       prog_name, pipeline_slots);
+      pipeline_free (&pipeline);
+      return SANE_STATUS_NO_MEM;
+    }
+#endif
+
   do
     {
-      if (!first_frame)
+      if (!first_frame && page)
+	page->frame++;
+      else if (!first_frame)
 	{
 #ifdef SANE_STATUS_WARMING_UP
           do
@@ -1408,7 +1779,13 @@ scan_it (FILE *ofp, void* pw)
 	    }
 	}
 
-      status = sane_get_parameters (device, &parm);
+      if (page)
+	{
+	  parm = page->frames[page->frame].parm;
+	  status = SANE_STATUS_GOOD;
+	}
+      else
+	status = sane_get_parameters (device, &parm);
       if (status != SANE_STATUS_GOOD)
 	{
 	  fprintf (stderr, "%s: sane_get_parameters: %s\n",
@@ -1416,7 +1793,7 @@ scan_it (FILE *ofp, void* pw)
 	  goto cleanup;
 	}
 
-      if (verbose)
+      if (verbose && !page)
 	{
 	  if (first_frame)
 	    {
@@ -1461,7 +1838,7 @@ scan_it (FILE *ofp, void* pw)
 		  offset = 0;
 		}
 	      else
-		  switch(output_format)
+		  switch(out_format)
 		  {
 		  case OUTPUT_TIFF:
 		    sanei_write_tiff_header (parm.format,
@@ -1502,11 +1879,11 @@ scan_it (FILE *ofp, void* pw)
 	      break;
 	    }
 #ifdef HAVE_LIBPNG
-	  if(output_format == OUTPUT_PNG)
+	  if(out_format == OUTPUT_PNG)
 	    pngbuf = malloc(parm.bytes_per_line);
 #endif
 #ifdef HAVE_LIBJPEG
-	  if(output_format == OUTPUT_JPEG || output_format == OUTPUT_PDF)
+	  if(out_format == OUTPUT_JPEG || out_format == OUTPUT_PDF)
 	    jpegbuf = malloc(parm.bytes_per_line);
 #endif
 
@@ -1546,15 +1923,35 @@ scan_it (FILE *ofp, void* pw)
       hundred_percent = ((uint64_t)parm.bytes_per_line) * parm.lines
 	* ((parm.format == SANE_FRAME_RGB || parm.format == SANE_FRAME_GRAY) ? 1:3);
 
+#ifdef SCANIMAGE_THREADS
+      if (pipeline_slots > 0 && !page)
+	{
+	  status = pipeline_start (&pipeline);
+	  if (status != SANE_STATUS_GOOD)
+	    goto cleanup;
+	}
+#endif
+
       while (1)
 	{
 	  double progr;
-	  status = sane_read (device, buffer, buffer_size, &len);
+	  if (page)
+	    status = page_read (page, &data, &len);
+	  else
+#ifdef SCANIMAGE_THREADS
+	  if (pipeline_slots > 0)
+	    status = pipeline_read (&pipeline, &data, &len);
+	  else
+#endif
+	    {
+	      data = buffer;
+	      status = sane_read (device, buffer, buffer_size, &len);
+	    }
 	  total_bytes += (SANE_Word) len;
           progr = ((total_bytes * 100.) / (double) hundred_percent);
           if (progr > 100.)
 	    progr = 100.;
-          if (progress)
+          if (progress && !page)
             {
               if (parm.lines >= 0)
                 fprintf(stderr, "Progress: %3.1f%%\r", progr);
@@ -1571,6 +1968,10 @@ scan_it (FILE *ofp, void* pw)
 		{
 		  fprintf (stderr, "%s: sane_read: %s\n",
 			   prog_name, sane_strstatus (status));
+#ifdef SCANIMAGE_THREADS
+		  if (pipeline_slots > 0 && !page)
+		    pipeline_free (&pipeline);
+#endif
 		  return status;
 		}
 	      break;
@@ -1586,7 +1987,7 @@ scan_it (FILE *ofp, void* pw)
 		  image.num_channels = 3;
 		  for (i = 0; i < len; ++i)
 		    {
-		      image.data[offset + 3 * i] = buffer[i];
+		      image.data[offset + 3 * i] = data[i];
 		      if (!advance (&image))
 			{
 			  status = SANE_STATUS_NO_MEM;
@@ -1600,7 +2001,7 @@ scan_it (FILE *ofp, void* pw)
 		  image.num_channels = 1;
 		  for (i = 0; i < len; ++i)
 		    {
-		      image.data[offset + i] = buffer[i];
+		      image.data[offset + i] = data[i];
 		      if (!advance (&image))
 			  {
 			    status = SANE_STATUS_NO_MEM;
@@ -1614,7 +2015,7 @@ scan_it (FILE *ofp, void* pw)
 		  image.num_channels = 1;
 		  for (i = 0; i < len; ++i)
 		    {
-		      image.data[offset + i] = buffer[i];
+		      image.data[offset + i] = data[i];
 		      if (!advance (&image))
 			  {
 			    status = SANE_STATUS_NO_MEM;
@@ -1631,13 +2032,13 @@ scan_it (FILE *ofp, void* pw)
 	  else			/* ! must_buffer */
 	    {
 #ifdef HAVE_LIBPNG
-	      if (output_format == OUTPUT_PNG)
+	      if (out_format == OUTPUT_PNG)
 	        {
 		  int idx = 0;
 		  int left = len;
 		  while(pngrow + left >= parm.bytes_per_line)
 		    {
-		      memcpy(pngbuf + pngrow, buffer + idx, parm.bytes_per_line - pngrow);
+		      memcpy(pngbuf + pngrow, data + idx, parm.bytes_per_line - pngrow);
 		      if(parm.depth == 1)
 			{
 			  int j;
@@ -1664,19 +2065,19 @@ scan_it (FILE *ofp, void* pw)
 		      left -= parm.bytes_per_line - pngrow;
 		      pngrow = 0;
 		    }
-		  memcpy(pngbuf + pngrow, buffer + idx, left);
+		  memcpy(pngbuf + pngrow, data + idx, left);
 		  pngrow += left;
 		}
 	      else
 #endif
 #ifdef HAVE_LIBJPEG
-	      if (output_format == OUTPUT_JPEG || output_format == OUTPUT_PDF)
+	      if (out_format == OUTPUT_JPEG || out_format == OUTPUT_PDF)
 	        {
 		  int idx = 0;
 		  int left = len;
 		  while(jpegrow + left >= parm.bytes_per_line)
 		    {
-		      memcpy(jpegbuf + jpegrow, buffer + idx, parm.bytes_per_line - jpegrow);
+		      memcpy(jpegbuf + jpegrow, data + idx, parm.bytes_per_line - jpegrow);
 		      if(parm.depth == 1)
 			{
 			  int col1, col8;
@@ -1693,13 +2094,13 @@ scan_it (FILE *ofp, void* pw)
 		      left -= parm.bytes_per_line - jpegrow;
 		      jpegrow = 0;
 		    }
-		  memcpy(jpegbuf + jpegrow, buffer + idx, left);
+		  memcpy(jpegbuf + jpegrow, data + idx, left);
 		  jpegrow += left;
 		}
 	      else
 #endif
-	      if ((output_format == OUTPUT_TIFF) || (parm.depth != 16))
-		fwrite (buffer, 1, len, ofp);
+	      if ((out_format == OUTPUT_TIFF) || (parm.depth != 16))
+		fwrite (data, 1, len, ofp);
 	      else
 		{
 #if !defined(WORDS_BIGENDIAN)
@@ -1710,8 +2111,8 @@ scan_it (FILE *ofp, void* pw)
 		    {
 		      if (len > 0)
 			{
-			  fwrite (buffer, 1, 1, ofp);
-			  buffer[0] = (SANE_Byte) hang_over;
+			  fwrite (data, 1, 1, ofp);
+			  data[0] = (SANE_Byte) hang_over;
 			  hang_over = -1;
 			  start = 1;
 			}
@@ -1720,30 +2121,34 @@ scan_it (FILE *ofp, void* pw)
 		  for (int idx = start; idx < (len - 1); idx += 2)
 		    {
 		      unsigned char LSB;
-		      LSB = buffer[idx];
-		      buffer[idx] = buffer[idx + 1];
-		      buffer[idx + 1] = LSB;
+		      LSB = data[idx];
+		      data[idx] = data[idx + 1];
+		      data[idx + 1] = LSB;
 		    }
 		  /* check if we have an odd number of bytes */
 		  if (((len - start) % 2) != 0)
 		    {
-		      hang_over = buffer[len - 1];
+		      hang_over = data[len - 1];
 		      len--;
 		    }
 #endif
-		  fwrite (buffer, 1, len, ofp);
+		  fwrite (data, 1, len, ofp);
 		}
 	    }
 
 	  if (verbose && parm.depth == 8)
 	    {
 	      for (i = 0; i < len; ++i)
-		if (buffer[i] >= max)
-		  max = buffer[i];
-		else if (buffer[i] < min)
-		  min = buffer[i];
+		if (data[i] >= max)
+		  max = data[i];
+		else if (data[i] < min)
+		  min = data[i];
 	    }
 	}
+#ifdef SCANIMAGE_THREADS
+      if (pipeline_slots > 0 && !page)
+	pipeline_stop (&pipeline);
+#endif
       first_frame = 0;
     }
   while (!parm.last_frame);
@@ -1752,7 +2157,7 @@ scan_it (FILE *ofp, void* pw)
     {
       image.height = image.y;
 
-      switch(output_format) {
+      switch(out_format) {
       case OUTPUT_TIFF:
 	sanei_write_tiff_header (parm.format, parm.pixels_per_line,
 				 image.height, parm.depth, resolution_value,
@@ -1789,7 +2194,7 @@ scan_it (FILE *ofp, void* pw)
 #if !defined(WORDS_BIGENDIAN)
       /* multibyte pnm file may need byte swap to LE */
       /* FIXME: other bit depths? */
-      if (output_format != OUTPUT_TIFF && parm.depth == 16)
+      if (out_format != OUTPUT_TIFF && parm.depth == 16)
 	{
 	  for (int idx = 0; idx < image.height * image.width; idx += 2)
 	    {
@@ -1804,11 +2209,11 @@ scan_it (FILE *ofp, void* pw)
 	fwrite (image.data, 1, image.height * image.width * image.num_channels, ofp);
     }
 #ifdef HAVE_LIBPNG
-    if(output_format == OUTPUT_PNG)
+    if(out_format == OUTPUT_PNG)
 	png_write_end(png_ptr, info_ptr);
 #endif
 #ifdef HAVE_LIBJPEG
-    if(output_format == OUTPUT_JPEG || output_format == OUTPUT_PDF)
+    if(out_format == OUTPUT_JPEG || out_format == OUTPUT_PDF)
 	jpeg_finish_compress(&cinfo);
 #endif
 
@@ -1817,13 +2222,13 @@ scan_it (FILE *ofp, void* pw)
 
 cleanup:
 #ifdef HAVE_LIBPNG
-  if(output_format == OUTPUT_PNG) {
+  if(out_format == OUTPUT_PNG) {
     png_destroy_write_struct(&png_ptr, &info_ptr);
     free(pngbuf);
   }
 #endif
 #ifdef HAVE_LIBJPEG
-  if(output_format == OUTPUT_JPEG || output_format == OUTPUT_PDF) {
+  if(out_format == OUTPUT_JPEG || out_format == OUTPUT_PDF) {
     jpeg_destroy_compress(&cinfo);
     free(jpegbuf);
   }
@@ -1831,6 +2236,16 @@ cleanup:
   if (image.data)
     free (image.data);
 
+#ifdef SCANIMAGE_THREADS
+  if (pipeline_slots > 0 && !page)
+    {
+      pipeline_free (&pipeline);
+      if (verbose)
+	fprintf (stderr, "%s: reader waited %.3fs for free buffers, "
+		 "encoder waited %.3fs for data\n", prog_name,
+		 pipeline.reader_wait, pipeline.encoder_wait);
+    }
+#endif
 
   expected_bytes = ((uint64_t)parm.bytes_per_line) * parm.lines *
     ((parm.format == SANE_FRAME_RGB
@@ -1849,6 +2264,308 @@ cleanup:
   return status;
 }
 
+#ifdef SCANIMAGE_THREADS
+/* With --batch-encoders, batch mode records each page and hands it to
+   a pool of encoder threads, so that the next page can be fed while
+   the previous ones are encoded.  Pages are written in the order they
+   were scanned.  */
+typedef struct
+{
+  pthread_t *workers;
+  int num_workers;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  Page *first;			/* pages waiting for a worker */
+  Page *last;
+  int next_seq;			/* of the next page queued */
+  int write_seq;		/* of the next page to write */
+  size_t held;			/* raw page bytes not yet encoded */
+  size_t limit;
+  int done;			/* no more pages will be queued */
+  SANE_Status status;		/* of the first page which failed */
+  int batch_print;
+  FILE *pdf_ofp;		/* document the pages are added to */
+  void *pw;
+}
+EncoderPool;
+
+/* encode a recorded page into its .part file, or into a temporary
+   one with the JPEG of a PDF page */
+static SANE_Status
+encode_page (Page *page)
+{
+  SANE_Status status;
+  int format = output_format;
+
+#ifdef HAVE_LIBJPEG
+  if (output_format == OUTPUT_PDF)
+    {
+      format = OUTPUT_JPEG;
+      page->ofp = tmpfile ();
+    }
+  else
+#endif
+    page->ofp = fopen (page->part_path, "w");
+
+  if (!page->ofp)
+    {
+      fprintf (stderr, "cannot open %s\n", page->part_path);
+      return SANE_STATUS_ACCESS_DENIED;
+    }
+
+  status = scan_it (page->ofp, NULL, format, page);
+  if (status == SANE_STATUS_EOF)
+    status = SANE_STATUS_GOOD;
+
+  if (format == output_format)
+    {
+      if (0 != fclose (page->ofp) && status == SANE_STATUS_GOOD)
+	{
+	  fprintf (stderr, "cannot close image file\n");
+	  status = SANE_STATUS_ACCESS_DENIED;
+	}
+      page->ofp = NULL;
+    }
+  return status;
+}
+
+/* make an encoded page show up, in page order */
+static SANE_Status
+write_page (EncoderPool *pool, Page *page)
+{
+#ifdef HAVE_LIBJPEG
+  if (output_format == OUTPUT_PDF)
+    {
+      Frame *frame = &page->frames[page->num_frames - 1];
+      char copy[BUFSIZ];
+      size_t len;
+
+      if (page->status != SANE_STATUS_GOOD)
+	return page->status;
+
+      sane_pdf_start_page (pool->pw, frame->parm.pixels_per_line,
+			   frame->parm.lines, resolution_value,
+			   SANE_PDF_IMAGE_COLOR, SANE_PDF_ROTATE_OFF);
+      rewind (page->ofp);
+      while ((len = fread (copy, 1, sizeof (copy), page->ofp)) > 0)
+	fwrite (copy, 1, len, pool->pdf_ofp);
+      sane_pdf_end_page (pool->pw);
+      fflush (pool->pdf_ofp);
+      return SANE_STATUS_GOOD;
+    }
+#endif
+
+  if (page->status != SANE_STATUS_GOOD)
+    {
+      unlink (page->part_path);
+      return page->status;
+    }
+
+  /* let the fully scanned file show up */
+  if (rename (page->part_path, page->path))
+    {
+      fprintf (stderr, "cannot rename %s to %s\n",
+	       page->part_path, page->path);
+      return SANE_STATUS_ACCESS_DENIED;
+    }
+  if (pool->batch_print)
+    {
+      fprintf (stdout, "%s\n", page->path);
+      fflush (stdout);
+    }
+  return SANE_STATUS_GOOD;
+}
+
+static void *
+encoder_worker (void *arg)
+{
+  EncoderPool *pool = arg;
+  SANE_Status status;
+  Page *page;
+  int i;
+
+  pthread_mutex_lock (&pool->lock);
+  while (1)
+    {
+      while (!pool->first && !pool->done)
+	pthread_cond_wait (&pool->cond, &pool->lock);
+      page = pool->first;
+      if (!page)
+	break;
+      pool->first = page->next;
+      if (!pool->first)
+	pool->last = NULL;
+      pthread_mutex_unlock (&pool->lock);
+
+      page->status = encode_page (page);
+
+      /* the raw page is no longer needed */
+      for (i = 0; i < page->num_frames; i++)
+	{
+	  free (page->frames[i].data);
+	  page->frames[i].data = NULL;
+	}
+
+      pthread_mutex_lock (&pool->lock);
+      pool->held -= page->size;
+      pthread_cond_broadcast (&pool->cond);
+      while (pool->write_seq != page->seq)
+	pthread_cond_wait (&pool->cond, &pool->lock);
+      pthread_mutex_unlock (&pool->lock);
+
+      /* only this worker may write now */
+      status = write_page (pool, page);
+
+      pthread_mutex_lock (&pool->lock);
+      if (status != SANE_STATUS_GOOD && pool->status == SANE_STATUS_GOOD)
+	pool->status = status;
+      pool->write_seq++;
+      pthread_cond_broadcast (&pool->cond);
+      pthread_mutex_unlock (&pool->lock);
+
+      free_page (page);
+      pthread_mutex_lock (&pool->lock);
+    }
+  pthread_mutex_unlock (&pool->lock);
+
+  return NULL;
+}
+
+static SANE_Status
+encoder_pool_start (EncoderPool *pool, int num_workers, size_t limit,
+		    int batch_print)
+{
+  int i;
+
+  memset (pool, 0, sizeof (*pool));
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->cond, NULL);
+  pool->limit = limit;
+  pool->batch_print = batch_print;
+  pool->status = SANE_STATUS_GOOD;
+
+  pool->workers = calloc (num_workers, sizeof (pthread_t));
+  if (!pool->workers)
+    return SANE_STATUS_NO_MEM;
+
+  for (i = 0; i < num_workers; i++)
+    {
+      if (pthread_create (&pool->workers[i], NULL, encoder_worker, pool))
+	break;
+      pool->num_workers++;
+    }
+  if (!pool->num_workers)
+    {
+      fprintf (stderr, "%s: can't start encoder threads\n", prog_name);
+      return SANE_STATUS_NO_MEM;
+    }
+  return SANE_STATUS_GOOD;
+}
+
+/* wait until raw pages take less memory than the limit, before the
+   next page is fed.  Returns the status of the first failed page.  */
+static SANE_Status
+encoder_pool_wait (EncoderPool *pool)
+{
+  SANE_Status status;
+
+  pthread_mutex_lock (&pool->lock);
+  while (pool->held >= pool->limit && pool->status == SANE_STATUS_GOOD)
+    pthread_cond_wait (&pool->cond, &pool->lock);
+  status = pool->status;
+  pthread_mutex_unlock (&pool->lock);
+
+  return status;
+}
+
+static void
+encoder_pool_add (EncoderPool *pool, Page *page, FILE *pdf_ofp, void *pw)
+{
+  pthread_mutex_lock (&pool->lock);
+  pool->pdf_ofp = pdf_ofp;
+  pool->pw = pw;
+  page->seq = pool->next_seq++;
+  pool->held += page->size;
+  if (pool->last)
+    pool->last->next = page;
+  else
+    pool->first = page;
+  pool->last = page;
+  pthread_cond_broadcast (&pool->cond);
+  pthread_mutex_unlock (&pool->lock);
+}
+
+/* write all queued pages, and stop the workers */
+static SANE_Status
+encoder_pool_finish (EncoderPool *pool)
+{
+  int i;
+
+  if (!pool->workers)
+    return pool->status;
+
+  pthread_mutex_lock (&pool->lock);
+  pool->done = 1;
+  pthread_cond_broadcast (&pool->cond);
+  pthread_mutex_unlock (&pool->lock);
+
+  for (i = 0; i < pool->num_workers; i++)
+    pthread_join (pool->workers[i], NULL);
+  free (pool->workers);
+  pool->workers = NULL;
+
+  pthread_mutex_destroy (&pool->lock);
+  pthread_cond_destroy (&pool->cond);
+  return pool->status;
+}
+
+/* record a started page and queue it for encoding */
+static SANE_Status
+encoder_pool_scan (EncoderPool *pool, int n, const char *path,
+		   const char *part_path, FILE **ofp, void **pw)
+{
+  SANE_Status status;
+  Page *page;
+
+#ifdef HAVE_LIBJPEG
+  /* the pages of a PDF all go into the first file */
+  if (output_format == OUTPUT_PDF && *ofp == NULL)
+    {
+      *ofp = fopen (part_path, "w");
+      if (*ofp == NULL)
+	{
+	  fprintf (stderr, "cannot open %s\n", part_path);
+	  sane_cancel (device);
+	  return SANE_STATUS_ACCESS_DENIED;
+	}
+      sane_pdf_open (pw, *ofp);
+      sane_pdf_start_doc (*pw);
+    }
+#endif
+
+  page = calloc (1, sizeof (Page));
+  if (!page)
+    return SANE_STATUS_NO_MEM;
+  page->n = n;
+  strcpy (page->path, path);
+  strcpy (page->part_path, part_path);
+
+  status = record_page (page);
+
+  fprintf (stderr, "Scanned page %d.", n);
+  fprintf (stderr, " (scanner status = %d)\n", status);
+
+  if (status != SANE_STATUS_GOOD)
+    {
+      free_page (page);
+      return status;
+    }
+
+  encoder_pool_add (pool, page, *ofp, *pw);
+  return SANE_STATUS_GOOD;
+}
+#endif
+
 #define clean_buffer(buf,size)	memset ((buf), 0x23, size)
 
 static void
@@ -2096,11 +2813,16 @@ main (int argc, char **argv)
   int batch_count = BATCH_COUNT_UNLIMITED;
   int batch_start_at = 1;
   int batch_increment = 1;
+  int batch_encoders = 0;
+  int batch_memory = BATCH_MEMORY;
   int promptc;
   SANE_Status status;
   SANE_Int version_code;
   void *pw = NULL;
   FILE *ofp = NULL;
+#ifdef SCANIMAGE_THREADS
+  EncoderPool pool;
+#endif
 
   buffer_size = (1024 * 1024);	/* default size */
 
@@ -2163,6 +2885,16 @@ main (int argc, char **argv)
 	case OPTION_BATCH_PRINT:
 	  batch_print = 1;
 	  break;
+	case OPTION_PIPELINE:
+#ifdef SCANIMAGE_THREADS
+	  pipeline_slots = optarg ? atoi (optarg) : PIPELINE_SLOTS;
+	  if (pipeline_slots < 2)
+	    pipeline_slots = 2;
+#else
+	  fprintf (stderr, "%s: no thread support, ignoring --pipeline\n",
+		   prog_name);
+#endif
+	  break;
 	case OPTION_BATCH_PROMPT:
 	  batch_prompt = 1;
 	  break;
@@ -2179,6 +2911,19 @@ main (int argc, char **argv)
 	  batch_count = atoi (optarg);
 	  batch = 1;
 	  break;
+	case OPTION_BATCH_ENCODERS:
+#ifdef SCANIMAGE_THREADS
+	  batch_encoders = atoi (optarg);
+#else
+	  fprintf (stderr, "%s: no thread support, ignoring --batch-encoders\n",
+		   prog_name);
+#endif
+	  break;
+	case OPTION_BATCH_MEMORY:
+	  batch_memory = atoi (optarg);
+	  if (batch_memory < 1)
+	    batch_memory = 1;
+	  break;
 	case OPTION_FORMAT:
 	  if (strcmp (optarg, "tiff") == 0)
 	    output_format = OUTPUT_TIFF;
@@ -2380,7 +3125,11 @@ Parameters are separated by a blank from single-character options (e.g.\n\
     --batch-double         increment page number by two, same as\n\
                            --batch-increment=2\n\
     --batch-print          print image filenames to stdout\n\
-    --batch-prompt         ask for pressing a key before scanning a page\n");
+    --batch-prompt         ask for pressing a key before scanning a page\n\
+    --batch-encoders=#     encode pages in # threads while the next pages\n\
+                           are scanned\n\
+    --batch-memory=#       MB of scanned pages waiting to be encoded, before\n\
+                           the next page waits (default 512)\n");
       printf ("\
     --accept-md5-only      only accept authorization requests using md5\n\
 -p, --progress             print progress messages\n\
@@ -2391,7 +3140,9 @@ Parameters are separated by a blank from single-character options (e.g.\n\
 -A, --all-options          list all available backend options\n\
 -h, --help                 display this help message and exit\n\
 -v, --verbose              give even more status messages\n\
--B, --buffer-size=#        change input buffer size (in kB, default 32)\n");
+-B, --buffer-size=#        change input buffer size (in kB, default 32)\n\
+    --pipeline[=#]         read from the device in a separate thread, into\n\
+                           # buffers (default 4) while encoding the image\n");
       printf ("\
 -V, --version              print version information\n");
     }
@@ -2736,10 +3487,33 @@ List of available devices:", prog_name);
 
       buffer = malloc (buffer_size);
 
+#ifdef SCANIMAGE_THREADS
+      if (!batch)
+	batch_encoders = 0;
+      if (batch_encoders > 0
+	  && encoder_pool_start (&pool, batch_encoders,
+				 (size_t) batch_memory << 20, batch_print)
+	  != SANE_STATUS_GOOD)
+	{
+	  encoder_pool_finish (&pool);
+	  batch_encoders = 0;
+	}
+#endif
+
       do
 	{
 	  char path[PATH_MAX];
 	  char part_path[PATH_MAX];
+
+#ifdef SCANIMAGE_THREADS
+	  /* don't feed another page while too many wait for encoding */
+	  if (batch_encoders > 0)
+	    {
+	      status = encoder_pool_wait (&pool);
+	      if (status != SANE_STATUS_GOOD)
+		break;
+	    }
+#endif
 	  if (batch)  /* format is NULL unless batch mode */
 	    {
 	      sprintf (path, format, n);	/* love --(C++) */
@@ -2761,6 +3535,10 @@ List of available devices:", prog_name);
 		    {
 		      if (ferror(stdin))
 			fprintf(stderr, "%s: stdin error: %s\n", prog_name, strerror(errno));
+#ifdef SCANIMAGE_THREADS
+		      if (batch_encoders > 0)
+			encoder_pool_finish (&pool);
+#endif
 		      if (ofp)
 			{
 #ifdef HAVE_LIBJPEG
@@ -2792,6 +3570,11 @@ List of available devices:", prog_name);
 	    {
 	      fprintf (stderr, "%s: sane_start: %s\n",
 		       prog_name, sane_strstatus (status));
+#ifdef SCANIMAGE_THREADS
+	      /* the document needs all pages before it ends */
+	      if (batch_encoders > 0)
+		encoder_pool_finish (&pool);
+#endif
 	      if (ofp )
 		{
 #ifdef HAVE_LIBJPEG
@@ -2807,6 +3590,14 @@ List of available devices:", prog_name);
 	      break;
 	    }
 
+#ifdef SCANIMAGE_THREADS
+	  if (batch_encoders > 0)
+	    {
+	      status = encoder_pool_scan (&pool, n, path, part_path, &ofp, &pw);
+	      n += batch_increment;
+	      continue;
+	    }
+#endif
 
 	  /* write to .part file while scanning is in progress */
 	  if (batch)
@@ -2837,7 +3628,7 @@ List of available devices:", prog_name);
 #endif
 	    }
 
-	  status = scan_it (ofp, pw);
+	  status = scan_it (ofp, pw, output_format, NULL);
 
 #ifdef HAVE_LIBJPEG
 	  if (output_format == OUTPUT_PDF)
@@ -2942,6 +3733,16 @@ List of available devices:", prog_name);
 	      && (batch_count == BATCH_COUNT_UNLIMITED || --batch_count))
 	     && SANE_STATUS_GOOD == status);
 
+#ifdef SCANIMAGE_THREADS
+      if (batch_encoders > 0)
+	{
+	  SANE_Status pool_status = encoder_pool_finish (&pool);
+
+	  if (pool_status != SANE_STATUS_GOOD)
+	    status = pool_status;
+	}
+#endif
+
       if (batch)
 	{
 #ifdef HAVE_LIBJPEG
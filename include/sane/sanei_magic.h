@@ -119,6 +119,39 @@ extern SANE_Status
 sanei_magic_rotate (SANE_Parameters * params, SANE_Byte * buffer,
   int centerX, int centerY, double slope, int bg_color);
 
+/** Flag for sanei_magic_rotate2(): interpolate between source pixels */
+#define SANEI_MAGIC_ROTATE_BILINEAR 1
+
+/** Correct the skew of the media inside the image, into another buffer
+ *
+ * Works like sanei_magic_rotate(), but writes the rotated image to dst,
+ * which must hold as many bytes as the source image, and does not
+ * allocate a copy of the image. The lines are split among several
+ * threads where available; the SANE_MAGIC_THREADS environment variable
+ * limits their number.
+ *
+ * With SANEI_MAGIC_ROTATE_BILINEAR, 8 bit gray and color images are
+ * interpolated instead of using the nearest source pixel. The flag is
+ * ignored for 1 bit images.
+ *
+ * @param params describes image
+ * @param src contains image data
+ * @param dst receives the rotated image, must not overlap src
+ * @param centerX horizontal coordinate of center of rotation
+ * @param centerY vertical coordinate of center of rotation
+ * @param slope slope of rotation
+ * @param bg_color the replacement color for edges exposed by rotation
+ * @param flags 0 or SANEI_MAGIC_ROTATE_BILINEAR
+ *
+ * @return
+ * - SANE_STATUS_GOOD - success
+ * - SANE_STATUS_INVAL - invalid image parameters
+ */
+extern SANE_Status
+sanei_magic_rotate2 (SANE_Parameters * params, SANE_Byte * src,
+  SANE_Byte * dst, int centerX, int centerY, double slope, int bg_color,
+  int flags);
+
 /** Find the edges of the media inside the image, parallel to image edges
  *
  * @param params describes image
@@ -223,6 +256,146 @@ extern SANE_Status
 sanei_magic_turn(SANE_Parameters * params, SANE_Byte * buffer,
   int angle);
 
+/** Operations for the band interface
+ */
+#define SANEI_MAGIC_BAND_DESKEW 1 /**< find skew and rotate */
+#define SANEI_MAGIC_BAND_CROP   2 /**< find edges and crop */
+#define SANEI_MAGIC_BAND_BLANK  4 /**< check for blank page */
+
+/** State of a page being processed in bands
+ */
+typedef struct sanei_magic_band SANEI_Magic_Band;
+
+/** Start processing a page in bands
+ *
+ * Instead of buffering the whole page, the band interface finds skew and
+ * edges in the first two inches of the page, and then rotates and crops
+ * each line as soon as the lines it depends upon have been written. The
+ * results match sanei_magic_rotate, sanei_magic_crop and
+ * sanei_magic_isBlank2, with skew and left/right/top edges estimated from
+ * the leading part of the page instead of the whole of it.
+ *
+ * Nothing can be read from a blank test until the first block which is
+ * not blank has been seen, and when cropping, the number of lines stays
+ * -1 until the page is finished.
+ *
+ * @param params describes image
+ * @param dpiX horizontal resolution
+ * @param dpiY vertical resolution
+ * @param ops SANEI_MAGIC_BAND_* operations to perform
+ * @param bg_color the replacement color for edges exposed by rotation
+ * @param thresh maximum % density for blankness (0-100)
+ * @param[out] band state of the page
+ *
+ * @return
+ * - SANE_STATUS_GOOD - success
+ * - SANE_STATUS_NO_MEM - not enough memory
+ * - SANE_STATUS_INVAL - invalid image parameters
+ */
+extern SANE_Status
+sanei_magic_band_open (SANE_Parameters * params, int dpiX, int dpiY,
+  int ops, int bg_color, double thresh, SANEI_Magic_Band ** band);
+
+/** Use a known skew instead of looking for it
+ *
+ * Must be called before any data is written. Useful for the back side of
+ * a duplex page, which can reuse the front side values.
+ *
+ * @param band state of the page
+ * @param centerX horizontal coordinate of center of rotation
+ * @param centerY vertical coordinate of center of rotation
+ * @param slope slope of rotation
+ *
+ * @return
+ * - SANE_STATUS_GOOD - success
+ * - SANE_STATUS_INVAL - too late to change skew
+ */
+extern SANE_Status
+sanei_magic_band_setSkew (SANEI_Magic_Band * band,
+  int centerX, int centerY, double slope);
+
+/** Get the skew found in the page
+ *
+ * @param band state of the page
+ * @param[out] centerX horizontal coordinate of center of rotation
+ * @param[out] centerY vertical coordinate of center of rotation
+ * @param[out] slope slope of rotation
+ *
+ * @return
+ * - SANE_STATUS_GOOD - success
+ * - SANE_STATUS_DEVICE_BUSY - not enough data written yet
+ * - SANE_STATUS_UNSUPPORTED - skew was not found
+ */
+extern SANE_Status
+sanei_magic_band_getSkew (SANEI_Magic_Band * band,
+  int * centerX, int * centerY, double * slope);
+
+/** Add image data to a page
+ *
+ * @param band state of the page
+ * @param data image data, need not be whole lines
+ * @param len length of data
+ *
+ * @return
+ * - SANE_STATUS_GOOD - success
+ * - SANE_STATUS_NO_MEM - not enough memory
+ * - SANE_STATUS_INVAL - page already finished
+ */
+extern SANE_Status
+sanei_magic_band_write (SANEI_Magic_Band * band, SANE_Byte * data,
+  SANE_Int len);
+
+/** Finish a page, after the last data was written
+ *
+ * Lines not written are filled with bg color.
+ *
+ * @param band state of the page
+ *
+ * @return
+ * - SANE_STATUS_GOOD - success
+ * - SANE_STATUS_NO_DOCS - page is blank
+ * - SANE_STATUS_NO_MEM - not enough memory
+ */
+extern SANE_Status
+sanei_magic_band_finish (SANEI_Magic_Band * band);
+
+/** Get the parameters of the processed image
+ *
+ * @param band state of the page
+ * @param[out] params describes processed image
+ *
+ * @return
+ * - SANE_STATUS_GOOD - image can be read, params are final except lines
+ * - SANE_STATUS_DEVICE_BUSY - more data must be written first
+ * - SANE_STATUS_NO_DOCS - page is blank
+ */
+extern SANE_Status
+sanei_magic_band_getParams (SANEI_Magic_Band * band,
+  SANE_Parameters * params);
+
+/** Read processed image data
+ *
+ * @param band state of the page
+ * @param buf buffer for image data
+ * @param max_len size of buf
+ * @param[out] len length of data read, may be 0
+ *
+ * @return
+ * - SANE_STATUS_GOOD - success
+ * - SANE_STATUS_EOF - page finished and all data read
+ * - SANE_STATUS_NO_DOCS - page is blank
+ */
+extern SANE_Status
+sanei_magic_band_read (SANEI_Magic_Band * band, SANE_Byte * buf,
+  SANE_Int max_len, SANE_Int * len);
+
+/** Free a page
+ *
+ * @param band state of the page
+ */
+extern void
+sanei_magic_band_close (SANEI_Magic_Band * band);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -20,7 +20,23 @@
 #include <sane/sane.h>
 #include <sane/sanei_wire.h>
 
-#define SANEI_NET_PROTOCOL_VERSION	3
+#define SANEI_NET_PROTOCOL_VERSION	5
+
+/* Lowest protocol version that allows compressed data channel records.
+   Such records are announced by setting SANEI_NET_RECORD_COMPRESSED in
+   the record length word; 0xffffffff still marks the end of the data.  */
+#define SANEI_NET_COMPRESSION_VERSION	4
+#define SANEI_NET_RECORD_COMPRESSED	0x80000000U
+#define SANEI_NET_RECORD_LENGTH_MASK	0x7fffffffU
+
+/* Lowest protocol version that knows SANE_NET_CONTROL_OPTIONS.  */
+#define SANEI_NET_OPTION_BATCH_VERSION	5
+
+/* Lowest protocol version whose SANE_NET_START request carries a word
+   of SANEI_NET_START_* flags after the handle.  */
+#define SANEI_NET_START_FLAGS_VERSION	5
+/* The client wants the data records of this scan uncompressed.  */
+#define SANEI_NET_START_NO_COMPRESSION	0x1
 
 typedef enum
   {
@@ -41,7 +57,8 @@ typedef enum
     SANE_NET_START,
     SANE_NET_CANCEL,
     SANE_NET_AUTHORIZE,
-    SANE_NET_EXIT
+    SANE_NET_EXIT,
+    SANE_NET_CONTROL_OPTIONS
   }
 SANE_Net_Procedure_Number;
 
@@ -103,6 +120,60 @@ typedef struct
   }
 SANE_Control_Option_Reply;
 
+/* SANE_NET_CONTROL_OPTIONS runs a list of option actions in one call.
+   The server stops at the first action that fails and returns the
+   results of the actions it ran.  It then sends the descriptors that
+   differ from the descriptor set GENERATION the client holds; a
+   generation of 0 asks for all descriptors.  */
+typedef struct
+  {
+    SANE_Word option;
+    SANE_Word action;
+    SANE_Word value_type;
+    SANE_Word value_size;
+    void *value;
+  }
+SANE_Option_Action;
+
+typedef struct
+  {
+    SANE_Status status;
+    SANE_Word info;
+    SANE_Word value_type;
+    SANE_Word value_size;
+    void *value;
+  }
+SANE_Option_Result;
+
+typedef struct
+  {
+    SANE_Word option;
+    SANE_Option_Descriptor *desc;
+  }
+SANE_Option_Descriptor_Change;
+
+typedef struct
+  {
+    SANE_Word handle;
+    SANE_Word generation;
+    SANE_Word num_actions;
+    SANE_Option_Action *actions;
+  }
+SANE_Control_Options_Req;
+
+typedef struct
+  {
+    SANE_Status status;
+    SANE_Word num_results;
+    SANE_Option_Result *results;
+    SANE_Word generation;
+    SANE_Word num_options;
+    SANE_Word num_changes;
+    SANE_Option_Descriptor_Change *changes;
+    SANE_String resource_to_authorize;
+  }
+SANE_Control_Options_Reply;
+
 typedef struct
   {
     SANE_Status status;
@@ -110,6 +181,13 @@ typedef struct
   }
 SANE_Get_Parameters_Reply;
 
+typedef struct
+  {
+    SANE_Word handle;
+    SANE_Word flags;
+  }
+SANE_Start_Req;
+
 typedef struct
   {
     SANE_Status status;
@@ -136,9 +214,34 @@ extern void sanei_w_option_descriptor_array (Wire *w,
 extern void sanei_w_control_option_req (Wire *w, SANE_Control_Option_Req *req);
 extern void sanei_w_control_option_reply (Wire *w,
 					  SANE_Control_Option_Reply *reply);
+extern void sanei_w_control_options_req (Wire *w,
+					 SANE_Control_Options_Req *req);
+extern void sanei_w_control_options_reply (Wire *w,
+					   SANE_Control_Options_Reply *reply);
 extern void sanei_w_get_parameters_reply (Wire *w,
 					  SANE_Get_Parameters_Reply *reply);
+extern void sanei_w_start_req (Wire *w, SANE_Start_Req *req);
 extern void sanei_w_start_reply (Wire *w, SANE_Start_Reply *reply);
 extern void sanei_w_authorization_req (Wire *w, SANE_Authorization_Req *req);
 
+/* Compress LEN bytes of image data from SRC into DST, predicting each
+   byte from the byte STRIDE positions earlier (usually the same sample
+   of the previous pixel).  Returns the size of the compressed record, or
+   0 if the result would not be smaller than the input, in which case
+   the data should be sent uncompressed.  DST must hold at least LEN
+   bytes.  */
+extern size_t sanei_net_compress (const SANE_Byte *src, size_t len,
+				  unsigned int stride, SANE_Byte *dst);
+
+/* Return the uncompressed size stored in the compressed record SRC, or
+   SANE_STATUS_IO_ERROR if the record header is malformed.  */
+extern SANE_Status sanei_net_decompressed_size (const SANE_Byte *src,
+						size_t len, size_t *size);
+
+/* Decompress the record SRC of LEN bytes into DST, which must hold the
+   size returned by sanei_net_decompressed_size().  The record is
+   untrusted input; any inconsistency yields SANE_STATUS_IO_ERROR.  */
+extern SANE_Status sanei_net_decompress (const SANE_Byte *src, size_t len,
+					 SANE_Byte *dst, size_t size);
+
 #endif /* sanei_net_h */
@@ -195,12 +195,35 @@ struct sanei_usb_dev_descriptor
     prepend all output commands before that node before an output command is
     encountered.
 
+    The data file may also be a packed capture written by
+    sanei_usb_testing_pack_capture(). Development mode needs an XML file.
+
     @param path Path to the XML data file.
     @param development_mode Enables development mode.
  */
 extern SANE_Status sanei_usb_testing_enable_replay(SANE_String_Const path,
                                                    int development_mode);
 
+/** Convert an XML capture to a packed capture.
+
+    A packed capture holds the data of the transactions in binary and is
+    memory-mapped when replayed, so large captures replay much faster and
+    need much less memory than the XML file.
+
+    @param xml_path Path to the XML data file.
+    @param pack_path Path of the packed capture to write.
+ */
+extern SANE_Status sanei_usb_testing_pack_capture(SANE_String_Const xml_path,
+                                                  SANE_String_Const pack_path);
+
+/** Convert a packed capture back to an XML capture.
+
+    @param pack_path Path to the packed capture.
+    @param xml_path Path of the XML data file to write.
+ */
+extern SANE_Status sanei_usb_testing_unpack_capture(SANE_String_Const pack_path,
+                                                    SANE_String_Const xml_path);
+
 /** Initialize sanei_usb for recording.
  *
  * Initializes sanei_usb for recording communication with the scanner. This
@@ -259,10 +282,42 @@ extern void sanei_usb_exit (void);
 
 /** Search for USB devices.
  *
- * Search USB buses for scanner devices.
+ * Search USB buses for scanner devices.  Devices found by an earlier
+ * search are not opened again.  Where libusb reports devices arriving
+ * and leaving, the buses are only searched again after such an event.
  */
 extern void sanei_usb_scan_devices (void);
 
+/** Get a signature of the devices currently attached to the USB buses.
+ *
+ * The signature changes whenever a device is plugged in or removed, so
+ * callers can cache what they found on the buses and only look again
+ * after a change.  It is cheap to compute and does not require
+ * sanei_usb_init().
+ *
+ * @param signature where to store the signature
+ *
+ * @return
+ * - SANE_STATUS_GOOD - if the signature could be determined
+ * - SANE_STATUS_UNSUPPORTED - if the platform offers no way to tell
+ */
+extern SANE_Status sanei_usb_get_bus_signature (SANE_Word * signature);
+
+/** Get the vendor and product ids of all USB devices found.
+ *
+ * Reports the devices found by the last scan of the USB buses, whether
+ * or not a backend knows them.  The ids of a device are 0 if the
+ * platform can't tell them without opening it.
+ *
+ * @param vendors where to store the vendor ids
+ * @param products where to store the product ids
+ * @param max how many ids fit into vendors and products
+ *
+ * @return the number of devices found, which may be more than max
+ */
+extern SANE_Int sanei_usb_get_device_ids (SANE_Word * vendors,
+					  SANE_Word * products, SANE_Int max);
+
 /** Get the vendor and product ids by device name.
  *
  * @param devname
@@ -429,6 +484,79 @@ sanei_usb_read_bulk (SANE_Int dn, SANE_Byte * buffer, size_t * size);
 extern SANE_Status
 sanei_usb_write_bulk (SANE_Int dn, const SANE_Byte * buffer, size_t * size);
 
+/** Set up the queue of bulk transfers of a device.
+ *
+ * Allocates depth buffers of size bytes each, which are used by
+ * sanei_usb_submit_bulk() and sanei_usb_reap().  Keeping several transfers
+ * queued avoids the pauses between them that synchronous reads and writes
+ * cause.  A depth of 0 frees the buffers.  The queue is freed by
+ * sanei_usb_close() as well.
+ *
+ * @param dn device number
+ * @param depth how many transfers may be queued at the same time
+ * @param size the size of the largest transfer
+ *
+ * @return
+ * - SANE_STATUS_GOOD - on success
+ * - SANE_STATUS_DEVICE_BUSY - if transfers are queued
+ * - SANE_STATUS_NO_MEM - if the buffers could not be allocated
+ * - SANE_STATUS_INVAL - on every other error
+ */
+extern SANE_Status
+sanei_usb_set_queue_depth (SANE_Int dn, SANE_Int depth, size_t size);
+
+/** Queue a bulk transfer.
+ *
+ * Starts a transfer of up to size bytes on the bulk-in or the bulk-out
+ * endpoint and returns right away.  The data to write is copied.  Every
+ * transfer must be finished with sanei_usb_reap() or
+ * sanei_usb_cancel_bulk().  Where the platform offers no asynchronous
+ * transfers, and when replaying a recording, the transfer is only done
+ * by sanei_usb_reap().
+ *
+ * @param dn device number
+ * @param direction USB_DIR_IN or USB_DIR_OUT
+ * @param data the data to write, or NULL for USB_DIR_IN
+ * @param size size of the data
+ *
+ * @return
+ * - SANE_STATUS_GOOD - if the transfer was queued
+ * - SANE_STATUS_DEVICE_BUSY - if the queue is full
+ * - SANE_STATUS_IO_ERROR - if the transfer could not be started
+ * - SANE_STATUS_INVAL - on every other error
+ */
+extern SANE_Status
+sanei_usb_submit_bulk (SANE_Int dn, SANE_Int direction,
+		       const SANE_Byte * data, size_t size);
+
+/** Wait for the oldest queued bulk transfer.
+ *
+ * Transfers are reaped in the order they were submitted.  For a read,
+ * data points to the data read, which stays valid until the next call to
+ * sanei_usb_reap(), sanei_usb_cancel_bulk() or sanei_usb_close().
+ *
+ * @param dn device number
+ * @param data where to store the address of the data read, may be NULL
+ * @param size where to store the number of bytes transferred
+ *
+ * @return
+ * - SANE_STATUS_GOOD - on success
+ * - SANE_STATUS_EOF - if zero bytes have been read
+ * - SANE_STATUS_IO_ERROR - if an error occurred during the transfer
+ * - SANE_STATUS_INVAL - if no transfer is queued, and on every other error
+ */
+extern SANE_Status
+sanei_usb_reap (SANE_Int dn, SANE_Byte ** data, size_t * size);
+
+/** Cancel all queued bulk transfers.
+ *
+ * Returns when none of them is in progress any more.  Transfers that
+ * completed before are dropped.
+ *
+ * @param dn device number
+ */
+extern void sanei_usb_cancel_bulk (SANE_Int dn);
+
 /** Send/receive a control message to/from a USB device.
  *
  * This function is only supported for libusb devices and kernel access with
@@ -25,12 +25,23 @@
  * licensed under the GNU General Public License version 2 or later.
 */
 
+#include "../include/sane/config.h"
+
 #include <stdlib.h>
 #include <string.h>
 #include <float.h>
 #include <limits.h>
 #include <math.h>
 
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if defined(HAVE_PTHREAD_H) && defined(USE_PTHREAD)
+#include <pthread.h>
+#define IR_THREADS
+#endif
+
 #define BACKEND_NAME sanei_ir	/* name of this module for debugging */
 
 #include "../include/sane/sane.h"
@@ -44,6 +55,109 @@ sanei_ir_create_norm_histo (const SANE_Parameters * params, const SANE_Uint *img
 double * sanei_ir_accumulate_norm_histo (double * histo_data);
 
 
+/* most parts an image is split into, and fewest rows in each */
+#define IR_MAX_PARTS 16
+#define IR_MIN_PART_ROWS 32
+
+/* a kernel, run on rows first_row up to last_row - 1 of an image
+ * as the given part of it */
+typedef void (*ir_rows_func) (void *arg, int part,
+                              int first_row, int last_row);
+
+struct ir_part
+{
+  ir_rows_func func;
+  void *arg;
+  int part;
+  int first_row;
+  int last_row;
+};
+
+static void *
+ir_run_part (void *arg)
+{
+  struct ir_part *part = arg;
+
+  part->func (part->arg, part->part, part->first_row, part->last_row);
+  return NULL;
+}
+
+
+/* Number of parts to split an image of rows rows into, internal.
+ * One per CPU, or as set by SANE_IR_THREADS
+ */
+static int
+ir_num_parts (int rows)
+{
+  int parts = 1;
+
+#if defined(IR_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+  char *env = getenv ("SANE_IR_THREADS");
+  long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+  if (cpus > 1)
+    parts = cpus;
+  if (env && atoi (env) > 0)
+    parts = atoi (env);
+  if (parts > IR_MAX_PARTS)
+    parts = IR_MAX_PARTS;
+  if (parts > rows / IR_MIN_PART_ROWS)
+    parts = rows / IR_MIN_PART_ROWS;
+#else
+  (void) rows;
+#endif
+
+  if (parts < 1)
+    parts = 1;
+  return parts;
+}
+
+
+/* Run a kernel on an image split into parts, one thread each, internal.
+ * Parts which get no thread of their own run in the calling thread,
+ * so the kernel always covers all rows
+ */
+static void
+ir_run_rows (ir_rows_func func, void *arg, int rows, int parts)
+{
+  struct ir_part part[IR_MAX_PARTS];
+  int i;
+#ifdef IR_THREADS
+  pthread_t tid[IR_MAX_PARTS];
+  int started[IR_MAX_PARTS];
+#endif
+
+  for (i = 0; i < parts; i++)
+    {
+      part[i].func = func;
+      part[i].arg = arg;
+      part[i].part = i;
+      part[i].first_row = (int) ((long) rows * i / parts);
+      part[i].last_row = (int) ((long) rows * (i + 1) / parts);
+    }
+
+#ifdef IR_THREADS
+  for (i = 1; i < parts; i++)
+    {
+      started[i] = !pthread_create (&tid[i], NULL, ir_run_part, &part[i]);
+      if (!started[i])
+        DBG (5, "ir_run_rows: no thread for part %d\n", i);
+    }
+  ir_run_part (&part[0]);
+  for (i = 1; i < parts; i++)
+    {
+      if (started[i])
+        pthread_join (tid[i], NULL);
+      else
+        ir_run_part (&part[i]);
+    }
+#else
+  for (i = 0; i < parts; i++)
+    ir_run_part (&part[i]);
+#endif
+}
+
+
 /* Initialize sanei_ir
  */
 void
@@ -53,13 +167,37 @@ sanei_ir_init (void)
 }
 
 
+struct ir_histo_job
+{
+  const SANE_Uint *img_data;
+  int num_cols;
+  int *histo_data;              /* HISTOGRAM_SIZE counts per part */
+};
+
+/* Count the pixels of some rows into the histogram of a part, internal
+ */
+static void
+ir_histo_rows (void *arg, int part, int first_row, int last_row)
+{
+  struct ir_histo_job *job = arg;
+  const SANE_Uint *src = job->img_data + (size_t) first_row * job->num_cols;
+  int *histo_data = job->histo_data + part * HISTOGRAM_SIZE;
+  int is = 16 - HISTOGRAM_SHIFT; /* Number of data bits to ignore */
+  int i;
+
+  for (i = (last_row - first_row) * job->num_cols; i > 0; i--)
+    histo_data[*src++ >> is]++;
+}
+
+
 /* Create a normalized histogram of a grayscale image, internal
  */
 double *
 sanei_ir_create_norm_histo (const SANE_Parameters * params,
                        const SANE_Uint *img_data)
 {
-  int is, i;
+  struct ir_histo_job job;
+  int i, j, parts;
   int num_pixels;
   int *histo_data;
   double *histo;
@@ -76,8 +214,9 @@ sanei_ir_create_norm_histo (const SANE_Parameters * params,
       return NULL;
     }
 
-  /* Allocate storage for the histogram */
-  histo_data = calloc (HISTOGRAM_SIZE, sizeof (int));
+  /* Allocate storage for the histogram, counted separately per part */
+  parts = ir_num_parts (params->lines);
+  histo_data = calloc (parts * HISTOGRAM_SIZE, sizeof (int));
   histo = malloc (HISTOGRAM_SIZE * sizeof (double));
   if ((histo == NULL) || (histo_data == NULL))
     {
@@ -91,12 +230,15 @@ sanei_ir_create_norm_histo (const SANE_Parameters * params,
 
   DBG (1, "sanei_ir_create_norm_histo: %d pixels_per_line, %d lines => %d num_pixels\n", params->pixels_per_line, params->lines, num_pixels);
   DBG (1, "sanei_ir_create_norm_histo: histo_data[] with %d x %ld bytes\n", HISTOGRAM_SIZE, sizeof(int));
+  DBG (1, "sanei_ir_create_norm_histo: depth %d, HISTOGRAM_SHIFT %d => ignore %d bits\n", params->depth, HISTOGRAM_SHIFT, 16 - HISTOGRAM_SHIFT);
   /* Populate the histogram */
-  is = 16 - HISTOGRAM_SHIFT; /* Number of data bits to ignore */
-  DBG (1, "sanei_ir_create_norm_histo: depth %d, HISTOGRAM_SHIFT %d => ignore %d bits\n", params->depth, HISTOGRAM_SHIFT, is);
-  for (i = num_pixels; i > 0; i--) {
-      histo_data[*img_data++ >> is]++;
-  }
+  job.img_data = img_data;
+  job.num_cols = params->pixels_per_line;
+  job.histo_data = histo_data;
+  ir_run_rows (ir_histo_rows, &job, params->lines, parts);
+  for (j = 1; j < parts; j++)
+    for (i = 0; i < HISTOGRAM_SIZE; i++)
+      histo_data[i] += histo_data[j * HISTOGRAM_SIZE + i];
 
   /* Calculate the normalized histogram */
   term = 1.0 / (double) num_pixels;
@@ -646,83 +788,81 @@ sanei_ir_spectral_clean (const SANE_Parameters * params, double *lut_ln,
 }
 
 
-/* Hopefully fast mean filter
- * JV: what does this do? Remove local mean?
+struct ir_mean_job
+{
+  const SANE_Uint *in_img;
+  SANE_Uint *out_img;
+  int num_rows, num_cols;
+  int win_rows, win_cols;
+  int *sums;                    /* num_cols column sums per part */
+};
+
+/* Mean filter some rows of an image, internal
  */
-SANE_Status
-sanei_ir_filter_mean (const SANE_Parameters * params,
-		      const SANE_Uint *in_img, SANE_Uint *out_img,
-		      int win_rows, int win_cols)
+static void
+ir_filter_mean_rows (void *arg, int part, int first_row, int last_row)
 {
-  const SANE_Uint *src;
+  struct ir_mean_job *job = arg;
+  const SANE_Uint *src, *sub;
   SANE_Uint *dest;
-  int num_cols, num_rows;
-  int itop, iadd, isub;
+  int num_cols = job->num_cols;
+  int num_rows = job->num_rows;
+  int win_cols = job->win_cols;
   int ndiv, the_sum;
   int nrow, ncol;
   int hwr, hwc;
+  int first, last;
   int *sum;
+  double rdiv;
   int i, j;
 
-  DBG (10, "sanei_ir_filter_mean, window: %d x%d\n", win_rows, win_cols);
-
-  if (((win_rows & 1) == 0) || ((win_cols & 1) == 0))
-    {
-      DBG (5, "sanei_ir_filter_mean: window even sized\n");
-      return SANE_STATUS_INVAL;
-    }
-
-  num_cols = params->pixels_per_line;
-  num_rows = params->lines;
-
-  sum = malloc (num_cols * sizeof (int));
-  if (!sum)
-    {
-      DBG (5, "sanei_ir_filter_mean: no buffer for sums\n");
-      return SANE_STATUS_NO_MEM;
-    }
-  dest = out_img;
-
-  hwr = win_rows / 2;		/* half window sizes */
+  hwr = job->win_rows / 2;	/* half window sizes */
   hwc = win_cols / 2;
-
-  /* pre-pre calculation */
-  for (j = 0; j < num_cols; j++)
+  sum = job->sums + (size_t) part * num_cols;
+  dest = job->out_img + (size_t) first_row * num_cols;
+
+  /* column sums of the window of the row before the first one,
+   * clipped to the image */
+  first = first_row - hwr - 1;
+  if (first < 0)
+    first = 0;
+  last = first_row + hwr - 1;
+  if (last > num_rows - 1)
+    last = num_rows - 1;
+  nrow = last - first + 1;
+
+  memset (sum, 0, num_cols * sizeof (int));
+  for (i = first; i <= last; i++)
     {
-        sum[j] = 0;
-	src = in_img + j;
-	for (i = 0; i < hwr; i++)
-	  {
-	    sum[j] += *src;
-	    src += num_cols;
-	  }
+      src = job->in_img + (size_t) i * num_cols;
+      for (j = 0; j < num_cols; j++)
+	sum[j] += src[j];
     }
 
-  itop = num_rows * num_cols;
-  iadd = hwr * num_cols;
-  isub = (hwr - win_rows) * num_cols;
-  nrow = hwr;
-
-      for (i = 0; i < num_rows; i++)
+      for (i = first_row; i < last_row; i++)
 	{
 	  /* update row sums if possible */
-	  if (isub >= 0)	/* subtract old row */
+	  src = NULL;
+	  sub = NULL;
+	  if (i - hwr - 1 >= 0)	/* subtract old row */
 	    {
 	      nrow--;
-	      src = in_img + isub;
-	      for (j = 0; j < num_cols; j++)
-		sum[j] -= *src++;
+	      sub = job->in_img + (size_t) (i - hwr - 1) * num_cols;
 	    }
-	  isub += num_cols;
-
-	  if (iadd < itop)	/* add new row */
+	  if (i + hwr < num_rows)	/* add new row */
 	    {
 	      nrow++;
-	      src = in_img + iadd;
-	      for (j = 0; j < num_cols; j++)
-		sum[j] += *src++;
+	      src = job->in_img + (size_t) (i + hwr) * num_cols;
 	    }
-	  iadd += num_cols;
+	  if (src && sub)
+	    for (j = 0; j < num_cols; j++)
+	      sum[j] += src[j] - sub[j];
+	  else if (src)
+	    for (j = 0; j < num_cols; j++)
+	      sum[j] += src[j];
+	  else if (sub)
+	    for (j = 0; j < num_cols; j++)
+	      sum[j] -= sub[j];
 
 	  /* now we do the image columns using only the precalculated sums */
 
@@ -739,13 +879,17 @@ sanei_ir_filter_mean (const SANE_Parameters * params,
 	      *dest++ = the_sum / (ncol * nrow);
 	    }
 
+	  /* in the middle, real index hwc + 1 higher. The sums are
+	   * not negative, and the quotient of sum + 0.5 lies at least
+	   * 0.5 / ndiv away from an integer, so the multiplication
+	   * truncates to the same value as the division */
 	  ndiv = ncol * nrow;
-	  /* in the middle, real index hwc + 1 higher */
+	  rdiv = 1.0 / ndiv;
 	  for (j = 0; j < num_cols - win_cols; j++)
 	    {
 	      the_sum -= sum[j];
 	      the_sum += sum[j + win_cols];
-	      *dest++ = the_sum / ndiv;
+	      *dest++ = (int) ((the_sum + 0.5) * rdiv);
 	    }
 
 	  /* at the right margin, real index hwc + 1 higher */
@@ -756,11 +900,114 @@ sanei_ir_filter_mean (const SANE_Parameters * params,
 	      *dest++ = the_sum / (ncol * nrow);
 	    }
 	}
-  free (sum);
+}
+
+
+/* Hopefully fast mean filter
+ * JV: what does this do? Remove local mean?
+ * Replaces each pixel by the mean of the window around it, clipped at
+ * the image borders. The rows are split among threads, each keeping
+ * its own running column sums.
+ */
+SANE_Status
+sanei_ir_filter_mean (const SANE_Parameters * params,
+		      const SANE_Uint *in_img, SANE_Uint *out_img,
+		      int win_rows, int win_cols)
+{
+  struct ir_mean_job job;
+  int parts;
+
+  DBG (10, "sanei_ir_filter_mean, window: %d x%d\n", win_rows, win_cols);
+
+  if (((win_rows & 1) == 0) || ((win_cols & 1) == 0))
+    {
+      DBG (5, "sanei_ir_filter_mean: window even sized\n");
+      return SANE_STATUS_INVAL;
+    }
+
+  job.in_img = in_img;
+  job.out_img = out_img;
+  job.num_cols = params->pixels_per_line;
+  job.num_rows = params->lines;
+  job.win_rows = win_rows;
+  job.win_cols = win_cols;
+
+  parts = ir_num_parts (job.num_rows);
+  job.sums = malloc ((size_t) parts * job.num_cols * sizeof (int));
+  if (!job.sums)
+    {
+      DBG (5, "sanei_ir_filter_mean: no buffer for sums\n");
+      return SANE_STATUS_NO_MEM;
+    }
+
+  ir_run_rows (ir_filter_mean_rows, &job, job.num_rows, parts);
+
+  free (job.sums);
   return SANE_STATUS_GOOD;
 }
 
 
+struct ir_madmean_job
+{
+  const SANE_Uint *in_img;
+  SANE_Uint *delta_ij;
+  const SANE_Uint *mad_ij;
+  SANE_Uint *out_ij;
+  int num_cols;
+  int a_val, b_val;
+  double ab_term;
+};
+
+/* Replace the local means of some rows by the absolute differences
+ * to them, internal
+ */
+static void
+ir_madmean_delta_rows (void *arg, int part, int first_row, int last_row)
+{
+  struct ir_madmean_job *job = arg;
+  size_t first = (size_t) first_row * job->num_cols;
+  const SANE_Uint *mad_ptr = job->in_img + first;
+  SANE_Uint *delta_ptr = job->delta_ij + first;
+  int ival, i;
+
+  (void) part;
+  for (i = (last_row - first_row) * job->num_cols; i > 0; i--)
+    {
+      ival = *mad_ptr++ - *delta_ptr;
+      *delta_ptr++ = abs (ival);
+    }
+}
+
+/* Construct the noise map of some rows, internal
+ */
+static void
+ir_madmean_noise_rows (void *arg, int part, int first_row, int last_row)
+{
+  struct ir_madmean_job *job = arg;
+  size_t first = (size_t) first_row * job->num_cols;
+  const SANE_Uint *mad_ptr = job->mad_ij + first;
+  const SANE_Uint *delta_ptr = job->delta_ij + first;
+  SANE_Uint *dest8 = job->out_ij + first;
+  int threshold, ival, i;
+
+  (void) part;
+  for (i = (last_row - first_row) * job->num_cols; i > 0; i--)
+    {
+      /* by calculating the threshold */
+      ival = *mad_ptr++;
+      if (ival >= job->b_val)	/* outlier */
+	threshold = job->a_val;
+      else
+	threshold = job->a_val + (double) ival * job->ab_term;
+      /* above threshold is noise, indicated by 0 */
+      if (*delta_ptr++ >= threshold)
+	*dest8++ = 0;
+      else
+	*dest8++ = 255;
+    }
+}
+
+
 /* Find noise by adaptive thresholding
  */
 SANE_Status
@@ -769,15 +1016,13 @@ sanei_ir_filter_madmean (const SANE_Parameters * params,
 			 SANE_Uint ** out_img, int win_size,
 			 int a_val, int b_val)
 {
-  SANE_Uint *delta_ij, *delta_ptr;
+  struct ir_madmean_job job;
+  SANE_Uint *delta_ij;
   SANE_Uint *mad_ij;
-  const SANE_Uint *mad_ptr;
-  SANE_Uint *out_ij, *dest8;
-  double ab_term;
+  SANE_Uint *out_ij;
   int num_rows, num_cols;
-  int threshold, itop;
+  int itop, parts;
   size_t size;
-  int ival, i;
   int depth;
   SANE_Status ret = SANE_STATUS_NO_MEM;
 
@@ -796,20 +1041,23 @@ sanei_ir_filter_madmean (const SANE_Parameters * params,
   out_ij = malloc (size);
   delta_ij = malloc (size);
   mad_ij = malloc (size);
+  parts = ir_num_parts (num_rows);
+
+  job.in_img = in_img;
+  job.delta_ij = delta_ij;
+  job.mad_ij = mad_ij;
+  job.out_ij = out_ij;
+  job.num_cols = num_cols;
+  job.a_val = a_val;
+  job.b_val = b_val;
 
   if (out_ij && delta_ij && mad_ij)
     {
       /* get the differences to the local mean */
-      mad_ptr = in_img;
-      if (sanei_ir_filter_mean (params, mad_ptr, delta_ij, win_size, win_size)
+      if (sanei_ir_filter_mean (params, in_img, delta_ij, win_size, win_size)
 	  == SANE_STATUS_GOOD)
 	{
-	  delta_ptr = delta_ij;
-	    for (i = 0; i < itop; i++)
-	      {
-		ival = *mad_ptr++ - *delta_ptr;
-		*delta_ptr++ = abs (ival);
-	      }
+	  ir_run_rows (ir_madmean_delta_rows, &job, num_rows, parts);
 	  /* make the second filtering window a bit larger */
 	  win_size = MAD_WIN2_SIZE(win_size);
 	  /* and get the local mean differences */
@@ -817,25 +1065,9 @@ sanei_ir_filter_madmean (const SANE_Parameters * params,
 	      (params, delta_ij, mad_ij, win_size,
 	       win_size) == SANE_STATUS_GOOD)
 	    {
-	      mad_ptr = mad_ij;
-	      delta_ptr = delta_ij;
-	      dest8 = out_ij;
 	      /* construct the noise map */
-	      ab_term = (b_val - a_val) / (double) b_val;
-		for (i = 0; i < itop; i++)
-		  {
-		    /* by calculating the threshold */
-		    ival = *mad_ptr++;
-		    if (ival >= b_val)	/* outlier */
-		      threshold = a_val;
-		    else
-		      threshold = a_val + (double) ival *ab_term;
-		    /* above threshold is noise, indicated by 0 */
-		    if (*delta_ptr++ >= threshold)
-		      *dest8++ = 0;
-		    else
-		      *dest8++ = 255;
-		  }
+	      job.ab_term = (b_val - a_val) / (double) b_val;
+	      ir_run_rows (ir_madmean_noise_rows, &job, num_rows, parts);
 	      *out_img = out_ij;
 	      ret = SANE_STATUS_GOOD;
 	    }
@@ -47,6 +47,24 @@
 #include <string.h>
 #include <errno.h>
 #include <math.h>
+#include <stdint.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if defined(HAVE_PTHREAD_H) && defined(USE_PTHREAD)
+#include <pthread.h>
+#define MAGIC_THREADS
+#endif
+
+/* most threads a rotation is split among, and fewest lines each */
+#define MAGIC_MAX_THREADS 16
+#define MAGIC_MIN_THREAD_LINES 64
+
+/* rotation steps thru the source image in 32.32 fixed point */
+#define ROT_SHIFT 32
+#define ROT_ONE ((int64_t)1 << ROT_SHIFT)
 
 #define BACKEND_NAME sanei_magic      /* name of this module for debugging */
 
@@ -72,6 +90,23 @@ static SANE_Status getLine (int height, int width, int * buff,
   int offsets, int minOffset, int maxOffset,
   double * finSlope, int * finOffset, int * finDensity);
 
+static SANE_Status getSkew (int width, int height, int dpiY,
+  int * topBuf, int * botBuf, int * centerX, int * centerY, double * finSlope);
+
+static void rotateLine (SANE_Parameters * params, SANE_Byte * buffer,
+  int bufLines, int firstLine, int lastLine, int line,
+  int centerX, int centerY, double slopeSin, double slopeCos,
+  SANE_Byte * outLine);
+
+static void rotateLineBilinear (SANE_Parameters * params, SANE_Byte * buffer,
+  int line, int centerX, int centerY, double slopeSin, double slopeCos,
+  int bg_color, SANE_Byte * outLine);
+
+static int rotateThreads (int height);
+
+static int getTransXLine (SANE_Parameters * params, SANE_Byte * line,
+  int left);
+
 void
 sanei_magic_init( void )
 {
@@ -508,21 +543,6 @@ sanei_magic_findSkew(SANE_Parameters * params, SANE_Byte * buffer,
   int pwidth = params->pixels_per_line;
   int height = params->lines;
 
-  double TSlope = 0;
-  int TXInter = 0;
-  int TYInter = 0;
-  double TSlopeHalf = 0;
-  int TOffsetHalf = 0;
-
-  double LSlope = 0;
-  int LXInter = 0;
-  int LYInter = 0;
-  double LSlopeHalf = 0;
-  int LOffsetHalf = 0;
-
-  int rotateX = 0;
-  int rotateY = 0;
-
   int * topBuf = NULL, * botBuf = NULL;
 
   DBG (10, "sanei_magic_findSkew: start\n");
@@ -544,48 +564,8 @@ sanei_magic_findSkew(SANE_Parameters * params, SANE_Byte * buffer,
     goto cleanup;
   }
 
-  /* find best top line */
-  ret = getTopEdge (pwidth, height, dpiY, topBuf,
-    &TSlope, &TXInter, &TYInter);
-  if(ret){
-    DBG(5,"sanei_magic_findSkew: gTE error: %d",ret);
-    goto cleanup;
-  }
-  DBG(15,"top: %04.04f %d %d\n",TSlope,TXInter,TYInter);
-
-  /* slope is too shallow, don't want to divide by 0 */
-  if(fabs(TSlope) < 0.0001){
-    DBG(15,"sanei_magic_findSkew: slope too shallow: %0.08f\n",TSlope);
-    ret = SANE_STATUS_UNSUPPORTED;
-    goto cleanup;
-  }
-
-  /* find best left line, perpendicular to top line */
-  LSlope = (double)-1/TSlope;
-  ret = getLeftEdge (pwidth, height, topBuf, botBuf, LSlope,
-    &LXInter, &LYInter);
-  if(ret){
-    DBG(5,"sanei_magic_findSkew: gLE error: %d",ret);
-    goto cleanup;
-  }
-  DBG(15,"sanei_magic_findSkew: left: %04.04f %d %d\n",LSlope,LXInter,LYInter);
-
-  /* find point about which to rotate */
-  TSlopeHalf = tan(atan(TSlope)/2);
-  TOffsetHalf = LYInter;
-  DBG(15,"sanei_magic_findSkew: top half: %04.04f %d\n",TSlopeHalf,TOffsetHalf);
-
-  LSlopeHalf = tan((atan(LSlope) + ((LSlope < 0)?-M_PI_2:M_PI_2))/2);
-  LOffsetHalf = - LSlopeHalf * TXInter;
-  DBG(15,"sanei_magic_findSkew: left half: %04.04f %d\n",LSlopeHalf,LOffsetHalf);
-
-  rotateX = (LOffsetHalf-TOffsetHalf) / (TSlopeHalf-LSlopeHalf);
-  rotateY = TSlopeHalf * rotateX + TOffsetHalf;
-  DBG(15,"sanei_magic_findSkew: rotate: %d %d\n",rotateX,rotateY);
-
-  *centerX = rotateX;
-  *centerY = rotateY;
-  *finSlope = TSlope;
+  ret = getSkew (pwidth, height, dpiY, topBuf, botBuf,
+    centerX, centerY, finSlope);
 
   cleanup:
   if(topBuf)
@@ -608,17 +588,10 @@ sanei_magic_rotate (SANE_Parameters * params, SANE_Byte * buffer,
 
   SANE_Status ret = SANE_STATUS_GOOD;
 
-  double slopeRad = -atan(slope);
-  double slopeSin = sin(slopeRad);
-  double slopeCos = cos(slopeRad);
-
-  int pwidth = params->pixels_per_line;
   int bwidth = params->bytes_per_line;
   int height = params->lines;
-  int depth = 1;
 
   unsigned char * outbuf;
-  int i, j, k;
 
   DBG(10,"sanei_magic_rotate: start: %d %d\n",centerX,centerY);
 
@@ -629,84 +602,146 @@ sanei_magic_rotate (SANE_Parameters * params, SANE_Byte * buffer,
     goto cleanup;
   }
 
-  if(params->format == SANE_FRAME_RGB ||
-    (params->format == SANE_FRAME_GRAY && params->depth == 8)
-  ){
+  ret = sanei_magic_rotate2(params, buffer, outbuf,
+    centerX, centerY, slope, bg_color, 0);
+  if(ret)
+    goto cleanup;
 
-    if(params->format == SANE_FRAME_RGB)
-      depth = 3;
+  memcpy(buffer,outbuf,bwidth*height);
 
-    memset(outbuf,bg_color,bwidth*height);
+  cleanup:
 
-    for (i=0; i<height; i++) {
-      int shiftY = centerY - i;
+  if(outbuf)
+    free(outbuf);
 
-      for (j=0; j<pwidth; j++) {
-        int shiftX = centerX - j;
-        int sourceX, sourceY;
+  DBG(10,"sanei_magic_rotate: finish\n");
 
-        sourceX = centerX - (int)(shiftX * slopeCos + shiftY * slopeSin);
-        if (sourceX < 0 || sourceX >= pwidth)
-          continue;
+  return ret;
+}
 
-        sourceY = centerY + (int)(-shiftY * slopeCos + shiftX * slopeSin);
-        if (sourceY < 0 || sourceY >= height)
-          continue;
+/* one group of lines rotated by each thread */
+struct rotateJob
+{
+  SANE_Parameters * params;
+  SANE_Byte * src;
+  SANE_Byte * dst;
+  int centerX;
+  int centerY;
+  double slopeSin;
+  double slopeCos;
+  int bg_color;
+  int flags;
+  int firstLine;
+  int lastLine;
+};
+
+static void *
+rotateLines (void * arg)
+{
+  struct rotateJob * job = arg;
+  int bwidth = job->params->bytes_per_line;
+  int height = job->params->lines;
+  int i;
 
-        for (k=0; k<depth; k++) {
-          outbuf[i*bwidth+j*depth+k]
-            = buffer[sourceY*bwidth+sourceX*depth+k];
-        }
-      }
-    }
-  }
+  for (i=job->firstLine; i<job->lastLine; i++) {
+    SANE_Byte * outLine = job->dst + (size_t)i*bwidth;
 
-  else if(params->format == SANE_FRAME_GRAY && params->depth == 1){
+    memset(outLine,job->bg_color,bwidth);
 
-    if(bg_color)
-      bg_color = 0xff;
+    if((job->flags & SANEI_MAGIC_ROTATE_BILINEAR) && job->params->depth == 8){
+      rotateLineBilinear(job->params, job->src, i, job->centerX, job->centerY,
+        job->slopeSin, job->slopeCos, job->bg_color, outLine);
+    }
+    else{
+      rotateLine(job->params, job->src, height, 0, height, i,
+        job->centerX, job->centerY, job->slopeSin, job->slopeCos, outLine);
+    }
+  }
 
-    memset(outbuf,bg_color,bwidth*height);
+  return NULL;
+}
 
-    for (i=0; i<height; i++) {
-      int shiftY = centerY - i;
+/* same as sanei_magic_rotate, but into a separate buffer, with the
+ * lines split among threads, and optionally interpolated */
+SANE_Status
+sanei_magic_rotate2 (SANE_Parameters * params, SANE_Byte * src,
+  SANE_Byte * dst, int centerX, int centerY, double slope, int bg_color,
+  int flags)
+{
+  SANE_Status ret = SANE_STATUS_GOOD;
 
-      for (j=0; j<pwidth; j++) {
-        int shiftX = centerX - j;
-        int sourceX, sourceY;
+  double slopeRad = -atan(slope);
+  double slopeSin = sin(slopeRad);
+  double slopeCos = cos(slopeRad);
 
-        sourceX = centerX - (int)(shiftX * slopeCos + shiftY * slopeSin);
-        if (sourceX < 0 || sourceX >= pwidth)
-          continue;
+  struct rotateJob jobs[MAGIC_MAX_THREADS];
+  int height = params->lines;
+  int threads, i;
 
-        sourceY = centerY + (int)(-shiftY * slopeCos + shiftX * slopeSin);
-        if (sourceY < 0 || sourceY >= height)
-          continue;
+#ifdef MAGIC_THREADS
+  pthread_t tids[MAGIC_MAX_THREADS];
+  int started[MAGIC_MAX_THREADS];
+#endif
 
-        /* wipe out old bit */
-        outbuf[i*bwidth + j/8] &= ~(1 << (7-(j%8)));
+  DBG(10,"sanei_magic_rotate2: start: %d %d\n",centerX,centerY);
 
-        /* fill in new bit */
-        outbuf[i*bwidth + j/8] |=
-          ((buffer[sourceY*bwidth + sourceX/8]
-          >> (7-(sourceX%8))) & 1) << (7-(j%8));
-      }
-    }
+  if(params->format == SANE_FRAME_GRAY && params->depth == 1){
+    if(bg_color)
+      bg_color = 0xff;
   }
-  else{
-    DBG (5, "sanei_magic_rotate: unsupported format/depth\n");
+  else if(params->format != SANE_FRAME_RGB
+    && !(params->format == SANE_FRAME_GRAY && params->depth == 8)
+  ){
+    DBG (5, "sanei_magic_rotate2: unsupported format/depth\n");
     ret = SANE_STATUS_INVAL;
     goto cleanup;
   }
 
-  memcpy(buffer,outbuf,bwidth*height);
+  threads = rotateThreads(height);
 
-  cleanup:
+  for (i=0; i<threads; i++) {
+    jobs[i].params = params;
+    jobs[i].src = src;
+    jobs[i].dst = dst;
+    jobs[i].centerX = centerX;
+    jobs[i].centerY = centerY;
+    jobs[i].slopeSin = slopeSin;
+    jobs[i].slopeCos = slopeCos;
+    jobs[i].bg_color = bg_color;
+    jobs[i].flags = flags;
+    jobs[i].firstLine = (int)((long)height * i / threads);
+    jobs[i].lastLine = (int)((long)height * (i+1) / threads);
+  }
 
-  if(outbuf)
-    free(outbuf);
+  DBG(15,"sanei_magic_rotate2: %d threads\n",threads);
 
-  DBG(10,"sanei_magic_rotate: finish\n");
+#ifdef MAGIC_THREADS
+  /* the first group is done by this thread, as is any
+   * group which could not get a thread of its own */
+  for (i=1; i<threads; i++) {
+    started[i] = !pthread_create(&tids[i], NULL, rotateLines, &jobs[i]);
+    if(!started[i]){
+      DBG(5,"sanei_magic_rotate2: no thread %d\n",i);
+    }
+  }
+
+  rotateLines(&jobs[0]);
+
+  for (i=1; i<threads; i++) {
+    if(started[i])
+      pthread_join(tids[i], NULL);
+    else
+      rotateLines(&jobs[i]);
+  }
+#else
+  for (i=0; i<threads; i++) {
+    rotateLines(&jobs[i]);
+  }
+#endif
+
+  cleanup:
+
+  DBG(10,"sanei_magic_rotate2: finish\n");
 
   return ret;
 }
@@ -1258,146 +1293,1205 @@ sanei_magic_turn(SANE_Parameters * params, SANE_Byte * buffer,
   return ret;
 }
 
-/* Utility functions, not used outside this file */
+/* The band interface keeps only as much of the page as the requested
+ * operations need. Skew and edges are found in the leading part of the
+ * page, then each line is rotated and cropped as soon as the lines it
+ * is built from have arrived. Lines below the last paper seen are held
+ * back, because they might be cropped off the bottom of the page. */
 
-/* Repeatedly call getLine to find the best range of slope and offset.
- * Shift the ranges thru 4 different positions to avoid splitting data
- * across multiple bins (false positive). Home-in on the most likely upper
- * line of the paper inside the image. Return the 'best' edge. */
-static SANE_Status
-getTopEdge(int width, int height, int resolution,
-  int * buff, double * finSlope, int * finXInter, int * finYInter)
+#define BAND_BLANK_UNKNOWN 0
+#define BAND_BLANK_NO 1
+#define BAND_BLANK_YES 2
+
+struct sanei_magic_band
 {
-  SANE_Status ret = SANE_STATUS_GOOD;
+  SANE_Parameters in;       /* image as it is written */
+  SANE_Parameters out;      /* image as it is read, lines -1 until known */
+  int dpiX;
+  int dpiY;
+  int ops;
+  int bg_color;
+  double thresh;
+
+  int finished;             /* no more lines will be written */
+  int analysed;             /* skew and edges have been looked for */
+
+  /* ring of input lines, line y is stored at (y % ringLines) */
+  SANE_Byte * ring;
+  int ringLines;
+  int firstLine;            /* oldest line still in the ring */
+  int lastLine;             /* one past the newest complete line */
+  int partialLen;           /* bytes of line lastLine written so far */
+  int leadLines;            /* lines to look at before starting */
+
+  /* rotation */
+  SANE_Status skewStat;
+  int skewSet;
+  int centerX;
+  int centerY;
+  double slope;
+  double slopeSin;
+  double slopeCos;
+
+  /* cropping, in lines and bytes of the rotated image */
+  int cropping;
+  int top;
+  int leftByte;
+  int paperRun;
+
+  /* next line of the rotated image to build */
+  int nextLine;
+  SANE_Byte * line;
+
+  /* output fifo, the first outReleased bytes are final */
+  SANE_Byte * outBuf;
+  int outSize;
+  int outStart;
+  int outLen;
+  int outReleased;
+  int outLines;
+
+  /* blank detection, in 1/2 inch blocks like sanei_magic_isBlank2 */
+  int blank;
+  int xquarter;
+  int yquarter;
+  int xhalf;
+  int yhalf;
+  int xblocks;
+  double * blockSums;
+};
+
+/* range of input lines which a line of the rotated image comes from */
+static void
+bandSourceLines (struct sanei_magic_band * band, int line,
+  int * minLine, int * maxLine)
+{
+  double shiftY = band->centerY - line;
+  double first, last;
 
-  int slopes = 31;
-  int offsets = 31;
-  double maxSlope = 1;
-  double minSlope = -1;
-  int maxOffset = resolution;
-  int minOffset = -resolution;
+  if(band->skewStat != SANE_STATUS_GOOD){
+    *minLine = line;
+    *maxLine = line;
+    return;
+  }
 
-  double topSlope = 0;
-  int topOffset = 0;
-  int topDensity = 0;
+  first = -shiftY * band->slopeCos + band->centerX * band->slopeSin;
+  last = -shiftY * band->slopeCos
+    + (band->centerX - band->in.pixels_per_line + 1) * band->slopeSin;
 
-  int i,j;
-  int pass = 0;
+  if(first > last){
+    double tmp = first;
+    first = last;
+    last = tmp;
+  }
 
-  DBG(10,"getTopEdge: start\n");
+  *minLine = band->centerY + (int)floor(first) - 1;
+  *maxLine = band->centerY + (int)ceil(last) + 1;
+}
 
-  while(pass++ < 7){
-    double sStep = (maxSlope-minSlope)/slopes;
-    int oStep = (maxOffset-minOffset)/offsets;
+/* make the ring larger, keeping the lines it holds */
+static SANE_Status
+bandGrow (struct sanei_magic_band * band, int lines)
+{
+  int bwidth = band->in.bytes_per_line;
+  SANE_Byte * ring;
+  int i;
 
-    double slope = 0;
-    int offset = 0;
-    int density = 0;
-    int go = 0;
+  ring = malloc((size_t)lines * bwidth);
+  if(!ring){
+    DBG (5, "bandGrow: no ring\n");
+    return SANE_STATUS_NO_MEM;
+  }
 
-    topSlope = 0;
-    topOffset = 0;
-    topDensity = 0;
+  for(i=band->firstLine; i<band->lastLine; i++){
+    memcpy(ring + (i % lines) * bwidth,
+      band->ring + (i % band->ringLines) * bwidth, bwidth);
+  }
 
-    /* find lines 4 times with slightly moved params,
-     * to bypass binning errors, highest density wins */
-    for(i=0;i<2;i++){
-      double sStep2 = sStep*i/2;
-      for(j=0;j<2;j++){
-        int oStep2 = oStep*j/2;
-        ret = getLine(height,width,buff,slopes,minSlope+sStep2,maxSlope+sStep2,offsets,minOffset+oStep2,maxOffset+oStep2,&slope,&offset,&density);
-        if(ret){
-          DBG(5,"getTopEdge: getLine error %d\n",ret);
-          return ret;
-        }
-        DBG(15,"getTopEdge: %d %d %+0.4f %d %d\n",i,j,slope,offset,density);
+  free(band->ring);
+  band->ring = ring;
+  band->ringLines = lines;
 
-        if(density > topDensity){
-          topSlope = slope;
-          topOffset = offset;
-          topDensity = density;
-        }
-      }
-    }
+  return SANE_STATUS_GOOD;
+}
 
-    DBG(15,"getTopEdge: ok %+0.4f %d %d\n",topSlope,topOffset,topDensity);
+/* add bytes to the end of the output fifo */
+static SANE_Status
+bandAppend (struct sanei_magic_band * band, SANE_Byte * data, int len)
+{
+  if(band->outStart + band->outLen + len > band->outSize){
 
-    /* did not find anything promising on first pass,
-     * give up instead of fixating on some small, pointless feature */
-    if(pass == 1 && topDensity < width/5){
-      DBG(5,"getTopEdge: density too small %d %d\n",topDensity,width);
-      topOffset = 0;
-      topSlope = 0;
-      break;
+    /* reuse the space the reader is finished with */
+    if(band->outStart && band->outStart >= band->outLen){
+      memmove(band->outBuf, band->outBuf + band->outStart, band->outLen);
+      band->outStart = 0;
     }
 
-    /* if slope can zoom in some more, do so. */
-    if(sStep >= 0.0001){
-      minSlope = topSlope - sStep;
-      maxSlope = topSlope + sStep;
-      go = 1;
-    }
+    if(band->outStart + band->outLen + len > band->outSize){
+      int size = band->outSize * 2;
+      SANE_Byte * buf;
 
-    /* if offset can zoom in some more, do so. */
-    if(oStep){
-      minOffset = topOffset - oStep;
-      maxOffset = topOffset + oStep;
-      go = 1;
-    }
+      if(size < band->outStart + band->outLen + len)
+        size = band->outStart + band->outLen + len;
 
-    /* cannot zoom in more, bail out */
-    if(!go){
-      break;
+      buf = realloc(band->outBuf, size);
+      if(!buf){
+        DBG (5, "bandAppend: no outBuf\n");
+        return SANE_STATUS_NO_MEM;
+      }
+      band->outBuf = buf;
+      band->outSize = size;
     }
-
-    DBG(15,"getTopEdge: zoom: %+0.4f %+0.4f %d %d\n",
-      minSlope,maxSlope,minOffset,maxOffset);
-  }
-
-  /* topOffset is in the center of the image,
-   * convert to x and y intercept */
-  if(topSlope != 0){
-    *finYInter = topOffset - topSlope * width/2;
-    *finXInter = *finYInter / -topSlope;
-    *finSlope = topSlope;
-  }
-  else{
-    *finYInter = 0;
-    *finXInter = 0;
-    *finSlope = 0;
   }
 
-  DBG(10,"getTopEdge: finish\n");
+  memcpy(band->outBuf + band->outStart + band->outLen, data, len);
+  band->outLen += len;
 
-  return 0;
+  return SANE_STATUS_GOOD;
 }
 
-/* Loop thru a transition array, and use a simplified Hough transform
- * to divide likely edges into a 2-d array of bins. Then weight each
- * bin based on its angle and offset. Return the 'best' bin. */
-static SANE_Status
-getLine (int height, int width, int * buff,
-  int slopes, double minSlope, double maxSlope,
-  int offsets, int minOffset, int maxOffset,
-  double * finSlope, int * finOffset, int * finDensity)
+/* add one released line to the blank detection. A row of blocks is
+ * only judged once 1/4 inch below it has arrived, so the bottom margin
+ * is skipped just as sanei_magic_isBlank2 does */
+static void
+bandBlankLine (struct sanei_magic_band * band, SANE_Byte * ptr)
 {
-  SANE_Status ret = 0;
+  int line = band->outLines++;
+  int xb, x, yb;
 
-  int ** lines = NULL;
-  int i, j;
-  int rise, run;
-  double slope;
-  int offset;
-  int sIndex, oIndex;
-  int hWidth = width/2;
+  if(band->blank != BAND_BLANK_UNKNOWN || !band->xblocks)
+    return;
 
-  double * slopeCenter = NULL;
-  int * slopeScale = NULL;
-  double * offsetCenter = NULL;
-  int * offsetScale = NULL;
+  if(line >= band->yquarter){
+    double * sums;
 
-  int maxDensity = 1;
-  double absMaxSlope = fabs(maxSlope);
+    yb = (line - band->yquarter) / band->yhalf;
+    sums = band->blockSums + (yb % 2) * band->xblocks;
+
+    if((line - band->yquarter) % band->yhalf == 0){
+      for(xb=0; xb<band->xblocks; xb++)
+        sums[xb] = 0;
+    }
+
+    for(xb=0; xb<band->xblocks; xb++){
+      int rowsum = 0;
+
+      if(band->out.depth == 8){
+        int Bpp = band->out.format == SANE_FRAME_RGB ? 3 : 1;
+        SANE_Byte * p = ptr + (band->xquarter + xb*band->xhalf) * Bpp;
+
+        for(x=0; x<band->xhalf*Bpp; x++){
+          rowsum += 255 - p[x];
+        }
+        sums[xb] += (double)rowsum/(band->xhalf*Bpp)/255;
+      }
+      else{
+        SANE_Byte * p = ptr + (band->xquarter + xb*band->xhalf) / 8;
+
+        for(x=0; x<band->xhalf; x++){
+          rowsum += p[x/8] >> (7-(x%8)) & 1;
+        }
+        sums[xb] += (double)rowsum/band->xhalf;
+      }
+    }
+  }
+
+  line = band->outLines - 2*band->yquarter;
+  if(line > 0 && line % band->yhalf == 0){
+    double * sums;
+
+    yb = line / band->yhalf - 1;
+    sums = band->blockSums + (yb % 2) * band->xblocks;
+
+    for(xb=0; xb<band->xblocks; xb++){
+
+      /* block was darker than thresh, keep image */
+      if(sums[xb]/band->yhalf > band->thresh){
+        DBG (15, "bandBlankLine: not blank %f %d %d\n",
+          sums[xb]/band->yhalf, yb, xb);
+        band->blank = BAND_BLANK_NO;
+        return;
+      }
+    }
+  }
+}
+
+/* mark the output fifo as final up to the given length */
+static void
+bandRelease (struct sanei_magic_band * band, int len)
+{
+  while(band->outReleased < len){
+    bandBlankLine(band, band->outBuf + band->outStart + band->outReleased);
+    band->outReleased += band->out.bytes_per_line;
+  }
+}
+
+/* find skew and edges in the lines collected so far */
+static SANE_Status
+bandAnalyse (struct sanei_magic_band * band)
+{
+  SANE_Status ret = SANE_STATUS_GOOD;
+  SANE_Parameters params = band->in;
+  int width = band->in.pixels_per_line;
+  int bwidth = band->in.bytes_per_line;
+
+  int * topBuf = NULL, * botBuf = NULL;
+  int * leftBuf = NULL, * rightBuf = NULL;
+  SANE_Byte * image = NULL;
+  int topCount = 0;
+  int left = width, right = -1;
+  int i;
+
+  /* the ring has not wrapped yet, so it holds the lines in order */
+  params.lines = band->lastLine;
+
+  DBG (10, "bandAnalyse: start %d\n", params.lines);
+
+  if((band->ops & SANEI_MAGIC_BAND_DESKEW) && !band->skewSet
+    && params.lines > 0
+  ){
+
+    topBuf = sanei_magic_getTransY(&params,band->dpiY,band->ring,1);
+    botBuf = calloc(width,sizeof(int));
+    if(!topBuf || !botBuf){
+      DBG (5, "bandAnalyse: no topBuf\n");
+      ret = SANE_STATUS_NO_MEM;
+      goto cleanup;
+    }
+
+    /* the bottom edge has not arrived */
+    for(i=0; i<width; i++)
+      botBuf[i] = -1;
+
+    band->skewStat = getSkew(width, params.lines, band->dpiY, topBuf, botBuf,
+      &band->centerX, &band->centerY, &band->slope);
+    if(band->skewStat){
+      DBG (5, "bandAnalyse: bad skew %d, not rotating\n", band->skewStat);
+    }
+  }
+
+  if(band->skewStat == SANE_STATUS_GOOD){
+    band->slopeSin = sin(-atan(band->slope));
+    band->slopeCos = cos(-atan(band->slope));
+  }
+
+  if((band->ops & SANEI_MAGIC_BAND_CROP) && params.lines > 0){
+
+    int avail = band->finished ? band->in.lines : band->lastLine;
+    int minLine, maxLine;
+
+    /* rotate as much of the collected lines as can be */
+    for(i=0; i<params.lines; i++){
+      bandSourceLines(band, i, &minLine, &maxLine);
+      if(maxLine >= band->in.lines)
+        maxLine = band->in.lines - 1;
+      if(maxLine >= avail)
+        break;
+    }
+    params.lines = i;
+
+    image = malloc((size_t)params.lines * bwidth + 1);
+    if(!image){
+      DBG (5, "bandAnalyse: no image\n");
+      ret = SANE_STATUS_NO_MEM;
+      goto cleanup;
+    }
+
+    memset(image, band->bg_color, (size_t)params.lines * bwidth);
+    for(i=0; i<params.lines; i++){
+      if(band->skewStat == SANE_STATUS_GOOD)
+        rotateLine(&band->in, band->ring, band->ringLines, 0, band->lastLine,
+          i, band->centerX, band->centerY, band->slopeSin, band->slopeCos,
+          image + i*bwidth);
+      else
+        memcpy(image + i*bwidth, band->ring + i*bwidth, bwidth);
+    }
+
+    leftBuf = sanei_magic_getTransX(&params,band->dpiX,image,1);
+    rightBuf = sanei_magic_getTransX(&params,band->dpiX,image,0);
+    if(!leftBuf || !rightBuf){
+      DBG (5, "bandAnalyse: no leftBuf\n");
+      ret = SANE_STATUS_NO_MEM;
+      goto cleanup;
+    }
+
+    /* look for top like sanei_magic_findEdges, then the widest paper */
+    band->top = params.lines;
+    for(i=0; i<params.lines; i++){
+      if(rightBuf[i] > leftBuf[i]){
+        if(band->top > i){
+          band->top = i;
+        }
+
+        topCount++;
+        if(topCount > 3){
+          break;
+        }
+      }
+      else{
+        topCount = 0;
+        band->top = params.lines;
+      }
+    }
+
+    for(i=band->top; i<params.lines; i++){
+      if(rightBuf[i] > leftBuf[i]){
+        if(left > leftBuf[i])
+          left = leftBuf[i];
+        if(right < rightBuf[i])
+          right = rightBuf[i];
+      }
+    }
+
+    if(band->top >= params.lines || left >= right){
+      DBG (5, "bandAnalyse: bad edges, not cropping\n");
+    }
+    else{
+      DBG (15, "bandAnalyse: t:%d l:%d r:%d\n", band->top, left, right);
+
+      /* convert left and right to bytes, like sanei_magic_crop */
+      if(band->in.format == SANE_FRAME_RGB){
+        band->leftByte = left * 3;
+        band->out.pixels_per_line = right - left;
+        band->out.bytes_per_line = (right - left) * 3;
+      }
+      else if(band->in.depth == 8){
+        band->leftByte = left;
+        band->out.pixels_per_line = right - left;
+        band->out.bytes_per_line = right - left;
+      }
+      else{
+        band->leftByte = left / 8;
+        band->out.bytes_per_line = (right + 7) / 8 - left / 8;
+        band->out.pixels_per_line = band->out.bytes_per_line * 8;
+      }
+      band->cropping = 1;
+    }
+  }
+
+  /* lines are only unknown if the bottom will be cropped */
+  band->out.lines = band->cropping ? -1 : band->in.lines;
+
+  /* .25 inch, rounded down to 8 pixel */
+  band->xquarter = band->dpiX/4/8*8;
+  band->yquarter = band->dpiY/4/8*8;
+  band->xhalf = band->xquarter*2;
+  band->yhalf = band->yquarter*2;
+
+  if(band->blank == BAND_BLANK_UNKNOWN){
+    if(!band->xhalf || !band->yhalf){
+      DBG (5, "bandAnalyse: resolution too low, not checking blank\n");
+      band->blank = BAND_BLANK_NO;
+    }
+    else if(band->out.pixels_per_line > band->xhalf){
+      band->xblocks = (band->out.pixels_per_line - band->xhalf)/band->xhalf;
+      band->blockSums = calloc(2 * band->xblocks + 1, sizeof(double));
+      if(!band->blockSums){
+        DBG (5, "bandAnalyse: no blockSums\n");
+        ret = SANE_STATUS_NO_MEM;
+        goto cleanup;
+      }
+    }
+  }
+
+  band->analysed = 1;
+
+  cleanup:
+  if(topBuf)
+    free(topBuf);
+  if(botBuf)
+    free(botBuf);
+  if(leftBuf)
+    free(leftBuf);
+  if(rightBuf)
+    free(rightBuf);
+  if(image)
+    free(image);
+
+  DBG (10, "bandAnalyse: finish\n");
+  return ret;
+}
+
+/* build the next line of the rotated image, and crop it */
+static SANE_Status
+bandNextLine (struct sanei_magic_band * band)
+{
+  SANE_Status ret = SANE_STATUS_GOOD;
+  int bwidth = band->in.bytes_per_line;
+  int line = band->nextLine++;
+  int paper;
+
+  memset(band->line, band->bg_color, bwidth);
+
+  if(band->skewStat == SANE_STATUS_GOOD){
+    rotateLine(&band->in, band->ring, band->ringLines,
+      band->firstLine, band->lastLine, line,
+      band->centerX, band->centerY, band->slopeSin, band->slopeCos,
+      band->line);
+  }
+  /* short pages are padded with bg color */
+  else if(line < band->lastLine){
+    memcpy(band->line, band->ring + (line % band->ringLines) * bwidth, bwidth);
+  }
+
+  if(!band->cropping){
+    ret = bandAppend(band, band->line, bwidth);
+    if(!ret)
+      bandRelease(band, band->outLen);
+    return ret;
+  }
+
+  if(line < band->top)
+    return ret;
+
+  paper = getTransXLine(&band->in, band->line, 0)
+    > getTransXLine(&band->in, band->line, 1);
+
+  ret = bandAppend(band, band->line + band->leftByte,
+    band->out.bytes_per_line);
+  if(ret)
+    return ret;
+
+  /* after a few lines of paper, the lines above are not the bottom */
+  if(paper){
+    band->paperRun++;
+    if(band->paperRun > 3)
+      bandRelease(band, band->outLen - band->out.bytes_per_line);
+  }
+  else{
+    band->paperRun = 0;
+  }
+
+  return ret;
+}
+
+/* process as many of the written lines as possible */
+static SANE_Status
+bandProcess (struct sanei_magic_band * band)
+{
+  SANE_Status ret = SANE_STATUS_GOOD;
+  int avail = band->finished ? band->in.lines : band->lastLine;
+  int minLine, maxLine;
+
+  if(!band->analysed){
+    int lead = band->leadLines;
+
+    /* nothing to look for */
+    if(!(band->ops & SANEI_MAGIC_BAND_CROP)
+      && (!(band->ops & SANEI_MAGIC_BAND_DESKEW) || band->skewSet)
+    ){
+      lead = 0;
+    }
+
+    if(avail < lead)
+      return ret;
+
+    ret = bandAnalyse(band);
+    if(ret)
+      return ret;
+  }
+
+  while(band->nextLine < band->in.lines){
+    bandSourceLines(band, band->nextLine, &minLine, &maxLine);
+    if(maxLine >= band->in.lines)
+      maxLine = band->in.lines - 1;
+    if(maxLine >= avail)
+      break;
+
+    ret = bandNextLine(band);
+    if(ret)
+      return ret;
+  }
+
+  /* forget lines no longer needed by the rotation */
+  bandSourceLines(band, band->nextLine, &minLine, &maxLine);
+  if(minLine > band->lastLine)
+    minLine = band->lastLine;
+  if(minLine > band->firstLine)
+    band->firstLine = minLine;
+
+  return ret;
+}
+
+SANE_Status
+sanei_magic_band_open (SANE_Parameters * params, int dpiX, int dpiY,
+  int ops, int bg_color, double thresh, SANEI_Magic_Band ** band)
+{
+  SANEI_Magic_Band * b;
+
+  DBG (10, "sanei_magic_band_open: start %d\n", ops);
+
+  *band = NULL;
+
+  if(params->lines <= 0 || params->pixels_per_line <= 0
+    || params->bytes_per_line <= 0
+    || (params->format != SANE_FRAME_RGB
+      && !(params->format == SANE_FRAME_GRAY
+        && (params->depth == 8 || params->depth == 1)))
+  ){
+    DBG (5, "sanei_magic_band_open: unsupported format/depth\n");
+    return SANE_STATUS_INVAL;
+  }
+
+  b = calloc(1, sizeof(*b));
+  if(!b){
+    DBG (5, "sanei_magic_band_open: no band\n");
+    return SANE_STATUS_NO_MEM;
+  }
+
+  b->in = *params;
+  b->out = *params;
+  if(ops & SANEI_MAGIC_BAND_CROP)
+    b->out.lines = -1;
+  b->dpiX = dpiX;
+  b->dpiY = dpiY;
+  b->ops = ops;
+  b->skewStat = SANE_STATUS_UNSUPPORTED;
+
+  b->bg_color = bg_color;
+  if(params->depth == 1 && bg_color)
+    b->bg_color = 0xff;
+
+  /*convert thresh from percent (0-100) to 0-1 range*/
+  b->thresh = thresh / 100;
+  b->blank = (ops & SANEI_MAGIC_BAND_BLANK)
+    ? BAND_BLANK_UNKNOWN : BAND_BLANK_NO;
+
+  /* top edge and skew are looked for in the first 2 inches */
+  b->leadLines = dpiY * 2;
+  if(b->leadLines > params->lines)
+    b->leadLines = params->lines;
+
+  b->ringLines = b->leadLines + 1;
+  if(b->ringLines < 16)
+    b->ringLines = 16;
+
+  b->ring = malloc((size_t)b->ringLines * params->bytes_per_line);
+  b->line = malloc(params->bytes_per_line);
+  if(!b->ring || !b->line){
+    DBG (5, "sanei_magic_band_open: no ring\n");
+    sanei_magic_band_close(b);
+    return SANE_STATUS_NO_MEM;
+  }
+
+  *band = b;
+
+  DBG (10, "sanei_magic_band_open: finish\n");
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+sanei_magic_band_setSkew (SANEI_Magic_Band * band,
+  int centerX, int centerY, double slope)
+{
+  if(band->analysed){
+    DBG (5, "sanei_magic_band_setSkew: too late\n");
+    return SANE_STATUS_INVAL;
+  }
+
+  band->skewSet = 1;
+  band->skewStat = SANE_STATUS_GOOD;
+  band->centerX = centerX;
+  band->centerY = centerY;
+  band->slope = slope;
+
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+sanei_magic_band_getSkew (SANEI_Magic_Band * band,
+  int * centerX, int * centerY, double * slope)
+{
+  if(!band->analysed && !band->skewSet)
+    return SANE_STATUS_DEVICE_BUSY;
+
+  *centerX = band->centerX;
+  *centerY = band->centerY;
+  *slope = band->slope;
+
+  return band->skewStat;
+}
+
+SANE_Status
+sanei_magic_band_write (SANEI_Magic_Band * band, SANE_Byte * data,
+  SANE_Int len)
+{
+  int bwidth = band->in.bytes_per_line;
+
+  DBG (15, "sanei_magic_band_write: %d\n", len);
+
+  if(band->finished){
+    DBG (5, "sanei_magic_band_write: already finished\n");
+    return SANE_STATUS_INVAL;
+  }
+
+  /* anything past the end of the image is ignored */
+  while(len > 0 && band->lastLine < band->in.lines){
+    int bytes = bwidth - band->partialLen;
+
+    if(bytes > len)
+      bytes = len;
+
+    /* starting a new line, make sure the ring has room for it */
+    if(!band->partialLen
+      && band->lastLine - band->firstLine >= band->ringLines
+    ){
+      SANE_Status ret = bandGrow(band, band->ringLines * 2);
+      if(ret)
+        return ret;
+    }
+
+    memcpy(band->ring + (band->lastLine % band->ringLines) * bwidth
+      + band->partialLen, data, bytes);
+
+    band->partialLen += bytes;
+    data += bytes;
+    len -= bytes;
+
+    /* process each line as it completes, to keep the ring small */
+    if(band->partialLen == bwidth){
+      SANE_Status ret;
+
+      band->partialLen = 0;
+      band->lastLine++;
+
+      ret = bandProcess(band);
+      if(ret)
+        return ret;
+    }
+  }
+
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+sanei_magic_band_finish (SANEI_Magic_Band * band)
+{
+  SANE_Status ret;
+
+  DBG (10, "sanei_magic_band_finish: start\n");
+
+  if(!band->finished){
+
+    band->finished = 1;
+
+    ret = bandProcess(band);
+    if(ret)
+      return ret;
+
+    /* whatever was held back is below the bottom edge */
+    if(band->cropping)
+      band->outLen = band->outReleased;
+    band->out.lines = band->outLines;
+
+    /* no block was dark enough */
+    if(band->blank == BAND_BLANK_UNKNOWN){
+      DBG (5, "sanei_magic_band_finish: blank!\n");
+      band->blank = BAND_BLANK_YES;
+    }
+  }
+
+  DBG (10, "sanei_magic_band_finish: finish\n");
+
+  if(band->blank == BAND_BLANK_YES)
+    return SANE_STATUS_NO_DOCS;
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+sanei_magic_band_getParams (SANEI_Magic_Band * band, SANE_Parameters * params)
+{
+  *params = band->out;
+
+  if(band->blank == BAND_BLANK_YES)
+    return SANE_STATUS_NO_DOCS;
+
+  if(!band->analysed || band->blank == BAND_BLANK_UNKNOWN)
+    return SANE_STATUS_DEVICE_BUSY;
+
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+sanei_magic_band_read (SANEI_Magic_Band * band, SANE_Byte * buf,
+  SANE_Int max_len, SANE_Int * len)
+{
+  int bytes = max_len;
+
+  *len = 0;
+
+  if(band->blank == BAND_BLANK_YES)
+    return SANE_STATUS_NO_DOCS;
+
+  /* nothing can be read until we know the page is wanted */
+  if(band->blank == BAND_BLANK_UNKNOWN)
+    return SANE_STATUS_GOOD;
+
+  if(bytes > band->outReleased)
+    bytes = band->outReleased;
+
+  if(!bytes){
+    if(band->finished)
+      return SANE_STATUS_EOF;
+    return SANE_STATUS_GOOD;
+  }
+
+  memcpy(buf, band->outBuf + band->outStart, bytes);
+  band->outStart += bytes;
+  band->outLen -= bytes;
+  band->outReleased -= bytes;
+  *len = bytes;
+
+  return SANE_STATUS_GOOD;
+}
+
+void
+sanei_magic_band_close (SANEI_Magic_Band * band)
+{
+  if(!band)
+    return;
+
+  if(band->ring)
+    free(band->ring);
+  if(band->line)
+    free(band->line);
+  if(band->outBuf)
+    free(band->outBuf);
+  if(band->blockSums)
+    free(band->blockSums);
+  free(band);
+}
+
+/* Utility functions, not used outside this file */
+
+/* Find the skew of the media from the first transitions in each column,
+ * found from the top (topBuf) and from the bottom (botBuf) of the image.
+ * Columns without a transition are ignored, so a caller which only has the
+ * upper part of the image can pass a botBuf full of -1 */
+static SANE_Status
+getSkew (int width, int height, int dpiY, int * topBuf, int * botBuf,
+  int * centerX, int * centerY, double * finSlope)
+{
+  SANE_Status ret = SANE_STATUS_GOOD;
+
+  double TSlope = 0;
+  int TXInter = 0;
+  int TYInter = 0;
+  double TSlopeHalf = 0;
+  int TOffsetHalf = 0;
+
+  double LSlope = 0;
+  int LXInter = 0;
+  int LYInter = 0;
+  double LSlopeHalf = 0;
+  int LOffsetHalf = 0;
+
+  int rotateX = 0;
+  int rotateY = 0;
+
+  /* find best top line */
+  ret = getTopEdge (width, height, dpiY, topBuf,
+    &TSlope, &TXInter, &TYInter);
+  if(ret){
+    DBG(5,"getSkew: gTE error: %d",ret);
+    return ret;
+  }
+  DBG(15,"getSkew: top: %04.04f %d %d\n",TSlope,TXInter,TYInter);
+
+  /* slope is too shallow, don't want to divide by 0 */
+  if(fabs(TSlope) < 0.0001){
+    DBG(15,"getSkew: slope too shallow: %0.08f\n",TSlope);
+    ret = SANE_STATUS_UNSUPPORTED;
+    return ret;
+  }
+
+  /* find best left line, perpendicular to top line */
+  LSlope = (double)-1/TSlope;
+  ret = getLeftEdge (width, height, topBuf, botBuf, LSlope,
+    &LXInter, &LYInter);
+  if(ret){
+    DBG(5,"getSkew: gLE error: %d",ret);
+    return ret;
+  }
+  DBG(15,"getSkew: left: %04.04f %d %d\n",LSlope,LXInter,LYInter);
+
+  /* find point about which to rotate */
+  TSlopeHalf = tan(atan(TSlope)/2);
+  TOffsetHalf = LYInter;
+  DBG(15,"getSkew: top half: %04.04f %d\n",TSlopeHalf,TOffsetHalf);
+
+  LSlopeHalf = tan((atan(LSlope) + ((LSlope < 0)?-M_PI_2:M_PI_2))/2);
+  LOffsetHalf = - LSlopeHalf * TXInter;
+  DBG(15,"getSkew: left half: %04.04f %d\n",LSlopeHalf,LOffsetHalf);
+
+  rotateX = (LOffsetHalf-TOffsetHalf) / (TSlopeHalf-LSlopeHalf);
+  rotateY = TSlopeHalf * rotateX + TOffsetHalf;
+  DBG(15,"getSkew: rotate: %d %d\n",rotateX,rotateY);
+
+  *centerX = rotateX;
+  *centerY = rotateY;
+  *finSlope = TSlope;
+
+  return ret;
+}
+
+/* convert to 32.32 fixed point, rounding to nearest */
+static int64_t
+rotFixed (double val)
+{
+  return (int64_t)floor(val * ROT_ONE + 0.5);
+}
+
+/* integer part of a 32.32 value, rounded toward zero like a cast */
+static int
+rotTrunc (int64_t val)
+{
+  if(val < 0)
+    return -(int)((-val) >> ROT_SHIFT);
+  return (int)(val >> ROT_SHIFT);
+}
+
+/* Rotate one line of the image by a given slope, around a given point.
+ * Source lines are looked up in a ring of bufLines lines, of which only
+ * lines firstLine up to lastLine-1 are present. Pixels which come from
+ * outside of that range are left untouched in outLine, so the caller
+ * should fill it with the bg color first.
+ * The source position is stepped along the line in fixed point, and
+ * 1 bit output is built a byte at a time where the source is a run of
+ * 8 pixels on a single line, which is most of it for small angles. */
+static void
+rotateLine (SANE_Parameters * params, SANE_Byte * buffer,
+  int bufLines, int firstLine, int lastLine, int line,
+  int centerX, int centerY, double slopeSin, double slopeCos,
+  SANE_Byte * outLine)
+{
+  int pwidth = params->pixels_per_line;
+  int bwidth = params->bytes_per_line;
+  int shiftY = centerY - line;
+  int depth = 1;
+  int j, k;
+
+  /* offsets from the center of the source of pixel 0, before
+   * truncation. Each pixel to the right subtracts cos and sin */
+  int64_t fx = rotFixed(centerX * slopeCos + shiftY * slopeSin);
+  int64_t fy = rotFixed(-shiftY * slopeCos + centerX * slopeSin);
+  int64_t stepX = rotFixed(slopeCos);
+  int64_t stepY = rotFixed(slopeSin);
+
+  if(params->format == SANE_FRAME_RGB)
+    depth = 3;
+
+  if(params->depth == 1){
+
+    for (j=0; j<pwidth; j+=8) {
+      int count = pwidth - j < 8 ? pwidth - j : 8;
+      int sourceX = centerX - rotTrunc(fx);
+      int sourceY = centerY + rotTrunc(fy);
+      int lastX = centerX - rotTrunc(fx - (count-1) * stepX);
+      int lastY = centerY + rotTrunc(fy - (count-1) * stepY);
+
+      /* positions only move by one pixel per step, so if both ends
+       * are 7 pixels apart on one line, so is everything between */
+      if (count == 8 && lastY == sourceY && lastX == sourceX + 7
+        && sourceX >= 0 && lastX < pwidth
+        && sourceY >= firstLine && sourceY < lastLine
+      ){
+        SANE_Byte * source = buffer + (sourceY % bufLines) * bwidth
+          + sourceX/8;
+        int shift = sourceX % 8;
+
+        if(shift)
+          outLine[j/8] = (source[0] << shift) | (source[1] >> (8-shift));
+        else
+          outLine[j/8] = source[0];
+
+        fx -= 8 * stepX;
+        fy -= 8 * stepY;
+        continue;
+      }
+
+      for (k=j; k<j+count; k++, fx -= stepX, fy -= stepY) {
+        SANE_Byte * source;
+
+        sourceX = centerX - rotTrunc(fx);
+        if (sourceX < 0 || sourceX >= pwidth)
+          continue;
+
+        sourceY = centerY + rotTrunc(fy);
+        if (sourceY < firstLine || sourceY >= lastLine)
+          continue;
+
+        source = buffer + (sourceY % bufLines) * bwidth;
+
+        /* wipe out old bit */
+        outLine[k/8] &= ~(1 << (7-(k%8)));
+
+        /* fill in new bit */
+        outLine[k/8] |=
+          ((source[sourceX/8] >> (7-(sourceX%8))) & 1) << (7-(k%8));
+      }
+    }
+    return;
+  }
+
+  for (j=0; j<pwidth; j++, fx -= stepX, fy -= stepY) {
+    int sourceX, sourceY;
+    SANE_Byte * source;
+
+    sourceX = centerX - rotTrunc(fx);
+    if (sourceX < 0 || sourceX >= pwidth)
+      continue;
+
+    sourceY = centerY + rotTrunc(fy);
+    if (sourceY < firstLine || sourceY >= lastLine)
+      continue;
+
+    source = buffer + (sourceY % bufLines) * bwidth + sourceX*depth;
+
+    if(depth == 1){
+      outLine[j] = source[0];
+    }
+    else{
+      outLine[j*3] = source[0];
+      outLine[j*3+1] = source[1];
+      outLine[j*3+2] = source[2];
+    }
+  }
+}
+
+/* Rotate one line of an 8 bit gray or color image like rotateLine,
+ * but blend the four source pixels around the exact position, using
+ * 8 bit weights. Source pixels outside the image count as bg color. */
+static void
+rotateLineBilinear (SANE_Parameters * params, SANE_Byte * buffer,
+  int line, int centerX, int centerY, double slopeSin, double slopeCos,
+  int bg_color, SANE_Byte * outLine)
+{
+  int pwidth = params->pixels_per_line;
+  int bwidth = params->bytes_per_line;
+  int height = params->lines;
+  int shiftY = centerY - line;
+  int depth = 1;
+  int j, k;
+
+  /* exact source position of pixel 0 */
+  int64_t fx = rotFixed(centerX - (centerX * slopeCos + shiftY * slopeSin));
+  int64_t fy = rotFixed(centerY + (-shiftY * slopeCos + centerX * slopeSin));
+  int64_t stepX = rotFixed(slopeCos);
+  int64_t stepY = rotFixed(slopeSin);
+
+  if(params->format == SANE_FRAME_RGB)
+    depth = 3;
+
+  for (j=0; j<pwidth; j++, fx += stepX, fy -= stepY) {
+    SANE_Byte * rows[2] = {NULL, NULL};
+    int cols[2];
+    int64_t px, py;
+    int x0, y0, wx, wy;
+
+    /* nothing of the source within a pixel of here */
+    if (fx <= -ROT_ONE || fy <= -ROT_ONE)
+      continue;
+
+    /* shift by one so that floor is a plain shift */
+    px = fx + ROT_ONE;
+    py = fy + ROT_ONE;
+    x0 = (int)(px >> ROT_SHIFT) - 1;
+    y0 = (int)(py >> ROT_SHIFT) - 1;
+    if (x0 >= pwidth || y0 >= height)
+      continue;
+
+    wx = (int)(px >> (ROT_SHIFT-8)) & 0xff;
+    wy = (int)(py >> (ROT_SHIFT-8)) & 0xff;
+
+    if (y0 >= 0)
+      rows[0] = buffer + (size_t)y0 * bwidth;
+    if (y0+1 < height)
+      rows[1] = buffer + (size_t)(y0+1) * bwidth;
+    cols[0] = x0 >= 0 ? x0*depth : -1;
+    cols[1] = x0+1 < pwidth ? (x0+1)*depth : -1;
+
+    for (k=0; k<depth; k++) {
+      int p00 = rows[0] && cols[0] >= 0 ? rows[0][cols[0]+k] : bg_color;
+      int p01 = rows[0] && cols[1] >= 0 ? rows[0][cols[1]+k] : bg_color;
+      int p10 = rows[1] && cols[0] >= 0 ? rows[1][cols[0]+k] : bg_color;
+      int p11 = rows[1] && cols[1] >= 0 ? rows[1][cols[1]+k] : bg_color;
+
+      int top = p00 * (256-wx) + p01 * wx;
+      int bot = p10 * (256-wx) + p11 * wx;
+
+      outLine[j*depth+k] = (top * (256-wy) + bot * wy + 32768) >> 16;
+    }
+  }
+}
+
+/* number of threads to split a rotation of height lines among */
+static int
+rotateThreads (int height)
+{
+  int threads = 1;
+
+#if defined(MAGIC_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+  char * env = getenv("SANE_MAGIC_THREADS");
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if(cpus > 1)
+    threads = cpus;
+
+  if(env && atoi(env) > 0)
+    threads = atoi(env);
+
+  if(threads > MAGIC_MAX_THREADS)
+    threads = MAGIC_MAX_THREADS;
+
+  if(threads > height / MAGIC_MIN_THREAD_LINES)
+    threads = height / MAGIC_MIN_THREAD_LINES;
+#endif
+
+  if(threads < 1)
+    threads = 1;
+
+  return threads;
+}
+
+/* Repeatedly call getLine to find the best range of slope and offset.
+ * Shift the ranges thru 4 different positions to avoid splitting data
+ * across multiple bins (false positive). Home-in on the most likely upper
+ * line of the paper inside the image. Return the 'best' edge. */
+static SANE_Status
+getTopEdge(int width, int height, int resolution,
+  int * buff, double * finSlope, int * finXInter, int * finYInter)
+{
+  SANE_Status ret = SANE_STATUS_GOOD;
+
+  int slopes = 31;
+  int offsets = 31;
+  double maxSlope = 1;
+  double minSlope = -1;
+  int maxOffset = resolution;
+  int minOffset = -resolution;
+
+  double topSlope = 0;
+  int topOffset = 0;
+  int topDensity = 0;
+
+  int i,j;
+  int pass = 0;
+
+  DBG(10,"getTopEdge: start\n");
+
+  while(pass++ < 7){
+    double sStep = (maxSlope-minSlope)/slopes;
+    int oStep = (maxOffset-minOffset)/offsets;
+
+    double slope = 0;
+    int offset = 0;
+    int density = 0;
+    int go = 0;
+
+    topSlope = 0;
+    topOffset = 0;
+    topDensity = 0;
+
+    /* find lines 4 times with slightly moved params,
+     * to bypass binning errors, highest density wins */
+    for(i=0;i<2;i++){
+      double sStep2 = sStep*i/2;
+      for(j=0;j<2;j++){
+        int oStep2 = oStep*j/2;
+        ret = getLine(height,width,buff,slopes,minSlope+sStep2,maxSlope+sStep2,offsets,minOffset+oStep2,maxOffset+oStep2,&slope,&offset,&density);
+        if(ret){
+          DBG(5,"getTopEdge: getLine error %d\n",ret);
+          return ret;
+        }
+        DBG(15,"getTopEdge: %d %d %+0.4f %d %d\n",i,j,slope,offset,density);
+
+        if(density > topDensity){
+          topSlope = slope;
+          topOffset = offset;
+          topDensity = density;
+        }
+      }
+    }
+
+    DBG(15,"getTopEdge: ok %+0.4f %d %d\n",topSlope,topOffset,topDensity);
+
+    /* did not find anything promising on first pass,
+     * give up instead of fixating on some small, pointless feature */
+    if(pass == 1 && topDensity < width/5){
+      DBG(5,"getTopEdge: density too small %d %d\n",topDensity,width);
+      topOffset = 0;
+      topSlope = 0;
+      break;
+    }
+
+    /* if slope can zoom in some more, do so. */
+    if(sStep >= 0.0001){
+      minSlope = topSlope - sStep;
+      maxSlope = topSlope + sStep;
+      go = 1;
+    }
+
+    /* if offset can zoom in some more, do so. */
+    if(oStep){
+      minOffset = topOffset - oStep;
+      maxOffset = topOffset + oStep;
+      go = 1;
+    }
+
+    /* cannot zoom in more, bail out */
+    if(!go){
+      break;
+    }
+
+    DBG(15,"getTopEdge: zoom: %+0.4f %+0.4f %d %d\n",
+      minSlope,maxSlope,minOffset,maxOffset);
+  }
+
+  /* topOffset is in the center of the image,
+   * convert to x and y intercept */
+  if(topSlope != 0){
+    *finYInter = topOffset - topSlope * width/2;
+    *finXInter = *finYInter / -topSlope;
+    *finSlope = topSlope;
+  }
+  else{
+    *finYInter = 0;
+    *finXInter = 0;
+    *finSlope = 0;
+  }
+
+  DBG(10,"getTopEdge: finish\n");
+
+  return 0;
+}
+
+/* Loop thru a transition array, and use a simplified Hough transform
+ * to divide likely edges into a 2-d array of bins. Then weight each
+ * bin based on its angle and offset. Return the 'best' bin. */
+static SANE_Status
+getLine (int height, int width, int * buff,
+  int slopes, double minSlope, double maxSlope,
+  int offsets, int minOffset, int maxOffset,
+  double * finSlope, int * finOffset, int * finDensity)
+{
+  SANE_Status ret = 0;
+
+  int ** lines = NULL;
+  int i, j;
+  int rise, run;
+  double slope;
+  int offset;
+  int sIndex, oIndex;
+  int hWidth = width/2;
+
+  double * slopeCenter = NULL;
+  int * slopeScale = NULL;
+  double * offsetCenter = NULL;
+  int * offsetScale = NULL;
+
+  int maxDensity = 1;
+  double absMaxSlope = fabs(maxSlope);
   double absMinSlope = fabs(minSlope);
   int absMaxOffset = abs(maxOffset);
   int absMinOffset = abs(minOffset);
@@ -1805,20 +2899,15 @@ sanei_magic_getTransY (
   return buff;
 }
 
-/* Loop thru the image height and look for first color change in each row.
- * Return a malloc'd array. Caller is responsible for freeing. */
-int *
-sanei_magic_getTransX (
-  SANE_Parameters * params, int dpi, SANE_Byte * buffer, int left)
+/* Loop thru one line of the image and look for the first color change.
+ * Return -1 (right-first) or the width (left-first) if there is none. */
+static int
+getTransXLine (SANE_Parameters * params, SANE_Byte * line, int left)
 {
-  int * buff;
-
-  int i, j, k;
+  int j, k;
   int winLen = 9;
 
-  int bwidth = params->bytes_per_line;
   int width = params->pixels_per_line;
-  int height = params->lines;
   int depth = 1;
 
   /* defaults for right-first */
@@ -1826,8 +2915,6 @@ sanei_magic_getTransX (
   int lastCol = -1;
   int direction = -1;
 
-  DBG (10, "sanei_magic_getTransX: start\n");
-
   /* override for left-first*/
   if(left){
     firstCol = 0;
@@ -1835,92 +2922,112 @@ sanei_magic_getTransX (
     direction = 1;
   }
 
-  /* build output and preload with impossible value */
-  buff = calloc(height,sizeof(int));
-  if(!buff){
-    DBG (5, "sanei_magic_getTransX: no buff\n");
-    return NULL;
-  }
-  for(i=0; i<height; i++)
-    buff[i] = lastCol;
-
-  /* load the buff array with x value for first color change from edge
+  /* find x value for first color change from edge
    * gray/color uses a different algo from binary/halftone */
   if(params->format == SANE_FRAME_RGB ||
     (params->format == SANE_FRAME_GRAY && params->depth == 8)
   ){
 
+    int near = 0;
+    int far = 0;
+
     if(params->format == SANE_FRAME_RGB)
       depth = 3;
 
-    /* loop over all columns, find first transition */
-    for(i=0; i<height; i++){
+    /* load the near and far windows with repeated copy of first pixel */
+    for(k=0; k<depth; k++){
+      near += line[k];
+    }
+    near *= winLen;
+    far = near;
 
-      int near = 0;
-      int far = 0;
+    /* move windows, check delta */
+    for(j=firstCol+direction; j!=lastCol; j+=direction){
 
-      /* load the near and far windows with repeated copy of first pixel */
-      for(k=0; k<depth; k++){
-        near += buffer[i*bwidth + k];
+      int farCol = j-winLen*2*direction;
+      int nearCol = j-winLen*direction;
+
+      if(farCol < 0 || farCol >= width){
+        farCol = firstCol;
+      }
+      if(nearCol < 0 || nearCol >= width){
+        nearCol = firstCol;
       }
-      near *= winLen;
-      far = near;
 
-      /* move windows, check delta */
-      for(j=firstCol+direction; j!=lastCol; j+=direction){
+      for(k=0; k<depth; k++){
+        far -= line[farCol*depth + k];
+        far += line[nearCol*depth + k];
 
-        int farCol = j-winLen*2*direction;
-        int nearCol = j-winLen*direction;
+        near -= line[nearCol*depth + k];
+        near += line[j*depth + k];
+      }
 
-        if(farCol < 0 || farCol >= width){
-          farCol = firstCol;
-        }
-        if(nearCol < 0 || nearCol >= width){
-          nearCol = firstCol;
-        }
+      if(abs(near - far) > 50*winLen*depth - near*40/255){
+        return j;
+      }
+    }
+  }
 
-        for(k=0; k<depth; k++){
-          far -= buffer[i*bwidth + farCol*depth + k];
-          far += buffer[i*bwidth + nearCol*depth + k];
+  else if (params->format == SANE_FRAME_GRAY && params->depth == 1){
 
-          near -= buffer[i*bwidth + nearCol*depth + k];
-          near += buffer[i*bwidth + j*depth + k];
-        }
+    /* load the near window with first pixel */
+    int near = line[firstCol/8] >> (7-(firstCol%8)) & 1;
 
-        if(abs(near - far) > 50*winLen*depth - near*40/255){
-          buff[i] = j;
-          break;
-        }
+    /* move */
+    for(j=firstCol+direction; j!=lastCol; j+=direction){
+      if((line[j/8] >> (7-(j%8)) & 1) != near){
+        return j;
       }
     }
   }
 
-  else if (params->format == SANE_FRAME_GRAY && params->depth == 1){
+  return lastCol;
+}
 
-    int near = 0;
+/* Loop thru the image height and look for first color change in each row.
+ * Return a malloc'd array. Caller is responsible for freeing. */
+int *
+sanei_magic_getTransX (
+  SANE_Parameters * params, int dpi, SANE_Byte * buffer, int left)
+{
+  int * buff;
 
-    for(i=0; i<height; i++){
+  int i, j;
 
-      /* load the near window with first pixel */
-      near = buffer[i*bwidth + firstCol/8] >> (7-(firstCol%8)) & 1;
+  int bwidth = params->bytes_per_line;
+  int height = params->lines;
 
-      /* move */
-      for(j=firstCol+direction; j!=lastCol; j+=direction){
-        if((buffer[i*bwidth + j/8] >> (7-(j%8)) & 1) != near){
-          buff[i] = j;
-          break;
-        }
-      }
-    }
+  /* default for right-first */
+  int lastCol = -1;
+
+  DBG (10, "sanei_magic_getTransX: start\n");
+
+  /* override for left-first*/
+  if(left){
+    lastCol = params->pixels_per_line;
   }
 
   /* some other format? */
-  else{
+  if(params->format != SANE_FRAME_RGB
+    && !(params->format == SANE_FRAME_GRAY
+      && (params->depth == 8 || params->depth == 1))
+  ){
     DBG (5, "sanei_magic_getTransX: unsupported format/depth\n");
-    free(buff);
     return NULL;
   }
 
+  /* build output */
+  buff = calloc(height,sizeof(int));
+  if(!buff){
+    DBG (5, "sanei_magic_getTransX: no buff\n");
+    return NULL;
+  }
+
+  /* load the buff array with x value for first color change from edge */
+  for(i=0; i<height; i++){
+    buff[i] = getTransXLine(params, buffer + i*bwidth, left);
+  }
+
   /* ignore transitions with few neighbors within .5 inch */
   for(i=0;i<height-7;i++){
     int sum = 0;
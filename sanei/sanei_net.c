@@ -40,6 +40,7 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "../include/sane/sane.h"
 #include "../include/sane/sanei_net.h"
@@ -87,7 +88,8 @@ sanei_w_open_reply (Wire *w, SANE_Open_Reply *reply)
   sanei_w_string (w, &reply->resource_to_authorize);
 }
 
-static void
+/* Returns the number of bytes of the value on the wire.  */
+static SANE_Word
 w_option_value (Wire *w, SANE_Word type, SANE_Word size, void **value)
 {
   SANE_Word len, element_size;
@@ -118,9 +120,59 @@ w_option_value (Wire *w, SANE_Word type, SANE_Word size, void **value)
 
     default:
       w->status = EINVAL;
-      return;
+      return 0;
     }
   sanei_w_array (w, &len, value, w_value, element_size);
+  return len * element_size;
+}
+
+/* Like w_option_value(), but a decoded value must really be SIZE bytes
+   long, so that the receiver can trust the size it was given.  */
+static void
+w_option_value_sized (Wire *w, SANE_Word type, SANE_Word *size, void **value)
+{
+  SANE_Word len;
+
+  len = w_option_value (w, type, *size, value);
+  if (w->direction != WIRE_DECODE || w->status)
+    return;
+
+  if (type == SANE_TYPE_BUTTON || type == SANE_TYPE_GROUP)
+    *size = 0;
+  else if (len != *size)
+    w->status = EINVAL;
+}
+
+static void
+w_option_action (Wire *w, SANE_Option_Action *a)
+{
+  sanei_w_word (w, &a->option);
+  sanei_w_word (w, &a->action);
+  sanei_w_word (w, &a->value_type);
+  sanei_w_word (w, &a->value_size);
+  if (a->action != SANE_ACTION_SET_AUTO)
+    w_option_value_sized (w, a->value_type, &a->value_size, &a->value);
+  else if (w->direction == WIRE_DECODE)
+    a->value_size = 0;
+}
+
+static void
+w_option_result (Wire *w, SANE_Option_Result *r)
+{
+  sanei_w_status (w, &r->status);
+  sanei_w_word (w, &r->info);
+  sanei_w_word (w, &r->value_type);
+  sanei_w_word (w, &r->value_size);
+  w_option_value_sized (w, r->value_type, &r->value_size, &r->value);
+}
+
+static void
+w_option_descriptor_change (Wire *w, SANE_Option_Descriptor_Change *c)
+{
+  sanei_w_word (w, &c->option);
+  /* the receiver may have taken over the descriptor */
+  if (w->direction != WIRE_FREE || c->desc)
+    sanei_w_option_descriptor_ptr (w, &c->desc);
 }
 
 void
@@ -159,6 +211,29 @@ sanei_w_control_option_reply (Wire *w, SANE_Control_Option_Reply *reply)
   sanei_w_string (w, &reply->resource_to_authorize);
 }
 
+void
+sanei_w_control_options_req (Wire *w, SANE_Control_Options_Req *req)
+{
+  sanei_w_word (w, &req->handle);
+  sanei_w_word (w, &req->generation);
+  sanei_w_array (w, &req->num_actions, (void **) &req->actions,
+		 (WireCodecFunc) w_option_action, sizeof (req->actions[0]));
+}
+
+void
+sanei_w_control_options_reply (Wire *w, SANE_Control_Options_Reply *reply)
+{
+  sanei_w_status (w, &reply->status);
+  sanei_w_array (w, &reply->num_results, (void **) &reply->results,
+		 (WireCodecFunc) w_option_result, sizeof (reply->results[0]));
+  sanei_w_word (w, &reply->generation);
+  sanei_w_word (w, &reply->num_options);
+  sanei_w_array (w, &reply->num_changes, (void **) &reply->changes,
+		 (WireCodecFunc) w_option_descriptor_change,
+		 sizeof (reply->changes[0]));
+  sanei_w_string (w, &reply->resource_to_authorize);
+}
+
 void
 sanei_w_get_parameters_reply (Wire *w, SANE_Get_Parameters_Reply *reply)
 {
@@ -166,6 +241,16 @@ sanei_w_get_parameters_reply (Wire *w, SANE_Get_Parameters_Reply *reply)
   sanei_w_parameters (w, &reply->params);
 }
 
+void
+sanei_w_start_req (Wire *w, SANE_Start_Req *req)
+{
+  sanei_w_word (w, &req->handle);
+  if (w->version >= SANEI_NET_START_FLAGS_VERSION)
+    sanei_w_word (w, &req->flags);
+  else if (w->direction == WIRE_DECODE)
+    req->flags = 0;
+}
+
 void
 sanei_w_start_reply (Wire *w, SANE_Start_Reply *reply)
 {
@@ -182,3 +267,283 @@ sanei_w_authorization_req (Wire *w, SANE_Authorization_Req *req)
   sanei_w_string (w, &req->username);
   sanei_w_string (w, &req->password);
 }
+
+/* Compressed data channel records.
+
+   A record starts with the uncompressed length (4 bytes, big endian) and
+   the prediction stride (1 byte).  The data follows in blocks of
+   NET_COMPRESS_BLOCK bytes, each introduced by a mode byte.  Mode
+   NET_COMPRESS_STORED means the block is copied verbatim.  Any other
+   mode is the Rice parameter k used to code the zigzagged differences
+   between each byte and the byte `stride' positions earlier: the
+   quotient in unary (ones terminated by a zero), then the k low bits.
+   Quotients of NET_COMPRESS_ESCAPE or more are sent as NET_COMPRESS_ESCAPE
+   ones followed by the raw 8-bit value.  Each block is padded to a byte
+   boundary.  */
+
+#define NET_COMPRESS_HEADER	5
+#define NET_COMPRESS_BLOCK	256
+#define NET_COMPRESS_MAX_STRIDE	16
+#define NET_COMPRESS_MAX_K	7
+#define NET_COMPRESS_STORED	8
+#define NET_COMPRESS_ESCAPE	16
+
+typedef struct
+{
+  SANE_Byte *out;
+  unsigned long acc;
+  int bits;
+}
+Net_Bit_Writer;
+
+typedef struct
+{
+  const SANE_Byte *in;
+  const SANE_Byte *end;
+  unsigned long acc;
+  int bits;
+}
+Net_Bit_Reader;
+
+static void
+net_put_bits (Net_Bit_Writer *bw, unsigned int value, int count)
+{
+  bw->acc = (bw->acc << count) | (value & ((1UL << count) - 1));
+  bw->bits += count;
+  while (bw->bits >= 8)
+    {
+      bw->bits -= 8;
+      *bw->out++ = (bw->acc >> bw->bits) & 0xff;
+    }
+}
+
+static void
+net_flush_bits (Net_Bit_Writer *bw)
+{
+  if (bw->bits > 0)
+    net_put_bits (bw, 0, 8 - bw->bits);
+  bw->acc = 0;
+}
+
+static int
+net_get_bits (Net_Bit_Reader *br, int count, unsigned int *value)
+{
+  while (br->bits < count)
+    {
+      if (br->in >= br->end)
+	return -1;
+      br->acc = ((br->acc << 8) | *br->in++) & 0xffffffUL;
+      br->bits += 8;
+    }
+  br->bits -= count;
+  *value = (br->acc >> br->bits) & ((1UL << count) - 1);
+  return 0;
+}
+
+static unsigned long
+net_rice_cost (const SANE_Byte *res, size_t n, unsigned int k)
+{
+  unsigned long bits = 0;
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    {
+      unsigned int q = res[i] >> k;
+      bits += (q < NET_COMPRESS_ESCAPE) ? q + 1 + k : NET_COMPRESS_ESCAPE + 8;
+    }
+  return bits;
+}
+
+size_t
+sanei_net_compress (const SANE_Byte *src, size_t len, unsigned int stride,
+		    SANE_Byte *dst)
+{
+  SANE_Byte res[NET_COMPRESS_BLOCK];
+  Net_Bit_Writer bw;
+  size_t pos, n, i, out;
+
+  if (len <= NET_COMPRESS_HEADER || len > SANEI_NET_RECORD_LENGTH_MASK
+      || stride == 0 || stride > NET_COMPRESS_MAX_STRIDE)
+    return 0;
+
+  dst[0] = (len >> 24) & 0xff;
+  dst[1] = (len >> 16) & 0xff;
+  dst[2] = (len >> 8) & 0xff;
+  dst[3] = len & 0xff;
+  dst[4] = stride;
+  out = NET_COMPRESS_HEADER;
+
+  for (pos = 0; pos < len; pos += n)
+    {
+      unsigned long sum = 0, bits, best_bits;
+      unsigned int k, k0, best_k;
+
+      n = len - pos;
+      if (n > NET_COMPRESS_BLOCK)
+	n = NET_COMPRESS_BLOCK;
+
+      for (i = 0; i < n; i++)
+	{
+	  size_t p = pos + i;
+	  SANE_Byte d = src[p] - (p >= stride ? src[p - stride] : 0);
+	  res[i] = ((d << 1) & 0xff) ^ ((d & 0x80) ? 0xff : 0x00);
+	  sum += res[i];
+	}
+
+      /* start from the parameter that suits the mean residual and try
+         its neighbours, which is nearly always as good as a full search */
+      for (k0 = 0; k0 < NET_COMPRESS_MAX_K && (n << (k0 + 1)) <= sum; k0++)
+	;
+
+      best_k = NET_COMPRESS_STORED;
+      best_bits = n * 8;
+      for (k = (k0 > 0 ? k0 - 1 : 0);
+	   k <= k0 + 1 && k <= NET_COMPRESS_MAX_K; k++)
+	{
+	  bits = net_rice_cost (res, n, k);
+	  if (bits < best_bits)
+	    {
+	      best_bits = bits;
+	      best_k = k;
+	    }
+	}
+
+      if (out + 1 + (best_bits + 7) / 8 >= len)
+	return 0;
+
+      dst[out++] = best_k;
+      if (best_k == NET_COMPRESS_STORED)
+	{
+	  memcpy (dst + out, src + pos, n);
+	  out += n;
+	  continue;
+	}
+
+      bw.out = dst + out;
+      bw.acc = 0;
+      bw.bits = 0;
+      for (i = 0; i < n; i++)
+	{
+	  unsigned int q = res[i] >> best_k;
+	  if (q < NET_COMPRESS_ESCAPE)
+	    {
+	      net_put_bits (&bw, ((1U << q) - 1) << 1, q + 1);
+	      if (best_k > 0)
+		net_put_bits (&bw, res[i], best_k);
+	    }
+	  else
+	    {
+	      net_put_bits (&bw, (1U << NET_COMPRESS_ESCAPE) - 1,
+			    NET_COMPRESS_ESCAPE);
+	      net_put_bits (&bw, res[i], 8);
+	    }
+	}
+      net_flush_bits (&bw);
+      out = bw.out - dst;
+    }
+
+  return out;
+}
+
+SANE_Status
+sanei_net_decompressed_size (const SANE_Byte *src, size_t len, size_t *size)
+{
+  size_t raw;
+
+  if (len < NET_COMPRESS_HEADER)
+    return SANE_STATUS_IO_ERROR;
+
+  raw = ((size_t) src[0] << 24) | ((size_t) src[1] << 16)
+    | ((size_t) src[2] << 8) | (size_t) src[3];
+
+  /* every byte costs at least one bit, so anything larger is bogus and
+     must not make the caller allocate huge buffers */
+  if (raw == 0 || raw > (len - NET_COMPRESS_HEADER) * 8
+      || src[4] == 0 || src[4] > NET_COMPRESS_MAX_STRIDE)
+    return SANE_STATUS_IO_ERROR;
+
+  *size = raw;
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+sanei_net_decompress (const SANE_Byte *src, size_t len, SANE_Byte *dst,
+		      size_t size)
+{
+  const SANE_Byte *in, *end = src + len;
+  Net_Bit_Reader br;
+  size_t raw, stride, pos, n, i;
+  unsigned int k, bit, u;
+
+  if (sanei_net_decompressed_size (src, len, &raw) != SANE_STATUS_GOOD
+      || raw != size)
+    return SANE_STATUS_IO_ERROR;
+
+  stride = src[4];
+  in = src + NET_COMPRESS_HEADER;
+
+  for (pos = 0; pos < size; pos += n)
+    {
+      n = size - pos;
+      if (n > NET_COMPRESS_BLOCK)
+	n = NET_COMPRESS_BLOCK;
+
+      if (in >= end)
+	return SANE_STATUS_IO_ERROR;
+      k = *in++;
+
+      if (k == NET_COMPRESS_STORED)
+	{
+	  if ((size_t) (end - in) < n)
+	    return SANE_STATUS_IO_ERROR;
+	  memcpy (dst + pos, in, n);
+	  in += n;
+	  continue;
+	}
+      if (k > NET_COMPRESS_MAX_K)
+	return SANE_STATUS_IO_ERROR;
+
+      br.in = in;
+      br.end = end;
+      br.acc = 0;
+      br.bits = 0;
+      for (i = 0; i < n; i++)
+	{
+	  size_t p = pos + i;
+	  unsigned int q = 0;
+	  SANE_Byte d;
+
+	  for (;;)
+	    {
+	      if (net_get_bits (&br, 1, &bit) < 0)
+		return SANE_STATUS_IO_ERROR;
+	      if (!bit || ++q == NET_COMPRESS_ESCAPE)
+		break;
+	    }
+
+	  if (q == NET_COMPRESS_ESCAPE)
+	    {
+	      if (net_get_bits (&br, 8, &u) < 0)
+		return SANE_STATUS_IO_ERROR;
+	    }
+	  else
+	    {
+	      u = 0;
+	      if (k > 0 && net_get_bits (&br, k, &u) < 0)
+		return SANE_STATUS_IO_ERROR;
+	      u |= q << k;
+	      if (u > 0xff)
+		return SANE_STATUS_IO_ERROR;
+	    }
+
+	  d = (u & 1) ? ~(u >> 1) : (u >> 1);
+	  dst[p] = d + (p >= stride ? dst[p - stride] : 0);
+	}
+      in = br.in;
+    }
+
+  if (in != end)
+    return SANE_STATUS_IO_ERROR;
+
+  return SANE_STATUS_GOOD;
+}
@@ -56,6 +56,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #ifdef HAVE_SYS_IOCTL_H
 #include <sys/ioctl.h>
@@ -67,6 +68,9 @@
 #if WITH_USB_RECORD_REPLAY
 #include <libxml/parser.h>
 #include <libxml/tree.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #endif
 
 #ifdef HAVE_RESMGR
@@ -176,6 +180,62 @@ static device_list_type devices[MAX_DEVICES];
  * total number of detected devices in devices array */
 static int device_number=0;
 
+/**
+ * number of hash buckets of the device index, a power of two */
+#define DEVICE_HASH_SIZE 128
+
+/**
+ * hash index of the devices array by device name and by vendor/product
+ * ids: each bucket holds the first dn + 1 of a chain, 0 if empty, which the
+ * *_next arrays continue in increasing order of dn */
+static int devname_buckets[DEVICE_HASH_SIZE];
+static int devname_next[MAX_DEVICES];
+static int devid_buckets[DEVICE_HASH_SIZE];
+static int devid_next[MAX_DEVICES];
+
+/**
+ * whether the next sanei_usb_scan_devices has to look at the buses, or
+ * whether nothing has changed since the last scan */
+static int usb_rescan_needed = 1;
+
+/**
+ * set while sanei_usb_scan_devices runs */
+static int usb_scanning = 0;
+
+/**
+ * a bulk transfer queued by sanei_usb_submit_bulk */
+typedef struct
+{
+  SANE_Byte *buffer;
+  size_t size;			/* bytes to transfer */
+  size_t actual;		/* bytes transferred */
+  SANE_Int direction;
+  SANE_Status status;
+  int completed;
+  int dev_mem;			/* buffer is from libusb_dev_mem_alloc */
+#ifdef HAVE_LIBUSB
+  struct libusb_transfer *lu_transfer;
+#endif				/* HAVE_LIBUSB */
+}
+transfer_type;
+
+/**
+ * ring of the bulk transfers of a device */
+typedef struct
+{
+  transfer_type *transfers;
+  SANE_Int depth;
+  size_t size;			/* of every buffer */
+  SANE_Int first;		/* the oldest queued transfer */
+  SANE_Int queued;
+  SANE_Int held;		/* the one before first is still in use */
+}
+transfer_queue_type;
+
+/**
+ * per-device transfer queues, using the functions' parameters dn as index */
+static transfer_queue_type transfer_queues[MAX_DEVICES];
+
 /**
  * count number of time sanei_usb has been initialized */
 static int initialized=0;
@@ -207,6 +267,32 @@ static xmlNode* testing_append_commands_node = NULL;
 static SANE_String testing_xml_path = NULL;
 static xmlDoc* testing_xml_doc = NULL;
 static xmlNode* testing_xml_next_tx_node = NULL;
+
+// A capture in the packed format written by sanei_usb_testing_pack_capture.
+// The file starts with a header of PACK_HEADER_SIZE bytes holding the magic,
+// the format version, and the offset and length of the index and of the XML.
+// The decoded data of the transactions follows the header, the index follows
+// the data and the XML comes last. The XML is the XML capture without the hex
+// data of the transactions; the nodes whose data is packed carry a data_index
+// attribute instead, which points to an index entry holding the file offset
+// and the size of the data. All numbers are little endian.
+typedef struct
+{
+  unsigned char* contents;
+  size_t size;
+  int mapped;
+  const unsigned char* index;
+  size_t index_count;
+  size_t data_end;
+} sanei_usb_capture_pack;
+
+#define PACK_MAGIC "SANEUSBP"
+#define PACK_MAGIC_SIZE 8
+#define PACK_VERSION 1
+#define PACK_HEADER_SIZE 48
+#define PACK_INDEX_ENTRY_SIZE 16
+
+static sanei_usb_capture_pack testing_pack;
 #endif // WITH_USB_RECORD_REPLAY
 
 #if defined(HAVE_LIBUSB_LEGACY) || defined(HAVE_LIBUSB)
@@ -215,8 +301,28 @@ static int libusb_timeout = 30 * 1000;	/* 30 seconds */
 
 #ifdef HAVE_LIBUSB
 static libusb_context *sanei_usb_ctx;
+
+/* devices rejected by the last scan for what their descriptors say, which
+   later scans don't look at again */
+typedef struct
+{
+  unsigned char busno;
+  unsigned char address;
+  unsigned short vendor;
+  unsigned short product;
+}
+ignored_device_type;
+
+static ignored_device_type ignored_devices[MAX_DEVICES];
+static int ignored_device_number = 0;
 #endif /* HAVE_LIBUSB */
 
+#if defined(HAVE_LIBUSB) && LIBUSB_API_VERSION >= 0x01000102
+#define SANEI_USB_HOTPLUG
+static libusb_hotplug_callback_handle hotplug_handle;
+static int hotplug_registered = 0;
+#endif
+
 #if defined (__APPLE__)
 /* macOS won't configure several USB scanners (i.e. ScanSnap 300M) because their
  * descriptors are vendor specific.  As a result the device will get configured
@@ -376,6 +482,74 @@ kernel_get_vendor_product (int fd, const char *name, int *vendorID, int *product
 }
 #endif /* !defined(HAVE_LIBUSB_LEGACY) && !defined(HAVE_LIBUSB) */
 
+static unsigned int
+devname_hash (SANE_String_Const devname)
+{
+  /* FNV-1a */
+  unsigned int hash = 2166136261u;
+
+  while (*devname)
+    hash = (hash ^ (unsigned char) *devname++) * 16777619u;
+  return hash & (DEVICE_HASH_SIZE - 1);
+}
+
+static unsigned int
+devid_hash (SANE_Int vendor, SANE_Int product)
+{
+  unsigned int key = ((unsigned int) vendor << 16) ^ (unsigned int) product;
+
+  return (key * 2654435761u) >> 25 & (DEVICE_HASH_SIZE - 1);
+}
+
+/** rebuild the hash index of the devices array
+ * must be called whenever devices are stored or removed
+ */
+static void
+index_devices (void)
+{
+  int i;
+  unsigned int bucket;
+
+  memset (devname_buckets, 0, sizeof (devname_buckets));
+  memset (devid_buckets, 0, sizeof (devid_buckets));
+
+  /* prepending in decreasing order leaves the chains in increasing order */
+  for (i = device_number - 1; i >= 0; i--)
+    {
+      if (!devices[i].devname)
+	continue;
+      bucket = devname_hash (devices[i].devname);
+      devname_next[i] = devname_buckets[bucket];
+      devname_buckets[bucket] = i + 1;
+      bucket = devid_hash (devices[i].vendor, devices[i].product);
+      devid_next[i] = devid_buckets[bucket];
+      devid_buckets[bucket] = i + 1;
+    }
+}
+
+/** find a device by name
+ * entries left behind by devices removed without index_devices() are
+ * skipped
+ * @param devname name of the device
+ * @param any_missing whether devices marked as missing are returned too
+ * @return the lowest dn of a matching device, -1 if there is none
+ */
+static int
+find_devname (SANE_String_Const devname, SANE_Bool any_missing)
+{
+  int i;
+
+  for (i = devname_buckets[devname_hash (devname)] - 1; i >= 0;
+       i = devname_next[i] - 1)
+    {
+      if (i < device_number && devices[i].devname
+	  && (any_missing || !devices[i].missing)
+	  && strcmp (devices[i].devname, devname) == 0)
+	return i;
+    }
+  return -1;
+}
+
 /**
  * store the given device in device list if it isn't already
  * in it
@@ -389,9 +563,11 @@ store_device (device_list_type device)
 
   /* if there are already some devices present, check against
    * them and leave if an equal one is found */
-  for (i = 0; i < device_number; i++)
+  for (i = devname_buckets[devname_hash (device.devname)] - 1; i >= 0;
+       i = devname_next[i] - 1)
     {
-      if (devices[i].method == device.method
+      if (i < device_number && devices[i].devname
+       && devices[i].method == device.method
        && !strcmp (devices[i].devname, device.devname)
        && devices[i].vendor == device.vendor
        && devices[i].product == device.product)
@@ -415,6 +591,10 @@ store_device (device_list_type device)
 	  free(device.devname);
 	  return;
 	}
+    }
+
+  for (i = 0; i < device_number; i++)
+    {
       if (devices[i].missing >= 2)
         pos = i;
     }
@@ -440,6 +620,11 @@ store_device (device_list_type device)
   }
   memcpy (&(devices[pos]), &device, sizeof (device));
   devices[pos].open = SANE_FALSE;
+  index_devices ();
+
+  /* scans only skip the buses if the list holds what they found */
+  if (!usb_scanning)
+    usb_rescan_needed = 1;
 }
 
 #ifdef HAVE_LIBUSB
@@ -499,6 +684,11 @@ sanei_libusb_strerror (int errcode)
 #endif /* HAVE_LIBUSB */
 
 #if WITH_USB_RECORD_REPLAY
+static int sanei_usb_pack_read(const char* path, sanei_usb_capture_pack* pack);
+static xmlDoc* sanei_usb_pack_parse(sanei_usb_capture_pack* pack,
+                                    const char* path);
+static void sanei_usb_pack_free(sanei_usb_capture_pack* pack);
+
 SANE_Status sanei_usb_testing_enable_replay(SANE_String_Const path,
                                             int development_mode)
 {
@@ -507,7 +697,33 @@ SANE_Status sanei_usb_testing_enable_replay(SANE_String_Const path,
 
   // TODO: we'll leak if no one ever inits sane_usb properly
   testing_xml_path = strdup(path);
-  testing_xml_doc = xmlReadFile(testing_xml_path, NULL, 0);
+
+  int packed = sanei_usb_pack_read(testing_xml_path, &testing_pack);
+  if (packed < 0)
+    return SANE_STATUS_INVAL;
+  if (packed)
+    {
+      if (development_mode)
+        {
+          DBG(1, "%s: development mode needs an XML capture, unpack %s "
+              "first\n", __func__, path);
+          sanei_usb_pack_free(&testing_pack);
+          free(testing_xml_path);
+          testing_xml_path = NULL;
+          testing_mode = sanei_usb_testing_mode_disabled;
+          testing_development_mode = 0;
+          return SANE_STATUS_UNSUPPORTED;
+        }
+      testing_xml_doc = sanei_usb_pack_parse(&testing_pack, testing_xml_path);
+      if (!testing_xml_doc)
+        {
+          sanei_usb_pack_free(&testing_pack);
+          return SANE_STATUS_INVAL;
+        }
+      return SANE_STATUS_GOOD;
+    }
+
+  testing_xml_doc = xmlReadFile(testing_xml_path, NULL, XML_PARSE_HUGE);
   if (!testing_xml_doc)
     return SANE_STATUS_ACCESS_DENIED;
 
@@ -695,6 +911,179 @@ static xmlNode* sanei_xml_get_next_tx_node(void)
   return next;
 }
 
+static uint64_t sanei_usb_pack_get_u64(const unsigned char* p)
+{
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; --i)
+    value = (value << 8) | p[i];
+  return value;
+}
+
+static void sanei_usb_pack_set_u64(unsigned char* p, uint64_t value)
+{
+  for (int i = 0; i < 8; ++i)
+    {
+      p[i] = value & 0xff;
+      value >>= 8;
+    }
+}
+
+static void sanei_usb_pack_free(sanei_usb_capture_pack* pack)
+{
+#ifdef HAVE_MMAP
+  if (pack->mapped)
+    munmap(pack->contents, pack->size);
+  else
+#endif
+    free(pack->contents);
+  memset(pack, 0, sizeof(*pack));
+}
+
+// Maps or reads the packed capture at path. Returns 1 on success, 0 if the
+// file is not a packed capture and -1 if it is a broken one.
+static int sanei_usb_pack_read(const char* path, sanei_usb_capture_pack* pack)
+{
+  unsigned char header[PACK_HEADER_SIZE];
+  struct stat st;
+
+  memset(pack, 0, sizeof(*pack));
+
+  FILE* f = fopen(path, "rb");
+  if (f == NULL)
+    return 0;
+  if (fread(header, 1, sizeof(header), f) != sizeof(header) ||
+      memcmp(header, PACK_MAGIC, PACK_MAGIC_SIZE) != 0)
+    {
+      fclose(f);
+      return 0;
+    }
+
+  unsigned version = header[8] | header[9] << 8 | header[10] << 16 |
+                     (unsigned) header[11] << 24;
+  if (version != PACK_VERSION)
+    {
+      DBG(1, "%s: %s has unsupported version %u\n", __func__, path, version);
+      fclose(f);
+      return -1;
+    }
+
+  if (fstat(fileno(f), &st) != 0 || (uint64_t) st.st_size > SIZE_MAX)
+    {
+      fclose(f);
+      return -1;
+    }
+  pack->size = st.st_size;
+
+#ifdef HAVE_MMAP
+  void* map = mmap(NULL, pack->size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+  if (map != MAP_FAILED)
+    {
+      pack->contents = map;
+      pack->mapped = 1;
+    }
+#endif
+  if (pack->contents == NULL)
+    {
+      pack->contents = malloc(pack->size);
+      if (pack->contents == NULL || fseek(f, 0, SEEK_SET) != 0 ||
+          fread(pack->contents, 1, pack->size, f) != pack->size)
+        {
+          DBG(1, "%s: could not read %s\n", __func__, path);
+          fclose(f);
+          sanei_usb_pack_free(pack);
+          return -1;
+        }
+    }
+  fclose(f);
+
+  uint64_t index_offset = sanei_usb_pack_get_u64(header + 16);
+  uint64_t index_count = sanei_usb_pack_get_u64(header + 24);
+  uint64_t xml_offset = sanei_usb_pack_get_u64(header + 32);
+  uint64_t xml_size = sanei_usb_pack_get_u64(header + 40);
+
+  if (index_offset < PACK_HEADER_SIZE || index_offset > pack->size ||
+      index_count > (pack->size - index_offset) / PACK_INDEX_ENTRY_SIZE ||
+      xml_offset < index_offset + index_count * PACK_INDEX_ENTRY_SIZE ||
+      xml_offset > pack->size || xml_size > pack->size - xml_offset ||
+      xml_size > INT_MAX)
+    {
+      DBG(1, "%s: %s is truncated or broken\n", __func__, path);
+      sanei_usb_pack_free(pack);
+      return -1;
+    }
+
+  pack->index = pack->contents + index_offset;
+  pack->index_count = index_count;
+  pack->data_end = index_offset;
+  return 1;
+}
+
+// Returns the data of a node whose data is packed and stores its size.
+// sanei_usb_pack_parse has checked that the entry lies within the file.
+static const unsigned char* sanei_usb_pack_node_data(
+    const sanei_usb_capture_pack* pack, xmlNode* node, size_t* size)
+{
+  size_t i = (uintptr_t) node->_private - 1;
+  const unsigned char* entry = pack->index + i * PACK_INDEX_ENTRY_SIZE;
+
+  *size = sanei_usb_pack_get_u64(entry + 8);
+  return pack->contents + sanei_usb_pack_get_u64(entry);
+}
+
+// Parses the XML of a packed capture and links the transactions carrying a
+// data_index attribute to their index entries through their _private field.
+static xmlDoc* sanei_usb_pack_parse(sanei_usb_capture_pack* pack,
+                                    const char* path)
+{
+  const unsigned char* header = pack->contents;
+  uint64_t xml_offset = sanei_usb_pack_get_u64(header + 32);
+  uint64_t xml_size = sanei_usb_pack_get_u64(header + 40);
+
+  xmlDoc* doc = xmlReadMemory((const char*) pack->contents + xml_offset,
+                              (int) xml_size, path, NULL, XML_PARSE_HUGE);
+  if (doc == NULL)
+    {
+      DBG(1, "%s: could not parse the XML of %s\n", __func__, path);
+      return NULL;
+    }
+
+  xmlNode* el_root = xmlDocGetRootElement(doc);
+  xmlNode* el_transactions = el_root == NULL ? NULL :
+      sanei_xml_find_first_child_with_name(el_root, "transactions");
+  xmlNode* node = el_transactions == NULL ? NULL :
+      xmlFirstElementChild(el_transactions);
+
+  for (; node != NULL; node = xmlNextElementSibling(node))
+    {
+      char* attr = sanei_xml_get_prop(node, "data_index");
+      if (attr == NULL)
+        continue;
+
+      char* end = NULL;
+      unsigned long long i = strtoull(attr, &end, 10);
+      int valid = *attr != 0 && *end == 0 && i < pack->index_count;
+      xmlFree(attr);
+
+      if (valid)
+        {
+          const unsigned char* entry = pack->index + i * PACK_INDEX_ENTRY_SIZE;
+          uint64_t offset = sanei_usb_pack_get_u64(entry);
+          uint64_t size = sanei_usb_pack_get_u64(entry + 8);
+          valid = offset >= PACK_HEADER_SIZE && offset <= pack->data_end &&
+                  size <= pack->data_end - offset;
+        }
+      if (!valid)
+        {
+          sanei_xml_print_seq_if_any(node, __func__);
+          DBG(1, "%s: invalid data_index in %s\n", __func__, path);
+          xmlFreeDoc(doc);
+          return NULL;
+        }
+      node->_private = (void*) (uintptr_t) (i + 1);
+    }
+  return doc;
+}
+
 #define CHAR_TYPE_INVALID -1
 #define CHAR_TYPE_SPACE -2
 
@@ -764,6 +1153,15 @@ static char* sanei_xml_get_hex_data_slow_path(xmlNode* node, xmlChar* content, x
 // freeing the returned value
 static char* sanei_xml_get_hex_data(xmlNode* node, size_t* size)
 {
+  if (node->_private != NULL)
+    {
+      const unsigned char* data = sanei_usb_pack_node_data(&testing_pack,
+                                                           node, size);
+      char* ret_data = malloc(*size + 1);
+      memcpy(ret_data, data, *size);
+      return ret_data;
+    }
+
   xmlChar* content = xmlNodeGetContent(node);
 
   // let's overallocate to simplify the implementation. We expect the string
@@ -812,6 +1210,29 @@ static char* sanei_xml_get_hex_data(xmlNode* node, size_t* size)
   return ret_data;
 }
 
+// Returns the size of the data sanei_xml_get_hex_data would return without
+// decoding it
+static size_t sanei_xml_get_hex_data_size(xmlNode* node)
+{
+  size_t size = 0;
+  if (node->_private != NULL)
+    {
+      sanei_usb_pack_node_data(&testing_pack, node, &size);
+      return size;
+    }
+
+  size_t num_nibbles = 0;
+  for (xmlNode* child = node->children; child != NULL; child = child->next)
+    {
+      if (child->type != XML_TEXT_NODE || child->content == NULL)
+        continue;
+      for (const xmlChar* c = child->content; *c != 0; ++c)
+        if (sanei_xml_char_types[*c] >= 0)
+          num_nibbles++;
+    }
+  return num_nibbles / 2;
+}
+
 // caller is responsible for freeing the returned pointer
 static char* sanei_binary_to_hex_data(const char* data, size_t size,
                                       size_t* out_size)
@@ -879,6 +1300,190 @@ static void sanei_xml_set_uint_attr(xmlNode* node, const char* attr_name,
   xmlNewProp(node, (const xmlChar*)attr_name, (const xmlChar*)buf);
 }
 
+// Returns whether the node is a transaction whose data is hex data that can be
+// packed, as opposed to e.g. placeholders written in development mode
+static int sanei_xml_is_packable(xmlNode* node)
+{
+  if (xmlStrcmp(node->name, (const xmlChar*)"bulk_tx") != 0 &&
+      xmlStrcmp(node->name, (const xmlChar*)"control_tx") != 0 &&
+      xmlStrcmp(node->name, (const xmlChar*)"interrupt_tx") != 0)
+    return 0;
+
+  xmlChar* content = xmlNodeGetContent(node);
+  size_t num_nibbles = 0;
+  int valid = content != NULL;
+  for (const xmlChar* c = content; valid && *c != 0; ++c)
+    {
+      if (sanei_xml_char_types[*c] == CHAR_TYPE_INVALID)
+        valid = 0;
+      else if (sanei_xml_char_types[*c] >= 0)
+        num_nibbles++;
+    }
+  xmlFree(content);
+  return valid && num_nibbles > 0 && num_nibbles % 2 == 0;
+}
+
+SANE_Status sanei_usb_testing_pack_capture(SANE_String_Const xml_path,
+                                           SANE_String_Const pack_path)
+{
+  unsigned char header[PACK_HEADER_SIZE];
+  unsigned char* index = NULL;
+  size_t index_count = 0;
+  size_t index_capacity = 0;
+  uint64_t offset = PACK_HEADER_SIZE;
+  SANE_Status status = SANE_STATUS_IO_ERROR;
+  xmlChar* xml = NULL;
+  int xml_size = 0;
+
+  xmlDoc* doc = xmlReadFile(xml_path, NULL, XML_PARSE_HUGE);
+  if (doc == NULL)
+    return SANE_STATUS_ACCESS_DENIED;
+
+  xmlNode* el_root = xmlDocGetRootElement(doc);
+  xmlNode* el_transactions = el_root == NULL ? NULL :
+      sanei_xml_find_first_child_with_name(el_root, "transactions");
+  if (el_transactions == NULL)
+    {
+      DBG(1, "%s: %s is not a USB capture\n", __func__, xml_path);
+      xmlFreeDoc(doc);
+      return SANE_STATUS_INVAL;
+    }
+
+  FILE* f = fopen(pack_path, "wb");
+  if (f == NULL)
+    {
+      xmlFreeDoc(doc);
+      return SANE_STATUS_ACCESS_DENIED;
+    }
+
+  // the data is written right away, the header once all offsets are known
+  memset(header, 0, sizeof(header));
+  if (fwrite(header, 1, sizeof(header), f) != sizeof(header))
+    goto out;
+
+  for (xmlNode* node = xmlFirstElementChild(el_transactions); node != NULL;
+       node = xmlNextElementSibling(node))
+    {
+      if (!sanei_xml_is_packable(node))
+        continue;
+
+      if (index_count == index_capacity)
+        {
+          index_capacity = index_capacity ? index_capacity * 2 : 1024;
+          unsigned char* new_index = realloc(index, index_capacity *
+                                                    PACK_INDEX_ENTRY_SIZE);
+          if (new_index == NULL)
+            {
+              status = SANE_STATUS_NO_MEM;
+              goto out;
+            }
+          index = new_index;
+        }
+
+      size_t size = 0;
+      char* data = sanei_xml_get_hex_data(node, &size);
+      size_t written = fwrite(data, 1, size, f);
+      free(data);
+      if (written != size)
+        goto out;
+
+      unsigned char* entry = index + index_count * PACK_INDEX_ENTRY_SIZE;
+      sanei_usb_pack_set_u64(entry, offset);
+      sanei_usb_pack_set_u64(entry + 8, size);
+      offset += size;
+
+      xmlNodeSetContent(node, NULL);
+      sanei_xml_set_uint_attr(node, "data_index", index_count);
+      index_count++;
+    }
+
+  xmlDocDumpMemoryEnc(doc, &xml, &xml_size, "UTF-8");
+  if (xml == NULL)
+    {
+      status = SANE_STATUS_NO_MEM;
+      goto out;
+    }
+
+  memcpy(header, PACK_MAGIC, PACK_MAGIC_SIZE);
+  header[8] = PACK_VERSION;
+  sanei_usb_pack_set_u64(header + 16, offset);
+  sanei_usb_pack_set_u64(header + 24, index_count);
+  sanei_usb_pack_set_u64(header + 32,
+                         offset + index_count * PACK_INDEX_ENTRY_SIZE);
+  sanei_usb_pack_set_u64(header + 40, xml_size);
+
+  if (fwrite(index, PACK_INDEX_ENTRY_SIZE, index_count, f) != index_count ||
+      fwrite(xml, 1, xml_size, f) != (size_t) xml_size ||
+      fseek(f, 0, SEEK_SET) != 0 ||
+      fwrite(header, 1, sizeof(header), f) != sizeof(header))
+    goto out;
+
+  DBG(3, "%s: packed %lu transactions of %lu bytes\n", __func__,
+      (unsigned long) index_count,
+      (unsigned long) (offset - PACK_HEADER_SIZE));
+  status = SANE_STATUS_GOOD;
+
+out:
+  if (fclose(f) != 0 && status == SANE_STATUS_GOOD)
+    status = SANE_STATUS_IO_ERROR;
+  if (status != SANE_STATUS_GOOD)
+    {
+      DBG(1, "%s: could not write %s\n", __func__, pack_path);
+      remove(pack_path);
+    }
+  xmlFree(xml);
+  free(index);
+  xmlFreeDoc(doc);
+  return status;
+}
+
+SANE_Status sanei_usb_testing_unpack_capture(SANE_String_Const pack_path,
+                                             SANE_String_Const xml_path)
+{
+  sanei_usb_capture_pack pack;
+
+  int packed = sanei_usb_pack_read(pack_path, &pack);
+  if (packed == 0)
+    {
+      DBG(1, "%s: %s is not a packed capture\n", __func__, pack_path);
+      return SANE_STATUS_INVAL;
+    }
+  if (packed < 0)
+    return SANE_STATUS_INVAL;
+
+  xmlDoc* doc = sanei_usb_pack_parse(&pack, pack_path);
+  if (doc == NULL)
+    {
+      sanei_usb_pack_free(&pack);
+      return SANE_STATUS_INVAL;
+    }
+
+  xmlNode* el_transactions = sanei_xml_find_first_child_with_name(
+      xmlDocGetRootElement(doc), "transactions");
+  for (xmlNode* node = xmlFirstElementChild(el_transactions); node != NULL;
+       node = xmlNextElementSibling(node))
+    {
+      if (node->_private == NULL)
+        continue;
+
+      size_t size = 0;
+      const unsigned char* data = sanei_usb_pack_node_data(&pack, node, &size);
+      xmlUnsetProp(node, (const xmlChar*)"data_index");
+      sanei_xml_set_hex_data(node, (const char*) data, size);
+      node->_private = NULL;
+    }
+
+  SANE_Status status = SANE_STATUS_GOOD;
+  if (xmlSaveFileEnc(xml_path, doc, "UTF-8") < 0)
+    {
+      DBG(1, "%s: could not write %s\n", __func__, xml_path);
+      status = SANE_STATUS_IO_ERROR;
+    }
+  xmlFreeDoc(doc);
+  sanei_usb_pack_free(&pack);
+  return status;
+}
+
 static xmlNode* sanei_xml_append_command(xmlNode* sibling,
                                          int indent, xmlNode* e_command)
 {
@@ -1307,6 +1912,7 @@ static SANE_Status sanei_usb_testing_init(void)
     }
 
   testing_xml_next_tx_node = el_transaction;
+  index_devices();
 
   return SANE_STATUS_GOOD;
 }
@@ -1323,6 +1929,7 @@ static void sanei_usb_testing_exit(void)
       xmlSaveFileEnc(testing_xml_path, testing_xml_doc, "UTF-8");
     }
   xmlFreeDoc(testing_xml_doc);
+  sanei_usb_pack_free(&testing_pack);
   free(testing_xml_path);
   xmlCleanupParser();
 
@@ -1358,6 +1965,26 @@ SANE_Status sanei_usb_testing_enable_record(SANE_String_Const path, SANE_String_
   return SANE_STATUS_UNSUPPORTED;
 }
 
+SANE_Status sanei_usb_testing_pack_capture(SANE_String_Const xml_path,
+                                           SANE_String_Const pack_path)
+{
+  (void) xml_path;
+  (void) pack_path;
+
+  DBG(1, "USB record-replay mode support is missing\n");
+  return SANE_STATUS_UNSUPPORTED;
+}
+
+SANE_Status sanei_usb_testing_unpack_capture(SANE_String_Const pack_path,
+                                             SANE_String_Const xml_path)
+{
+  (void) pack_path;
+  (void) xml_path;
+
+  DBG(1, "USB record-replay mode support is missing\n");
+  return SANE_STATUS_UNSUPPORTED;
+}
+
 SANE_String sanei_usb_testing_get_backend()
 {
   return NULL;
@@ -1378,6 +2005,22 @@ void sanei_usb_testing_record_message(SANE_String_Const message)
 }
 #endif // WITH_USB_RECORD_REPLAY
 
+#ifdef SANEI_USB_HOTPLUG
+static int LIBUSB_CALL
+sanei_usb_hotplug_event (libusb_context * ctx, libusb_device * dev,
+			 libusb_hotplug_event event, void *user_data)
+{
+  (void) ctx;
+  (void) user_data;
+
+  DBG (4, "%s: device at %03d:%03d %s\n", __func__,
+       libusb_get_bus_number (dev), libusb_get_device_address (dev),
+       event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED ? "arrived" : "left");
+  usb_rescan_needed = 1;
+  return 0;
+}
+#endif /* SANEI_USB_HOTPLUG */
+
 void
 sanei_usb_init (void)
 {
@@ -1394,7 +2037,10 @@ sanei_usb_init (void)
 
   /* if no device yet, clean up memory */
   if(device_number==0)
-    memset (devices, 0, sizeof (devices));
+    {
+      memset (devices, 0, sizeof (devices));
+      index_devices ();
+    }
 
 #if WITH_USB_RECORD_REPLAY
   if (testing_mode != sanei_usb_testing_mode_disabled)
@@ -1449,6 +2095,24 @@ sanei_usb_init (void)
 	libusb_set_debug (sanei_usb_ctx, 3);
 #endif /* LIBUSB_API_VERSION */
 #endif /* DBG_LEVEL */
+#ifdef SANEI_USB_HOTPLUG
+      /* arrivals and removals tell when the buses need a new scan */
+      if (libusb_has_capability (LIBUSB_CAP_HAS_HOTPLUG))
+	{
+	  ret = libusb_hotplug_register_callback (sanei_usb_ctx,
+						  LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED
+						  | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+						  0, LIBUSB_HOTPLUG_MATCH_ANY,
+						  LIBUSB_HOTPLUG_MATCH_ANY,
+						  LIBUSB_HOTPLUG_MATCH_ANY,
+						  sanei_usb_hotplug_event, NULL,
+						  &hotplug_handle);
+	  hotplug_registered = ret == LIBUSB_SUCCESS;
+	  if (!hotplug_registered)
+	    DBG (1, "%s: failed to register hotplug callback: %s\n",
+		 __func__, sanei_libusb_strerror (ret));
+	}
+#endif /* SANEI_USB_HOTPLUG */
     }
 #endif /* HAVE_LIBUSB */
 
@@ -1502,13 +2166,21 @@ int i;
 #ifdef HAVE_LIBUSB
       if (sanei_usb_ctx)
         {
+#ifdef SANEI_USB_HOTPLUG
+          if (hotplug_registered)
+            libusb_hotplug_deregister_callback (sanei_usb_ctx, hotplug_handle);
+          hotplug_registered = 0;
+#endif
           libusb_exit (sanei_usb_ctx);
 	  /* reset libusb-1.0 context */
 	  sanei_usb_ctx=NULL;
         }
+      ignored_device_number = 0;
 #endif
       /* reset device_number */
       device_number=0;
+      index_devices ();
+      usb_rescan_needed = 1;
     }
   else
     {
@@ -1819,10 +2491,13 @@ static void libusb_scan_devices(void)
   struct libusb_config_descriptor *config0;
   unsigned short vid, pid;
   unsigned char busno, address;
+  ignored_device_type ignored[MAX_DEVICES];
+  int ignored_number = 0;
   int config;
   int interface;
+  int known;
   int ret;
-  int i;
+  int i, j;
 
   DBG (4, "%s: Looking for libusb-1.0 devices\n", __func__);
 
@@ -1832,6 +2507,7 @@ static void libusb_scan_devices(void)
       DBG (1,
 	   "%s: failed to get libusb-1.0 device list, error %d\n", __func__,
 	   (int) ndev);
+      usb_rescan_needed = 1;
       return;
     }
 
@@ -1864,37 +2540,41 @@ static void libusb_scan_devices(void)
 	  continue;
 	}
 
-      ret = libusb_open (dev, &hdl);
-      if (ret < 0)
-	{
-	  DBG (1,
-	       "%s: skipping device 0x%04x/0x%04x at %03d:%03d: cannot open: %s\n", __func__,
-	       vid, pid, busno, address, sanei_libusb_strerror (ret));
+      snprintf (devname, sizeof (devname), "libusb:%03d:%03d",
+		busno, address);
 
+      /* devices found by an earlier scan are not probed again */
+      known = find_devname (devname, SANE_TRUE);
+      if (known >= 0 && devices[known].method == sanei_usb_method_libusb
+	  && devices[known].vendor == vid && devices[known].product == pid)
+	{
+	  memset (&device, 0, sizeof (device));
+	  device.lu_device = libusb_ref_device (dev);
+	  device.devname = strdup (devname);
+	  if (!device.devname)
+	    break;
+	  device.vendor = vid;
+	  device.product = pid;
+	  device.method = sanei_usb_method_libusb;
+	  device.interface_nr = devices[known].interface_nr;
+	  store_device (device);
 	  continue;
 	}
 
-      ret = libusb_get_configuration (hdl, &config);
-
-      libusb_close (hdl);
-
-      if (ret < 0)
+      for (j = 0; j < ignored_device_number; j++)
 	{
-	  DBG (1,
-	       "%s: could not get configuration for device 0x%04x/0x%04x at %03d:%03d (err %d)\n", __func__,
-	       vid, pid, busno, address, ret);
-	  continue;
+	  if (ignored_devices[j].busno == busno
+	      && ignored_devices[j].address == address
+	      && ignored_devices[j].vendor == vid
+	      && ignored_devices[j].product == pid)
+	    break;
 	}
-
-#if !defined(SANEI_ALLOW_UNCONFIGURED_DEVICES)
-      if (config == 0)
+      if (j < ignored_device_number)
 	{
-	  DBG (1,
-	       "%s: device 0x%04x/0x%04x at %03d:%03d is not configured\n", __func__,
-	       vid, pid, busno, address);
+	  if (ignored_number < MAX_DEVICES)
+	    ignored[ignored_number++] = ignored_devices[j];
 	  continue;
 	}
-#endif
 
       ret = libusb_get_config_descriptor (dev, 0, &config0);
       if (ret < 0)
@@ -1902,6 +2582,7 @@ static void libusb_scan_devices(void)
 	  DBG (1,
 	       "%s: could not get config[0] descriptor for device 0x%04x/0x%04x at %03d:%03d (err %d)\n", __func__,
 	       vid, pid, busno, address, ret);
+	  usb_rescan_needed = 1;
 	  continue;
 	}
 
@@ -1953,16 +2634,57 @@ static void libusb_scan_devices(void)
 	  DBG (5,
 	       "%s: device 0x%04x/0x%04x at %03d:%03d: no suitable interfaces\n", __func__,
 	       vid, pid, busno, address);
+	  if (ignored_number < MAX_DEVICES)
+	    {
+	      ignored[ignored_number].busno = busno;
+	      ignored[ignored_number].address = address;
+	      ignored[ignored_number].vendor = vid;
+	      ignored[ignored_number].product = pid;
+	      ignored_number++;
+	    }
+	  continue;
+	}
+
+      /* failures from here on may go away, so the next scan tries again */
+      ret = libusb_open (dev, &hdl);
+      if (ret < 0)
+	{
+	  DBG (1,
+	       "%s: skipping device 0x%04x/0x%04x at %03d:%03d: cannot open: %s\n", __func__,
+	       vid, pid, busno, address, sanei_libusb_strerror (ret));
+	  usb_rescan_needed = 1;
+	  continue;
+	}
+
+      ret = libusb_get_configuration (hdl, &config);
+
+      libusb_close (hdl);
+
+      if (ret < 0)
+	{
+	  DBG (1,
+	       "%s: could not get configuration for device 0x%04x/0x%04x at %03d:%03d (err %d)\n", __func__,
+	       vid, pid, busno, address, ret);
+	  usb_rescan_needed = 1;
 	  continue;
 	}
 
+#if !defined(SANEI_ALLOW_UNCONFIGURED_DEVICES)
+      if (config == 0)
+	{
+	  DBG (1,
+	       "%s: device 0x%04x/0x%04x at %03d:%03d is not configured\n", __func__,
+	       vid, pid, busno, address);
+	  usb_rescan_needed = 1;
+	  continue;
+	}
+#endif
+
       memset (&device, 0, sizeof (device));
       device.lu_device = libusb_ref_device(dev);
-      snprintf (devname, sizeof (devname), "libusb:%03d:%03d",
-		busno, address);
       device.devname = strdup (devname);
       if (!device.devname)
-	return;
+	break;
       device.vendor = vid;
       device.product = pid;
       device.method = sanei_usb_method_libusb;
@@ -1976,6 +2698,10 @@ static void libusb_scan_devices(void)
       store_device (device);
     }
 
+  /* only devices still on the buses are remembered */
+  memcpy (ignored_devices, ignored, ignored_number * sizeof (ignored[0]));
+  ignored_device_number = ignored_number;
+
   libusb_free_device_list (devlist, 1);
 
 }
@@ -2000,6 +2726,31 @@ sanei_usb_scan_devices (void)
       // device added in sanei_usb_testing_init()
       return;
     }
+
+#ifdef SANEI_USB_HOTPLUG
+  if (hotplug_registered)
+    {
+      /* run the callbacks of the events that came in since the last scan */
+      struct timeval tv = { 0, 0 };
+
+      libusb_handle_events_timeout_completed (sanei_usb_ctx, &tv, NULL);
+      if (!usb_rescan_needed)
+	{
+	  /* the buses hold what the last scan found */
+	  DBG (4, "%s: no devices arrived or left since the last scan\n",
+	       __func__);
+	  for (i = 0; i < device_number; i++)
+	    {
+	      if (devices[i].missing)
+		devices[i].missing++;
+	    }
+	  return;
+	}
+    }
+#endif /* SANEI_USB_HOTPLUG */
+  usb_rescan_needed = 0;
+  usb_scanning = 1;
+
   /* we mark all already detected devices as missing */
   /* each scan method will reset this value to 0 (not missing)
    * when storing the device */
@@ -2023,6 +2774,7 @@ sanei_usb_scan_devices (void)
   /* Check for devices using OS/2 USBCALLS Interface */
   usbcall_scan_devices();
 #endif
+  usb_scanning = 0;
 
   /* display found devices */
   if (debug_level > 5)
@@ -2040,7 +2792,82 @@ sanei_usb_scan_devices (void)
     }
 }
 
+SANE_Status
+sanei_usb_get_bus_signature (SANE_Word * signature)
+{
+#if defined(__linux__)
+  /* Device nodes are named after the bus and the device address, which
+     the kernel never reuses right away, so they identify a plug-in. */
+  const char *root = "/dev/bus/usb";
+  char path[512];
+  DIR *buses, *bus;
+  struct dirent *b, *d;
+  unsigned int sig = 0, hash;
+  const char *c;
+  int count = 0;
+
+  buses = opendir (root);
+  if (!buses)
+    return SANE_STATUS_UNSUPPORTED;
+
+  while ((b = readdir (buses)) != NULL)
+    {
+      if (b->d_name[0] == '.')
+	continue;
+      snprintf (path, sizeof (path), "%s/%s", root, b->d_name);
+      bus = opendir (path);
+      if (!bus)
+	continue;
+      while ((d = readdir (bus)) != NULL)
+	{
+	  if (d->d_name[0] == '.')
+	    continue;
+	  /* FNV-1a of "bus/device", summed so the order does not matter */
+	  hash = 2166136261u;
+	  for (c = b->d_name; *c; c++)
+	    hash = (hash ^ (unsigned char) *c) * 16777619u;
+	  hash = (hash ^ '/') * 16777619u;
+	  for (c = d->d_name; *c; c++)
+	    hash = (hash ^ (unsigned char) *c) * 16777619u;
+	  sig += hash;
+	  count++;
+	}
+      closedir (bus);
+    }
+  closedir (buses);
 
+  *signature = (SANE_Word) (sig + (unsigned int) count);
+  DBG (5, "%s: %d devices, signature 0x%08x\n", __func__, count,
+       (unsigned int) *signature);
+  return SANE_STATUS_GOOD;
+#else
+  (void) signature;
+  return SANE_STATUS_UNSUPPORTED;
+#endif
+}
+
+
+
+SANE_Int
+sanei_usb_get_device_ids (SANE_Word * vendors, SANE_Word * products,
+			  SANE_Int max)
+{
+  SANE_Int dn, count = 0;
+
+  for (dn = 0; dn < device_number && devices[dn].devname; dn++)
+    {
+      if (devices[dn].missing)
+	continue;
+      if (count < max)
+	{
+	  vendors[count] = devices[dn].vendor;
+	  products[count] = devices[dn].product;
+	}
+      count++;
+    }
+  DBG (5, "%s: %d devices\n", __func__, count);
+  return count;
+}
 
 /* This logically belongs to sanei_config.c but not every backend that
    uses sanei_config() wants to depend on sanei_usb.  */
@@ -2089,18 +2916,9 @@ sanei_usb_get_vendor_product_byname (SANE_String_Const devname,
 				     SANE_Word * vendor, SANE_Word * product)
 {
   int i;
-  SANE_Bool found = SANE_FALSE;
 
-  for (i = 0; i < device_number && devices[i].devname; i++)
-    {
-      if (!devices[i].missing && strcmp (devices[i].devname, devname) == 0)
-	{
-	  found = SANE_TRUE;
-	  break;
-	}
-    }
-
-  if (!found)
+  i = find_devname (devname, SANE_FALSE);
+  if (i < 0)
     {
       DBG (1, "sanei_usb_get_vendor_product_byname: can't find device `%s' in list\n", devname);
       return SANE_STATUS_INVAL;
@@ -2167,20 +2985,21 @@ SANE_Status
 sanei_usb_find_devices (SANE_Int vendor, SANE_Int product,
 			SANE_Status (*attach) (SANE_String_Const dev))
 {
-  SANE_Int dn = 0;
+  SANE_Int dn;
 
   DBG (3,
        "sanei_usb_find_devices: vendor=0x%04x, product=0x%04x\n",
        vendor, product);
 
-  while (devices[dn].devname && dn < device_number)
+  for (dn = devid_buckets[devid_hash (vendor, product)] - 1; dn >= 0;
+       dn = devid_next[dn] - 1)
     {
-      if (devices[dn].vendor == vendor
+      if (dn < device_number && devices[dn].devname
+        && devices[dn].vendor == vendor
         && devices[dn].product == product
         && !devices[dn].missing
 	&& attach)
 	  attach (devices[dn].devname);
-      dn++;
     }
   return SANE_STATUS_GOOD;
 }
@@ -2427,20 +3246,15 @@ sanei_usb_open (SANE_String_Const devname, SANE_Int * dn)
       return SANE_STATUS_INVAL;
     }
 
-  for (devcount = 0;
-       devcount < device_number && devices[devcount].devname != 0;
-       devcount++)
+  devcount = find_devname (devname, SANE_FALSE);
+  if (devcount >= 0)
     {
-      if (!devices[devcount].missing && strcmp (devices[devcount].devname, devname) == 0)
+      if (devices[devcount].open)
 	{
-	  if (devices[devcount].open)
-	    {
-	      DBG (1, "sanei_usb_open: device `%s' already open\n", devname);
-	      return SANE_STATUS_INVAL;
-	    }
-	  found = SANE_TRUE;
-	  break;
+	  DBG (1, "sanei_usb_open: device `%s' already open\n", devname);
+	  return SANE_STATUS_INVAL;
 	}
+      found = SANE_TRUE;
     }
 
   if (!found)
@@ -3015,6 +3829,8 @@ sanei_usb_close (SANE_Int dn)
 	   dn);
       return;
     }
+  sanei_usb_cancel_bulk (dn);
+  sanei_usb_set_queue_depth (dn, 0, 0);
   if (testing_mode == sanei_usb_testing_mode_replay)
     {
       DBG (1, "sanei_usb_close: closing fake USB device\n");
@@ -3209,10 +4025,7 @@ static int sanei_usb_replay_next_read_bulk_packet_size(SANE_Int dn)
                               devices[dn].bulk_in_ep & 0x0f))
     return -1;
 
-  size_t got_size = 0;
-  char* got_data = sanei_xml_get_hex_data(node, &got_size);
-  free(got_data);
-  return got_size;
+  return sanei_xml_get_hex_data_size(node);
 }
 
 static void sanei_usb_record_read_bulk(xmlNode* node, SANE_Int dn,
@@ -3570,10 +4383,7 @@ static int sanei_usb_replay_next_write_bulk_packet_size(SANE_Int dn)
                               devices[dn].bulk_out_ep & 0x0f))
     return -1;
 
-  size_t got_size = 0;
-  char* got_data = sanei_xml_get_hex_data(node, &got_size);
-  free(got_data);
-  return got_size;
+  return sanei_xml_get_hex_data_size(node);
 }
 
 static int sanei_usb_replay_write_bulk(SANE_Int dn, const SANE_Byte* buffer,
@@ -3846,6 +4656,362 @@ sanei_usb_write_bulk (SANE_Int dn, const SANE_Byte * buffer, size_t * size)
   return SANE_STATUS_GOOD;
 }
 
+#ifdef HAVE_LIBUSB
+static void LIBUSB_CALL
+sanei_usb_transfer_done (struct libusb_transfer *lu_transfer)
+{
+  transfer_type *transfer = lu_transfer->user_data;
+
+  transfer->actual = lu_transfer->actual_length;
+  if (lu_transfer->status == LIBUSB_TRANSFER_COMPLETED)
+    transfer->status = SANE_STATUS_GOOD;
+  else
+    {
+      DBG (1, "sanei_usb_transfer_done: transfer failed with status %d\n",
+	   lu_transfer->status);
+      transfer->status = SANE_STATUS_IO_ERROR;
+    }
+  transfer->completed = 1;
+}
+
+static void
+sanei_usb_wait_transfer (transfer_type * transfer)
+{
+  int ret;
+
+  while (!transfer->completed)
+    {
+      ret = libusb_handle_events_completed (sanei_usb_ctx,
+					    &transfer->completed);
+      if (ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED)
+	{
+	  DBG (1, "sanei_usb_wait_transfer: handling events failed: %s\n",
+	       sanei_libusb_strerror (ret));
+	  libusb_cancel_transfer (transfer->lu_transfer);
+	}
+    }
+}
+#endif /* HAVE_LIBUSB */
+
+/* Whether libusb does the transfers of device dn in the background;
+   otherwise sanei_usb_reap does them one after the other. */
+static int
+sanei_usb_transfers_async (SANE_Int dn)
+{
+#ifdef HAVE_LIBUSB
+  return testing_mode != sanei_usb_testing_mode_replay
+    && devices[dn].method == sanei_usb_method_libusb;
+#else
+  (void) dn;
+  return 0;
+#endif
+}
+
+static void
+sanei_usb_free_transfers (SANE_Int dn)
+{
+  transfer_queue_type *queue = &transfer_queues[dn];
+  transfer_type *transfer;
+  SANE_Int i;
+
+  for (i = 0; i < queue->depth; i++)
+    {
+      transfer = &queue->transfers[i];
+#ifdef HAVE_LIBUSB
+      if (transfer->lu_transfer)
+	libusb_free_transfer (transfer->lu_transfer);
+#if LIBUSB_API_VERSION >= 0x01000105
+      if (transfer->dev_mem)
+	{
+	  libusb_dev_mem_free (devices[dn].lu_handle, transfer->buffer,
+			       queue->size);
+	  continue;
+	}
+#endif
+#endif /* HAVE_LIBUSB */
+      free (transfer->buffer);
+    }
+  free (queue->transfers);
+  memset (queue, 0, sizeof (*queue));
+}
+
+SANE_Status
+sanei_usb_set_queue_depth (SANE_Int dn, SANE_Int depth, size_t size)
+{
+  transfer_queue_type *queue;
+  transfer_type *transfer;
+  SANE_Int i;
+  int failed;
+
+  if (dn >= device_number || dn < 0 || depth < 0)
+    {
+      DBG (1, "sanei_usb_set_queue_depth: dn >= device number || dn < 0 "
+	   "|| depth < 0\n");
+      return SANE_STATUS_INVAL;
+    }
+  queue = &transfer_queues[dn];
+  if (queue->queued > 0)
+    {
+      DBG (1, "sanei_usb_set_queue_depth: %d transfers are queued\n",
+	   queue->queued);
+      return SANE_STATUS_DEVICE_BUSY;
+    }
+  sanei_usb_free_transfers (dn);
+  if (depth == 0)
+    return SANE_STATUS_GOOD;
+  if (size == 0 || size > INT_MAX)
+    {
+      DBG (1, "sanei_usb_set_queue_depth: invalid size %lu\n",
+	   (unsigned long) size);
+      return SANE_STATUS_INVAL;
+    }
+
+  queue->transfers = calloc (depth, sizeof (*queue->transfers));
+  if (!queue->transfers)
+    return SANE_STATUS_NO_MEM;
+  queue->size = size;
+
+  for (i = 0; i < depth; i++)
+    {
+      transfer = &queue->transfers[i];
+      queue->depth = i + 1;
+#if defined(HAVE_LIBUSB) && LIBUSB_API_VERSION >= 0x01000105
+      /* memory the kernel transfers to directly, as far as there is some */
+      if (sanei_usb_transfers_async (dn) && devices[dn].open)
+	{
+	  transfer->buffer = libusb_dev_mem_alloc (devices[dn].lu_handle,
+						   size);
+	  transfer->dev_mem = transfer->buffer != NULL;
+	}
+#endif
+      if (!transfer->buffer)
+	transfer->buffer = malloc (size);
+      failed = transfer->buffer == NULL;
+#ifdef HAVE_LIBUSB
+      transfer->lu_transfer = libusb_alloc_transfer (0);
+      failed |= transfer->lu_transfer == NULL;
+#endif
+      if (failed)
+	{
+	  DBG (1, "sanei_usb_set_queue_depth: out of memory\n");
+	  sanei_usb_free_transfers (dn);
+	  return SANE_STATUS_NO_MEM;
+	}
+    }
+
+  DBG (5, "sanei_usb_set_queue_depth: %d transfers of %lu bytes\n", depth,
+       (unsigned long) size);
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+sanei_usb_submit_bulk (SANE_Int dn, SANE_Int direction,
+		       const SANE_Byte * data, size_t size)
+{
+  transfer_queue_type *queue;
+  transfer_type *transfer;
+
+  if (dn >= device_number || dn < 0)
+    {
+      DBG (1, "sanei_usb_submit_bulk: dn >= device number || dn < 0\n");
+      return SANE_STATUS_INVAL;
+    }
+  queue = &transfer_queues[dn];
+  if (size == 0 || size > queue->size
+      || (direction == USB_DIR_OUT && !data)
+      || (direction != USB_DIR_OUT && direction != USB_DIR_IN))
+    {
+      DBG (1, "sanei_usb_submit_bulk: invalid transfer of %lu bytes "
+	   "(direction 0x%02x, queue of %lu byte transfers)\n",
+	   (unsigned long) size, direction, (unsigned long) queue->size);
+      return SANE_STATUS_INVAL;
+    }
+  /* the buffer sanei_usb_reap handed out last is still in use */
+  if (queue->queued + queue->held >= queue->depth)
+    {
+      DBG (3, "sanei_usb_submit_bulk: queue is full\n");
+      return SANE_STATUS_DEVICE_BUSY;
+    }
+
+  transfer = &queue->transfers[(queue->first + queue->queued) % queue->depth];
+  transfer->direction = direction;
+  transfer->size = size;
+  transfer->actual = 0;
+  transfer->status = SANE_STATUS_GOOD;
+  transfer->completed = 0;
+  if (direction == USB_DIR_OUT)
+    memcpy (transfer->buffer, data, size);
+
+#ifdef HAVE_LIBUSB
+  if (sanei_usb_transfers_async (dn))
+    {
+      SANE_Int ep = direction == USB_DIR_IN ? devices[dn].bulk_in_ep
+					    : devices[dn].bulk_out_ep;
+      int ret;
+
+      if (!ep)
+	{
+	  DBG (1, "sanei_usb_submit_bulk: device has no bulk-%s endpoint\n",
+	       direction == USB_DIR_IN ? "in" : "out");
+	  return SANE_STATUS_INVAL;
+	}
+      libusb_fill_bulk_transfer (transfer->lu_transfer, devices[dn].lu_handle,
+				 ep, transfer->buffer, (int) size,
+				 sanei_usb_transfer_done, transfer,
+				 libusb_timeout);
+      ret = libusb_submit_transfer (transfer->lu_transfer);
+      if (ret < 0)
+	{
+	  DBG (1, "sanei_usb_submit_bulk: submitting failed: %s\n",
+	       sanei_libusb_strerror (ret));
+	  return SANE_STATUS_IO_ERROR;
+	}
+    }
+#endif /* HAVE_LIBUSB */
+
+  queue->queued++;
+  DBG (5, "sanei_usb_submit_bulk: queued %s of %lu bytes, %d queued\n",
+       direction == USB_DIR_IN ? "read" : "write", (unsigned long) size,
+       queue->queued);
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+sanei_usb_reap (SANE_Int dn, SANE_Byte ** data, size_t * size)
+{
+  transfer_queue_type *queue;
+  transfer_type *transfer;
+  SANE_Status status = SANE_STATUS_INVAL;
+  size_t actual = 0;
+
+  if (!size)
+    {
+      DBG (1, "sanei_usb_reap: size == NULL\n");
+      return SANE_STATUS_INVAL;
+    }
+  *size = 0;
+  if (data)
+    *data = NULL;
+  if (dn >= device_number || dn < 0)
+    {
+      DBG (1, "sanei_usb_reap: dn >= device number || dn < 0\n");
+      return SANE_STATUS_INVAL;
+    }
+  queue = &transfer_queues[dn];
+  queue->held = 0;
+  if (queue->queued == 0)
+    {
+      DBG (1, "sanei_usb_reap: no transfer queued\n");
+      return SANE_STATUS_INVAL;
+    }
+
+  transfer = &queue->transfers[queue->first];
+  queue->first = (queue->first + 1) % queue->depth;
+  queue->queued--;
+
+  if (!sanei_usb_transfers_async (dn))
+    {
+      /* the synchronous functions take care of replaying and recording */
+      actual = transfer->size;
+      if (transfer->direction == USB_DIR_IN)
+	status = sanei_usb_read_bulk (dn, transfer->buffer, &actual);
+      else
+	status = sanei_usb_write_bulk (dn, transfer->buffer, &actual);
+    }
+#ifdef HAVE_LIBUSB
+  else
+    {
+      sanei_usb_wait_transfer (transfer);
+      status = transfer->status;
+      actual = transfer->actual;
+
+      if (testing_mode == sanei_usb_testing_mode_record)
+	{
+#if WITH_USB_RECORD_REPLAY
+	  if (transfer->direction == USB_DIR_IN)
+	    sanei_usb_record_read_bulk (NULL, dn, transfer->buffer,
+					transfer->size,
+					status == SANE_STATUS_GOOD
+					? (ssize_t) actual : -1);
+	  else
+	    sanei_usb_record_write_bulk (NULL, dn, transfer->buffer,
+					 transfer->size, actual);
+#else
+	  DBG (1, "USB record-replay mode support is missing\n");
+	  return SANE_STATUS_UNSUPPORTED;
+#endif
+	}
+
+      if (status != SANE_STATUS_GOOD)
+	{
+	  actual = 0;
+	  if (testing_mode == sanei_usb_testing_mode_disabled)
+	    libusb_clear_halt (devices[dn].lu_handle,
+			       transfer->direction == USB_DIR_IN
+			       ? devices[dn].bulk_in_ep
+			       : devices[dn].bulk_out_ep);
+	}
+      else if (transfer->direction == USB_DIR_IN && actual == 0)
+	{
+	  DBG (3, "sanei_usb_reap: read returned EOF\n");
+	  status = SANE_STATUS_EOF;
+	}
+      else if (transfer->direction == USB_DIR_IN && debug_level > 10)
+	print_buffer (transfer->buffer, actual);
+    }
+#endif /* HAVE_LIBUSB */
+
+  DBG (5, "sanei_usb_reap: %s of %lu bytes transferred %lu bytes, %d "
+       "queued\n", transfer->direction == USB_DIR_IN ? "read" : "write",
+       (unsigned long) transfer->size, (unsigned long) actual,
+       queue->queued);
+
+  *size = actual;
+  if (transfer->direction == USB_DIR_IN && status == SANE_STATUS_GOOD)
+    {
+      queue->held = 1;
+      if (data)
+	*data = transfer->buffer;
+    }
+  return status;
+}
+
+void
+sanei_usb_cancel_bulk (SANE_Int dn)
+{
+  transfer_queue_type *queue;
+
+  if (dn >= device_number || dn < 0)
+    {
+      DBG (1, "sanei_usb_cancel_bulk: dn >= device number || dn < 0\n");
+      return;
+    }
+  queue = &transfer_queues[dn];
+  DBG (5, "sanei_usb_cancel_bulk: cancelling %d transfers\n", queue->queued);
+
+#ifdef HAVE_LIBUSB
+  if (sanei_usb_transfers_async (dn))
+    {
+      transfer_type *transfer;
+      SANE_Int i;
+
+      for (i = 0; i < queue->queued; i++)
+	{
+	  transfer = &queue->transfers[(queue->first + i) % queue->depth];
+	  if (!transfer->completed)
+	    libusb_cancel_transfer (transfer->lu_transfer);
+	}
+      for (i = 0; i < queue->queued; i++)
+	sanei_usb_wait_transfer (&queue->transfers[(queue->first + i)
+						   % queue->depth]);
+    }
+#endif /* HAVE_LIBUSB */
+
+  queue->first = 0;
+  queue->queued = 0;
+  queue->held = 0;
+}
+
 #if WITH_USB_RECORD_REPLAY
 static void
 sanei_usb_record_control_msg(xmlNode* node,
@@ -0,0 +1,437 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Measures the throughput of the image pipeline for every scan configuration that
+// session_config_test covers. For each configuration the backend is started in testing mode to
+// compute the scan session, then the same pipeline as during a real scan is built on top of an
+// array of synthetic raw data and timed.
+
+#define DEBUG_DECLARE_ONLY
+
+#include "../../../backend/genesys/device.h"
+#include "../../../backend/genesys/enums.h"
+#include "../../../backend/genesys/error.h"
+#include "../../../backend/genesys/genesys.h"
+#include "../../../backend/genesys/image_pipeline.h"
+#include "../../../backend/genesys/low.h"
+#include "../../../backend/genesys/test_settings.h"
+#include "../../../backend/genesys/thread_pool.h"
+#include "../../../include/sane/saneopts.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+
+struct BenchmarkConfig
+{
+    std::uint16_t vendor_id = 0;
+    std::uint16_t product_id = 0;
+    std::uint16_t bcd_device = 0;
+    std::string model_name;
+    genesys::ScanMethod method = genesys::ScanMethod::FLATBED;
+    genesys::ScanColorMode color_mode = genesys::ScanColorMode::COLOR_SINGLE_PASS;
+    unsigned depth = 0;
+    unsigned resolution = 0;
+
+    std::string name() const
+    {
+        std::stringstream out;
+        out << model_name
+            << '_' << method
+            << '_' << color_mode
+            << "_depth" << depth
+            << "_dpi" << resolution;
+        return out.str();
+    }
+};
+
+struct BenchmarkSettings
+{
+    unsigned iterations = 3;
+    unsigned thread_count = 0;
+    bool fusion = true;
+    // the raw data is limited to this size so that high resolution configurations don't take
+    // unreasonable amounts of memory and time
+    std::size_t max_input_bytes = 64 * 1024 * 1024;
+};
+
+struct BenchmarkResult
+{
+    BenchmarkConfig config;
+    bool success = true;
+    std::string failure_message;
+
+    std::size_t input_width = 0;
+    std::size_t input_rows = 0;
+    std::size_t input_bytes = 0;
+    std::size_t output_width = 0;
+    std::size_t output_rows = 0;
+    std::size_t output_bytes = 0;
+    // the fastest of all iterations
+    double seconds = 0;
+
+    double rows_per_second() const { return seconds > 0 ? output_rows / seconds : 0; }
+    double mb_per_second() const { return seconds > 0 ? output_bytes / seconds / 1e6 : 0; }
+};
+
+static SANE_Int find_option(SANE_Handle handle, const char* name)
+{
+    SANE_Int option_count = 0;
+    TIE(sane_control_option(handle, 0, SANE_ACTION_GET_VALUE, &option_count, nullptr));
+    for (SANE_Int i = 1; i < option_count; ++i) {
+        const auto* option = sane_get_option_descriptor(handle, i);
+        if (option != nullptr && option->name != nullptr && std::strcmp(option->name, name) == 0) {
+            return i;
+        }
+    }
+    throw std::runtime_error(std::string("Could not find option ") + name);
+}
+
+static void set_option_int(SANE_Handle handle, const char* name, int value)
+{
+    TIE(sane_control_option(handle, find_option(handle, name), SANE_ACTION_SET_VALUE,
+                            &value, nullptr));
+}
+
+static void set_option_string(SANE_Handle handle, const char* name, const std::string& value)
+{
+    TIE(sane_control_option(handle, find_option(handle, name), SANE_ACTION_SET_VALUE,
+                            const_cast<char*>(value.c_str()), nullptr));
+}
+
+static std::vector<std::uint8_t> create_synthetic_data(std::size_t size)
+{
+    // a simple linear congruential generator gives repeatable, non-uniform data
+    std::vector<std::uint8_t> data(size);
+    std::uint32_t state = 12345;
+    for (auto& value : data) {
+        state = state * 1103515245 + 12345;
+        value = static_cast<std::uint8_t>(state >> 16);
+    }
+    return data;
+}
+
+static double time_pipeline(const genesys::Genesys_Device& dev,
+                            const BenchmarkSettings& settings,
+                            const std::vector<std::uint8_t>& input_data,
+                            std::size_t input_width, std::size_t input_rows,
+                            genesys::PixelFormat input_format,
+                            BenchmarkResult& result)
+{
+    genesys::ImagePipelineStack pipeline;
+    pipeline.set_fusion_enabled(settings.fusion);
+    // as during a real scan, disabling fusion also disables processing on multiple threads
+    if (settings.fusion) {
+        pipeline.set_thread_count(settings.thread_count);
+    }
+    pipeline.push_first_node<genesys::ImagePipelineNodeArraySource>(input_width, input_rows,
+                                                                     input_format, input_data);
+    genesys::push_image_pipeline_nodes(pipeline, dev, dev.session, 0, false);
+
+    result.output_width = pipeline.get_output_width();
+    result.output_rows = pipeline.get_output_height();
+    result.output_bytes = pipeline.get_output_row_bytes() * result.output_rows;
+
+    std::vector<std::uint8_t> row(pipeline.get_output_row_bytes());
+
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (std::size_t i = 0; i < result.output_rows; ++i) {
+        pipeline.get_next_row_data(row.data());
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(end - begin).count();
+}
+
+static void run_benchmark(const BenchmarkSettings& settings, BenchmarkResult& result)
+{
+    const auto& config = result.config;
+
+    genesys::enable_testing_mode(config.vendor_id, config.product_id, config.bcd_device,
+                                 [](const genesys::Genesys_Device&, genesys::TestScannerInterface&,
+                                    const std::string&) {});
+
+    SANE_Handle handle;
+    TIE(sane_init(nullptr, nullptr));
+    TIE(sane_open(genesys::get_testing_device_name().c_str(), &handle));
+
+    try {
+        int force_calibration = 1;
+        TIE(sane_control_option(handle, find_option(handle, "force-calibration"),
+                                SANE_ACTION_SET_VALUE, &force_calibration, nullptr));
+        set_option_string(handle, SANE_NAME_SCAN_SOURCE,
+                          genesys::scan_method_to_option_string(config.method));
+        set_option_string(handle, SANE_NAME_SCAN_MODE,
+                          genesys::scan_color_mode_to_option_string(config.color_mode));
+        set_option_int(handle, SANE_NAME_BIT_DEPTH, config.depth);
+        set_option_int(handle, SANE_NAME_SCAN_RESOLUTION, config.resolution);
+
+        // computes the session and the calibration data that the pipeline uses
+        TIE(sane_start(handle));
+
+        const auto& dev = *reinterpret_cast<genesys::Genesys_Scanner*>(handle)->dev;
+        const auto& session = dev.session;
+
+        auto input_format = dev.pipeline.get_input_format();
+        result.input_width = dev.pipeline.get_input_width();
+        auto input_row_bytes = dev.pipeline.get_input_row_bytes();
+
+        // the rows that are consumed by the line shifting nodes must be always present
+        std::size_t min_rows = session.max_color_shift_lines + session.num_staggered_lines + 16;
+        result.input_rows = std::min<std::size_t>(
+                    dev.pipeline.get_input_height(),
+                    std::max(settings.max_input_bytes / input_row_bytes, min_rows));
+        result.input_bytes = input_row_bytes * result.input_rows;
+
+        auto input_data = create_synthetic_data(result.input_bytes);
+
+        for (unsigned i = 0; i < settings.iterations; ++i) {
+            double seconds = time_pipeline(dev, settings, input_data, result.input_width,
+                                           result.input_rows, input_format, result);
+            if (i == 0 || seconds < result.seconds) {
+                result.seconds = seconds;
+            }
+        }
+    } catch (...) {
+        sane_cancel(handle);
+        sane_close(handle);
+        sane_exit();
+        genesys::disable_testing_mode();
+        throw;
+    }
+
+    sane_cancel(handle);
+    sane_close(handle);
+    sane_exit();
+    genesys::disable_testing_mode();
+}
+
+static std::vector<BenchmarkConfig> get_all_benchmark_configs()
+{
+    genesys::genesys_init_usb_device_tables();
+    genesys::genesys_init_sensor_tables();
+
+    std::vector<BenchmarkConfig> configs;
+    std::unordered_set<std::string> model_names;
+
+    for (const auto& usb_dev : *genesys::s_usb_devices) {
+
+        const auto& model = usb_dev.model();
+
+        if (genesys::has_flag(model.flags, genesys::ModelFlag::UNTESTED)) {
+            continue;
+        }
+        if (model_names.find(model.name) != model_names.end()) {
+            continue;
+        }
+        model_names.insert(model.name);
+
+        for (auto scan_mode : { genesys::ScanColorMode::GRAY,
+                                genesys::ScanColorMode::COLOR_SINGLE_PASS }) {
+
+            auto depth_values = model.bpp_gray_values;
+            if (scan_mode == genesys::ScanColorMode::COLOR_SINGLE_PASS) {
+                depth_values = model.bpp_color_values;
+            }
+            for (unsigned depth : depth_values) {
+                for (auto method_resolutions : model.resolutions) {
+                    for (auto method : method_resolutions.methods) {
+                        for (unsigned resolution : method_resolutions.get_resolutions()) {
+                            BenchmarkConfig config;
+                            config.vendor_id = usb_dev.vendor_id();
+                            config.product_id = usb_dev.product_id();
+                            config.bcd_device = usb_dev.bcd_device();
+                            config.model_name = model.name;
+                            config.method = method;
+                            config.depth = depth;
+                            config.resolution = resolution;
+                            config.color_mode = scan_mode;
+                            configs.push_back(config);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return configs;
+}
+
+static std::string json_escape(const std::string& str)
+{
+    std::string ret;
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            ret += '\\';
+            ret += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned>(c));
+            ret += buf;
+        } else {
+            ret += c;
+        }
+    }
+    return ret;
+}
+
+static void print_json(std::ostream& out, const BenchmarkSettings& settings,
+                       const std::vector<BenchmarkResult>& results)
+{
+    out << "{\n"
+        << "  \"iterations\": " << settings.iterations << ",\n"
+        << "  \"threads\": " << settings.thread_count << ",\n"
+        << "  \"fusion\": " << (settings.fusion ? "true" : "false") << ",\n"
+        << "  \"results\": [";
+
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        std::stringstream method;
+        std::stringstream color_mode;
+        method << r.config.method;
+        color_mode << r.config.color_mode;
+
+        out << (i == 0 ? "\n" : ",\n")
+            << "    {\n"
+            << "      \"name\": \"" << json_escape(r.config.name()) << "\",\n"
+            << "      \"model\": \"" << json_escape(r.config.model_name) << "\",\n"
+            << "      \"method\": \"" << json_escape(method.str()) << "\",\n"
+            << "      \"color_mode\": \"" << json_escape(color_mode.str()) << "\",\n"
+            << "      \"depth\": " << r.config.depth << ",\n"
+            << "      \"resolution\": " << r.config.resolution << ",\n"
+            << "      \"success\": " << (r.success ? "true" : "false") << ",\n";
+        if (!r.success) {
+            out << "      \"error\": \"" << json_escape(r.failure_message) << "\"\n"
+                << "    }";
+            continue;
+        }
+        out << "      \"input_width\": " << r.input_width << ",\n"
+            << "      \"input_rows\": " << r.input_rows << ",\n"
+            << "      \"input_bytes\": " << r.input_bytes << ",\n"
+            << "      \"output_width\": " << r.output_width << ",\n"
+            << "      \"output_rows\": " << r.output_rows << ",\n"
+            << "      \"output_bytes\": " << r.output_bytes << ",\n"
+            << "      \"seconds\": " << r.seconds << ",\n"
+            << "      \"rows_per_second\": " << r.rows_per_second() << ",\n"
+            << "      \"mb_per_second\": " << r.mb_per_second() << "\n"
+            << "    }";
+    }
+    out << "\n  ]\n}\n";
+}
+
+static void print_help()
+{
+    std::cerr << "Usage:\n"
+              << "pipeline_benchmark [--test={name_substring}] [--json] [--iterations={count}]\n"
+              << "                   [--threads={count}] [--no-fusion] [--max-input-mb={size}]\n"
+              << "pipeline_benchmark --help\n"
+              << "pipeline_benchmark --print_test_names\n"
+              << "\n"
+              << "By default, the pipeline uses as many threads as during a real scan.\n";
+}
+
+int main(int argc, const char* argv[])
+{
+    BenchmarkSettings settings;
+    settings.thread_count = genesys::get_image_processing_thread_count();
+
+    std::string test_name_filter;
+    bool print_test_names = false;
+    bool json = false;
+
+    for (int argi = 1; argi < argc; ++argi) {
+        std::string arg = argv[argi];
+        if (arg.rfind("--test=", 0) == 0) {
+            test_name_filter = arg.substr(7);
+        } else if (arg.rfind("--iterations=", 0) == 0) {
+            settings.iterations = std::max(std::stoi(arg.substr(13)), 1);
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            settings.thread_count = std::max(std::stoi(arg.substr(10)), 1);
+        } else if (arg.rfind("--max-input-mb=", 0) == 0) {
+            settings.max_input_bytes = std::max(std::stoi(arg.substr(15)), 1) * 1024 * 1024;
+        } else if (arg == "--no-fusion") {
+            settings.fusion = false;
+        } else if (arg == "--json") {
+            json = true;
+        } else if (arg == "--print_test_names") {
+            print_test_names = true;
+        } else if (arg == "-h" || arg == "--help") {
+            print_help();
+            return 0;
+        } else {
+            print_help();
+            return 1;
+        }
+    }
+
+    auto configs = get_all_benchmark_configs();
+
+    if (print_test_names) {
+        for (const auto& config : configs) {
+            std::cout << config.name() << "\n";
+        }
+        return 0;
+    }
+
+    std::vector<BenchmarkResult> results;
+    bool success = true;
+
+    for (unsigned i = 0; i < configs.size(); ++i) {
+        const auto& config = configs[i];
+        if (!test_name_filter.empty() && config.name().find(test_name_filter) == std::string::npos) {
+            continue;
+        }
+
+        BenchmarkResult result;
+        result.config = config;
+        try {
+            run_benchmark(settings, result);
+        } catch (const std::exception& exc) {
+            result.success = false;
+            result.failure_message = exc.what();
+        } catch (...) {
+            result.success = false;
+            result.failure_message = "unknown exception";
+        }
+        success &= result.success;
+
+        std::cerr << "(" << i << "/" << configs.size() << "): ";
+        if (result.success) {
+            std::cerr << std::fixed << std::setprecision(1)
+                      << std::setw(9) << result.mb_per_second() << " MB/s "
+                      << std::setw(10) << result.rows_per_second() << " rows/s: ";
+        } else {
+            std::cerr << "FAIL: ";
+        }
+        std::cerr << config.name() << "\n";
+        if (!result.success) {
+            std::cerr << result.failure_message << "\n";
+        }
+
+        results.push_back(result);
+    }
+
+    if (json) {
+        print_json(std::cout, settings, results);
+    }
+
+    return success ? 0 : 1;
+}
@@ -24,8 +24,14 @@
 #include "minigtest.h"
 
 #include "../../../backend/genesys/low.h"
+#include "../../../backend/genesys/calibration_store.h"
 
+#include <dirent.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
 #include <sstream>
+#include <thread>
 
 namespace genesys {
 
@@ -121,9 +127,182 @@ void test_calibration_roundtrip()
     ASSERT_TRUE(str.eof());
 }
 
+static std::vector<std::uint8_t> write_calibration_store_data(
+        const CalibrationStore& store, const Genesys_Device::Calibration& calibration)
+{
+    std::stringstream str;
+    store.write(str, calibration);
+    auto data = str.str();
+    return std::vector<std::uint8_t>(data.begin(), data.end());
+}
+
+void test_calibration_store_roundtrip()
+{
+    Genesys_Device::Calibration calibration;
+    for (unsigned xres : { 1200, 300, 600 }) {
+        auto entry = create_fake_calibration_entry();
+        entry.params.xres = xres;
+        entry.params.yres = xres;
+        entry.last_calibration = xres * 10;
+        entry.white_average_data.push_back(xres);
+        calibration.push_back(entry);
+    }
+
+    CalibrationStore empty_store;
+    CalibrationStore store;
+    ASSERT_TRUE(store.open_data(write_calibration_store_data(empty_store, calibration)));
+    ASSERT_EQ(store.size(), 3u);
+
+    for (const auto& entry : calibration) {
+        auto indices = store.find_entries(entry.sensor.sensor_id, entry.params);
+        ASSERT_EQ(indices.size(), 1u);
+
+        auto header = store.get_entry_header(indices.front());
+        ASSERT_EQ(header.params.xres, entry.params.xres);
+        ASSERT_EQ(header.params.yres, entry.params.yres);
+        ASSERT_EQ(header.params.channels, entry.params.channels);
+        ASSERT_EQ(header.params.pixels, entry.params.pixels);
+        ASSERT_EQ(header.last_calibration, entry.last_calibration);
+
+        ASSERT_TRUE(store.load_entry(indices.front()) == entry);
+    }
+
+    auto params = calibration.front().params;
+    params.xres = 150;
+    ASSERT_TRUE(store.find_entries(calibration.front().sensor.sensor_id, params).empty());
+    ASSERT_TRUE(store.find_entries(SensorId::CCD_HP2300, calibration.front().params).empty());
+}
+
+void test_calibration_store_rewrite()
+{
+    Genesys_Device::Calibration calibration;
+    for (unsigned xres : { 300, 600 }) {
+        auto entry = create_fake_calibration_entry();
+        entry.params.xres = xres;
+        calibration.push_back(entry);
+    }
+
+    CalibrationStore empty_store;
+    CalibrationStore store;
+    ASSERT_TRUE(store.open_data(write_calibration_store_data(empty_store, calibration)));
+
+    // one entry supersedes the entry stored for 600 dpi, another one is new
+    Genesys_Device::Calibration new_calibration;
+    for (unsigned xres : { 600, 1200 }) {
+        auto entry = create_fake_calibration_entry();
+        entry.params.xres = xres;
+        entry.last_calibration = 1000;
+        new_calibration.push_back(entry);
+    }
+
+    CalibrationStore new_store;
+    ASSERT_TRUE(new_store.open_data(write_calibration_store_data(store, new_calibration)));
+    ASSERT_EQ(new_store.size(), 3u);
+
+    auto sensor_id = calibration.front().sensor.sensor_id;
+    auto indices = new_store.find_entries(sensor_id, calibration[0].params);
+    ASSERT_EQ(indices.size(), 1u);
+    ASSERT_TRUE(new_store.load_entry(indices.front()) == calibration[0]);
+
+    for (const auto& entry : new_calibration) {
+        indices = new_store.find_entries(sensor_id, entry.params);
+        ASSERT_EQ(indices.size(), 1u);
+        ASSERT_TRUE(new_store.load_entry(indices.front()) == entry);
+    }
+}
+
+void test_calibration_store_invalid_data()
+{
+    std::stringstream str;
+    Genesys_Device::Calibration calibration = { create_fake_calibration_entry() };
+    serialize(static_cast<std::ostream&>(str), calibration);
+    auto text_data = str.str();
+
+    CalibrationStore store;
+    ASSERT_FALSE(store.open_data(std::vector<std::uint8_t>(text_data.begin(), text_data.end())));
+    ASSERT_FALSE(store.is_open());
+
+    CalibrationStore empty_store;
+    auto data = write_calibration_store_data(empty_store, calibration);
+    data.resize(data.size() / 2);
+    ASSERT_TRUE(store.open_data(data));
+
+    bool got_exception = false;
+    try {
+        store.load_entry(0);
+    } catch (const SaneException&) {
+        got_exception = true;
+    }
+    ASSERT_TRUE(got_exception);
+}
+
+void test_calibration_store_concurrent_write()
+{
+    char dir_template[] = "/tmp/genesys_calibration_XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir_template) != nullptr);
+    std::string dir = dir_template;
+    std::string path = dir + "/calibration.cal";
+
+    // several processes may save calibration of the same device at the same time. Each of them
+    // must write a complete file.
+    std::vector<Genesys_Device::Calibration> calibrations;
+    for (unsigned xres : { 300, 600, 1200, 2400 }) {
+        auto entry = create_fake_calibration_entry();
+        entry.params.xres = xres;
+        entry.white_average_data.resize(xres * 10, xres / 100);
+        calibrations.push_back({ entry });
+    }
+
+    CalibrationStore empty_store;
+    std::vector<std::thread> threads;
+    for (const auto& calibration : calibrations) {
+        threads.emplace_back([&path, &calibration, &empty_store]()
+        {
+            for (unsigned i = 0; i < 20; ++i) {
+                write_calibration_store(path, calibration, empty_store);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    CalibrationStore store;
+    ASSERT_TRUE(store.open(path));
+    ASSERT_EQ(store.size(), 1u);
+    auto entry = store.load_entry(0);
+    bool found = false;
+    for (const auto& calibration : calibrations) {
+        found = found || entry == calibration.front();
+    }
+    ASSERT_TRUE(found);
+    store.close();
+
+    // no temporary files must be left behind
+    std::vector<std::string> names;
+    DIR* dir_handle = opendir(dir.c_str());
+    ASSERT_TRUE(dir_handle != nullptr);
+    while (dirent* dir_entry = readdir(dir_handle)) {
+        std::string name = dir_entry->d_name;
+        if (name != "." && name != "..") {
+            names.push_back(name);
+        }
+    }
+    closedir(dir_handle);
+    ASSERT_EQ(names.size(), 1u);
+    ASSERT_EQ(names.front(), "calibration.cal");
+
+    std::remove(path.c_str());
+    rmdir(dir.c_str());
+}
+
 void test_calibration_parsing()
 {
     test_calibration_roundtrip();
+    test_calibration_store_roundtrip();
+    test_calibration_store_rewrite();
+    test_calibration_store_invalid_data();
+    test_calibration_store_concurrent_write();
 }
 
 } // namespace genesys
@@ -26,6 +26,8 @@
 
 #include "../../../backend/genesys/image_pipeline.h"
 
+#include <algorithm>
+#include <atomic>
 #include <numeric>
 
 namespace genesys {
@@ -167,6 +169,198 @@ void test_image_buffer_capped_remaining_bytes()
     ASSERT_EQ(requests, expected);
 }
 
+void test_image_buffer_direct_reads()
+{
+    std::vector<const std::uint8_t*> read_pointers;
+    std::uint8_t next_value = 0;
+
+    auto on_read = [&](std::size_t x, std::uint8_t* data)
+    {
+        read_pointers.push_back(data);
+        for (std::size_t i = 0; i < x; ++i) {
+            data[i] = next_value++;
+        }
+        return true;
+    };
+
+    ImageBuffer buffer{100, on_read};
+    buffer.set_remaining_size(450);
+
+    std::vector<std::uint8_t> data;
+    data.resize(450);
+
+    // the first two chunks are read directly into the output, the third one is split
+    ASSERT_TRUE(buffer.get_data(250, data.data()));
+    ASSERT_EQ(read_pointers.size(), 3u);
+    ASSERT_TRUE(read_pointers[0] == data.data());
+    ASSERT_TRUE(read_pointers[1] == data.data() + 100);
+    ASSERT_TRUE(read_pointers[2] != data.data() + 200);
+
+    // the rest of the split chunk comes from the buffer, then the whole chunks are read directly
+    // and the last chunk is smaller due to the remaining size
+    ASSERT_TRUE(buffer.get_data(200, data.data() + 250));
+    ASSERT_EQ(read_pointers.size(), 5u);
+    ASSERT_TRUE(read_pointers[3] == data.data() + 300);
+    ASSERT_TRUE(read_pointers[4] == data.data() + 400);
+
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        ASSERT_EQ(data[i], static_cast<std::uint8_t>(i));
+    }
+}
+
+void test_image_buffer_multi_chunk_reads()
+{
+    std::vector<std::size_t> requests;
+    std::vector<const std::uint8_t*> read_pointers;
+    std::uint8_t next_value = 0;
+
+    auto on_read = [&](std::size_t x, std::uint8_t* data)
+    {
+        requests.push_back(x);
+        read_pointers.push_back(data);
+        for (std::size_t i = 0; i < x; ++i) {
+            data[i] = next_value++;
+        }
+        return true;
+    };
+
+    ImageBuffer buffer{100, on_read};
+    buffer.set_multi_chunk_reads(true);
+
+    std::vector<std::uint8_t> data;
+    data.resize(600);
+
+    // all whole chunks are read at once, the split chunk goes through the buffer
+    ASSERT_TRUE(buffer.get_data(250, data.data()));
+    ASSERT_TRUE(buffer.get_data(350, data.data() + 250));
+
+    std::vector<std::size_t> expected_requests = { 200, 100, 300 };
+    ASSERT_EQ(requests, expected_requests);
+    ASSERT_TRUE(read_pointers[0] == data.data());
+    ASSERT_TRUE(read_pointers[2] == data.data() + 300);
+
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        ASSERT_EQ(data[i], static_cast<std::uint8_t>(i));
+    }
+}
+
+void test_prefetch_image_buffer_data()
+{
+    std::vector<std::size_t> requests;
+    std::uint8_t next_value = 0;
+
+    auto on_read = [&](std::size_t x, std::uint8_t* data)
+    {
+        requests.push_back(x);
+        for (std::size_t i = 0; i < x; ++i) {
+            data[i] = next_value++;
+        }
+        return true;
+    };
+
+    PrefetchImageBuffer buffer{1000, 2, on_read};
+    buffer.set_remaining_size(3500);
+    buffer.set_last_read_multiple(16);
+
+    std::vector<std::uint8_t> data;
+    data.resize(3500);
+
+    ASSERT_TRUE(buffer.get_data(700, data.data()));
+    ASSERT_TRUE(buffer.get_data(2000, data.data() + 700));
+    ASSERT_TRUE(buffer.get_data(800, data.data() + 2700));
+    ASSERT_FALSE(buffer.get_data(1, data.data()));
+
+    for (std::size_t i = 0; i < 3500; ++i) {
+        ASSERT_EQ(data[i], static_cast<std::uint8_t>(i));
+    }
+
+    std::vector<std::size_t> expected = {
+        // note that the last size is rounded-up to 16 bytes
+        1000, 1000, 1000, 512
+    };
+    ASSERT_EQ(requests, expected);
+}
+
+void test_prefetch_image_buffer_uncapped_remaining_bytes()
+{
+    unsigned request_count = 0;
+    auto on_read = [&](std::size_t x, std::uint8_t* data)
+    {
+        (void) data;
+        (void) x;
+        request_count++;
+        return request_count < 4;
+    };
+
+    PrefetchImageBuffer buffer{1000, 2, on_read};
+
+    std::vector<std::uint8_t> dummy;
+    dummy.resize(3000);
+
+    ASSERT_TRUE(buffer.get_data(3000, dummy.data()));
+    ASSERT_FALSE(buffer.get_data(3000, dummy.data()));
+    ASSERT_EQ(request_count, 4u);
+}
+
+void test_prefetch_image_buffer_exception()
+{
+    unsigned request_count = 0;
+    auto on_read = [&](std::size_t x, std::uint8_t* data)
+    {
+        (void) data;
+        (void) x;
+        if (++request_count == 2) {
+            throw SaneException(SANE_STATUS_IO_ERROR, "test error");
+        }
+        return true;
+    };
+
+    PrefetchImageBuffer buffer{1000, 2, on_read};
+    buffer.set_remaining_size(5000);
+
+    std::vector<std::uint8_t> dummy;
+    dummy.resize(1000);
+
+    ASSERT_TRUE(buffer.get_data(1000, dummy.data()));
+
+    bool got_exception = false;
+    try {
+        buffer.get_data(1000, dummy.data());
+    } catch (const SaneException& e) {
+        got_exception = true;
+        ASSERT_EQ(e.status(), SANE_STATUS_IO_ERROR);
+    }
+    ASSERT_TRUE(got_exception);
+}
+
+void test_prefetch_image_buffer_stop()
+{
+    std::atomic<unsigned> request_count{0};
+    auto on_read = [&](std::size_t x, std::uint8_t* data)
+    {
+        (void) data;
+        (void) x;
+        request_count++;
+        return true;
+    };
+
+    PrefetchImageBuffer buffer{1000, 2, on_read};
+
+    std::vector<std::uint8_t> dummy;
+    dummy.resize(1000);
+
+    ASSERT_TRUE(buffer.get_data(1000, dummy.data()));
+    buffer.stop();
+
+    // at most prefetch_count chunks may be read ahead of the consumer
+    unsigned count_after_stop = request_count;
+    ASSERT_TRUE(count_after_stop <= 3u);
+
+    // the already read chunks are still returned, but no new data is requested
+    while (buffer.get_data(1000, dummy.data())) {}
+    ASSERT_EQ(static_cast<unsigned>(request_count), count_after_stop);
+}
+
 void test_node_buffered_callable_source()
 {
     using Data = std::vector<std::uint8_t>;
@@ -211,6 +405,57 @@ void test_node_buffered_callable_source()
     ASSERT_EQ(curr_index, 12u);
 }
 
+void test_node_buffered_callable_source_prefetch()
+{
+    using Data = std::vector<std::uint8_t>;
+
+    Data in_data = {
+        0, 1, 2, 3,
+        4, 5, 6, 7,
+        8, 9, 10, 11
+    };
+
+    std::size_t chunk_size = 3;
+    std::size_t curr_index = 0;
+
+    // the callback runs on the prefetch thread, so the requests are only recorded there and
+    // checked after the thread has been stopped
+    std::vector<std::size_t> requests;
+
+    auto data_source_cb = [&](std::size_t size, std::uint8_t* out_data)
+    {
+        requests.push_back(size);
+        if (curr_index + size > in_data.size()) {
+            return false;
+        }
+        std::copy(in_data.begin() + curr_index,
+                  in_data.begin() + curr_index + size, out_data);
+        curr_index += size;
+        return true;
+    };
+
+    ImagePipelineStack stack;
+    auto& source = stack.push_first_node<ImagePipelineNodeBufferedCallableSource>(
+                4, 3, PixelFormat::I8, chunk_size, data_source_cb, 2);
+    source.set_remaining_bytes(in_data.size());
+
+    Data out_data;
+    out_data.resize(4);
+
+    ASSERT_TRUE(stack.get_next_row_data(out_data.data()));
+    ASSERT_EQ(out_data, Data({0, 1, 2, 3}));
+
+    ASSERT_TRUE(stack.get_next_row_data(out_data.data()));
+    ASSERT_EQ(out_data, Data({4, 5, 6, 7}));
+
+    ASSERT_TRUE(stack.get_next_row_data(out_data.data()));
+    ASSERT_EQ(out_data, Data({8, 9, 10, 11}));
+
+    source.stop_prefetch();
+    ASSERT_EQ(curr_index, 12u);
+    ASSERT_EQ(requests, std::vector<std::size_t>({3, 3, 3, 3}));
+}
+
 void test_node_format_convert()
 {
     using Data = std::vector<std::uint8_t>;
@@ -952,6 +1197,410 @@ void test_node_calibrate_16bit()
     ASSERT_EQ(out_data, expected_data);
 }
 
+// Builds calibration data that exercises clamping on both ends, halfway rounding cases and
+// degenerate (infinite and negative) multipliers
+static void make_calibrate_row_test_data(std::size_t count, std::vector<float>& offset,
+                                         std::vector<float>& multiplier)
+{
+    std::uint32_t seed = 12345;
+    auto next = [&]()
+    {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) & 0xffff;
+    };
+
+    offset.clear();
+    multiplier.clear();
+    for (std::size_t i = 0; i < count; ++i) {
+        std::uint16_t bottom = next() / 4;
+        std::uint16_t top = bottom + next() / 2;
+        switch (i % 16) {
+            case 3: top = bottom; break;
+            case 7: top = bottom / 2; break;
+            default: break;
+        }
+        offset.push_back(bottom / 65535.0f);
+        multiplier.push_back(65535.0f / (top - bottom));
+    }
+}
+
+void test_calibrate_row_simd_8bit()
+{
+    std::size_t count = 1000 * 3 + 7;
+    std::vector<float> offset;
+    std::vector<float> multiplier;
+    make_calibrate_row_test_data(count, offset, multiplier);
+
+    std::vector<std::uint8_t> input;
+    for (std::size_t i = 0; i < count; ++i) {
+        input.push_back((i * 7) % 256);
+    }
+
+    auto expected = input;
+    calibrate_row_8bit(expected.data(), count, offset.data(), multiplier.data(), SimdLevel::NONE);
+
+    for (auto level : get_supported_simd_levels()) {
+        auto data = input;
+        calibrate_row_8bit(data.data(), count, offset.data(), multiplier.data(), level);
+        ASSERT_EQ(data, expected);
+    }
+}
+
+void test_calibrate_row_simd_16bit()
+{
+    std::size_t count = 1000 * 3 + 7;
+    std::vector<float> offset;
+    std::vector<float> multiplier;
+    make_calibrate_row_test_data(count, offset, multiplier);
+
+    std::vector<std::uint8_t> input;
+    for (std::size_t i = 0; i < count; ++i) {
+        std::uint16_t value = (i * 4099) % 65536;
+        input.push_back(value & 0xff);
+        input.push_back(value >> 8);
+    }
+
+    auto expected = input;
+    calibrate_row_16bit(expected.data(), count, offset.data(), multiplier.data(),
+                        SimdLevel::NONE);
+
+    for (auto level : get_supported_simd_levels()) {
+        auto data = input;
+        calibrate_row_16bit(data.data(), count, offset.data(), multiplier.data(), level);
+        ASSERT_EQ(data, expected);
+    }
+}
+
+static std::vector<std::uint8_t> get_parallel_rows_test_output(unsigned thread_count,
+                                                               bool with_stateful_node)
+{
+    std::size_t width = 2000;
+    std::size_t height = 200;
+    std::size_t row_bytes = get_pixel_row_bytes(PixelFormat::RGB161616, width);
+
+    std::vector<std::uint8_t> in_data;
+    in_data.resize(row_bytes * height);
+    std::uint32_t state = 1;
+    for (auto& value : in_data) {
+        state = state * 1103515245 + 12345;
+        value = static_cast<std::uint8_t>(state >> 16);
+    }
+
+    std::vector<std::uint16_t> bottom(width * 3, 0x1000);
+    std::vector<std::uint16_t> top(width * 3, 0xe000);
+
+    ImagePipelineStack stack;
+    stack.set_thread_count(thread_count);
+    stack.push_first_node<ImagePipelineNodeArraySource>(width, height, PixelFormat::RGB161616,
+                                                        std::move(in_data));
+    stack.push_node<ImagePipelineNodeSwap16BitEndian>();
+    stack.push_node<ImagePipelineNodeInvert>();
+    if (with_stateful_node) {
+        stack.push_node<ImagePipelineNodeComponentShiftLines>(0, 1, 2);
+    }
+    stack.push_node<ImagePipelineNodeCalibrate>(bottom, top, 0);
+    stack.push_node<ImagePipelineNodeMergeColorToGray>();
+    stack.push_node<ImagePipelineNodeFormatConvert>(PixelFormat::I8);
+    stack.push_node<ImagePipelineNodeScaleRows>(1500);
+
+    ASSERT_EQ(stack.get_output_width(), 1500u);
+    ASSERT_EQ(stack.get_output_format(), PixelFormat::I8);
+
+    return stack.get_all_data();
+}
+
+void test_node_parallel_rows()
+{
+    for (bool with_stateful_node : { false, true }) {
+        auto expected = get_parallel_rows_test_output(1, with_stateful_node);
+        for (unsigned thread_count : { 2, 3, 4 }) {
+            auto data = get_parallel_rows_test_output(thread_count, with_stateful_node);
+            ASSERT_TRUE(data == expected);
+        }
+    }
+}
+
+void test_node_parallel_rows_split_by_other_nodes()
+{
+    using Data = std::vector<std::uint8_t>;
+
+    Data in_data = {
+        0x10, 0x20, 0x30, 0x40,
+        0x50, 0x60, 0x70, 0x80,
+        0x90, 0xa0, 0xb0, 0xc0,
+    };
+
+    ImagePipelineStack stack;
+    stack.set_thread_count(2);
+    stack.push_first_node<ImagePipelineNodeArraySource>(4, 3, PixelFormat::I8,
+                                                        std::move(in_data));
+    stack.push_node<ImagePipelineNodeInvert>();
+    stack.push_node<ImagePipelineNodeFormatConvert>(PixelFormat::I16);
+    stack.push_node<ImagePipelineNodeExtract>(0, 0, 4, 3);
+    stack.push_node<ImagePipelineNodeInvert>();
+
+    auto out_data = stack.get_all_data();
+
+    Data expected_data = {
+        0x10, 0x10, 0x20, 0x20, 0x30, 0x30, 0x40, 0x40,
+        0x50, 0x50, 0x60, 0x60, 0x70, 0x70, 0x80, 0x80,
+        0x90, 0x90, 0xa0, 0xa0, 0xb0, 0xb0, 0xc0, 0xc0,
+    };
+    ASSERT_EQ(out_data, expected_data);
+}
+
+enum class FusedRowsTestChain
+{
+    // transforms that change the format and width
+    CONVERT,
+    // transforms that change the format and width with a stateful node in between
+    CONVERT_WITH_SHIFT,
+    // transforms that can all be applied in place
+    IN_PLACE,
+    // in place transforms that follow a transform that copies the data
+    COPY_THEN_IN_PLACE,
+};
+
+// If rows_per_read is not zero, the first row is read alone and the rest in groups of up to
+// rows_per_read rows at once
+static std::vector<std::uint8_t> get_fused_rows_test_output(FusedRowsTestChain chain,
+                                                            bool fusion, unsigned thread_count,
+                                                            std::size_t rows_per_read = 0)
+{
+    std::size_t width = 2000;
+    std::size_t height = 200;
+    std::size_t row_bytes = get_pixel_row_bytes(PixelFormat::RGB161616, width);
+
+    std::vector<std::uint8_t> in_data;
+    in_data.resize(row_bytes * height);
+    std::uint32_t state = 1;
+    for (auto& value : in_data) {
+        state = state * 1103515245 + 12345;
+        value = static_cast<std::uint8_t>(state >> 16);
+    }
+
+    std::vector<std::uint16_t> bottom(width * 3, 0x1000);
+    std::vector<std::uint16_t> top(width * 3, 0xe000);
+
+    ImagePipelineStack stack;
+    stack.set_fusion_enabled(fusion);
+    stack.set_thread_count(thread_count);
+    stack.push_first_node<ImagePipelineNodeArraySource>(width, height, PixelFormat::RGB161616,
+                                                        std::move(in_data));
+    switch (chain) {
+        case FusedRowsTestChain::CONVERT:
+        case FusedRowsTestChain::CONVERT_WITH_SHIFT:
+            stack.push_node<ImagePipelineNodeSwap16BitEndian>();
+            stack.push_node<ImagePipelineNodeInvert>();
+            if (chain == FusedRowsTestChain::CONVERT_WITH_SHIFT) {
+                stack.push_node<ImagePipelineNodeComponentShiftLines>(0, 1, 2);
+            }
+            stack.push_node<ImagePipelineNodeCalibrate>(bottom, top, 0);
+            stack.push_node<ImagePipelineNodeMergeColorToGray>();
+            stack.push_node<ImagePipelineNodeFormatConvert>(PixelFormat::I8);
+            stack.push_node<ImagePipelineNodeScaleRows>(1500);
+            break;
+        case FusedRowsTestChain::IN_PLACE:
+            stack.push_node<ImagePipelineNodeSwap16BitEndian>();
+            stack.push_node<ImagePipelineNodeInvert>();
+            stack.push_node<ImagePipelineNodeCalibrate>(bottom, top, 0);
+            break;
+        case FusedRowsTestChain::COPY_THEN_IN_PLACE:
+            stack.push_node<ImagePipelineNodeFormatConvert>(PixelFormat::BGR888);
+            stack.push_node<ImagePipelineNodeInvert>();
+            stack.push_node<ImagePipelineNodeCalibrate>(bottom, top, 0);
+            break;
+    }
+
+    if (rows_per_read == 0) {
+        return stack.get_all_data();
+    }
+
+    auto out_row_bytes = stack.get_output_row_bytes();
+    auto out_height = stack.get_output_height();
+    std::vector<std::uint8_t> out_data(out_row_bytes * out_height);
+
+    stack.get_next_row_data(out_data.data());
+    for (std::size_t row = 1; row < out_height; row += rows_per_read) {
+        auto count = std::min(rows_per_read, out_height - row);
+        stack.get_next_rows_data(count, out_data.data() + row * out_row_bytes);
+    }
+    return out_data;
+}
+
+void test_node_fused_rows()
+{
+    for (auto chain : { FusedRowsTestChain::CONVERT, FusedRowsTestChain::CONVERT_WITH_SHIFT,
+                        FusedRowsTestChain::IN_PLACE, FusedRowsTestChain::COPY_THEN_IN_PLACE })
+    {
+        auto expected = get_fused_rows_test_output(chain, false, 1);
+        for (unsigned thread_count : { 1, 2, 3, 4 }) {
+            auto data = get_fused_rows_test_output(chain, true, thread_count);
+            ASSERT_TRUE(data == expected);
+        }
+    }
+}
+
+void test_node_fused_rows_multiple_rows()
+{
+    for (auto chain : { FusedRowsTestChain::CONVERT, FusedRowsTestChain::CONVERT_WITH_SHIFT,
+                        FusedRowsTestChain::IN_PLACE, FusedRowsTestChain::COPY_THEN_IN_PLACE })
+    {
+        auto expected = get_fused_rows_test_output(chain, false, 1);
+        for (unsigned thread_count : { 1, 3 }) {
+            // reads smaller than, equal to and larger than a batch
+            for (std::size_t rows_per_read : { 7, 199, 500 }) {
+                auto data = get_fused_rows_test_output(chain, true, thread_count, rows_per_read);
+                ASSERT_TRUE(data == expected);
+            }
+        }
+    }
+}
+
+void test_image_pipeline_stack_profiling()
+{
+    using Data = std::vector<std::uint8_t>;
+
+    for (bool fusion : { false, true }) {
+        Data in_data = {
+            0x10, 0x20, 0x30, 0x40,
+            0x50, 0x60, 0x70, 0x80,
+            0x90, 0xa0, 0xb0, 0xc0,
+        };
+
+        ImagePipelineStack stack;
+        stack.set_fusion_enabled(fusion);
+        stack.set_profiling_enabled(true);
+        stack.push_first_node<ImagePipelineNodeArraySource>(4, 3, PixelFormat::I8,
+                                                            std::move(in_data));
+        stack.push_node<ImagePipelineNodeInvert>();
+        stack.push_node<ImagePipelineNodeFormatConvert>(PixelFormat::I16);
+        stack.push_node<ImagePipelineNodeExtract>(0, 0, 4, 3);
+
+        auto out_data = stack.get_all_data();
+
+        Data expected_data = {
+            0xef, 0xef, 0xdf, 0xdf, 0xcf, 0xcf, 0xbf, 0xbf,
+            0xaf, 0xaf, 0x9f, 0x9f, 0x8f, 0x8f, 0x7f, 0x7f,
+            0x6f, 0x6f, 0x5f, 0x5f, 0x4f, 0x4f, 0x3f, 0x3f,
+        };
+        ASSERT_EQ(out_data, expected_data);
+
+        auto stats = stack.get_stage_stats();
+
+        std::vector<std::string> expected_names;
+        if (fusion) {
+            expected_names = { "ArraySource", "FusedRows(Invert,FormatConvert)", "Extract" };
+        } else {
+            expected_names = { "ArraySource", "Invert", "FormatConvert", "Extract" };
+        }
+        ASSERT_EQ(stats.size(), expected_names.size());
+
+        std::uint64_t self_ns_sum = 0;
+        for (std::size_t i = 0; i < stats.size(); ++i) {
+            ASSERT_EQ(stats[i].name, expected_names[i]);
+            ASSERT_EQ(stats[i].rows, 3u);
+            ASSERT_TRUE(stats[i].self_ns <= stats[i].total_ns);
+            self_ns_sum += stats[i].self_ns;
+        }
+        ASSERT_EQ(stats.front().bytes, 12u);
+        ASSERT_EQ(stats.back().bytes, 24u);
+        ASSERT_EQ(self_ns_sum, stats.back().total_ns);
+
+        auto table = format_pipeline_stage_stats(stats);
+        for (const auto& name : expected_names) {
+            ASSERT_TRUE(table.find(name) != std::string::npos);
+        }
+    }
+
+    ImagePipelineStack stack;
+    stack.push_first_node<ImagePipelineNodeArraySource>(1, 1, PixelFormat::I8, Data{0x10});
+    stack.get_all_data();
+    ASSERT_TRUE(stack.get_stage_stats().empty());
+}
+
+// Records whether the rows were requested one at a time or in batches
+class RowsCallCounterNode : public ImagePipelineNode
+{
+public:
+    std::size_t get_width() const override { return 4; }
+    std::size_t get_height() const override { return 6; }
+    PixelFormat get_format() const override { return PixelFormat::I8; }
+
+    bool eof() const override { return false; }
+
+    bool get_next_row_data(std::uint8_t* out_data) override
+    {
+        single_calls++;
+        std::fill(out_data, out_data + get_row_bytes(), 0x10);
+        return true;
+    }
+
+    bool get_next_rows_data(std::size_t count, std::uint8_t* out_data) override
+    {
+        batch_calls++;
+        std::fill(out_data, out_data + count * get_row_bytes(), 0x20);
+        return true;
+    }
+
+    unsigned single_calls = 0;
+    unsigned batch_calls = 0;
+};
+
+void test_node_profile_rows()
+{
+    RowsCallCounterNode source;
+    ImagePipelineNodeProfile profile{source};
+
+    std::vector<std::uint8_t> out_data(6 * 4);
+    ASSERT_TRUE(profile.get_next_row_data(out_data.data()));
+    ASSERT_TRUE(profile.get_next_rows_data(5, out_data.data() + 4));
+
+    ASSERT_EQ(source.single_calls, 1u);
+    ASSERT_EQ(source.batch_calls, 1u);
+    ASSERT_EQ(out_data[3], 0x10);
+    ASSERT_EQ(out_data[4], 0x20);
+    ASSERT_EQ(out_data[23], 0x20);
+
+    ASSERT_EQ(profile.get_stats().rows, 6u);
+    ASSERT_EQ(profile.get_stats().bytes, 24u);
+}
+
+void test_thread_pool()
+{
+    ThreadPool pool{4};
+    ASSERT_EQ(pool.thread_count(), 4u);
+
+    for (std::size_t count : { 0u, 1u, 3u, 100u }) {
+        std::vector<std::atomic<unsigned>> calls(count);
+        for (auto& c : calls) {
+            c = 0;
+        }
+        pool.parallel_for(count, [&](std::size_t i) { calls[i]++; });
+        for (auto& c : calls) {
+            ASSERT_EQ(static_cast<unsigned>(c), 1u);
+        }
+    }
+
+    bool got_exception = false;
+    try {
+        pool.parallel_for(10, [&](std::size_t i)
+        {
+            if (i == 5) {
+                throw SaneException("test error");
+            }
+        });
+    } catch (const SaneException&) {
+        got_exception = true;
+    }
+    ASSERT_TRUE(got_exception);
+
+    // the pool must remain usable after an exception
+    std::atomic<unsigned> total{0};
+    pool.parallel_for(10, [&](std::size_t) { total++; });
+    ASSERT_EQ(static_cast<unsigned>(total), 10u);
+}
+
 void test_image_pipeline()
 {
     test_image_buffer_exact_reads();
@@ -959,7 +1608,14 @@ void test_image_pipeline()
     test_image_buffer_larger_reads();
     test_image_buffer_uncapped_remaining_bytes();
     test_image_buffer_capped_remaining_bytes();
+    test_image_buffer_direct_reads();
+    test_image_buffer_multi_chunk_reads();
+    test_prefetch_image_buffer_data();
+    test_prefetch_image_buffer_uncapped_remaining_bytes();
+    test_prefetch_image_buffer_exception();
+    test_prefetch_image_buffer_stop();
     test_node_buffered_callable_source();
+    test_node_buffered_callable_source_prefetch();
     test_node_format_convert();
     test_node_desegment_1_line();
     test_node_deinterleave_lines_i8();
@@ -982,6 +1638,15 @@ void test_image_pipeline()
     test_node_pixel_shift_columns_compute_max_width();
     test_node_calibrate_8bit();
     test_node_calibrate_16bit();
+    test_calibrate_row_simd_8bit();
+    test_calibrate_row_simd_16bit();
+    test_node_parallel_rows();
+    test_node_parallel_rows_split_by_other_nodes();
+    test_node_fused_rows();
+    test_node_fused_rows_multiple_rows();
+    test_image_pipeline_stack_profiling();
+    test_node_profile_rows();
+    test_thread_pool();
 }
 
 } // namespace genesys
@@ -0,0 +1,217 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define DEBUG_DECLARE_ONLY
+
+#include "tests.h"
+#include "tests_printers.h"
+#include "minigtest.h"
+
+#include "../../../backend/genesys/device.h"
+#include "../../../backend/genesys/low.h"
+#include "../../../backend/genesys/scanner_interface_usb.h"
+#include "../../../backend/genesys/test_usb_device.h"
+
+namespace genesys {
+
+struct UsbTransfer
+{
+    bool is_bulk = false;
+    int rtype = 0;
+    int reg = 0;
+    int value = 0;
+    int index = 0;
+    std::vector<std::uint8_t> data;
+};
+
+// Records the transfers instead of sending them to a device
+class RecordingUsbDevice : public TestUsbDevice
+{
+public:
+    RecordingUsbDevice(std::vector<UsbTransfer>& transfers) :
+        TestUsbDevice{0, 0, 0},
+        transfers_{transfers}
+    {}
+
+    void control_msg(int rtype, int reg, int value, int index, int length,
+                     std::uint8_t* data) override
+    {
+        UsbTransfer transfer;
+        transfer.rtype = rtype;
+        transfer.reg = reg;
+        transfer.value = value;
+        transfer.index = index;
+        transfer.data.assign(data, data + length);
+        transfers_.push_back(transfer);
+    }
+
+    void bulk_write(const std::uint8_t* buffer, std::size_t* size) override
+    {
+        UsbTransfer transfer;
+        transfer.is_bulk = true;
+        transfer.data.assign(buffer, buffer + *size);
+        transfers_.push_back(transfer);
+    }
+
+private:
+    std::vector<UsbTransfer>& transfers_;
+};
+
+class ScannerInterfaceUsbTester
+{
+public:
+    ScannerInterfaceUsbTester(AsicType asic_type)
+    {
+        model_.asic_type = asic_type;
+        dev_.model = &model_;
+        iface_.reset(new ScannerInterfaceUsb{
+                         &dev_, std::unique_ptr<IUsbDevice>{new RecordingUsbDevice{transfers_}}});
+    }
+
+    ScannerInterfaceUsb& iface() { return *iface_; }
+
+    // Returns the transfers since the last call
+    std::vector<UsbTransfer> take_transfers()
+    {
+        auto transfers = transfers_;
+        transfers_.clear();
+        return transfers;
+    }
+
+private:
+    Genesys_Model model_;
+    Genesys_Device dev_;
+    std::vector<UsbTransfer> transfers_;
+    std::unique_ptr<ScannerInterfaceUsb> iface_;
+};
+
+static void check_register_batch(const UsbTransfer& transfer, int usb_value,
+                                 const std::vector<std::uint8_t>& expected_data)
+{
+    ASSERT_FALSE(transfer.is_bulk);
+    ASSERT_EQ(transfer.rtype, REQUEST_TYPE_OUT);
+    ASSERT_EQ(transfer.reg, REQUEST_BUFFER);
+    ASSERT_EQ(transfer.value, usb_value);
+    ASSERT_EQ(transfer.index, INDEX);
+    ASSERT_EQ(transfer.data, expected_data);
+}
+
+static void check_register_transfer(const UsbTransfer& transfer, int usb_value,
+                                    std::uint8_t expected_data)
+{
+    ASSERT_FALSE(transfer.is_bulk);
+    ASSERT_EQ(transfer.rtype, REQUEST_TYPE_OUT);
+    ASSERT_EQ(transfer.reg, REQUEST_REGISTER);
+    ASSERT_EQ(transfer.value, usb_value);
+    ASSERT_EQ(transfer.index, INDEX);
+    ASSERT_EQ(transfer.data, std::vector<std::uint8_t>({ expected_data }));
+}
+
+void test_scanner_interface_usb_register_batches()
+{
+    ScannerInterfaceUsbTester tester{AsicType::GL841};
+
+    Genesys_Register_Set regs;
+    std::vector<std::uint8_t> expected_first;
+    std::vector<std::uint8_t> expected_second;
+    for (unsigned address = 0x10; address < 0x38; address++) {
+        regs.init_reg(address, address + 1);
+        auto& expected = address < 0x30 ? expected_first : expected_second;
+        expected.push_back(address);
+        expected.push_back(address + 1);
+    }
+
+    tester.iface().write_registers(regs);
+    auto transfers = tester.take_transfers();
+    ASSERT_EQ(transfers.size(), 2u);
+    check_register_batch(transfers[0], VALUE_SET_REGISTER, expected_first);
+    check_register_batch(transfers[1], VALUE_SET_REGISTER, expected_second);
+
+    // unchanged registers are written again
+    tester.iface().write_registers(regs);
+    transfers = tester.take_transfers();
+    ASSERT_EQ(transfers.size(), 2u);
+    check_register_batch(transfers[0], VALUE_SET_REGISTER, expected_first);
+    check_register_batch(transfers[1], VALUE_SET_REGISTER, expected_second);
+}
+
+void test_scanner_interface_usb_register_batches_gl646()
+{
+    ScannerInterfaceUsbTester tester{AsicType::GL646};
+
+    Genesys_Register_Set regs;
+    regs.init_reg(0x10, 0x01);
+    regs.init_reg(0x11, 0x02);
+    regs.init_reg(0x41, 0x03);
+
+    tester.iface().write_registers(regs);
+    auto transfers = tester.take_transfers();
+    ASSERT_EQ(transfers.size(), 2u);
+    ASSERT_FALSE(transfers[0].is_bulk);
+    ASSERT_EQ(transfers[0].rtype, REQUEST_TYPE_OUT);
+    ASSERT_EQ(transfers[0].reg, REQUEST_BUFFER);
+    ASSERT_EQ(transfers[0].value, VALUE_BUFFER);
+    ASSERT_EQ(transfers[0].index, INDEX);
+    ASSERT_EQ(transfers[0].data, std::vector<std::uint8_t>({ BULK_OUT, BULK_REGISTER, 0x00, 0x00,
+                                                             0x06, 0x00, 0x00, 0x00 }));
+    ASSERT_TRUE(transfers[1].is_bulk);
+    ASSERT_EQ(transfers[1].data, std::vector<std::uint8_t>({ 0x10, 0x01, 0x11, 0x02,
+                                                             0x41, 0x03 }));
+}
+
+void test_scanner_interface_usb_register_writes_gl843()
+{
+    ScannerInterfaceUsbTester tester{AsicType::GL843};
+
+    Genesys_Register_Set regs;
+    regs.init_reg(0x05, 0x01);
+    regs.init_reg(0x10, 0x02);
+
+    tester.iface().write_registers(regs);
+    auto transfers = tester.take_transfers();
+    ASSERT_EQ(transfers.size(), 4u);
+    check_register_transfer(transfers[0], VALUE_SET_REGISTER, 0x05);
+    check_register_transfer(transfers[1], VALUE_WRITE_REGISTER, 0x01);
+    check_register_transfer(transfers[2], VALUE_SET_REGISTER, 0x10);
+    check_register_transfer(transfers[3], VALUE_WRITE_REGISTER, 0x02);
+}
+
+void test_scanner_interface_usb_register_writes_gl124()
+{
+    ScannerInterfaceUsbTester tester{AsicType::GL124};
+
+    Genesys_Register_Set regs;
+    regs.init_reg(0x10, 0x01);
+    regs.init_reg(0x101, 0x03);
+
+    tester.iface().write_registers(regs);
+    auto transfers = tester.take_transfers();
+    ASSERT_EQ(transfers.size(), 2u);
+    check_register_batch(transfers[0], VALUE_SET_REGISTER, { 0x10, 0x01 });
+    check_register_batch(transfers[1], VALUE_SET_REGISTER | 0x100, { 0x01, 0x03 });
+}
+
+void test_scanner_interface()
+{
+    test_scanner_interface_usb_register_batches();
+    test_scanner_interface_usb_register_batches_gl646();
+    test_scanner_interface_usb_register_writes_gl843();
+    test_scanner_interface_usb_register_writes_gl124();
+}
+
+} // namespace genesys
@@ -0,0 +1,214 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Measures how much reading scan data ahead of the image pipeline helps. The data is read
+// through TestUsbDevice, with each bulk transfer taking as long as it would on a bus of the given
+// speed, and each row is processed for as long as the pipeline would take at the given speed. The
+// scan is timed without prefetching and with each of the given prefetch counts.
+
+#define DEBUG_DECLARE_ONLY
+
+#include "../../../backend/genesys/image_pipeline.h"
+#include "../../../backend/genesys/test_usb_device.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchmarkSettings
+{
+    std::size_t scan_bytes = 64 * 1024 * 1024;
+    std::size_t row_bytes = 5100 * 3;
+    std::size_t chunk_bytes = 512 * 1024;
+    // the largest size of a single bulk transfer, as in ScannerInterfaceUsb::bulk_read_data
+    std::size_t max_transfer_bytes = 0xeff0;
+    double usb_mb_per_second = 30;
+    double pipeline_mb_per_second = 30;
+    unsigned iterations = 3;
+    std::vector<std::size_t> prefetch_counts = { 1, 2, 4 };
+};
+
+// A test device that takes as long to transfer the data as a real bus would
+class TimedUsbDevice : public genesys::TestUsbDevice
+{
+public:
+    TimedUsbDevice(double mb_per_second) :
+        genesys::TestUsbDevice{0x04a9, 0x1906, 0x0000},
+        mb_per_second_{mb_per_second}
+    {}
+
+    void bulk_read(std::uint8_t* buffer, std::size_t* size) override
+    {
+        auto end = Clock::now() + std::chrono::duration<double>(*size / mb_per_second_ / 1e6);
+        genesys::TestUsbDevice::bulk_read(buffer, size);
+        std::this_thread::sleep_until(end);
+    }
+
+private:
+    double mb_per_second_ = 0;
+};
+
+// Keeps the CPU busy for the given time, like the pipeline nodes would
+static void process_for(std::chrono::duration<double> duration, std::uint8_t* data,
+                        std::size_t size)
+{
+    auto end = Clock::now() + duration;
+    std::uint8_t sum = 0;
+    do {
+        for (std::size_t i = 0; i < size; ++i) {
+            sum += data[i];
+        }
+    } while (Clock::now() < end);
+    data[0] = sum;
+}
+
+static double time_scan(const BenchmarkSettings& settings, std::size_t prefetch_count)
+{
+    TimedUsbDevice usb_dev{settings.usb_mb_per_second};
+    usb_dev.open("test");
+
+    auto read_data = [&](std::size_t size, std::uint8_t* data)
+    {
+        while (size > 0) {
+            std::size_t transfer_size = std::min(size, settings.max_transfer_bytes);
+            usb_dev.bulk_read(data, &transfer_size);
+            data += transfer_size;
+            size -= transfer_size;
+        }
+        return true;
+    };
+
+    std::size_t rows = settings.scan_bytes / settings.row_bytes;
+
+    genesys::ImagePipelineStack pipeline;
+    auto& source = pipeline.push_first_node<genesys::ImagePipelineNodeBufferedCallableSource>(
+                settings.row_bytes, rows, genesys::PixelFormat::I8, settings.chunk_bytes,
+                read_data, prefetch_count);
+    source.set_remaining_bytes(rows * settings.row_bytes);
+
+    std::vector<std::uint8_t> row(settings.row_bytes);
+    std::chrono::duration<double> row_time{settings.row_bytes / settings.pipeline_mb_per_second
+                                           / 1e6};
+
+    auto begin = Clock::now();
+    for (std::size_t i = 0; i < rows; ++i) {
+        pipeline.get_next_row_data(row.data());
+        process_for(row_time, row.data(), row.size());
+    }
+    auto end = Clock::now();
+
+    source.stop_prefetch();
+    usb_dev.close();
+    return std::chrono::duration<double>(end - begin).count();
+}
+
+static double best_time(const BenchmarkSettings& settings, std::size_t prefetch_count)
+{
+    double best = 0;
+    for (unsigned i = 0; i < settings.iterations; ++i) {
+        double seconds = time_scan(settings, prefetch_count);
+        if (i == 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+static std::vector<std::size_t> parse_counts(const std::string& str)
+{
+    std::vector<std::size_t> counts;
+    std::size_t pos = 0;
+    while (pos < str.size()) {
+        std::size_t next = str.find(',', pos);
+        if (next == std::string::npos) {
+            next = str.size();
+        }
+        counts.push_back(std::max(std::stoi(str.substr(pos, next - pos)), 1));
+        pos = next + 1;
+    }
+    return counts;
+}
+
+static void print_help()
+{
+    std::cerr << "Usage:\n"
+              << "usb_prefetch_benchmark [--scan-mb={size}] [--row-bytes={size}]\n"
+              << "                       [--chunk-kb={size}] [--usb-mbps={speed}]\n"
+              << "                       [--pipeline-mbps={speed}] [--iterations={count}]\n"
+              << "                       [--prefetch={count},...]\n"
+              << "usb_prefetch_benchmark --help\n"
+              << "\n"
+              << "Speeds are in MB/s. By default a 64 MB scan is read at 30 MB/s and processed\n"
+              << "at 30 MB/s, with 1, 2 and 4 chunks read ahead.\n";
+}
+
+int main(int argc, const char* argv[])
+{
+    BenchmarkSettings settings;
+
+    for (int argi = 1; argi < argc; ++argi) {
+        std::string arg = argv[argi];
+        if (arg.rfind("--scan-mb=", 0) == 0) {
+            settings.scan_bytes = std::max(std::stoi(arg.substr(10)), 1) * 1024 * 1024;
+        } else if (arg.rfind("--row-bytes=", 0) == 0) {
+            settings.row_bytes = std::max(std::stoi(arg.substr(12)), 1);
+        } else if (arg.rfind("--chunk-kb=", 0) == 0) {
+            settings.chunk_bytes = std::max(std::stoi(arg.substr(11)), 1) * 1024;
+        } else if (arg.rfind("--usb-mbps=", 0) == 0) {
+            settings.usb_mb_per_second = std::max(std::stod(arg.substr(11)), 0.1);
+        } else if (arg.rfind("--pipeline-mbps=", 0) == 0) {
+            settings.pipeline_mb_per_second = std::max(std::stod(arg.substr(16)), 0.1);
+        } else if (arg.rfind("--iterations=", 0) == 0) {
+            settings.iterations = std::max(std::stoi(arg.substr(13)), 1);
+        } else if (arg.rfind("--prefetch=", 0) == 0) {
+            settings.prefetch_counts = parse_counts(arg.substr(11));
+        } else if (arg == "-h" || arg == "--help") {
+            print_help();
+            return 0;
+        } else {
+            print_help();
+            return 1;
+        }
+    }
+
+    try {
+        std::size_t rows = settings.scan_bytes / settings.row_bytes;
+        double mb = rows * settings.row_bytes / 1e6;
+        double sync_seconds = best_time(settings, 0);
+
+        std::cerr << std::fixed << std::setprecision(1)
+                  << "no prefetch: " << std::setw(7) << mb / sync_seconds << " MB/s\n";
+
+        for (auto prefetch_count : settings.prefetch_counts) {
+            double seconds = best_time(settings, prefetch_count);
+            std::cerr << "prefetch " << prefetch_count << ":  "
+                      << std::setw(7) << mb / seconds << " MB/s, "
+                      << std::setprecision(2) << sync_seconds / seconds << "x\n"
+                      << std::setprecision(1);
+        }
+    } catch (const std::exception& exc) {
+        std::cerr << "FAIL: " << exc.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,332 @@
+#include "../../include/sane/config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+#include <sys/time.h>
+
+/* sane includes for the sanei functions called */
+#include "../../include/sane/sane.h"
+#include "../../include/sane/sanei_ir.h"
+
+/* a 16 bit infrared plane with dust and scratches */
+#define WIDTH 1201
+#define HEIGHT 901
+
+static double
+now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static SANE_Uint *
+make_image (SANE_Parameters * params)
+{
+  SANE_Uint *image;
+  int x, y;
+
+  params->format = SANE_FRAME_GRAY;
+  params->last_frame = SANE_TRUE;
+  params->depth = 16;
+  params->pixels_per_line = WIDTH;
+  params->bytes_per_line = WIDTH * 2;
+  params->lines = HEIGHT;
+
+  image = malloc (WIDTH * HEIGHT * sizeof (SANE_Uint));
+  assert (image != NULL);
+
+  srand (16);
+  for (y = 0; y < HEIGHT; y++)
+    for (x = 0; x < WIDTH; x++)
+      {
+	int val = 40000 + 8000 * sin (x / 97.0) + rand () % 2000;
+
+	if (rand () % 500 == 0 || (x + 3 * y) % 613 < 4)
+	  val = rand () % 10000;
+	image[y * WIDTH + x] = val;
+      }
+
+  return image;
+}
+
+/* the mean filter as it was before it was split among threads,
+ * to check results and speed against */
+static void
+ref_filter_mean (const SANE_Uint * in_img, SANE_Uint * out_img,
+		 int num_cols, int num_rows, int win_rows, int win_cols)
+{
+  const SANE_Uint *src;
+  SANE_Uint *dest = out_img;
+  int itop, iadd, isub;
+  int ndiv, the_sum;
+  int nrow, ncol;
+  int hwr = win_rows / 2, hwc = win_cols / 2;
+  int *sum = malloc (num_cols * sizeof (int));
+  int i, j;
+
+  assert (sum != NULL);
+  for (j = 0; j < num_cols; j++)
+    {
+      sum[j] = 0;
+      src = in_img + j;
+      for (i = 0; i < hwr; i++)
+	{
+	  sum[j] += *src;
+	  src += num_cols;
+	}
+    }
+
+  itop = num_rows * num_cols;
+  iadd = hwr * num_cols;
+  isub = (hwr - win_rows) * num_cols;
+  nrow = hwr;
+
+  for (i = 0; i < num_rows; i++)
+    {
+      if (isub >= 0)
+	{
+	  nrow--;
+	  src = in_img + isub;
+	  for (j = 0; j < num_cols; j++)
+	    sum[j] -= *src++;
+	}
+      isub += num_cols;
+
+      if (iadd < itop)
+	{
+	  nrow++;
+	  src = in_img + iadd;
+	  for (j = 0; j < num_cols; j++)
+	    sum[j] += *src++;
+	}
+      iadd += num_cols;
+
+      the_sum = 0;
+      for (j = 0; j < hwc; j++)
+	the_sum += sum[j];
+      ncol = hwc;
+
+      for (j = hwc; j < win_cols; j++)
+	{
+	  ncol++;
+	  the_sum += sum[j];
+	  *dest++ = the_sum / (ncol * nrow);
+	}
+
+      ndiv = ncol * nrow;
+      for (j = 0; j < num_cols - win_cols; j++)
+	{
+	  the_sum -= sum[j];
+	  the_sum += sum[j + win_cols];
+	  *dest++ = the_sum / ndiv;
+	}
+
+      for (j = num_cols - win_cols; j < num_cols - hwc - 1; j++)
+	{
+	  ncol--;
+	  the_sum -= sum[j];
+	  *dest++ = the_sum / (ncol * nrow);
+	}
+    }
+  free (sum);
+}
+
+/* the noise map of sanei_ir_filter_madmean before it was split */
+static void
+ref_filter_madmean (const SANE_Uint * in_img, SANE_Uint * out_img,
+		    int win_size, int a_val, int b_val)
+{
+  int itop = WIDTH * HEIGHT;
+  SANE_Uint *delta_ij = malloc (itop * sizeof (SANE_Uint));
+  SANE_Uint *mad_ij = malloc (itop * sizeof (SANE_Uint));
+  double ab_term;
+  int threshold, i;
+
+  assert (delta_ij != NULL && mad_ij != NULL);
+  a_val <<= 8;
+  b_val <<= 8;
+
+  ref_filter_mean (in_img, delta_ij, WIDTH, HEIGHT, win_size, win_size);
+  for (i = 0; i < itop; i++)
+    delta_ij[i] = abs (in_img[i] - delta_ij[i]);
+  win_size = MAD_WIN2_SIZE (win_size);
+  ref_filter_mean (delta_ij, mad_ij, WIDTH, HEIGHT, win_size, win_size);
+
+  ab_term = (b_val - a_val) / (double) b_val;
+  for (i = 0; i < itop; i++)
+    {
+      if (mad_ij[i] >= b_val)
+	threshold = a_val;
+      else
+	threshold = a_val + (double) mad_ij[i] * ab_term;
+      out_img[i] = delta_ij[i] >= threshold ? 0 : 255;
+    }
+
+  free (mad_ij);
+  free (delta_ij);
+}
+
+/** mean filter must match the single threaded version
+ * @return 1 on success, else 0
+ */
+static int
+test_filter_mean (SANE_Uint * image, SANE_Parameters * params,
+		  const char *threads, int win_rows, int win_cols)
+{
+  SANE_Uint *expected, *out;
+  size_t size = WIDTH * HEIGHT * sizeof (SANE_Uint);
+  double ref_time, time;
+  int ok = 1;
+
+  expected = malloc (size);
+  out = malloc (size);
+  assert (expected != NULL && out != NULL);
+
+  ref_time = now ();
+  ref_filter_mean (image, expected, WIDTH, HEIGHT, win_rows, win_cols);
+  ref_time = now () - ref_time;
+
+  setenv ("SANE_IR_THREADS", threads, 1);
+  time = now ();
+  if (sanei_ir_filter_mean (params, image, out, win_rows, win_cols)
+      != SANE_STATUS_GOOD || memcmp (out, expected, size) != 0)
+    {
+      printf ("ERROR: %dx%d mean with %s threads differs!\n",
+	      win_rows, win_cols, threads);
+      ok = 0;
+    }
+  time = now () - time;
+
+  printf ("mean %dx%d, %s threads: %.3fs, was %.3fs\n",
+	  win_rows, win_cols, threads, time, ref_time);
+
+  free (out);
+  free (expected);
+  return ok;
+}
+
+/** noise map must match the single threaded version
+ * @return 1 on success, else 0
+ */
+static int
+test_filter_madmean (SANE_Uint * image, SANE_Parameters * params,
+		     const char *threads)
+{
+  SANE_Uint *expected, *out = NULL;
+  size_t size = WIDTH * HEIGHT * sizeof (SANE_Uint);
+  double ref_time, time;
+  int ok = 1;
+
+  expected = malloc (size);
+  assert (expected != NULL);
+
+  ref_time = now ();
+  ref_filter_madmean (image, expected, 21, 9, 40);
+  ref_time = now () - ref_time;
+
+  setenv ("SANE_IR_THREADS", threads, 1);
+  time = now ();
+  if (sanei_ir_filter_madmean (params, image, &out, 21, 9, 40)
+      != SANE_STATUS_GOOD || memcmp (out, expected, size) != 0)
+    {
+      printf ("ERROR: madmean with %s threads differs!\n", threads);
+      ok = 0;
+    }
+  time = now () - time;
+
+  printf ("madmean, %s threads: %.3fs, was %.3fs\n", threads, time,
+	  ref_time);
+
+  free (out);
+  free (expected);
+  return ok;
+}
+
+/** thresholds from the histogram must match the single threaded ones
+ * @return 1 on success, else 0
+ */
+static int
+test_thresholds (SANE_Uint * image, SANE_Parameters * params,
+		 const char *threads)
+{
+  double *histo, *expected;
+  int yen[2], otsu[2], maxentropy[2];
+  double time;
+  int i, ok = 1;
+
+  setenv ("SANE_IR_THREADS", "1", 1);
+  if (sanei_ir_create_norm_histogram (params, image, &expected)
+      != SANE_STATUS_GOOD)
+    {
+      printf ("ERROR: no histogram!\n");
+      return 0;
+    }
+
+  setenv ("SANE_IR_THREADS", threads, 1);
+  time = now ();
+  if (sanei_ir_create_norm_histogram (params, image, &histo)
+      != SANE_STATUS_GOOD)
+    {
+      printf ("ERROR: no histogram with %s threads!\n", threads);
+      free (expected);
+      return 0;
+    }
+  time = now () - time;
+  printf ("histogram, %s threads: %.3fs\n", threads, time);
+
+  for (i = 0; i < HISTOGRAM_SIZE; i++)
+    if (histo[i] != expected[i])
+      {
+	printf ("ERROR: histogram with %s threads differs at %d!\n",
+		threads, i);
+	ok = 0;
+	break;
+      }
+
+  sanei_ir_threshold_yen (params, expected, &yen[0]);
+  sanei_ir_threshold_yen (params, histo, &yen[1]);
+  sanei_ir_threshold_otsu (params, expected, &otsu[0]);
+  sanei_ir_threshold_otsu (params, histo, &otsu[1]);
+  sanei_ir_threshold_maxentropy (params, expected, &maxentropy[0]);
+  sanei_ir_threshold_maxentropy (params, histo, &maxentropy[1]);
+  if (yen[0] != yen[1] || otsu[0] != otsu[1]
+      || maxentropy[0] != maxentropy[1])
+    {
+      printf ("ERROR: thresholds with %s threads differ!\n", threads);
+      ok = 0;
+    }
+
+  free (histo);
+  free (expected);
+  return ok;
+}
+
+int
+main (void)
+{
+  static const char *threads[] = { "1", "3", "16" };
+  SANE_Parameters params;
+  SANE_Uint *image;
+  int ok = 1;
+  int i;
+
+  sanei_ir_init ();
+  image = make_image (&params);
+
+  for (i = 0; i < 3; i++)
+    {
+      ok &= test_filter_mean (image, &params, threads[i], 3, 3);
+      ok &= test_filter_mean (image, &params, threads[i], 21, 21);
+      ok &= test_filter_mean (image, &params, threads[i], 75, 11);
+      ok &= test_filter_madmean (image, &params, threads[i]);
+      ok &= test_thresholds (image, &params, threads[i]);
+    }
+
+  free (image);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,378 @@
+#include "../../include/sane/config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+
+/* sane includes for the sanei functions called */
+#include "../../include/sane/sane.h"
+#include "../../include/sane/sanei_magic.h"
+
+/* a letter sized page at 100 dpi, on a black background */
+#define DPI 100
+#define WIDTH 800
+#define HEIGHT 1100
+#define PAPER_LEFT 100
+#define PAPER_RIGHT 700
+#define PAPER_TOP 80
+#define PAPER_BOT 1000
+
+/* amount written between reads, not a multiple of the line size */
+#define CHUNK 777
+
+/* build a page tilted by slope around its top left corner,
+ * with a dark mark at mark_y if it is positive */
+static SANE_Byte *
+make_page (SANE_Parameters * params, int depth, double slope, int mark_y)
+{
+  double angle = atan (slope);
+  SANE_Byte *image;
+  int x, y;
+
+  params->format = SANE_FRAME_GRAY;
+  params->last_frame = SANE_TRUE;
+  params->depth = depth;
+  params->pixels_per_line = WIDTH;
+  params->bytes_per_line = depth == 1 ? WIDTH / 8 : WIDTH;
+  params->lines = HEIGHT;
+
+  image = calloc (params->bytes_per_line, HEIGHT);
+  assert (image != NULL);
+
+  for (y = 0; y < HEIGHT; y++)
+    for (x = 0; x < WIDTH; x++)
+      {
+	/* untilt the pixel to see where it is on the paper */
+	double px = PAPER_LEFT + (x - PAPER_LEFT) * cos (angle)
+	  + (y - PAPER_TOP) * sin (angle);
+	double py = PAPER_TOP - (x - PAPER_LEFT) * sin (angle)
+	  + (y - PAPER_TOP) * cos (angle);
+	int white = px >= PAPER_LEFT && px < PAPER_RIGHT
+	  && py >= PAPER_TOP && py < PAPER_BOT;
+
+	if (mark_y > 0 && px >= 300 && px < 500
+	    && py >= mark_y && py < mark_y + 40)
+	  white = 0;
+
+	if (depth == 8)
+	  image[y * WIDTH + x] = white ? 0xff : 0x00;
+	else if (!white)
+	  image[y * WIDTH / 8 + x / 8] |= 0x80 >> (x % 8);
+      }
+
+  return image;
+}
+
+/* feed the page to a band in chunks, reading in between.
+ * returns the output and sets how much had been written
+ * when the first byte could be read */
+static SANE_Byte *
+run_band (SANEI_Magic_Band * band, SANE_Byte * image, int size,
+	  int *out_len, int *first_byte, SANE_Status * finish)
+{
+  SANE_Byte *out = malloc (size * 2);
+  SANE_Int len;
+  int pos = 0;
+
+  assert (out != NULL);
+  *out_len = 0;
+  *first_byte = -1;
+
+  while (pos < size)
+    {
+      int chunk = size - pos < CHUNK ? size - pos : CHUNK;
+
+      *finish = sanei_magic_band_write (band, image + pos, chunk);
+      if (*finish != SANE_STATUS_GOOD)
+	return out;
+      pos += chunk;
+
+      do
+	{
+	  if (sanei_magic_band_read (band, out + *out_len, size * 2 - *out_len,
+				     &len) != SANE_STATUS_GOOD)
+	    break;
+	  if (len && *first_byte < 0)
+	    *first_byte = pos;
+	  *out_len += len;
+	}
+      while (len);
+    }
+
+  *finish = sanei_magic_band_finish (band);
+  if (*finish == SANE_STATUS_GOOD)
+    {
+      while (sanei_magic_band_read (band, out + *out_len,
+				    size * 2 - *out_len, &len)
+	     == SANE_STATUS_GOOD)
+	*out_len += len;
+    }
+
+  return out;
+}
+
+/** rotation by a known skew must match sanei_magic_rotate
+ * @return 1 on success, else 0
+ */
+static int
+test_rotate (int depth)
+{
+  SANE_Parameters params;
+  SANEI_Magic_Band *band;
+  SANE_Status finish;
+  SANE_Byte *image, *expected, *out;
+  int size, out_len, first_byte;
+  int ok = 1;
+
+  image = make_page (&params, depth, 0.05, 500);
+  size = params.bytes_per_line * params.lines;
+
+  expected = malloc (size);
+  assert (expected != NULL);
+  memcpy (expected, image, size);
+  if (sanei_magic_rotate (&params, expected, 120, 60, 0.05, 0)
+      != SANE_STATUS_GOOD
+      || sanei_magic_band_open (&params, DPI, DPI, SANEI_MAGIC_BAND_DESKEW,
+				0, 0, &band) != SANE_STATUS_GOOD)
+    {
+      printf ("ERROR: couldn't rotate %d bit page!\n", depth);
+      return 0;
+    }
+
+  if (sanei_magic_band_setSkew (band, 120, 60, 0.05) != SANE_STATUS_GOOD)
+    {
+      printf ("ERROR: couldn't set skew!\n");
+      ok = 0;
+    }
+
+  out = run_band (band, image, size, &out_len, &first_byte, &finish);
+
+  if (finish != SANE_STATUS_GOOD || out_len != size
+      || memcmp (out, expected, size) != 0)
+    {
+      printf ("ERROR: %d bit band rotation differs!\n", depth);
+      ok = 0;
+    }
+
+  /* only the lines a rotated line comes from are needed */
+  if (first_byte < 0 || first_byte > size / 4)
+    {
+      printf ("ERROR: %d bit rotation started at %d of %d!\n",
+	      depth, first_byte, size);
+      ok = 0;
+    }
+
+  sanei_magic_band_close (band);
+  free (out);
+  free (expected);
+  free (image);
+  return ok;
+}
+
+/** skew found in the leading lines must match sanei_magic_findSkew
+ * @return 1 on success, else 0
+ */
+static int
+test_skew (void)
+{
+  SANE_Parameters params;
+  SANEI_Magic_Band *band;
+  SANE_Status finish;
+  SANE_Byte *image, *out;
+  int size, out_len, first_byte;
+  int centerX, centerY, bandX, bandY;
+  double slope, bandSlope;
+  int ok = 1;
+
+  image = make_page (&params, 8, 0.04, 0);
+  size = params.bytes_per_line * params.lines;
+
+  if (sanei_magic_findSkew (&params, image, DPI, DPI,
+			    &centerX, &centerY, &slope) != SANE_STATUS_GOOD
+      || sanei_magic_band_open (&params, DPI, DPI, SANEI_MAGIC_BAND_DESKEW,
+				0, 0, &band) != SANE_STATUS_GOOD)
+    {
+      printf ("ERROR: couldn't find skew!\n");
+      return 0;
+    }
+
+  if (sanei_magic_band_getSkew (band, &bandX, &bandY, &bandSlope)
+      != SANE_STATUS_DEVICE_BUSY)
+    {
+      printf ("ERROR: skew known before any data!\n");
+      ok = 0;
+    }
+
+  out = run_band (band, image, size, &out_len, &first_byte, &finish);
+
+  /* the center is far off the page, and without the bottom edge
+   * it can move a little, so allow a quarter inch */
+  if (sanei_magic_band_getSkew (band, &bandX, &bandY, &bandSlope)
+      != SANE_STATUS_GOOD || fabs (bandSlope - slope) > 0.005
+      || abs (bandX - centerX) > DPI / 4 || abs (bandY - centerY) > DPI / 4)
+    {
+      printf ("ERROR: band skew %d %d %f, page skew %d %d %f!\n",
+	      bandX, bandY, bandSlope, centerX, centerY, slope);
+      ok = 0;
+    }
+
+  if (finish != SANE_STATUS_GOOD || out_len != size
+      || first_byte < 0 || first_byte > size / 2)
+    {
+      printf ("ERROR: deskew returned %d bytes from %d!\n",
+	      out_len, first_byte);
+      ok = 0;
+    }
+
+  sanei_magic_band_close (band);
+  free (out);
+  free (image);
+  return ok;
+}
+
+/** cropping must find the paper, and stream before the page ends
+ * @return 1 on success, else 0
+ */
+static int
+test_crop (void)
+{
+  SANE_Parameters params, out_params;
+  SANEI_Magic_Band *band;
+  SANE_Status finish;
+  SANE_Byte *image, *out;
+  int size, out_len, first_byte;
+  int top, bot, left, right;
+  int ok = 1;
+
+  image = make_page (&params, 8, 0, 500);
+  size = params.bytes_per_line * params.lines;
+
+  if (sanei_magic_findEdges (&params, image, DPI, DPI,
+			     &top, &bot, &left, &right) != SANE_STATUS_GOOD
+      || sanei_magic_band_open (&params, DPI, DPI, SANEI_MAGIC_BAND_CROP,
+				0, 0, &band) != SANE_STATUS_GOOD)
+    {
+      printf ("ERROR: couldn't find edges!\n");
+      return 0;
+    }
+
+  /* half a page is enough to know the width, but not the height */
+  if (sanei_magic_band_write (band, image, size / 2) != SANE_STATUS_GOOD
+      || sanei_magic_band_getParams (band, &out_params) != SANE_STATUS_GOOD
+      || out_params.lines != -1
+      || abs (out_params.pixels_per_line - (right - left)) > 4)
+    {
+      printf ("ERROR: crop width %d lines %d, expected %d!\n",
+	      out_params.pixels_per_line, out_params.lines, right - left);
+      ok = 0;
+    }
+  sanei_magic_band_close (band);
+
+  if (sanei_magic_band_open (&params, DPI, DPI, SANEI_MAGIC_BAND_CROP,
+			     0, 0, &band) != SANE_STATUS_GOOD)
+    {
+      printf ("ERROR: couldn't open band!\n");
+      return 0;
+    }
+  out = run_band (band, image, size, &out_len, &first_byte, &finish);
+  sanei_magic_band_getParams (band, &out_params);
+
+  if (finish != SANE_STATUS_GOOD
+      || abs (out_params.lines - (bot - top)) > 4
+      || out_len != out_params.lines * out_params.bytes_per_line)
+    {
+      printf ("ERROR: crop lines %d bytes %d, expected %d lines!\n",
+	      out_params.lines, out_len, bot - top);
+      ok = 0;
+    }
+
+  if (first_byte < 0 || first_byte > size / 2)
+    {
+      printf ("ERROR: crop started at %d of %d!\n", first_byte, size);
+      ok = 0;
+    }
+
+  sanei_magic_band_close (band);
+  free (out);
+  free (image);
+  return ok;
+}
+
+/** blank test must agree with sanei_magic_isBlank2
+ * @return 1 on success, else 0
+ */
+static int
+test_blank (int mark_y)
+{
+  SANE_Parameters params, out_params;
+  SANEI_Magic_Band *band;
+  SANE_Status finish, expected;
+  SANE_Byte *image, *out;
+  int size, out_len, first_byte;
+  int ok = 1;
+
+  image = make_page (&params, 8, 0, mark_y);
+  size = params.bytes_per_line * params.lines;
+
+  /* the black background counts as dark, so test inside the paper */
+  memcpy (&out_params, &params, sizeof (params));
+  if (sanei_magic_crop (&out_params, image, PAPER_TOP, PAPER_BOT,
+			PAPER_LEFT, PAPER_RIGHT) != SANE_STATUS_GOOD
+      || sanei_magic_band_open (&out_params, DPI, DPI,
+				SANEI_MAGIC_BAND_BLANK, 0, 1, &band)
+      != SANE_STATUS_GOOD)
+    {
+      printf ("ERROR: couldn't crop page!\n");
+      return 0;
+    }
+  size = out_params.bytes_per_line * out_params.lines;
+  expected = sanei_magic_isBlank2 (&out_params, image, DPI, DPI, 1);
+
+  out = run_band (band, image, size, &out_len, &first_byte, &finish);
+
+  if (finish != expected)
+    {
+      printf ("ERROR: band blank %d, page blank %d!\n", finish, expected);
+      ok = 0;
+    }
+
+  if (finish == SANE_STATUS_GOOD
+      && (out_len != size || memcmp (out, image, size) != 0))
+    {
+      printf ("ERROR: blank test changed the page!\n");
+      ok = 0;
+    }
+
+  /* a mark near the top lets the page through early */
+  if (finish == SANE_STATUS_GOOD && mark_y < 300
+      && (first_byte < 0 || first_byte > size / 2))
+    {
+      printf ("ERROR: blank test held the page until %d!\n", first_byte);
+      ok = 0;
+    }
+
+  sanei_magic_band_close (band);
+  free (out);
+  free (image);
+  return ok;
+}
+
+int
+main (void)
+{
+  int ok = 1;
+
+  sanei_magic_init ();
+
+  ok &= test_rotate (8);
+  ok &= test_rotate (1);
+  ok &= test_skew ();
+  ok &= test_crop ();
+  ok &= test_blank (-1);
+  ok &= test_blank (200);
+  ok &= test_blank (900);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+#include "../../include/sane/config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+/* sane includes for the sanei functions called */
+#include "../../include/sane/sane.h"
+#include "../../include/sane/sanei_magic.h"
+
+/* odd sizes, so that 1 bit lines end in a partial byte */
+#define WIDTH 1003
+#define HEIGHT 777
+
+static SANE_Byte *
+make_image (SANE_Parameters * params, SANE_Frame format, int depth)
+{
+  SANE_Byte *image;
+  int i, size;
+
+  params->format = format;
+  params->last_frame = SANE_TRUE;
+  params->depth = depth;
+  params->pixels_per_line = WIDTH;
+  if (depth == 1)
+    params->bytes_per_line = (WIDTH + 7) / 8;
+  else if (format == SANE_FRAME_RGB)
+    params->bytes_per_line = WIDTH * 3;
+  else
+    params->bytes_per_line = WIDTH;
+  params->lines = HEIGHT;
+
+  size = params->bytes_per_line * HEIGHT;
+  image = malloc (size);
+  assert (image != NULL);
+
+  srand (depth);
+  for (i = 0; i < size; i++)
+    image[i] = rand ();
+
+  return image;
+}
+
+/** rotating into another buffer must match rotating in place,
+ * whatever the number of threads
+ * @return 1 on success, else 0
+ */
+static int
+test_threads (SANE_Frame format, int depth, int flags)
+{
+  static const char *threads[] = { "1", "3", "8" };
+  SANE_Parameters params;
+  SANE_Byte *image, *expected, *out;
+  int size, i;
+  int ok = 1;
+
+  image = make_image (&params, format, depth);
+  size = params.bytes_per_line * params.lines;
+
+  expected = malloc (size);
+  out = malloc (size);
+  assert (expected != NULL && out != NULL);
+
+  if (flags)
+    {
+      setenv ("SANE_MAGIC_THREADS", "1", 1);
+      sanei_magic_rotate2 (&params, image, expected, -200, 900, -0.07,
+			   0xff, flags);
+    }
+  else
+    {
+      memcpy (expected, image, size);
+      sanei_magic_rotate (&params, expected, -200, 900, -0.07, 0xff);
+    }
+
+  for (i = 0; i < 3; i++)
+    {
+      setenv ("SANE_MAGIC_THREADS", threads[i], 1);
+      memset (out, 0x55, size);
+      if (sanei_magic_rotate2 (&params, image, out, -200, 900, -0.07,
+			       0xff, flags) != SANE_STATUS_GOOD
+	  || memcmp (out, expected, size) != 0)
+	{
+	  printf ("ERROR: %d bit rotation with %s threads differs!\n",
+		  depth, threads[i]);
+	  ok = 0;
+	}
+    }
+
+  unsetenv ("SANE_MAGIC_THREADS");
+  free (out);
+  free (expected);
+  free (image);
+  return ok;
+}
+
+/** interpolation must keep a straight image, and stay between
+ * the colors it blends
+ * @return 1 on success, else 0
+ */
+static int
+test_bilinear (void)
+{
+  SANE_Parameters params;
+  SANE_Byte *image, *out;
+  int size, i;
+  int ok = 1;
+
+  image = make_image (&params, SANE_FRAME_RGB, 8);
+  size = params.bytes_per_line * params.lines;
+  out = malloc (size);
+  assert (out != NULL);
+
+  if (sanei_magic_rotate2 (&params, image, out, 100, 100, 0, 0,
+			   SANEI_MAGIC_ROTATE_BILINEAR) != SANE_STATUS_GOOD
+      || memcmp (out, image, size) != 0)
+    {
+      printf ("ERROR: bilinear rotation by 0 changed the image!\n");
+      ok = 0;
+    }
+
+  /* a two color image only blends to values between them */
+  for (i = 0; i < size; i++)
+    image[i] = image[i] & 1 ? 200 : 40;
+
+  sanei_magic_rotate2 (&params, image, out, 100, 100, 0.1, 40,
+		       SANEI_MAGIC_ROTATE_BILINEAR);
+  for (i = 0; i < size; i++)
+    if (out[i] < 40 || out[i] > 200)
+      {
+	printf ("ERROR: bilinear value %d at %d!\n", out[i], i);
+	ok = 0;
+	break;
+      }
+
+  free (out);
+  free (image);
+  return ok;
+}
+
+int
+main (void)
+{
+  int ok = 1;
+
+  sanei_magic_init ();
+
+  ok &= test_threads (SANE_FRAME_RGB, 8, 0);
+  ok &= test_threads (SANE_FRAME_GRAY, 8, 0);
+  ok &= test_threads (SANE_FRAME_GRAY, 1, 0);
+  ok &= test_threads (SANE_FRAME_RGB, 8, SANEI_MAGIC_ROTATE_BILINEAR);
+  ok &= test_bilinear ();
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,205 @@
+#include "../../include/sane/config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/* sane includes for the sanei functions called */
+#include "../../include/sane/sane.h"
+#include "../../include/sane/sanei_net.h"
+
+#define DATA_SIZE 10000
+
+static int failures;
+
+#define CHECK(cond) check ((cond), #cond, __LINE__)
+
+static void
+check (int ok, const char *what, int line)
+{
+  if (!ok)
+    {
+      printf ("ERROR: line %d: %s failed!\n", line, what);
+      failures++;
+    }
+}
+
+static void
+round_trip (const SANE_Byte *data, size_t len, unsigned int stride,
+	    int expect_compressed)
+{
+  SANE_Byte *packed, *unpacked;
+  size_t packed_len, size;
+  SANE_Status status;
+
+  packed = malloc (len);
+  if (packed == NULL)
+    {
+      printf ("ERROR: out of memory!\n");
+      failures++;
+      return;
+    }
+
+  packed_len = sanei_net_compress (data, len, stride, packed);
+  if (!expect_compressed)
+    {
+      CHECK (packed_len == 0);
+      free (packed);
+      return;
+    }
+  CHECK (packed_len > 0);
+  CHECK (packed_len < len);
+
+  status = sanei_net_decompressed_size (packed, packed_len, &size);
+  CHECK (status == SANE_STATUS_GOOD);
+  if (status != SANE_STATUS_GOOD || size != len)
+    {
+      CHECK (size == len);
+      free (packed);
+      return;
+    }
+
+  unpacked = malloc (size);
+  if (unpacked == NULL)
+    {
+      printf ("ERROR: out of memory!\n");
+      failures++;
+      free (packed);
+      return;
+    }
+  status = sanei_net_decompress (packed, packed_len, unpacked, size);
+  CHECK (status == SANE_STATUS_GOOD);
+  CHECK (memcmp (data, unpacked, len) == 0);
+
+  free (unpacked);
+  free (packed);
+}
+
+static void
+gradient_rgb (void)
+{
+  SANE_Byte data[DATA_SIZE];
+  size_t i;
+
+  for (i = 0; i < DATA_SIZE; i++)
+    data[i] = (i / 3) * (i % 3 + 1) + ((i * 7) & 3);
+
+  round_trip (data, DATA_SIZE, 3, 1);
+}
+
+static void
+constant_gray (void)
+{
+  SANE_Byte data[DATA_SIZE];
+
+  memset (data, 0xff, DATA_SIZE);
+  round_trip (data, DATA_SIZE, 1, 1);
+}
+
+static void
+mixed_blocks (void)
+{
+  SANE_Byte data[DATA_SIZE];
+  unsigned int seed = 1;
+  size_t i;
+
+  /* smooth data with a burst of noise in the middle, so that stored and
+     escaped blocks get mixed with well predicted ones */
+  for (i = 0; i < DATA_SIZE; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      if (i > 3000 && i < 4000)
+	data[i] = seed >> 16;
+      else if (i > 6000 && i < 6100)
+	data[i] = (i & 1) ? 0 : 0xff;
+      else
+	data[i] = (i / 2) & 0xff;
+    }
+
+  round_trip (data, DATA_SIZE, 2, 1);
+}
+
+static void
+random_data (void)
+{
+  SANE_Byte data[DATA_SIZE];
+  unsigned int seed = 42;
+  size_t i;
+
+  for (i = 0; i < DATA_SIZE; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      data[i] = seed >> 16;
+    }
+
+  /* incompressible data must be sent as is */
+  round_trip (data, DATA_SIZE, 1, 0);
+}
+
+static void
+small_records (void)
+{
+  SANE_Byte data[4] = { 1, 1, 1, 1 };
+
+  round_trip (data, sizeof (data), 1, 0);
+  round_trip (data, 0, 1, 0);
+}
+
+static void
+corrupt_records (void)
+{
+  SANE_Byte data[DATA_SIZE], packed[DATA_SIZE], unpacked[DATA_SIZE];
+  size_t packed_len, size, i;
+  SANE_Status status;
+
+  for (i = 0; i < DATA_SIZE; i++)
+    data[i] = i / 5;
+  packed_len = sanei_net_compress (data, DATA_SIZE, 1, packed);
+  CHECK (packed_len > 0);
+  if (packed_len == 0)
+    return;
+
+  /* truncated record */
+  status = sanei_net_decompress (packed, packed_len - 1, unpacked, DATA_SIZE);
+  CHECK (status == SANE_STATUS_IO_ERROR);
+
+  /* trailing garbage */
+  packed[packed_len] = 0;
+  status = sanei_net_decompress (packed, packed_len + 1, unpacked, DATA_SIZE);
+  CHECK (status == SANE_STATUS_IO_ERROR);
+
+  /* size mismatch */
+  status = sanei_net_decompress (packed, packed_len, unpacked, DATA_SIZE - 1);
+  CHECK (status == SANE_STATUS_IO_ERROR);
+
+  /* bogus header */
+  packed[4] = 0;
+  status = sanei_net_decompressed_size (packed, packed_len, &size);
+  CHECK (status == SANE_STATUS_IO_ERROR);
+  packed[4] = 1;
+  packed[0] = 0x7f;
+  status = sanei_net_decompressed_size (packed, packed_len, &size);
+  CHECK (status == SANE_STATUS_IO_ERROR);
+  status = sanei_net_decompressed_size (packed, 3, &size);
+  CHECK (status == SANE_STATUS_IO_ERROR);
+
+  /* invalid block mode */
+  packed[0] = (DATA_SIZE >> 24) & 0xff;
+  packed[5] = 9;
+  status = sanei_net_decompress (packed, packed_len, unpacked, DATA_SIZE);
+  CHECK (status == SANE_STATUS_IO_ERROR);
+}
+
+int
+main (void)
+{
+  gradient_rgb ();
+  constant_gray ();
+  mixed_blocks ();
+  random_data ();
+  small_records ();
+  corrupt_records ();
+  return failures ? 1 : 0;
+}
+
+/* vim: set sw=2 cino=>2se-1sn-1s{s^-1st0(0u0 smarttab expandtab: */
@@ -0,0 +1,307 @@
+#include "../../include/sane/config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* sane includes for the sanei functions called */
+#include "../../include/sane/sane.h"
+#include "../../include/sane/sanei_wire.h"
+#include "../../include/sane/sanei_codec_bin.h"
+#include "../../include/sane/sanei_net.h"
+
+static Wire sender, receiver;
+static int failures;
+
+#define CHECK(cond) check ((cond), #cond, __LINE__)
+
+static int
+check (int ok, const char *what, int line)
+{
+  if (!ok)
+    {
+      printf ("ERROR: line %d: %s failed!\n", line, what);
+      failures++;
+    }
+  return ok;
+}
+
+static SANE_Range range = { 75, 600, 75 };
+
+static SANE_String_Const mode_list[] = { "Color", "Gray", NULL };
+
+static void
+open_wires (void)
+{
+  int fds[2];
+
+  if (pipe (fds) != 0)
+    {
+      printf ("ERROR: cannot create pipe: %s\n", strerror (errno));
+      exit (1);
+    }
+
+  sanei_w_init (&sender, sanei_codec_bin_init);
+  sender.io.fd = fds[1];
+  sender.io.read = read;
+  sender.io.write = write;
+  sender.version = SANEI_NET_PROTOCOL_VERSION;
+
+  sanei_w_init (&receiver, sanei_codec_bin_init);
+  receiver.io.fd = fds[0];
+  receiver.io.read = read;
+  receiver.io.write = write;
+  receiver.version = SANEI_NET_PROTOCOL_VERSION;
+}
+
+static void
+close_wires (void)
+{
+  close (sender.io.fd);
+  close (receiver.io.fd);
+  sanei_w_exit (&sender);
+  sanei_w_exit (&receiver);
+}
+
+static void
+request_round_trip (void)
+{
+  SANE_Option_Action actions[3];
+  SANE_Control_Options_Req req, got;
+  SANE_Word resolution = 300;
+  char mode[] = "Gray";
+
+  actions[0].option = 1;
+  actions[0].action = SANE_ACTION_SET_VALUE;
+  actions[0].value_type = SANE_TYPE_STRING;
+  actions[0].value_size = sizeof (mode);
+  actions[0].value = mode;
+
+  actions[1].option = 2;
+  actions[1].action = SANE_ACTION_SET_VALUE;
+  actions[1].value_type = SANE_TYPE_INT;
+  actions[1].value_size = sizeof (resolution);
+  actions[1].value = &resolution;
+
+  actions[2].option = 3;
+  actions[2].action = SANE_ACTION_SET_AUTO;
+  actions[2].value_type = SANE_TYPE_INT;
+  actions[2].value_size = 0;
+  actions[2].value = NULL;
+
+  req.handle = 7;
+  req.generation = 42;
+  req.num_actions = 3;
+  req.actions = actions;
+
+  open_wires ();
+  sanei_w_reply (&sender, (WireCodecFunc) sanei_w_control_options_req, &req);
+  CHECK (sender.status == 0);
+
+  memset (&got, 0, sizeof (got));
+  sanei_w_set_dir (&receiver, WIRE_DECODE);
+  sanei_w_control_options_req (&receiver, &got);
+  if (CHECK (receiver.status == 0) && CHECK (got.num_actions == 3))
+    {
+      CHECK (got.handle == 7);
+      CHECK (got.generation == 42);
+      CHECK (got.actions[0].option == 1);
+      CHECK (got.actions[0].value_size == sizeof (mode));
+      CHECK (strcmp (got.actions[0].value, "Gray") == 0);
+      CHECK (got.actions[1].action == SANE_ACTION_SET_VALUE);
+      CHECK (*(SANE_Word *) got.actions[1].value == 300);
+      CHECK (got.actions[2].action == SANE_ACTION_SET_AUTO);
+      CHECK (got.actions[2].value_size == 0);
+      CHECK (got.actions[2].value == NULL);
+    }
+
+  sanei_w_free (&receiver, (WireCodecFunc) sanei_w_control_options_req, &got);
+  CHECK (receiver.allocated_memory == 0);
+  close_wires ();
+}
+
+static void
+reply_round_trip (void)
+{
+  SANE_Option_Descriptor mode, resolution;
+  SANE_Option_Descriptor_Change changes[2];
+  SANE_Option_Result result;
+  SANE_Control_Options_Reply reply, got;
+  SANE_Word value = 150;
+
+  memset (&mode, 0, sizeof (mode));
+  mode.name = "mode";
+  mode.title = "Scan mode";
+  mode.desc = "Selects the scan mode";
+  mode.type = SANE_TYPE_STRING;
+  mode.size = 32;
+  mode.cap = SANE_CAP_SOFT_SELECT | SANE_CAP_SOFT_DETECT;
+  mode.constraint_type = SANE_CONSTRAINT_STRING_LIST;
+  mode.constraint.string_list = mode_list;
+
+  memset (&resolution, 0, sizeof (resolution));
+  resolution.name = "resolution";
+  resolution.title = "Resolution";
+  resolution.desc = "Sets the resolution";
+  resolution.type = SANE_TYPE_INT;
+  resolution.unit = SANE_UNIT_DPI;
+  resolution.size = sizeof (SANE_Word);
+  resolution.cap = SANE_CAP_SOFT_SELECT | SANE_CAP_SOFT_DETECT;
+  resolution.constraint_type = SANE_CONSTRAINT_RANGE;
+  resolution.constraint.range = &range;
+
+  changes[0].option = 1;
+  changes[0].desc = &mode;
+  changes[1].option = 2;
+  changes[1].desc = &resolution;
+
+  result.status = SANE_STATUS_GOOD;
+  result.info = SANE_INFO_INEXACT | SANE_INFO_RELOAD_OPTIONS;
+  result.value_type = SANE_TYPE_INT;
+  result.value_size = sizeof (value);
+  result.value = &value;
+
+  memset (&reply, 0, sizeof (reply));
+  reply.status = SANE_STATUS_GOOD;
+  reply.num_results = 1;
+  reply.results = &result;
+  reply.generation = 3;
+  reply.num_options = 5;
+  reply.num_changes = 2;
+  reply.changes = changes;
+
+  open_wires ();
+  sanei_w_reply (&sender, (WireCodecFunc) sanei_w_control_options_reply,
+		 &reply);
+  CHECK (sender.status == 0);
+
+  memset (&got, 0, sizeof (got));
+  sanei_w_set_dir (&receiver, WIRE_DECODE);
+  sanei_w_control_options_reply (&receiver, &got);
+  if (CHECK (receiver.status == 0) && CHECK (got.num_results == 1)
+      && CHECK (got.num_changes == 2))
+    {
+      CHECK (got.status == SANE_STATUS_GOOD);
+      CHECK (got.results[0].info == result.info);
+      CHECK (*(SANE_Word *) got.results[0].value == 150);
+      CHECK (got.generation == 3);
+      CHECK (got.num_options == 5);
+      CHECK (got.changes[0].option == 1);
+      CHECK (strcmp (got.changes[0].desc->name, "mode") == 0);
+      CHECK (strcmp (got.changes[0].desc->constraint.string_list[1], "Gray")
+	     == 0);
+      CHECK (got.changes[1].option == 2);
+      CHECK (got.changes[1].desc->unit == SANE_UNIT_DPI);
+      CHECK (got.changes[1].desc->constraint.range->quant == 75);
+      CHECK (got.resource_to_authorize == NULL);
+
+      /* a receiver taking over a descriptor leaves NULL behind */
+      sanei_w_set_dir (&receiver, WIRE_FREE);
+      sanei_w_option_descriptor_ptr (&receiver, &got.changes[0].desc);
+      got.changes[0].desc = NULL;
+    }
+  sanei_w_free (&receiver, (WireCodecFunc) sanei_w_control_options_reply,
+		&got);
+  CHECK (receiver.allocated_memory == 0);
+  close_wires ();
+}
+
+/* An action claiming more bytes than its value holds.  */
+static void
+w_short_value_req (Wire * w, void *unused)
+{
+  SANE_Word word;
+  SANE_Char ch = 'x';
+
+  (void) unused;
+  word = 0;			/* handle */
+  sanei_w_word (w, &word);
+  word = 1;			/* generation */
+  sanei_w_word (w, &word);
+  word = 1;			/* number of actions */
+  sanei_w_word (w, &word);
+  word = 2;			/* option */
+  sanei_w_word (w, &word);
+  word = SANE_ACTION_GET_VALUE;
+  sanei_w_word (w, &word);
+  word = SANE_TYPE_STRING;
+  sanei_w_word (w, &word);
+  word = 1024;			/* value size */
+  sanei_w_word (w, &word);
+  word = 1;			/* but just one character follows */
+  sanei_w_word (w, &word);
+  sanei_w_char (w, &ch);
+}
+
+static void
+short_value_rejected (void)
+{
+  SANE_Control_Options_Req got;
+
+  open_wires ();
+  sanei_w_reply (&sender, (WireCodecFunc) w_short_value_req, NULL);
+  CHECK (sender.status == 0);
+
+  memset (&got, 0, sizeof (got));
+  sanei_w_set_dir (&receiver, WIRE_DECODE);
+  sanei_w_control_options_req (&receiver, &got);
+  CHECK (receiver.status == EINVAL);
+
+  sanei_w_free (&receiver, (WireCodecFunc) sanei_w_control_options_req, &got);
+  close_wires ();
+}
+
+/* A start request followed by a word that must not be taken for the
+   start flags.  */
+static void
+w_start_req_trailer (Wire * w, SANE_Start_Req * req)
+{
+  SANE_Word trailer = 0x5a5a;
+
+  sanei_w_start_req (w, req);
+  sanei_w_word (w, &trailer);
+}
+
+/* The start flags only follow the handle from protocol version 5 on.  */
+static void
+start_request (int version, SANE_Word flags, SANE_Word expected_flags)
+{
+  SANE_Start_Req req, got;
+  SANE_Word trailer = 0;
+
+  req.handle = 3;
+  req.flags = flags;
+
+  open_wires ();
+  sender.version = version;
+  receiver.version = version;
+  sanei_w_reply (&sender, (WireCodecFunc) w_start_req_trailer, &req);
+  CHECK (sender.status == 0);
+
+  got.handle = -1;
+  got.flags = -1;
+  sanei_w_set_dir (&receiver, WIRE_DECODE);
+  sanei_w_start_req (&receiver, &got);
+  sanei_w_word (&receiver, &trailer);
+  CHECK (receiver.status == 0);
+  CHECK (got.handle == 3);
+  CHECK (got.flags == expected_flags);
+  CHECK (trailer == 0x5a5a);
+  close_wires ();
+}
+
+int
+main (void)
+{
+  request_round_trip ();
+  reply_round_trip ();
+  short_value_rejected ();
+  start_request (SANEI_NET_PROTOCOL_VERSION, SANEI_NET_START_NO_COMPRESSION,
+		 SANEI_NET_START_NO_COMPRESSION);
+  start_request (SANEI_NET_PROTOCOL_VERSION, 0, 0);
+  start_request (SANEI_NET_COMPRESSION_VERSION,
+		 SANEI_NET_START_NO_COMPRESSION, 0);
+  return failures ? 1 : 0;
+}
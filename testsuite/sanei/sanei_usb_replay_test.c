@@ -0,0 +1,197 @@
+#include "../../include/sane/config.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* sane includes for the sanei functions called */
+#include "../../include/sane/sane.h"
+#include "../../include/sane/sanei_usb.h"
+
+#if WITH_USB_RECORD_REPLAY
+#define XML_CAPTURE "sanei_usb_replay_test.xml"
+#define PACKED_CAPTURE "sanei_usb_replay_test.pack"
+#define UNPACKED_CAPTURE "sanei_usb_replay_test.unpacked.xml"
+
+static const char capture[] =
+  "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+  "<device_capture backend=\"test\">\n"
+  "  <description id_vendor=\"0x04a9\" id_product=\"0x1909\">\n"
+  "    <configurations>\n"
+  "      <configuration number=\"1\">\n"
+  "        <interface number=\"0\">\n"
+  "          <endpoint transfer_type=\"BULK\" number=\"1\" direction=\"IN\""
+  " address=\"0x81\"/>\n"
+  "          <endpoint transfer_type=\"BULK\" number=\"2\" direction=\"OUT\""
+  " address=\"0x02\"/>\n"
+  "        </interface>\n"
+  "      </configuration>\n"
+  "    </configurations>\n"
+  "  </description>\n"
+  "  <transactions>\n"
+  "    <bulk_tx time_usec=\"0\" seq=\"1\" endpoint_number=\"0x02\""
+  " direction=\"OUT\">1b 53 0a</bulk_tx>\n"
+  "    <bulk_tx time_usec=\"0\" seq=\"2\" endpoint_number=\"0x01\""
+  " direction=\"IN\">00 01 fe ff</bulk_tx>\n"
+  "    <bulk_tx time_usec=\"0\" seq=\"3\" endpoint_number=\"0x01\""
+  " direction=\"IN\">80 7f</bulk_tx>\n"
+  "  </transactions>\n"
+  "</device_capture>\n";
+
+static int
+write_file (const char *path, const void *data, size_t size)
+{
+  FILE *f = fopen (path, "wb");
+  int ok;
+
+  if (f == NULL)
+    return 0;
+  ok = fwrite (data, 1, size, f) == size;
+  return fclose (f) == 0 && ok;
+}
+
+/* replays the capture at path, the two IN transactions make up one read */
+static int
+replay (const char *path)
+{
+  static const SANE_Byte command[] = { 0x1b, 0x53, 0x0a };
+  static const SANE_Byte expected[] = { 0x00, 0x01, 0xfe, 0xff, 0x80, 0x7f };
+  SANE_Byte buffer[16];
+  SANE_Int dn;
+  size_t size;
+  int ok = 1;
+
+  if (sanei_usb_testing_enable_replay (path, 0) != SANE_STATUS_GOOD)
+    {
+      printf ("ERROR: couldn't replay %s!\n", path);
+      return 0;
+    }
+  sanei_usb_init ();
+
+  if (sanei_usb_open (path, &dn) != SANE_STATUS_GOOD)
+    {
+      printf ("ERROR: couldn't open %s!\n", path);
+      ok = 0;
+    }
+  else
+    {
+      size = sizeof (command);
+      if (sanei_usb_write_bulk (dn, command, &size) != SANE_STATUS_GOOD
+	  || size != sizeof (command))
+	{
+	  printf ("ERROR: write not replayed from %s!\n", path);
+	  ok = 0;
+	}
+      size = sizeof (buffer);
+      if (sanei_usb_read_bulk (dn, buffer, &size) != SANE_STATUS_GOOD
+	  || size != sizeof (expected)
+	  || memcmp (buffer, expected, sizeof (expected)) != 0)
+	{
+	  printf ("ERROR: read not replayed from %s!\n", path);
+	  ok = 0;
+	}
+      sanei_usb_close (dn);
+    }
+
+  sanei_usb_exit ();
+  return ok;
+}
+
+/** test a truncated packed capture
+ * @return 1 on success, else 0
+ */
+static int
+test_truncated (void)
+{
+  char contents[4096];
+  size_t size;
+  SANE_Status status;
+  FILE *f = fopen (PACKED_CAPTURE, "rb");
+
+  if (f == NULL)
+    {
+      printf ("ERROR: couldn't read packed capture!\n");
+      return 0;
+    }
+  size = fread (contents, 1, sizeof (contents), f);
+  fclose (f);
+
+  /* cut off the end of the XML */
+  if (size < 16 || !write_file (PACKED_CAPTURE, contents, size - 16))
+    {
+      printf ("ERROR: couldn't truncate packed capture!\n");
+      return 0;
+    }
+
+  status = sanei_usb_testing_unpack_capture (PACKED_CAPTURE,
+					     UNPACKED_CAPTURE);
+  if (status != SANE_STATUS_INVAL)
+    {
+      printf ("ERROR: truncated capture unpacked!\n");
+      return 0;
+    }
+  return 1;
+}
+#endif
+
+int
+main (void)
+{
+#if WITH_USB_RECORD_REPLAY
+  int ok = 1;
+
+  if (!write_file (XML_CAPTURE, capture, strlen (capture)))
+    {
+      printf ("ERROR: couldn't write XML capture!\n");
+      return 1;
+    }
+
+  ok &= replay (XML_CAPTURE);
+
+  if (sanei_usb_testing_pack_capture (XML_CAPTURE, PACKED_CAPTURE)
+      != SANE_STATUS_GOOD)
+    {
+      printf ("ERROR: couldn't pack capture!\n");
+      ok = 0;
+    }
+  else
+    {
+      ok &= replay (PACKED_CAPTURE);
+
+      /* development mode rewrites the capture, which needs XML */
+      if (sanei_usb_testing_enable_replay (PACKED_CAPTURE, 1)
+	  != SANE_STATUS_UNSUPPORTED)
+	{
+	  printf ("ERROR: development mode enabled on packed capture!\n");
+	  ok = 0;
+	}
+
+      if (sanei_usb_testing_unpack_capture (PACKED_CAPTURE, UNPACKED_CAPTURE)
+	  != SANE_STATUS_GOOD)
+	{
+	  printf ("ERROR: couldn't unpack capture!\n");
+	  ok = 0;
+	}
+      else
+	ok &= replay (UNPACKED_CAPTURE);
+    }
+
+  /* an XML capture is not a packed one */
+  if (sanei_usb_testing_unpack_capture (XML_CAPTURE, UNPACKED_CAPTURE)
+      != SANE_STATUS_INVAL)
+    {
+      printf ("ERROR: XML capture unpacked!\n");
+      ok = 0;
+    }
+
+  ok &= test_truncated ();
+
+  remove (XML_CAPTURE);
+  remove (PACKED_CAPTURE);
+  remove (UNPACKED_CAPTURE);
+  return ok ? 0 : 1;
+#else
+  printf ("USB record-replay mode support is missing, skipping\n");
+  return 77;
+#endif
+}
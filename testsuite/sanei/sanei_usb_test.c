@@ -7,6 +7,7 @@
 #include <unistd.h>
 #include <math.h>
 #include <stddef.h>
+#include <sys/socket.h>
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
 #endif
@@ -826,6 +827,221 @@ test_attach (void)
   return 1;
 }
 
+/**
+ * devices attached by count_attach, in order */
+static char attached[4][16];
+static int attached_count;
+
+static SANE_Status
+count_attach (const char *dev)
+{
+  if (attached_count < 4)
+    snprintf (attached[attached_count], sizeof (attached[0]), "%s", dev);
+  attached_count++;
+  return SANE_STATUS_GOOD;
+}
+
+/** test the device index
+ * store mock devices sharing ids and check that lookups by ids
+ * and by name find them in device order
+ * @return 1 on success, else 0
+ */
+static int
+test_device_index (void)
+{
+  device_list_type mock;
+  char name[16];
+  SANE_Word vendor, product;
+  int first = device_number;
+  int i;
+
+  for (i = 0; i < 3; i++)
+    {
+      snprintf (name, sizeof (name), "mock%d", i);
+      create_mock_device (name, &mock);
+      if (i == 1)
+	mock.product = 0xcafe;
+      store_device (mock);
+    }
+  if (device_number != first + 3)
+    {
+      printf ("ERROR: mock devices not stored!\n");
+      return 0;
+    }
+
+  attached_count = 0;
+  sanei_usb_find_devices (0xdead, 0xbeef, count_attach);
+  if (attached_count != 2 || strcmp (attached[0], "mock0")
+      || strcmp (attached[1], "mock2"))
+    {
+      printf ("ERROR: devices not found by ids in order!\n");
+      return 0;
+    }
+
+  if (sanei_usb_get_vendor_product_byname ("mock1", &vendor, &product)
+      != SANE_STATUS_GOOD || vendor != 0xdead || product != 0xcafe)
+    {
+      printf ("ERROR: device not found by name!\n");
+      return 0;
+    }
+
+  /* missing devices are not found any more */
+  devices[first + 2].missing = 1;
+  attached_count = 0;
+  sanei_usb_find_devices (0xdead, 0xbeef, count_attach);
+  if (attached_count != 1
+      || sanei_usb_get_vendor_product_byname ("mock2", NULL, NULL)
+      != SANE_STATUS_INVAL)
+    {
+      printf ("ERROR: missing device found!\n");
+      return 0;
+    }
+
+  /* remove mock devices */
+  while (device_number > first)
+    {
+      device_number--;
+      free (devices[device_number].devname);
+      devices[device_number].devname = NULL;
+    }
+
+  /* removed devices are skipped even though still indexed */
+  attached_count = 0;
+  sanei_usb_find_devices (0xdead, 0xbeef, count_attach);
+  if (attached_count != 0)
+    {
+      printf ("ERROR: removed device found!\n");
+      return 0;
+    }
+
+  return 1;
+}
+
+/** test queued bulk transfers
+ * queue transfers on a mock device talking through a socket pair,
+ * which sanei_usb_reap carries out one after the other
+ * @return 1 on success, else 0
+ */
+static int
+test_transfer_queue (void)
+{
+  device_list_type mock;
+  SANE_Int dn;
+  SANE_Byte *data;
+  size_t size;
+  char peer[16];
+  int fds[2];
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    {
+      printf ("ERROR: couldn't create socket pair!\n");
+      return 0;
+    }
+  create_mock_device ("mock", &mock);
+  mock.method = sanei_usb_method_scanner_driver;
+  mock.fd = fds[0];
+  store_device (mock);
+  dn = device_number - 1;
+
+  /* nothing can be queued before the queue is set up */
+  if (sanei_usb_submit_bulk (dn, USB_DIR_IN, NULL, 4) != SANE_STATUS_INVAL)
+    {
+      printf ("ERROR: transfer queued without a queue!\n");
+      return 0;
+    }
+  if (sanei_usb_set_queue_depth (dn, 3, 8) != SANE_STATUS_GOOD)
+    {
+      printf ("ERROR: couldn't set queue depth!\n");
+      return 0;
+    }
+  if (sanei_usb_submit_bulk (dn, USB_DIR_IN, NULL, 9) != SANE_STATUS_INVAL)
+    {
+      printf ("ERROR: transfer larger than the queue's buffers queued!\n");
+      return 0;
+    }
+
+  /* transfers are carried out in the order they were submitted */
+  if (sanei_usb_submit_bulk (dn, USB_DIR_OUT, (SANE_Byte *) "scan", 4)
+      != SANE_STATUS_GOOD
+      || sanei_usb_submit_bulk (dn, USB_DIR_IN, NULL, 8) != SANE_STATUS_GOOD
+      || sanei_usb_submit_bulk (dn, USB_DIR_IN, NULL, 8) != SANE_STATUS_GOOD)
+    {
+      printf ("ERROR: couldn't queue transfers!\n");
+      return 0;
+    }
+  if (sanei_usb_submit_bulk (dn, USB_DIR_IN, NULL, 8)
+      != SANE_STATUS_DEVICE_BUSY)
+    {
+      printf ("ERROR: transfer queued on a full queue!\n");
+      return 0;
+    }
+  if (sanei_usb_set_queue_depth (dn, 1, 8) != SANE_STATUS_DEVICE_BUSY)
+    {
+      printf ("ERROR: queue resized with transfers pending!\n");
+      return 0;
+    }
+
+  if (sanei_usb_reap (dn, &data, &size) != SANE_STATUS_GOOD || size != 4
+      || data != NULL)
+    {
+      printf ("ERROR: write not reaped!\n");
+      return 0;
+    }
+  if (read (fds[1], peer, sizeof (peer)) != 4 || memcmp (peer, "scan", 4))
+    {
+      printf ("ERROR: written data doesn't match!\n");
+      return 0;
+    }
+  if (write (fds[1], "line1", 5) != 5)
+    return 0;
+  if (sanei_usb_reap (dn, &data, &size) != SANE_STATUS_GOOD || size != 5
+      || memcmp (data, "line1", 5))
+    {
+      printf ("ERROR: read data doesn't match!\n");
+      return 0;
+    }
+
+  /* the buffer just handed out takes up its slot until the next reap */
+  if (sanei_usb_submit_bulk (dn, USB_DIR_IN, NULL, 8) != SANE_STATUS_GOOD
+      || sanei_usb_submit_bulk (dn, USB_DIR_IN, NULL, 8)
+      != SANE_STATUS_DEVICE_BUSY)
+    {
+      printf ("ERROR: buffer in use was reused!\n");
+      return 0;
+    }
+  if (write (fds[1], "line2", 5) != 5)
+    return 0;
+  if (sanei_usb_reap (dn, &data, &size) != SANE_STATUS_GOOD || size != 5
+      || memcmp (data, "line2", 5))
+    {
+      printf ("ERROR: read data doesn't match!\n");
+      return 0;
+    }
+
+  /* cancelling empties the queue */
+  sanei_usb_cancel_bulk (dn);
+  if (sanei_usb_reap (dn, &data, &size) != SANE_STATUS_INVAL)
+    {
+      printf ("ERROR: transfer reaped after cancelling!\n");
+      return 0;
+    }
+  if (sanei_usb_set_queue_depth (dn, 0, 0) != SANE_STATUS_GOOD
+      || transfer_queues[dn].transfers != NULL)
+    {
+      printf ("ERROR: queue not freed!\n");
+      return 0;
+    }
+
+  /* remove mock device */
+  close (fds[0]);
+  close (fds[1]);
+  device_number--;
+  free (devices[device_number].devname);
+  memset (&devices[device_number], 0, sizeof (devices[device_number]));
+
+  return 1;
+}
+
 int
 main (int __sane_unused__ argc, char **argv)
 {
@@ -924,6 +1140,14 @@ main (int __sane_unused__ argc, char **argv)
   /* test attach matching device with a mock */
   assert (test_attach ());
 
+  /* look up mock devices through the index */
+  if (!test_device_index ())
+    return 1;
+
+  /* queue transfers on a mock device */
+  if (!test_transfer_queue ())
+    return 1;
+
   /* try to call sanei_usb_exit() when it not initialized */
   assert (test_exit (0));
 
@@ -0,0 +1,269 @@
+/*
+* Copyright (c) 2025 Huawei Device Co., Ltd.
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Compares the work-stealing pool with a pool built like OHOS::ThreadPool, which the
+// threadpool_c wrapper used before: one FIFO of std::function guarded by one mutex. The
+// wrapper's Wait polled that queue once a second; the reference pool below is waited for with
+// a condition variable instead so that only the queueing itself is compared.
+//
+// usage: threadpool_benchmark [threads [iterations]]
+
+#include "threadpool_c.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double ElapsedMs(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void Spin(unsigned iterations)
+{
+    volatile unsigned sink = 0;
+    for (unsigned i = 0; i < iterations; i++) {
+        sink = sink + i;
+    }
+}
+
+class FifoThreadPool {
+public:
+    explicit FifoThreadPool(int thread_num)
+    {
+        for (int i = 0; i < thread_num; i++) {
+            threads_.emplace_back(&FifoThreadPool::WorkInThread, this);
+        }
+    }
+
+    ~FifoThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        hasTask_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    void AddTask(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push_back(std::move(task));
+            pending_++;
+        }
+        hasTask_.notify_one();
+    }
+
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return pending_ == 0; });
+    }
+
+private:
+    void WorkInThread()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            hasTask_.wait(lock, [this]() { return !tasks_.empty() || !running_; });
+            if (!running_) {
+                return;
+            }
+            auto task = std::move(tasks_.front());
+            tasks_.pop_front();
+            lock.unlock();
+            task();
+            lock.lock();
+            if (--pending_ == 0) {
+                done_.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable hasTask_;
+    std::condition_variable done_;
+    std::size_t pending_ = 0;
+    bool running_ = true;
+};
+
+// Adapts both pools to the C interface the backends use.
+struct Pool {
+    virtual ~Pool() = default;
+    virtual void Add(threadpool_task_func_t func, void* arg,
+                     threadpool_priority_t priority = THREADPOOL_PRIORITY_NORMAL) = 0;
+    virtual void Wait() = 0;
+};
+
+struct FifoPool : Pool {
+    explicit FifoPool(int thread_num) : pool(thread_num) {}
+
+    void Add(threadpool_task_func_t func, void* arg, threadpool_priority_t) override
+    {
+        pool.AddTask([func, arg]() { func(arg); });
+    }
+
+    void Wait() override { pool.Wait(); }
+
+    FifoThreadPool pool;
+};
+
+struct StealingPool : Pool {
+    explicit StealingPool(int thread_num) : pool(threadpool_create(thread_num)) {}
+
+    ~StealingPool() override { threadpool_destroy(pool); }
+
+    void Add(threadpool_task_func_t func, void* arg, threadpool_priority_t priority) override
+    {
+        if (!threadpool_add_task_with_priority(pool, func, arg, priority)) {
+            std::abort();
+        }
+    }
+
+    void Wait() override { threadpool_wait(pool); }
+
+    threadpool_handle_t* pool;
+};
+
+Pool* currentPool = nullptr;
+
+constexpr unsigned FLAT_TASKS = 200000;
+constexpr unsigned FORK_PARENTS = 256;
+constexpr unsigned FORK_CHILDREN = 256;
+constexpr unsigned BACKLOG_TASKS = 2000;
+constexpr unsigned TINY_WORK = 50;
+constexpr unsigned BACKLOG_WORK = 200000;
+
+void TinyTask(void*)
+{
+    Spin(TINY_WORK);
+}
+
+// Many tiny tasks added from outside the pool.
+double RunFlat(Pool& pool)
+{
+    auto start = Clock::now();
+    for (unsigned i = 0; i < FLAT_TASKS; i++) {
+        pool.Add(TinyTask, nullptr);
+    }
+    pool.Wait();
+    return ElapsedMs(start, Clock::now());
+}
+
+void ForkTask(void*)
+{
+    for (unsigned i = 0; i < FORK_CHILDREN; i++) {
+        currentPool->Add(TinyTask, nullptr);
+    }
+}
+
+// Tasks that add tasks, as a pipeline splitting its work into rows would.
+double RunFork(Pool& pool)
+{
+    currentPool = &pool;
+    auto start = Clock::now();
+    for (unsigned i = 0; i < FORK_PARENTS; i++) {
+        pool.Add(ForkTask, nullptr);
+    }
+    pool.Wait();
+    return ElapsedMs(start, Clock::now());
+}
+
+void BacklogTask(void*)
+{
+    Spin(BACKLOG_WORK);
+}
+
+void UrgentTask(void* arg)
+{
+    static_cast<std::atomic<Clock::rep>*>(arg)->store(Clock::now().time_since_epoch().count());
+}
+
+// How long an urgent task queued behind a backlog of slow ones waits to start.
+double RunUrgent(Pool& pool)
+{
+    std::atomic<Clock::rep> started{0};
+    for (unsigned i = 0; i < BACKLOG_TASKS; i++) {
+        pool.Add(BacklogTask, nullptr, THREADPOOL_PRIORITY_LOW);
+    }
+    auto start = Clock::now();
+    pool.Add(UrgentTask, &started, THREADPOOL_PRIORITY_HIGH);
+    pool.Wait();
+    return ElapsedMs(start, Clock::time_point(Clock::duration(started.load())));
+}
+
+template<class PoolType>
+double Best(int threads, unsigned iterations, double (*run)(Pool&))
+{
+    double best = 0;
+    for (unsigned i = 0; i < iterations; i++) {
+        PoolType pool(threads);
+        double ms = run(pool);
+        best = i == 0 ? ms : std::min(best, ms);
+    }
+    return best;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int threads = argc > 1 ? std::atoi(argv[1]) : 0;
+    unsigned iterations = argc > 2 ? static_cast<unsigned>(std::atoi(argv[2])) : 5;
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (iterations == 0) {
+        iterations = 1;
+    }
+
+    struct {
+        const char* name;
+        double (*run)(Pool&);
+    } workloads[] = {
+        { "flat", RunFlat },
+        { "fork", RunFork },
+        { "urgent", RunUrgent },
+    };
+
+    std::printf("%d threads, best of %u\n", threads, iterations);
+    std::printf("%-10s %12s %12s %8s\n", "workload", "fifo ms", "stealing ms", "speedup");
+    for (const auto& workload : workloads) {
+        double fifo = Best<FifoPool>(threads, iterations, workload.run);
+        double stealing = Best<StealingPool>(threads, iterations, workload.run);
+        std::printf("%-10s %12.3f %12.3f %7.2fx\n", workload.name, fifo, stealing,
+                    stealing > 0 ? fifo / stealing : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,290 @@
+#include "../../include/sane/config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "threadpool_c.h"
+
+/* The checks must run even when NDEBUG is defined, so assert () is not
+   used.  */
+static int failures;
+
+static int
+check (int ok, const char *what, int line)
+{
+  if (!ok)
+    {
+      printf ("ERROR: line %d: %s failed\n", line, what);
+      failures++;
+    }
+  return ok;
+}
+
+#define CHECK(cond) check ((cond) != 0, #cond, __LINE__)
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static int counter;
+static int gate_open;
+
+static char order[8];
+static int order_len;
+
+static void
+count (void *arg)
+{
+  (void) arg;
+  pthread_mutex_lock (&lock);
+  counter++;
+  pthread_mutex_unlock (&lock);
+}
+
+/* Blocks a thread of the pool until open_gate is called.  */
+static void
+gate (void *arg)
+{
+  (void) arg;
+  pthread_mutex_lock (&lock);
+  while (!gate_open)
+    pthread_cond_wait (&cond, &lock);
+  pthread_mutex_unlock (&lock);
+}
+
+static void
+close_gate (void)
+{
+  pthread_mutex_lock (&lock);
+  gate_open = 0;
+  pthread_mutex_unlock (&lock);
+}
+
+static void
+open_gate (void)
+{
+  pthread_mutex_lock (&lock);
+  gate_open = 1;
+  pthread_cond_broadcast (&cond);
+  pthread_mutex_unlock (&lock);
+}
+
+static void *
+open_gate_later (void *arg)
+{
+  (void) arg;
+  usleep (100000);
+  open_gate ();
+  return NULL;
+}
+
+static void
+record (void *arg)
+{
+  pthread_mutex_lock (&lock);
+  order[order_len++] = *(const char *) arg;
+  pthread_mutex_unlock (&lock);
+}
+
+static void
+many_tasks (void)
+{
+  threadpool_handle_t *pool;
+  int i;
+
+  pool = threadpool_create (0);
+  if (!CHECK (pool != NULL))
+    return;
+
+  counter = 0;
+  for (i = 0; i < 1000; i++)
+    CHECK (threadpool_add_task (pool, count, NULL));
+  threadpool_wait (pool);
+  CHECK (counter == 1000);
+
+  /* the pool is still usable after waiting */
+  for (i = 0; i < 10; i++)
+    CHECK (threadpool_add_task (pool, count, NULL));
+  threadpool_wait (pool);
+  CHECK (counter == 1010);
+
+  CHECK (!threadpool_add_task (pool, NULL, NULL));
+  threadpool_destroy (pool);
+}
+
+static void
+priorities (void)
+{
+  threadpool_handle_t *pool;
+  static const char low = 'l', normal = 'n', high = 'h';
+
+  pool = threadpool_create (1);
+  if (!CHECK (pool != NULL))
+    return;
+
+  close_gate ();
+  order_len = 0;
+  CHECK (threadpool_add_task (pool, gate, NULL));
+  CHECK (threadpool_add_task_with_priority (pool, record, (void *) &low,
+					    THREADPOOL_PRIORITY_LOW));
+  CHECK (threadpool_add_task_with_priority (pool, record, (void *) &normal,
+					    THREADPOOL_PRIORITY_NORMAL));
+  CHECK (threadpool_add_task_with_priority (pool, record, (void *) &high,
+					    THREADPOOL_PRIORITY_HIGH));
+  open_gate ();
+  threadpool_wait (pool);
+
+  CHECK (order_len == 3);
+  CHECK (memcmp (order, "hnl", 3) == 0);
+  threadpool_destroy (pool);
+}
+
+static void
+cancellation (void)
+{
+  threadpool_handle_t *pool;
+  threadpool_task_t *blocker, *task;
+
+  pool = threadpool_create (1);
+  if (!CHECK (pool != NULL))
+    return;
+
+  close_gate ();
+  counter = 0;
+  blocker = threadpool_submit (pool, gate, NULL, THREADPOOL_PRIORITY_NORMAL);
+  task = threadpool_submit (pool, count, NULL, THREADPOOL_PRIORITY_NORMAL);
+  if (!CHECK (blocker != NULL) || !CHECK (task != NULL))
+    {
+      open_gate ();
+      threadpool_destroy (pool);
+      return;
+    }
+  CHECK (threadpool_task_state (task) == THREADPOOL_TASK_QUEUED);
+
+  CHECK (threadpool_task_cancel (task));
+  CHECK (!threadpool_task_cancel (task));
+  CHECK (threadpool_task_state (task) == THREADPOOL_TASK_CANCELLED);
+  CHECK (threadpool_task_wait (task) == THREADPOOL_TASK_CANCELLED);
+
+  open_gate ();
+  CHECK (threadpool_task_wait (blocker) == THREADPOOL_TASK_DONE);
+  CHECK (!threadpool_task_cancel (blocker));
+  threadpool_wait (pool);
+  CHECK (counter == 0);
+
+  threadpool_task_release (blocker);
+  threadpool_task_release (task);
+  threadpool_destroy (pool);
+}
+
+static threadpool_handle_t *nested_pool;
+
+/* Waits for tasks of its own, which needs the waiting thread to run them
+   when the pool has just one.  */
+static void
+fork_join (void *arg)
+{
+  threadpool_task_t *children[16];
+  int i;
+
+  (void) arg;
+  for (i = 0; i < 16; i++)
+    {
+      children[i] = threadpool_submit (nested_pool, count, NULL,
+				       THREADPOOL_PRIORITY_HIGH);
+      CHECK (children[i] != NULL);
+    }
+  for (i = 0; i < 16; i++)
+    {
+      if (!children[i])
+	continue;
+      CHECK (threadpool_task_wait (children[i]) == THREADPOOL_TASK_DONE);
+      threadpool_task_release (children[i]);
+    }
+}
+
+static void
+nested_tasks (void)
+{
+  threadpool_task_t *parents[4];
+  int i;
+
+  nested_pool = threadpool_create (1);
+  if (!CHECK (nested_pool != NULL))
+    return;
+
+  counter = 0;
+  for (i = 0; i < 4; i++)
+    parents[i] = threadpool_submit (nested_pool, fork_join, NULL,
+				    THREADPOOL_PRIORITY_NORMAL);
+  for (i = 0; i < 4; i++)
+    {
+      if (!CHECK (parents[i] != NULL))
+	continue;
+      CHECK (threadpool_task_wait (parents[i]) == THREADPOOL_TASK_DONE);
+      threadpool_task_release (parents[i]);
+    }
+  CHECK (counter == 64);
+  threadpool_destroy (nested_pool);
+}
+
+static void
+destroy_cancels_queued (void)
+{
+  threadpool_handle_t *pool;
+  threadpool_task_t *task;
+  pthread_t opener;
+
+  pool = threadpool_create (1);
+  if (!CHECK (pool != NULL))
+    return;
+
+  close_gate ();
+  counter = 0;
+  CHECK (threadpool_add_task (pool, gate, NULL));
+  task = threadpool_submit (pool, count, NULL, THREADPOOL_PRIORITY_NORMAL);
+  if (!CHECK (task != NULL))
+    {
+      open_gate ();
+      threadpool_destroy (pool);
+      return;
+    }
+
+  /* destroy waits for the running task, so the gate is opened by
+     another thread */
+  if (CHECK (pthread_create (&opener, NULL, open_gate_later, NULL) == 0))
+    {
+      threadpool_destroy (pool);
+      pthread_join (opener, NULL);
+    }
+  else
+    {
+      open_gate ();
+      threadpool_destroy (pool);
+    }
+
+  /* the handle outlives the pool */
+  CHECK (threadpool_task_state (task) == THREADPOOL_TASK_CANCELLED);
+  CHECK (threadpool_task_wait (task) == THREADPOOL_TASK_CANCELLED);
+  CHECK (counter == 0);
+  threadpool_task_release (task);
+}
+
+int
+main (void)
+{
+  many_tasks ();
+  priorities ();
+  cancellation ();
+  nested_tasks ();
+  destroy_cancels_queued ();
+
+  if (failures)
+    {
+      printf ("%d checks failed\n", failures);
+      return 1;
+    }
+  return 0;
+}
@@ -17,6 +17,10 @@
 #ifndef THREADPOOL_C_H
 #define THREADPOOL_C_H
 
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -25,12 +29,55 @@ typedef void (*threadpool_task_func_t)(void* arg);
 
 typedef struct threadpool_handle_t threadpool_handle_t;
 
+/* A task added with threadpool_submit, to cancel it or wait for it. */
+typedef struct threadpool_task_t threadpool_task_t;
+
+/* Queued tasks of a higher priority run first. */
+typedef enum {
+    THREADPOOL_PRIORITY_HIGH = 0,
+    THREADPOOL_PRIORITY_NORMAL,
+    THREADPOOL_PRIORITY_LOW,
+    THREADPOOL_PRIORITY_COUNT
+} threadpool_priority_t;
+
+typedef enum {
+    THREADPOOL_TASK_QUEUED = 0,
+    THREADPOOL_TASK_RUNNING,
+    THREADPOOL_TASK_DONE,
+    THREADPOOL_TASK_CANCELLED
+} threadpool_task_state_t;
+
+/* Starts thread_num threads, or one per CPU if thread_num is 0. */
 threadpool_handle_t* threadpool_create(int thread_num);
 
+/* Queues func(arg) with normal priority. */
 bool threadpool_add_task(threadpool_handle_t* pool, threadpool_task_func_t func, void* arg);
 
+bool threadpool_add_task_with_priority(threadpool_handle_t* pool, threadpool_task_func_t func, void* arg,
+                                       threadpool_priority_t priority);
+
+/* Queues func(arg) and returns a handle to it, which must be released with
+   threadpool_task_release.  Returns NULL on failure. */
+threadpool_task_t* threadpool_submit(threadpool_handle_t* pool, threadpool_task_func_t func, void* arg,
+                                     threadpool_priority_t priority);
+
+/* Keeps the task from running if it has not started yet.  Returns whether
+   it was cancelled. */
+bool threadpool_task_cancel(threadpool_task_t* task);
+
+threadpool_task_state_t threadpool_task_state(const threadpool_task_t* task);
+
+/* Waits until the task is done or cancelled and returns which.  A task of
+   the pool may wait for another one; it runs queued tasks meanwhile. */
+threadpool_task_state_t threadpool_task_wait(threadpool_task_t* task);
+
+void threadpool_task_release(threadpool_task_t* task);
+
+/* Waits for the running tasks to finish and cancels the queued ones. */
 void threadpool_destroy(threadpool_handle_t* pool);
 
+/* Waits until all tasks added so far are done or cancelled.  The pool can
+   be used further.  Must not be called from a task of the pool. */
 void threadpool_wait(threadpool_handle_t* pool);
 
 #ifdef __cplusplus
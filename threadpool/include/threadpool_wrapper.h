@@ -18,26 +18,88 @@
 #define THREADPOOL_WRAPPER
 
 #include "threadpool_c.h"
-#include "thread_pool.h"
-#include <string>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
+// The state of a task somebody holds a handle to.
+struct ThreadPoolTask {
+    std::atomic<int> state{THREADPOOL_TASK_QUEUED};
+};
+
+/*
+ * A work-stealing pool.  Every thread has a queue per priority for the
+ * tasks added by the tasks it runs, which it takes from the back; tasks
+ * added from outside go to shared queues.  A thread out of work of some
+ * priority takes it from the shared queue and then from the front of the
+ * other threads' queues before looking at lower priorities.
+ */
 class ThreadPoolWrapper {
 public:
     ThreadPoolWrapper() = default;
-    
-    ~ThreadPoolWrapper() = default;
-    
+
+    ~ThreadPoolWrapper();
+
+    ThreadPoolWrapper(const ThreadPoolWrapper&) = delete;
+    ThreadPoolWrapper& operator=(const ThreadPoolWrapper&) = delete;
+
     bool Start(int thread_num);
-    
+
     void Stop();
-    
-    void AddTask(threadpool_task_func_t func, void* arg);
 
-    void Wait();
+    // Stores a handle to the task in handle unless it is nullptr.
+    bool AddTask(threadpool_task_func_t func, void* arg, threadpool_priority_t priority = THREADPOOL_PRIORITY_NORMAL,
+                 std::shared_ptr<ThreadPoolTask>* handle = nullptr);
+
+    bool Cancel(ThreadPoolTask& task);
+
+    threadpool_task_state_t WaitTask(ThreadPoolTask& task);
+
+    // Returns false if called from a task of this pool.
+    bool Wait();
 
 private:
-    OHOS::ThreadPool pool_;
+    struct Entry {
+        threadpool_task_func_t func;
+        void* arg;
+        std::shared_ptr<ThreadPoolTask> task;
+    };
+
+    struct Queues {
+        std::mutex mutex;
+        std::deque<Entry> tasks[THREADPOOL_PRIORITY_COUNT];
+        // lets threads looking for work pass empty queues without locking them
+        std::atomic<std::size_t> sizes[THREADPOOL_PRIORITY_COUNT] = {};
+    };
+
+    void WorkInThread(std::size_t index);
+    bool TakeTask(std::size_t index, Entry& entry);
+    bool RunOneTask(std::size_t index);
+    void WakeOne();
+    void Finish(bool has_handle);
+    bool IsOwnThread(std::size_t* index) const;
+
+    std::vector<std::thread> threads_;
+    std::vector<std::unique_ptr<Queues>> local_;
+    Queues shared_;
+
+    std::atomic<std::size_t> queued_{0};    // tasks in any queue, cancelled ones included
+    std::atomic<std::size_t> pending_{0};   // tasks neither done nor cancelled
+    std::atomic<bool> running_{false};
+
+    std::atomic<std::size_t> idle_{0};      // threads asleep or about to be
+    std::atomic<std::size_t> woken_{0};     // of which were notified
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+
+    std::atomic<int> waiters_{0};
+    std::mutex done_mutex_;
+    std::condition_variable done_;
 };
 
 #endif // THREADPOOL_WRAPPER
-
@@ -24,10 +24,21 @@ struct threadpool_handle_t {
     ThreadPoolWrapper* wrapper;
 };
 
+struct threadpool_task_t {
+    std::shared_ptr<ThreadPoolTask> task;
+    ThreadPoolWrapper* wrapper;
+};
+
 threadpool_handle_t* threadpool_create(int32_t thread_num)
 {
-    constexpr int32_t maxThreadNum = 20;
-    if (thread_num <= 0 || thread_num > maxThreadNum) {
+    constexpr int32_t maxThreadNum = 256;
+    if (thread_num == 0) {
+        thread_num = static_cast<int32_t>(std::thread::hardware_concurrency());
+        if (thread_num <= 0) {
+            thread_num = 1;
+        }
+    }
+    if (thread_num < 0 || thread_num > maxThreadNum) {
         DBG(LEVEL, "threadpool_create: fail\n");
         return nullptr;
     }
@@ -56,16 +67,77 @@ threadpool_handle_t* threadpool_create(int32_t thread_num)
 }
 
 bool threadpool_add_task(threadpool_handle_t* pool, threadpool_task_func_t func, void* arg)
+{
+    return threadpool_add_task_with_priority(pool, func, arg, THREADPOOL_PRIORITY_NORMAL);
+}
+
+bool threadpool_add_task_with_priority(threadpool_handle_t* pool, threadpool_task_func_t func, void* arg,
+                                       threadpool_priority_t priority)
 {
     if (!pool || !pool->wrapper || !func) {
         DBG(LEVEL, "threadpool_add_task: fail\n");
         return false;
     }
     
-    pool->wrapper->AddTask(func, arg);
+    if (!pool->wrapper->AddTask(func, arg, priority)) {
+        DBG(LEVEL, "threadpool_add_task: AddTask fail\n");
+        return false;
+    }
     return true;
 }
 
+threadpool_task_t* threadpool_submit(threadpool_handle_t* pool, threadpool_task_func_t func, void* arg,
+                                     threadpool_priority_t priority)
+{
+    if (!pool || !pool->wrapper || !func) {
+        DBG(LEVEL, "threadpool_submit: fail\n");
+        return nullptr;
+    }
+
+    threadpool_task_t* handle = new(std::nothrow) threadpool_task_t();
+    if (!handle) {
+        DBG(LEVEL, "threadpool_submit: handle is nullptr\n");
+        return nullptr;
+    }
+
+    if (!pool->wrapper->AddTask(func, arg, priority, &handle->task)) {
+        delete handle;
+        DBG(LEVEL, "threadpool_submit: AddTask fail\n");
+        return nullptr;
+    }
+    handle->wrapper = pool->wrapper;
+    return handle;
+}
+
+bool threadpool_task_cancel(threadpool_task_t* task)
+{
+    if (!task) {
+        return false;
+    }
+    return task->wrapper->Cancel(*task->task);
+}
+
+threadpool_task_state_t threadpool_task_state(const threadpool_task_t* task)
+{
+    if (!task) {
+        return THREADPOOL_TASK_CANCELLED;
+    }
+    return static_cast<threadpool_task_state_t>(task->task->state.load());
+}
+
+threadpool_task_state_t threadpool_task_wait(threadpool_task_t* task)
+{
+    if (!task) {
+        return THREADPOOL_TASK_CANCELLED;
+    }
+    return task->wrapper->WaitTask(*task->task);
+}
+
+void threadpool_task_release(threadpool_task_t* task)
+{
+    delete task;
+}
+
 void threadpool_destroy(threadpool_handle_t* pool)
 {
     if (pool) {
@@ -79,6 +151,8 @@ void threadpool_destroy(threadpool_handle_t* pool)
 void threadpool_wait(threadpool_handle_t* pool)
 {
     if (pool && pool->wrapper) {
-        pool->wrapper->Wait();
+        if (!pool->wrapper->Wait()) {
+            DBG(LEVEL, "threadpool_wait: called from a task of the pool\n");
+        }
     }
 }
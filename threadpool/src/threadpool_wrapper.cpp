@@ -14,37 +14,286 @@
 * You should have received a copy of the GNU General Public License
 * along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
-#include <functional>
-#include <string>
-#include "errors.h"
+#include <chrono>
+#include <new>
+#include <system_error>
 #include "threadpool_wrapper.h"
 
+namespace {
+
+thread_local const ThreadPoolWrapper* currentPool = nullptr;
+thread_local std::size_t currentIndex = 0;
+
+} // namespace
+
+ThreadPoolWrapper::~ThreadPoolWrapper()
+{
+    Stop();
+}
+
 bool ThreadPoolWrapper::Start(int32_t thread_num)
 {
-    return pool_.Start(thread_num) == OHOS::ERR_OK;
+    if (running_ || thread_num <= 0) {
+        return false;
+    }
+    try {
+        for (int32_t i = 0; i < thread_num; i++) {
+            local_.emplace_back(new Queues());
+        }
+        running_ = true;
+        for (int32_t i = 0; i < thread_num; i++) {
+            threads_.emplace_back(&ThreadPoolWrapper::WorkInThread, this, static_cast<std::size_t>(i));
+        }
+    } catch (const std::system_error&) {
+        Stop();
+        return false;
+    } catch (const std::bad_alloc&) {
+        Stop();
+        return false;
+    }
+    return true;
 }
 
 void ThreadPoolWrapper::Stop()
 {
-    pool_.Stop();
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        running_ = false;
+    }
+    wake_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+    threads_.clear();
+
+    // AddTask checks running_ under the queue lock, so nothing gets queued
+    // after a queue is drained
+    auto drain = [this](Queues& queues) {
+        std::lock_guard<std::mutex> lock(queues.mutex);
+        for (int priority = 0; priority < THREADPOOL_PRIORITY_COUNT; priority++) {
+            for (auto& entry : queues.tasks[priority]) {
+                int expected = THREADPOOL_TASK_QUEUED;
+                if (!entry.task || entry.task->state.compare_exchange_strong(expected, THREADPOOL_TASK_CANCELLED)) {
+                    Finish(entry.task != nullptr);
+                }
+                queued_--;
+            }
+            queues.tasks[priority].clear();
+            queues.sizes[priority].store(0, std::memory_order_relaxed);
+        }
+    };
+    drain(shared_);
+    for (auto& queues : local_) {
+        drain(*queues);
+    }
+    local_.clear();
+}
+
+bool ThreadPoolWrapper::AddTask(threadpool_task_func_t func, void* arg, threadpool_priority_t priority,
+                                std::shared_ptr<ThreadPoolTask>* handle)
+{
+    if (!func || priority < 0 || priority >= THREADPOOL_PRIORITY_COUNT) {
+        return false;
+    }
+    Entry entry{func, arg, nullptr};
+    if (handle) {
+        try {
+            entry.task = std::make_shared<ThreadPoolTask>();
+        } catch (const std::bad_alloc&) {
+            return false;
+        }
+        *handle = entry.task;
+    }
+
+    // tasks added by a task are likely to need its data, so its thread runs
+    // them unless another one is idle
+    std::size_t index;
+    Queues& queues = IsOwnThread(&index) ? *local_[index] : shared_;
+    {
+        std::lock_guard<std::mutex> lock(queues.mutex);
+        if (!running_) {
+            return false;
+        }
+        try {
+            queues.tasks[priority].push_back(std::move(entry));
+        } catch (const std::bad_alloc&) {
+            return false;
+        }
+        queues.sizes[priority].store(queues.tasks[priority].size(), std::memory_order_relaxed);
+        pending_++;
+        queued_++;
+    }
+    WakeOne();
+    return true;
+}
+
+bool ThreadPoolWrapper::Cancel(ThreadPoolTask& task)
+{
+    int expected = THREADPOOL_TASK_QUEUED;
+    if (!task.state.compare_exchange_strong(expected, THREADPOOL_TASK_CANCELLED)) {
+        return false;
+    }
+    // the task stays queued until a thread comes across it
+    Finish(true);
+    return true;
+}
+
+threadpool_task_state_t ThreadPoolWrapper::WaitTask(ThreadPoolTask& task)
+{
+    std::size_t index;
+    bool own = IsOwnThread(&index);
+    auto finished = [&task]() {
+        int state = task.state;
+        return state == THREADPOOL_TASK_DONE || state == THREADPOOL_TASK_CANCELLED;
+    };
+
+    while (!finished()) {
+        // a thread of the pool does not block while there is work, otherwise
+        // tasks waiting for each other could leave none to run them
+        if (own && RunOneTask(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(done_mutex_);
+        waiters_++;
+        if (own) {
+            constexpr auto POLL_TIME = std::chrono::milliseconds(1);
+            done_.wait_for(lock, POLL_TIME, finished);
+        } else {
+            done_.wait(lock, finished);
+        }
+        waiters_--;
+    }
+    return static_cast<threadpool_task_state_t>(task.state.load());
 }
 
-void ThreadPoolWrapper::AddTask(threadpool_task_func_t func, void* arg)
+bool ThreadPoolWrapper::Wait()
 {
-    if (func) {
-        pool_.AddTask([func, arg]() {
-            func(arg);
-        });
+    if (IsOwnThread(nullptr)) {
+        return false;
     }
+    std::unique_lock<std::mutex> lock(done_mutex_);
+    waiters_++;
+    done_.wait(lock, [this]() { return pending_ == 0; });
+    waiters_--;
+    return true;
 }
 
-void ThreadPoolWrapper::Wait()
+void ThreadPoolWrapper::WorkInThread(std::size_t index)
 {
-    constexpr int32_t WAIT_TIME = 1;
-    int32_t curTaskNum = 0;
-    do {
-        curTaskNum = static_cast<int32_t>(pool_.GetCurTaskNum());
-        std::this_thread::sleep_for(std::chrono::seconds(WAIT_TIME));
-    } while (curTaskNum != 0);
-    pool_.Stop();
+    currentPool = this;
+    currentIndex = index;
+    while (running_) {
+        if (RunOneTask(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        idle_++;
+        while (queued_ == 0 && running_) {
+            wake_.wait(lock);
+            if (woken_ > 0) {
+                woken_--;
+            }
+        }
+        idle_--;
+    }
+    currentPool = nullptr;
+}
+
+bool ThreadPoolWrapper::TakeTask(std::size_t index, Entry& entry)
+{
+    auto take = [this, &entry](Queues& queues, int priority, bool back) {
+        if (queues.sizes[priority].load(std::memory_order_relaxed) == 0) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(queues.mutex);
+        auto& tasks = queues.tasks[priority];
+        if (tasks.empty()) {
+            return false;
+        }
+        if (back) {
+            entry = std::move(tasks.back());
+            tasks.pop_back();
+        } else {
+            entry = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        queues.sizes[priority].store(tasks.size(), std::memory_order_relaxed);
+        queued_--;
+        return true;
+    };
+
+    std::size_t count = local_.size();
+    for (int priority = 0; priority < THREADPOOL_PRIORITY_COUNT; priority++) {
+        if (take(*local_[index], priority, true) || take(shared_, priority, false)) {
+            return true;
+        }
+        for (std::size_t i = 1; i < count; i++) {
+            if (take(*local_[(index + i) % count], priority, false)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool ThreadPoolWrapper::RunOneTask(std::size_t index)
+{
+    Entry entry;
+    if (!TakeTask(index, entry)) {
+        return false;
+    }
+    // there may be work for more threads than the one that was woken
+    if (queued_ > 0) {
+        WakeOne();
+    }
+    if (!entry.task) {
+        entry.func(entry.arg);
+        Finish(false);
+        return true;
+    }
+    int expected = THREADPOOL_TASK_QUEUED;
+    if (entry.task->state.compare_exchange_strong(expected, THREADPOOL_TASK_RUNNING)) {
+        entry.func(entry.arg);
+        entry.task->state = THREADPOOL_TASK_DONE;
+        Finish(true);
+    }
+    return true;
+}
+
+void ThreadPoolWrapper::WakeOne()
+{
+    // A thread going to sleep counts itself idle before it checks queued_,
+    // so it is either counted here or sees the new task.  Threads that were
+    // woken but have not run yet are not woken again.
+    if (idle_ <= woken_) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    if (idle_ > woken_) {
+        woken_++;
+        wake_.notify_one();
+    }
+}
+
+void ThreadPoolWrapper::Finish(bool has_handle)
+{
+    // Wait only cares about the last task, WaitTask only about tasks with a handle
+    std::size_t left = --pending_;
+    if (waiters_ > 0 && (left == 0 || has_handle)) {
+        {
+            std::lock_guard<std::mutex> lock(done_mutex_);
+        }
+        done_.notify_all();
+    }
+}
+
+bool ThreadPoolWrapper::IsOwnThread(std::size_t* index) const
+{
+    if (currentPool != this) {
+        return false;
+    }
+    if (index) {
+        *index = currentIndex;
+    }
+    return true;
 }
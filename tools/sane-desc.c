@@ -84,7 +84,8 @@ typedef enum output_mode
   output_mode_hwdb,
   output_mode_plist,
   output_mode_hal,
-  output_mode_halnew
+  output_mode_halnew,
+  output_mode_dllindex
 }
 output_mode;
 
@@ -318,7 +319,8 @@ print_usage (char *program_name)
 	  "(multiple directories can be concatenated by \":\")\n");
   printf ("  -m|--mode mode         "
 	  "Output mode (ascii, html-backends-split, html-mfgs,\n"
-	  "                         xml, statistics, usermap, db, udev, udev+acl, udev+hwdb, hwdb, plist, hal, hal-new)\n");
+	  "                         xml, statistics, usermap, db, udev, udev+acl, udev+hwdb, hwdb, plist, hal, hal-new,\n"
+	  "                         dll-index)\n");
   printf ("  -t|--title \"title\"     The title used for HTML pages\n");
   printf ("  -i|--intro \"intro\"     A short description of the "
 	  "contents of the page\n");
@@ -445,6 +447,11 @@ get_options (int argc, char **argv)
 	      DBG_INFO ("Output mode: %s\n", optarg);
 	      mode = output_mode_halnew;
 	    }
+	  else if (strcmp (optarg, "dll-index") == 0)
+	    {
+	      DBG_INFO ("Output mode: %s\n", optarg);
+	      mode = output_mode_dllindex;
+	    }
 	  else
 	    {
 	      DBG_ERR ("Unknown output mode: %s\n", optarg);
@@ -3977,6 +3984,116 @@ print_hal (int new)
   printf ("</deviceinfo>\n");
 }
 
+/* Sort the words of an :interface into the ways devices are found */
+static void
+classify_interface (const char *interface, SANE_Bool * usb, SANE_Bool * net,
+		    SANE_Bool * other)
+{
+  char *copy, *word;
+
+  if (!interface)
+    {
+      *other = SANE_TRUE;
+      return;
+    }
+
+  copy = strdup (interface);
+  for (word = strtok (copy, " \t"); word; word = strtok (NULL, " \t"))
+    {
+      if (strcasecmp (word, "USB") == 0)
+	*usb = SANE_TRUE;
+      else if (strcasecmp (word, "Ethernet") == 0
+	       || strcasecmp (word, "WiFi") == 0
+	       || strcasecmp (word, "Wi-Fi") == 0
+	       || strcasecmp (word, "Network") == 0)
+	*net = SANE_TRUE;
+      else
+	*other = SANE_TRUE;
+    }
+  free (copy);
+}
+
+/* print the index the dll backend uses to skip backends without devices */
+static void
+print_dll_index (void)
+{
+  backend_entry *be;
+
+  print_header_comment ();
+  printf
+    ("#\n"
+     "# The dll backend uses this file to avoid loading backends that cannot\n"
+     "# find any device.  A \"backend\" line lists how the devices of a\n"
+     "# backend are found:\n"
+     "#\n"
+     "#   usb    only the USB devices listed on \"usb\" lines, and those\n"
+     "#          in the backend's configuration file\n"
+     "#   net    on the network\n"
+     "#   other  in ways that cannot be checked beforehand\n"
+     "#\n"
+     "# Backends marked \"other\", and backends not listed, are always loaded.\n"
+     "#\n"
+     "# backend <name> [usb] [net] [other]\n"
+     "# usb 0xVVVV 0xPPPP <name>\n"
+     "#\n");
+
+  for (be = first_backend; be; be = be->next)
+    {
+      type_entry *type;
+      usbid_type *first_usbid = NULL, *usbid;
+      SANE_Bool usb = SANE_FALSE, net = SANE_FALSE, other = SANE_FALSE;
+
+      for (type = be->type; type; type = type->next)
+	{
+	  mfg_entry *mfg;
+
+	  if (type->type != type_scanner && type->type != type_stillcam
+	      && type->type != type_vidcam)
+	    {
+	      other = SANE_TRUE;
+	      continue;
+	    }
+
+	  for (mfg = type->mfg; mfg; mfg = mfg->next)
+	    {
+	      model_entry *model;
+
+	      for (model = mfg->model; model; model = model->next)
+		{
+		  SANE_Bool model_usb = SANE_FALSE;
+
+		  if (model->status == status_unsupported)
+		    continue;
+
+		  classify_interface (model->interface, &model_usb, &net,
+				      &other);
+		  if (!model_usb)
+		    continue;
+
+		  /* a USB device we can't look for has to be probed */
+		  if (!model->usb_vendor_id || !model->usb_product_id)
+		    {
+		      other = SANE_TRUE;
+		      continue;
+		    }
+		  usb = SANE_TRUE;
+		  first_usbid = add_usbid (first_usbid, mfg->name, model->name,
+					   model->usb_vendor_id,
+					   model->usb_product_id);
+		}
+	    }
+	}
+      if (!usb && !net)
+	other = SANE_TRUE;
+
+      printf ("backend %s%s%s%s\n", be->name, usb ? " usb" : "",
+	      net ? " net" : "", other ? " other" : "");
+      for (usbid = first_usbid; usbid; usbid = usbid->next)
+	printf ("usb %s %s %s\n", usbid->usb_vendor_id, usbid->usb_product_id,
+		be->name);
+    }
+}
+
 int
 main (int argc, char **argv)
 {
@@ -4032,6 +4149,9 @@ main (int argc, char **argv)
     case output_mode_halnew:
       print_hal (1);
       break;
+    case output_mode_dllindex:
+      print_dll_index ();
+      break;
     default:
       DBG_ERR ("Unknown output mode\n");
       return 1;
@@ -0,0 +1,69 @@
+/* sane-usb-capture.c -- convert USB captures between the XML and the packed
+   format
+
+   Copyright (C) 2026 The SANE developers
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+   The captures are the files written by the backends when USB recording is
+   enabled and replayed through the fakeusb: device names of the dll
+   backend.  Packed captures replay much faster, XML captures can be edited
+   and are needed for development mode.
+ */
+
+#include "../include/sane/config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../include/sane/sane.h"
+#include "../include/sane/sanei_usb.h"
+
+static void
+usage (const char *prog_name)
+{
+  fprintf (stderr, "Usage: %s pack XML-CAPTURE PACKED-CAPTURE\n"
+	   "       %s unpack PACKED-CAPTURE XML-CAPTURE\n",
+	   prog_name, prog_name);
+}
+
+int
+main (int argc, char **argv)
+{
+  SANE_Status status;
+
+  if (argc != 4)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  if (strcmp (argv[1], "pack") == 0)
+    status = sanei_usb_testing_pack_capture (argv[2], argv[3]);
+  else if (strcmp (argv[1], "unpack") == 0)
+    status = sanei_usb_testing_unpack_capture (argv[2], argv[3]);
+  else
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  if (status != SANE_STATUS_GOOD)
+    {
+      fprintf (stderr, "%s: converting %s failed: %s\n", argv[0], argv[2],
+	       sane_strstatus (status));
+      return 1;
+    }
+  return 0;
+}